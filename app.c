@@ -20,7 +20,9 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdbool.h>
-#include <unistd.h>
+#include <time.h>
+
+#include "infrastructure.h"
 
 /* BG stack headers */
 #include "bg_types.h"
@@ -28,101 +30,1131 @@
 
 /* Own header */
 #include "app.h"
+#include "broadcast.h"
+#include "cmd_queue.h"
+#include "gatt_cache.h"
+#include "link_policy.h"
+#include "link_state.h"
+#include "measurement.h"
+#include "metrics.h"
+#include "output_sink.h"
+#include "reading_store.h"
+#include "rotation.h"
+#include "scan_filter.h"
+#include "scan_policy.h"
+#include "sensor_stats.h"
+#include "sensor_table.h"
+#include "supervision.h"
+#include "timer_wheel.h"
 
-// App booted flag
-static bool appBooted = false;
+// State of one NCP and its connections
+typedef struct {
+  // App booted flag
+  bool appBooted;
+  // Array for holding properties of multiple (parallel) connections
+  ConnProperties connProperties[MAX_CONNECTIONS];
+  // Counter of active connections
+  uint8_t activeConnectionsNum;
+  // State of the scanner: scanning, opening (a connection is being established) or
+  // running (not scanning, the table is full)
+  ConnState connState;
+  // Handle and address of the connection being opened while connState == opening
+  uint8_t openingConnection;
+  bd_addr openingAddress;
+  // When the connection being opened was asked for, rotation gives up on it after a while
+  uint64_t openingSinceMs;
+  // Table index of each BGAPI connection handle, TABLE_INDEX_INVALID if unused
+  uint8_t slotByHandle[256];
+  // Stack of unused table indexes, lowest index on top
+  uint8_t freeSlots[MAX_CONNECTIONS];
+  // Full address of the server on each connection, kept apart from the hot fields
+  bd_addr connAddress[MAX_CONNECTIONS];
+  uint8_t connAddressType[MAX_CONNECTIONS];
+  // When each connection was opened, for the setup time
+  uint64_t openedUs[MAX_CONNECTIONS];
+  // When the last RSSI sample was requested, and the slot to look for the next one from
+  uint64_t rssiLastMs;
+  uint8_t rssiCursor;
+  // First results table slot of this NCP's connections
+  uint8_t firstSlot;
+  // Scanner settings in force, and how many known sensors are in the NCP's accept list
+  ScanPolicySettings scan;
+  uint16_t acceptLoaded;
+  // The accept list has refused an entry, the NCP goes on reporting every advertiser
+  bool acceptFull;
+  // Battery service of each connection, and the handles and last values of what is read
+  // besides the readings, 0 for a handle the sensor does not have
+  uint32_t batteryServiceHandle[MAX_CONNECTIONS];
+  uint16_t infoHandles[MAX_CONNECTIONS][infoCount];
+  SensorInfo info[MAX_CONNECTIONS];
+  // When the values were last read, and the slot to look for the next read from
+  uint64_t infoLastMs;
+  uint8_t infoCursor;
+  // PHY of each connection, moved with its RSSI by the link policy
+  LinkPolicyLink linkPolicy[MAX_CONNECTIONS];
+  // Deadlines of this NCP: of the setup step or the next reading of each connection, and of the
+  // connection being opened
+  TimerWheel wheel;
+  TimerWheelTimer deadline[MAX_CONNECTIONS];
+  TimerWheelTimer openingDeadline;
+} AppContext;
 
-// Array for holding properties of multiple (parallel) connections
-ConnProperties connProperties[MAX_CONNECTIONS];
-// Counter of active connections
-uint8_t activeConnectionsNum;
-// State of the connection under establishment
-ConnState connState;
+static AppContext contexts[MAX_NCPS];
+// Context of the NCP whose events are being handled
+static AppContext *app = &contexts[0];
+// Time between RSSI samples of one sensor, 0 to never sample
+static uint32_t rssiPeriodMs = RSSI_DEFAULT_PERIOD_MS;
+// When appStart() was first called and the first reading taken, for the time to first reading
+static uint64_t startUs = 0;
+static uint64_t firstReadingUs = 0;
+// An NCP has been taken over without a reset
+static bool warmStarted = false;
+// Readings are taken as notifications from the sensors that allow them
+static bool notificationsEnabled = false;
+// Time between reads of the values besides the readings of one sensor, 0 to never read them
+static uint32_t infoPeriodMs = 0;
 // Health Thermometer service UUID defined by Bluetooth SIG
 const uint8_t thermoService[2] = { 0x09, 0x18 };
 // Temperature Measurement characteristic UUID defined by Bluetooth SIG
 const uint8_t thermoChar[2] = { 0x1c, 0x2a };
+// Intermediate Temperature characteristic UUID defined by Bluetooth SIG
+const uint8_t intermediateChar[2] = { 0x1e, 0x2a };
+// Battery service UUID defined by Bluetooth SIG
+const uint8_t batteryService[2] = { 0x0f, 0x18 };
+// Temperature Type, Measurement Interval and Battery Level characteristic UUIDs defined by
+// Bluetooth SIG, and the length of their values
+const uint8_t infoChars[infoCount][2] = { { 0x1d, 0x2a }, { 0x21, 0x2a }, { 0x19, 0x2a } };
+static const uint8_t infoSizes[infoCount] = { 1, 2, 1 };
 
 enum le_gap_phy_type default_phy = DEFAULT_PHY_TYPE;
 
+// Clear the properties of a table entry
+static void clearSlot(uint8_t index)
+{
+  app->connProperties[index].connectionHandle = CONNECTION_HANDLE_INVALID;
+  app->connProperties[index].thermometerServiceHandle = SERVICE_HANDLE_INVALID;
+  app->connProperties[index].thermometerCharacteristicHandle = CHARACTERISTIC_HANDLE_INVALID;
+  app->connProperties[index].temperature = TEMP_INVALID;
+  app->connProperties[index].rssi = RSSI_INVALID;
+  app->connProperties[index].state = running;
+  app->connProperties[index].delivery = gatt_indication;
+  app->batteryServiceHandle[index] = SERVICE_HANDLE_INVALID;
+  memset(app->infoHandles[index], 0, sizeof(app->infoHandles[index]));
+  app->info[index].temperatureType = TEMP_TYPE_INVALID;
+  app->info[index].batteryLevel = BATTERY_LEVEL_INVALID;
+  app->info[index].measurementInterval = MEASUREMENT_INTERVAL_INVALID;
+  timerWheelCancel(&app->deadline[index]);
+}
+
+// Publish the state of a connection, and the aggregates of its readings, to the shared-memory
+// sensor table
+static void publishSlot(uint8_t index)
+{
+  SensorStats stats;
+
+  sensorTableUpdate(app->firstSlot + index, &app->connAddress[index], &app->connProperties[index],
+                    sensorStatsGet(&app->connAddress[index], &stats) ? &stats : NULL,
+                    &app->info[index]);
+}
+
 // Init connection properties
 void initProperties(void)
 {
-  uint8_t i;
-  activeConnectionsNum = 0;
+  uint16_t i;
+  app->activeConnectionsNum = 0;
 
   for (i = 0; i < MAX_CONNECTIONS; i++) {
-    connProperties[i].connectionHandle = CONNECTION_HANDLE_INVALID;
-    connProperties[i].thermometerServiceHandle = SERVICE_HANDLE_INVALID;
-    connProperties[i].thermometerCharacteristicHandle = CHARACTERISTIC_HANDLE_INVALID;
-    connProperties[i].temperature = TEMP_INVALID;
-    connProperties[i].rssi = RSSI_INVALID;
-  }
-}
-
-// Parse advertisements looking for advertised Health Thermometer service
-uint8_t findServiceInAdvertisement(uint8_t *data, uint8_t len)
-{
-  uint8_t adFieldLength;
-  uint8_t adFieldType;
-  uint8_t i = 0;
-  // Parse advertisement packet
-  while (i < len) {
-    adFieldLength = data[i];
-    adFieldType = data[i + 1];
-    // Partial ($02) or complete ($03) list of 16-bit UUIDs
-    if (adFieldType == 0x02 || adFieldType == 0x03) {
-      // compare UUID to Health Thermometer service UUID
-      if (memcmp(&data[i + 2], thermoService, 2) == 0) {
-        return 1;
-      }
-    }
-    // advance to the next AD struct
-    i = i + adFieldLength + 1;
+    clearSlot(i);
+    app->freeSlots[i] = MAX_CONNECTIONS - 1 - i;
+    linkStateClear(app->firstSlot + i);
   }
-  return 0;
+  memset(app->slotByHandle, TABLE_INDEX_INVALID, sizeof(app->slotByHandle));
 }
 
 // Find the index of a given connection in the connection_properties array
 uint8_t findIndexByConnectionHandle(uint8_t connection)
 {
-  for (uint8_t i = 0; i < activeConnectionsNum; i++) {
-    if (connProperties[i].connectionHandle == connection) {
-      return i;
+  return app->slotByHandle[connection];
+}
+
+// Add a new connection to the connection_properties array, returns its stable table index
+uint8_t addConnection(uint8_t connection, const bd_addr *address)
+{
+  uint8_t index = app->slotByHandle[connection];
+
+  if (index != TABLE_INDEX_INVALID) {
+    // Handle reused without a close event in between, take the slot over
+    clearSlot(index);
+  } else {
+    if (app->activeConnectionsNum >= MAX_CONNECTIONS) {
+      return TABLE_INDEX_INVALID;
     }
+    index = app->freeSlots[MAX_CONNECTIONS - 1 - app->activeConnectionsNum];
+    app->slotByHandle[connection] = index;
+    app->activeConnectionsNum++;
+    metricsGaugeAdd(metricConnectionsActive, 1);
+  }
+  // Last two bytes of the address identify the server in the results table
+  app->connProperties[index].connectionHandle = connection;
+  app->connProperties[index].serverAddress    = (uint16_t)(address->addr[1] << 8) + address->addr[0];
+  app->connProperties[index].state            = discoverServices;
+  app->connAddress[index] = *address;
+  app->openedUs[index] = metricsNowUs();
+  linkPolicyOpened(&app->linkPolicy[index], default_phy);
+  publishSlot(index);
+  // Drop its advertisements unparsed while it is connected
+  scanFilterSetConnected(address, true);
+  return index;
+}
+
+// Remove a connection from the connection_properties array, other entries keep their index
+void removeConnection(uint8_t connection)
+{
+  uint8_t index = app->slotByHandle[connection];
+
+  if (index == TABLE_INDEX_INVALID) {
+    return;
   }
-  return TABLE_INDEX_INVALID;
+  app->slotByHandle[connection] = TABLE_INDEX_INVALID;
+  clearSlot(index);
+  linkStateClear(app->firstSlot + index);
+  // Its advertisements are of interest again
+  scanFilterSetConnected(&app->connAddress[index], false);
+  scanPolicySetConnected(&app->connAddress[index], false);
+  // Empty the slot in the results table
+  outputSinkPush(app->firstSlot + index, app->connProperties[index].serverAddress, TEMP_INVALID, RSSI_INVALID);
+  sensorTableClear(app->firstSlot + index);
+  app->activeConnectionsNum--;
+  metricsGaugeAdd(metricConnectionsActive, -1);
+  app->freeSlots[MAX_CONNECTIONS - 1 - app->activeConnectionsNum] = index;
 }
 
-// Add a new connection to the connection_properties array
-void addConnection(uint8_t connection, uint16_t address)
+// Queue a command whose response is of no interest, failures show in the events that follow
+static void sendCommand(uint32_t id, const void *params, uint16_t len)
 {
-  connProperties[activeConnectionsNum].connectionHandle = connection;
-  connProperties[activeConnectionsNum].serverAddress    = address;
-  activeConnectionsNum++;
+  cmdQueueSend(id, params, len, NULL, NULL);
 }
 
-// Remove a connection from the connection_properties array
-void removeConnection(uint8_t connection)
+// Enable the indications or notifications of the characteristic the readings come from
+static void subscribe(uint8_t connection, uint16_t characteristic, uint8_t delivery,
+                      CmdQueueCallback callback)
+{
+  struct gecko_msg_gatt_set_characteristic_notification_cmd_t cmd;
+
+  cmd.connection = connection;
+  cmd.characteristic = characteristic;
+  cmd.flags = delivery;
+  cmdQueueSend(gecko_cmd_gatt_set_characteristic_notification_id, &cmd, sizeof(cmd),
+               callback, (void *)(uintptr_t)connection);
+}
+
+// Start GATT discovery of the Health Thermometer service on a connection, or of every service
+// when the Battery service is wanted too
+static void discoverThermometer(uint8_t index)
+{
+  uint8_t cmd[2 + sizeof(thermoService)];
+
+  app->connProperties[index].thermometerServiceHandle = SERVICE_HANDLE_INVALID;
+  app->connProperties[index].thermometerCharacteristicHandle = CHARACTERISTIC_HANDLE_INVALID;
+  app->batteryServiceHandle[index] = SERVICE_HANDLE_INVALID;
+  memset(app->infoHandles[index], 0, sizeof(app->infoHandles[index]));
+  app->connProperties[index].state = discoverServices;
+  if (infoPeriodMs != 0) {
+    struct gecko_msg_gatt_discover_primary_services_cmd_t allCmd;
+
+    allCmd.connection = app->connProperties[index].connectionHandle;
+    sendCommand(gecko_cmd_gatt_discover_primary_services_id, &allCmd, sizeof(allCmd));
+    return;
+  }
+  // connection, then the UUID as a uint8array
+  cmd[0] = app->connProperties[index].connectionHandle;
+  cmd[1] = sizeof(thermoService);
+  memcpy(&cmd[2], thermoService, sizeof(thermoService));
+  sendCommand(gecko_cmd_gatt_discover_primary_services_by_uuid_id, cmd, sizeof(cmd));
+}
+
+// Discover every characteristic of a service
+static void discoverAllCharacteristics(uint8_t index, uint32_t service)
+{
+  struct gecko_msg_gatt_discover_characteristics_cmd_t cmd;
+
+  cmd.connection = app->connProperties[index].connectionHandle;
+  cmd.service = service;
+  sendCommand(gecko_cmd_gatt_discover_characteristics_id, &cmd, sizeof(cmd));
+}
+
+// Discover the Temperature Measurement characteristic in the service found, or every
+// characteristic of the service, to find the ones that notify and the values read besides
+static void discoverTemperature(uint8_t index)
+{
+  uint32_t service = app->connProperties[index].thermometerServiceHandle;
+  uint8_t cmd[6 + sizeof(thermoChar)];
+
+  app->connProperties[index].state = discoverCharacteristics;
+  if (notificationsEnabled || infoPeriodMs != 0) {
+    discoverAllCharacteristics(index, service);
+    return;
+  }
+  // connection, service handle (little endian), then the UUID as a uint8array
+  cmd[0] = app->connProperties[index].connectionHandle;
+  cmd[1] = (uint8_t)service;
+  cmd[2] = (uint8_t)(service >> 8);
+  cmd[3] = (uint8_t)(service >> 16);
+  cmd[4] = (uint8_t)(service >> 24);
+  cmd[5] = sizeof(thermoChar);
+  memcpy(&cmd[6], thermoChar, sizeof(thermoChar));
+  sendCommand(gecko_cmd_gatt_discover_characteristics_by_uuid_id, cmd, sizeof(cmd));
+}
+
+// Take a discovered characteristic the readings may come from. With notifications, one that
+// notifies wins over the Temperature Measurement indications, and the Intermediate Temperature
+// over the Temperature Measurement.
+static void offerCharacteristic(uint8_t index, const struct gecko_msg_gatt_characteristic_evt_t *evt)
+{
+  ConnProperties *props = &app->connProperties[index];
+  bool intermediate;
+  uint8_t delivery;
+  uint8_t i;
+
+  if (evt->uuid.len != sizeof(thermoChar)) {
+    return;
+  }
+  for (i = 0; i < infoCount; i++) {
+    if (memcmp(evt->uuid.data, infoChars[i], sizeof(infoChars[i])) == 0) {
+      app->infoHandles[index][i] = evt->characteristic;
+      return;
+    }
+  }
+  intermediate = (memcmp(evt->uuid.data, intermediateChar, sizeof(intermediateChar)) == 0);
+  if (!intermediate && memcmp(evt->uuid.data, thermoChar, sizeof(thermoChar)) != 0) {
+    return;
+  }
+  if (notificationsEnabled && (evt->properties & GATT_PROPERTY_NOTIFY)) {
+    delivery = gatt_notification;
+  } else if (!intermediate) {
+    delivery = gatt_indication;
+  } else {
+    return;
+  }
+  if (props->thermometerCharacteristicHandle == CHARACTERISTIC_HANDLE_INVALID
+      || (delivery == gatt_notification && (props->delivery == gatt_indication || intermediate))) {
+    props->thermometerCharacteristicHandle = evt->characteristic;
+    props->delivery = delivery;
+  }
+}
+
+// Cached handles found without looking for notifications are of no use with them, and handles of
+// notifications of no use without. Neither are handles found without looking for the values
+// read besides the readings, when they are read.
+static bool cacheUsable(const GattCacheEntry *cached)
+{
+  if (infoPeriodMs != 0 && !cached->infoSearched) {
+    return false;
+  }
+  return (cached->delivery == gatt_notification) ? notificationsEnabled
+         : (cached->delivery != 0 || !notificationsEnabled);
+}
+
+// Take the handles of the values read besides the readings from the cache
+static void takeCachedInfo(uint8_t index, const GattCacheEntry *cached)
+{
+  uint8_t i;
+
+  for (i = 0; i < infoCount; i++) {
+    app->infoHandles[index][i] = (i < GATT_CACHE_INFO_HANDLES) ? cached->infoHandles[i] : 0;
+  }
+}
+
+// Read the values kept besides the readings, all of them with one Read Multiple request. The
+// request needs two handles at least, a single one is read on its own.
+static void readInfo(uint8_t index)
+{
+  uint8_t connection = app->connProperties[index].connectionHandle;
+  uint8_t cmd[2 + 2 * infoCount];
+  uint16_t handle = 0;
+  uint8_t count = 0;
+  uint8_t i;
+
+  if (infoPeriodMs == 0) {
+    return;
+  }
+  for (i = 0; i < infoCount; i++) {
+    if (app->infoHandles[index][i] != 0) {
+      handle = app->infoHandles[index][i];
+      cmd[2 + 2 * count] = (uint8_t)handle;
+      cmd[3 + 2 * count] = (uint8_t)(handle >> 8);
+      count++;
+    }
+  }
+  if (count == 0) {
+    return;
+  }
+  if (count == 1) {
+    struct gecko_msg_gatt_read_characteristic_value_cmd_t readCmd = { connection, handle };
+    sendCommand(gecko_cmd_gatt_read_characteristic_value_id, &readCmd, sizeof(readCmd));
+    return;
+  }
+  // connection, then the handles as a uint8array
+  cmd[0] = connection;
+  cmd[1] = (uint8_t)(2 * count);
+  sendCommand(gecko_cmd_gatt_read_multiple_characteristic_values_id, cmd, (uint16_t)(2 + 2 * count));
+}
+
+// Take the values of a read, one after the other in the order they were asked for
+static void takeInfo(uint8_t index, const uint8_t *data, uint8_t len)
 {
+  SensorInfo *info = &app->info[index];
+  uint8_t offset = 0;
   uint8_t i;
-  uint8_t table_index = findIndexByConnectionHandle(connection);
 
-  if (activeConnectionsNum > 0) {
-    activeConnectionsNum--;
+  for (i = 0; i < infoCount; i++) {
+    if (app->infoHandles[index][i] == 0) {
+      continue;
+    }
+    if (offset + infoSizes[i] > len) {
+      break;
+    }
+    switch (i) {
+      case infoTemperatureType:
+        info->temperatureType = data[offset];
+        break;
+      case infoMeasurementInterval:
+        info->measurementInterval = (uint16_t)(data[offset] | (data[offset + 1] << 8));
+        break;
+      default:
+        info->batteryLevel = data[offset];
+        break;
+    }
+    offset += infoSizes[i];
+  }
+  publishSlot(index);
+}
+
+static void onPhyResponse(const struct gecko_cmd_packet *rsp, void *context)
+{
+  uint8_t index = app->slotByHandle[(uintptr_t)context];
+
+  if (rsp->data.rsp_le_connection_set_preferred_phy.result != 0 && index != TABLE_INDEX_INVALID) {
+    linkPolicyRejected(&app->linkPolicy[index]);
+  }
+}
+
+// Move a running connection to the PHY its RSSI calls for. The sensor may only take the PHY
+// asked for or stay on 1M, the NCP reports which with a PHY status event.
+static void applyLinkPolicy(uint8_t index)
+{
+  struct gecko_msg_le_connection_set_preferred_phy_cmd_t cmd;
+  uint8_t phy;
+
+  if (app->connProperties[index].state != running) {
+    return;
+  }
+  phy = linkPolicySample(&app->linkPolicy[index], app->connProperties[index].rssi);
+  if (phy == 0) {
+    return;
+  }
+  cmd.connection = app->connProperties[index].connectionHandle;
+  cmd.preferred_phy = phy;
+  cmd.accepted_phy = (uint8_t)(phy | le_gap_phy_1m);
+  cmdQueueSend(gecko_cmd_le_connection_set_preferred_phy_id, &cmd, sizeof(cmd), onPhyResponse,
+               (void *)(uintptr_t)cmd.connection);
+}
+
+// Set up the readings of a connection once every handle is known
+static void enableReadings(uint8_t index)
+{
+  subscribe(app->connProperties[index].connectionHandle,
+            app->connProperties[index].thermometerCharacteristicHandle,
+            app->connProperties[index].delivery, NULL);
+  app->connProperties[index].state = enableIndication;
+}
+
+static void closeConnection(uint8_t connection)
+{
+  struct gecko_msg_le_connection_close_cmd_t cmd = { connection };
+
+  sendCommand(gecko_cmd_le_connection_close_id, &cmd, sizeof(cmd));
+}
+
+// Connections that are kept have deadlines, rotation gives up on its own ones by itself
+static bool supervising(void)
+{
+  return supervisionEnabled() && !rotationEnabled();
+}
+
+// Close a connection past its deadline, its sensor is connected again once it advertises
+static void onDeadline(void *context)
+{
+  uint8_t index = (uint8_t)(uintptr_t)context;
+
+  if (app->connProperties[index].connectionHandle == CONNECTION_HANDLE_INVALID) {
+    return;
+  }
+  supervisionClosed((app->connProperties[index].state == running)
+                    ? supervisionStalled : supervisionSetupHung);
+  closeConnection(app->connProperties[index].connectionHandle);
+}
+
+// Give the setup step a connection has just started its time
+static void superviseSetup(uint8_t index)
+{
+  if (supervising()) {
+    timerWheelArm(&app->wheel, &app->deadline[index], SUPERVISION_STEP_TIMEOUT_MS,
+                  onDeadline, (void *)(uintptr_t)index);
+  }
+}
+
+// Expect the next reading of a running connection within a few intervals of its sensor
+static void superviseReadings(uint8_t index)
+{
+  SensorStats stats;
+
+  if (supervising()) {
+    timerWheelArm(&app->wheel, &app->deadline[index],
+                  supervisionStallMs(app->info[index].measurementInterval,
+                                     sensorStatsGet(&app->connAddress[index], &stats)
+                                     ? stats.readingsPerMin : 0),
+                  onDeadline, (void *)(uintptr_t)index);
+  }
+}
+
+// Cached handles were refused outright, e.g. the handle is out of range on the server
+static void onCachedIndicationResponse(const struct gecko_cmd_packet *rsp, void *context)
+{
+  uint8_t index = app->slotByHandle[(uintptr_t)context];
+
+  if (rsp->data.rsp_gatt_set_characteristic_notification.result != 0
+      && index != TABLE_INDEX_INVALID
+      && app->connProperties[index].state == enableCachedIndication) {
+    discoverThermometer(index);
+  }
+}
+
+// Set up a new connection, straight from the GATT cache if the server is known
+static void setupConnection(uint8_t index)
+{
+  const GattCacheEntry *cached = gattCacheLookup(&app->connAddress[index]);
+
+  superviseSetup(index);
+  if (cached != NULL && cacheUsable(cached)) {
+    metricsCount(metricGattCacheHits);
+    app->connProperties[index].thermometerServiceHandle = cached->serviceHandle;
+    app->connProperties[index].thermometerCharacteristicHandle = cached->characteristicHandle;
+    app->connProperties[index].delivery = cached->delivery ? cached->delivery : gatt_indication;
+    takeCachedInfo(index, cached);
+    app->connProperties[index].state = enableCachedIndication;
+    subscribe(app->connProperties[index].connectionHandle, cached->characteristicHandle,
+              app->connProperties[index].delivery, onCachedIndicationResponse);
+    return;
+  }
+  discoverThermometer(index);
+}
+
+// A thermometer that has been set up is part of the fleet the scan policy filters on
+static void learnSensor(uint8_t index)
+{
+  scanPolicyLearn(&app->connAddress[index], app->connAddressType[index]);
+  // Rotated sensors are let go after every reading, only kept connections count as connected
+  if (!rotationEnabled()) {
+    scanPolicySetConnected(&app->connAddress[index], true);
+  }
+}
+
+// Keep the connection on record, so a restarted client can adopt it
+static void recordLink(uint8_t index)
+{
+  LinkStateEntry entry;
+
+  memset(&entry, 0, sizeof(entry));
+  entry.address = app->connAddress[index];
+  entry.addressType = app->connAddressType[index];
+  entry.connection = app->connProperties[index].connectionHandle;
+  entry.running = (app->connProperties[index].state == running);
+  linkStateSet(app->firstSlot + index, &entry);
+}
+
+// Report how long the client took to its first reading, after a cold or a warm start
+static void noteFirstReading(void)
+{
+  if (firstReadingUs != 0 || startUs == 0) {
+    return;
+  }
+  firstReadingUs = metricsNowUs();
+  fprintf(stderr, "First reading %.1f ms after start-up, %s start\n",
+          (firstReadingUs - startUs) / 1e3, warmStarted ? "warm" : "cold");
+}
+
+static uint64_t clockMs(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000u + (uint64_t)ts.tv_nsec / 1000000u;
+}
+
+// Cancel a connection that has not opened in time, which reports it closed. The handle comes
+// with the connect response, the deadline is moved on until it is in.
+static void onOpeningDeadline(void *context)
+{
+  (void)context;
+  if (app->connState != opening) {
+    return;
+  }
+  if (app->openingConnection != CONNECTION_HANDLE_INVALID) {
+    supervisionClosed(supervisionConnectHung);
+    closeConnection(app->openingConnection);
+  }
+  timerWheelArm(&app->wheel, &app->openingDeadline, SUPERVISION_CONNECT_TIMEOUT_MS,
+                onOpeningDeadline, NULL);
+}
+
+// Expire the deadlines that are due
+static void supervise(void)
+{
+  if (supervisionEnabled()) {
+    timerWheelAdvance(&app->wheel, clockMs());
+  }
+}
+
+static void startDiscovery(void)
+{
+  struct gecko_msg_le_gap_start_discovery_cmd_t cmd = { default_phy, le_gap_discover_generic };
+
+  sendCommand(gecko_cmd_le_gap_start_discovery_id, &cmd, sizeof(cmd));
+}
+
+// Keep the scanner running while there is room for more connections. Only one
+// connection can be opened at a time, scanning resumes once it is established.
+static void updateScanning(void)
+{
+  if (app->connState == opening) {
+    return;
+  }
+  // Rotation keeps looking for sensors it does not know yet while the links are busy, and
+  // broadcast readings only come with the advertisements
+  if (app->activeConnectionsNum < MAX_CONNECTIONS || rotationEnabled() || broadcastEnabled()) {
+    if (app->connState != scanning) {
+      startDiscovery();
+      app->connState = scanning;
+    }
+  } else if (app->connState == scanning) {
+    sendCommand(gecko_cmd_le_gap_end_procedure_id, NULL, 0);
+    app->connState = running;
+  }
+}
+
+// The connection handle is known once the connect command is answered. The response comes
+// before any event of the connection, so it is in place for the opened or closed event.
+static void onConnectResponse(const struct gecko_cmd_packet *rsp, void *context)
+{
+  (void)context;
+  if (app->connState != opening) {
+    return;
+  }
+  if (rsp->data.rsp_le_gap_connect.result == 0) {
+    app->openingConnection = rsp->data.rsp_le_gap_connect.connection;
+    return;
+  }
+  scanFilterSetConnected(&app->openingAddress, false);
+  rotationDone(&app->openingAddress, false);
+  if (supervising()) {
+    supervisionHold(&app->wheel, &app->openingAddress, 0);
   }
-  // Shift entries after the removed connection toward 0 index
-  for (i = table_index; i < activeConnectionsNum; i++) {
-    connProperties[i] = connProperties[i + 1];
+  app->connState = running;
+  updateScanning();
+}
+
+// Stop scanning and connect to a sensor, the handle comes with the response. Only one connection
+// is opened at a time.
+static void connectTo(const bd_addr *address, uint8_t addressType)
+{
+  struct gecko_msg_le_gap_connect_cmd_t cmd;
+
+  if (app->connState == scanning) {
+    sendCommand(gecko_cmd_le_gap_end_procedure_id, NULL, 0);
   }
-  // Clear the slots we've just removed so no junk values appear
-  for (i = activeConnectionsNum; i < MAX_CONNECTIONS; i++) {
-    connProperties[i].connectionHandle = CONNECTION_HANDLE_INVALID;
-    connProperties[i].thermometerServiceHandle = SERVICE_HANDLE_INVALID;
-    connProperties[i].thermometerCharacteristicHandle = CHARACTERISTIC_HANDLE_INVALID;
-    connProperties[i].temperature = TEMP_INVALID;
-    connProperties[i].rssi = RSSI_INVALID;
+  cmd.address = *address;
+  cmd.address_type = addressType;
+  cmd.initiating_phy = default_phy;
+  cmdQueueSend(gecko_cmd_le_gap_connect_id, &cmd, sizeof(cmd), onConnectResponse, NULL);
+  app->openingConnection = CONNECTION_HANDLE_INVALID;
+  app->openingAddress = *address;
+  app->openingSinceMs = clockMs();
+  app->connState = opening;
+  if (supervising()) {
+    timerWheelArm(&app->wheel, &app->openingDeadline, SUPERVISION_CONNECT_TIMEOUT_MS,
+                  onOpeningDeadline, NULL);
   }
+  // Keep the other NCPs from connecting to it as well
+  scanFilterSetConnected(address, true);
+}
+
+// Take the reading a broadcasting thermometer advertises, once however many times it is heard.
+// Sensors take results table slots in the order they are first heard, across all NCPs, the
+// ones past the table are only logged and stored.
+static void takeBroadcast(const bd_addr *address, uint8_t addressType, const uint8_t *data,
+                          uint8_t len, int8_t rssi)
+{
+  ConnProperties props;
+  SensorStats stats;
+  uint32_t temperature;
+  uint16_t index = broadcastAccept(address, data, len, &temperature);
+  uint8_t slot = (index < TABLE_INDEX_INVALID) ? (uint8_t)index : TABLE_INDEX_INVALID;
+
+  if (index == BROADCAST_INDEX_NONE) {
+    return;
+  }
+  scanPolicyLearn(address, addressType);
+  sensorStatsUpdate(address, temperature);
+  props.connectionHandle = CONNECTION_HANDLE_INVALID;
+  props.rssi = rssi;
+  props.thermometerCharacteristicHandle = CHARACTERISTIC_HANDLE_INVALID;
+  props.temperature = temperature;
+  props.serverAddress = (uint16_t)(address->addr[1] << 8) + address->addr[0];
+  props.state = broadcasting;
+  props.thermometerServiceHandle = SERVICE_HANDLE_INVALID;
+  outputSinkPush(slot, props.serverAddress, temperature, rssi);
+  readingStoreAppend(address, temperature, rssi);
+  sensorTableUpdate(slot, address, &props, sensorStatsGet(address, &stats) ? &stats : NULL, NULL);
+  metricsCount(metricReadings);
+  noteFirstReading();
+  if (metricsReadTime() != 0) {
+    metricsObserve(metricReadingDelay, metricsNowUs() - metricsReadTime());
+  }
+}
+
+// Request the RSSI of the next running connection once it is due. A single request per
+// period / connections keeps the replies from bunching up on the serial link, and the
+// spacing follows the number of connections as it changes.
+static void sampleRssi(void)
+{
+  uint64_t nowMs;
+  uint8_t index;
+  uint16_t i;
+
+  if (!app->appBooted || rssiPeriodMs == 0 || app->activeConnectionsNum == 0) {
+    return;
+  }
+  nowMs = clockMs();
+  if (nowMs - app->rssiLastMs < rssiPeriodMs / app->activeConnectionsNum) {
+    return;
+  }
+  for (i = 0; i < MAX_CONNECTIONS; i++) {
+    index = app->rssiCursor;
+    app->rssiCursor = (uint8_t)((app->rssiCursor + 1) % MAX_CONNECTIONS);
+    if (app->connProperties[index].state == running
+        && app->connProperties[index].connectionHandle != CONNECTION_HANDLE_INVALID) {
+      struct gecko_msg_le_connection_get_rssi_cmd_t cmd = {
+        app->connProperties[index].connectionHandle
+      };
+      sendCommand(gecko_cmd_le_connection_get_rssi_id, &cmd, sizeof(cmd));
+      break;
+    }
+  }
+  app->rssiLastMs = nowMs;
+}
+
+// Read the values besides the readings of one sensor at a time, spread like the RSSI samples
+static void sampleInfo(void)
+{
+  uint64_t nowMs;
+  uint8_t index;
+  uint16_t i;
+
+  if (!app->appBooted || infoPeriodMs == 0 || app->activeConnectionsNum == 0) {
+    return;
+  }
+  nowMs = clockMs();
+  if (nowMs - app->infoLastMs < infoPeriodMs / app->activeConnectionsNum) {
+    return;
+  }
+  for (i = 0; i < MAX_CONNECTIONS; i++) {
+    index = app->infoCursor;
+    app->infoCursor = (uint8_t)((app->infoCursor + 1) % MAX_CONNECTIONS);
+    if (app->connProperties[index].state == running
+        && app->connProperties[index].connectionHandle != CONNECTION_HANDLE_INVALID) {
+      readInfo(index);
+      break;
+    }
+  }
+  app->infoLastMs = nowMs;
+}
+
+// Connect to the sensor whose reading is most overdue while a link is free. An attempt that
+// does not open in time is cancelled, which reports it closed.
+static void rotate(void)
+{
+  bd_addr address;
+  uint8_t addressType;
+
+  if (!rotationEnabled() || !app->appBooted) {
+    return;
+  }
+  if (app->connState == opening) {
+    if (app->openingConnection != CONNECTION_HANDLE_INVALID
+        && clockMs() - app->openingSinceMs > ROTATION_CONNECT_TIMEOUT_MS) {
+      closeConnection(app->openingConnection);
+      app->openingSinceMs = clockMs();
+    }
+    return;
+  }
+  if (app->activeConnectionsNum < MAX_CONNECTIONS && rotationNextDue(&address, &addressType)) {
+    connectTo(&address, addressType);
+  }
+}
+
+// Close rotated connections that have not delivered a reading in time
+static void expireRotated(void)
+{
+  uint64_t nowUs = metricsNowUs();
+  uint8_t index;
+
+  for (index = 0; index < MAX_CONNECTIONS; index++) {
+    if (app->connProperties[index].connectionHandle != CONNECTION_HANDLE_INVALID
+        && nowUs - app->openedUs[index] > ROTATION_READ_TIMEOUT_MS * 1000ull) {
+      closeConnection(app->connProperties[index].connectionHandle);
+      // Once per timeout, the close takes a connection event or two
+      app->openedUs[index] = nowUs;
+    }
+  }
+}
+
+// Connections of a rebooted NCP are gone, their sensors may be picked up again
+static void releaseConnections(void)
+{
+  uint8_t index;
+
+  for (index = 0; index < MAX_CONNECTIONS; index++) {
+    if (app->connProperties[index].connectionHandle != CONNECTION_HANDLE_INVALID) {
+      scanFilterSetConnected(&app->connAddress[index], false);
+      scanPolicySetConnected(&app->connAddress[index], false);
+      rotationDone(&app->connAddress[index], false);
+      outputSinkPush(app->firstSlot + index, app->connProperties[index].serverAddress,
+                     TEMP_INVALID, RSSI_INVALID);
+      sensorTableClear(app->firstSlot + index);
+      linkStateClear(app->firstSlot + index);
+      metricsGaugeAdd(metricConnectionsActive, -1);
+    }
+  }
+  if (app->connState == opening) {
+    scanFilterSetConnected(&app->openingAddress, false);
+    rotationDone(&app->openingAddress, false);
+  }
+}
+
+#if defined(gecko_cmd_sm_add_to_whitelist_id) && defined(gecko_cmd_le_gap_enable_whitelisting_id)
+// The controller has no room left in its accept list
+static void onAcceptListResponse(const struct gecko_cmd_packet *rsp, void *context)
+{
+  (void)context;
+  if (rsp->data.rsp_sm_add_to_whitelist.result != 0) {
+    app->acceptFull = true;
+  }
+}
+#endif
+
+// Bring the scanner in line with the scan policy. Newly known sensors are loaded into the accept
+// list a few at a time, and the scanner is restarted for new settings or entries to take effect.
+static void applyScanPolicy(void)
+{
+  ScanPolicySettings want;
+  bool restart = false;
+
+  if (!scanPolicyEnabled() || !app->appBooted) {
+    return;
+  }
+  scanPolicyCurrent(&want);
+#if defined(gecko_cmd_sm_add_to_whitelist_id) && defined(gecko_cmd_le_gap_enable_whitelisting_id)
+  {
+    struct gecko_msg_sm_add_to_whitelist_cmd_t acceptCmd;
+    uint8_t i;
+
+    for (i = 0; i < SCAN_POLICY_LOAD_BATCH && !app->acceptFull
+         && scanPolicyKnown(app->acceptLoaded, &acceptCmd.address, &acceptCmd.address_type); i++) {
+      if (cmdQueueSend(gecko_cmd_sm_add_to_whitelist_id, &acceptCmd, sizeof(acceptCmd),
+                       onAcceptListResponse, NULL) < 0) {
+        break;
+      }
+      app->acceptLoaded++;
+      restart = app->scan.filtered;
+    }
+    // Filter only once every known sensor is in the list, and all of them fit
+    want.filtered = want.filtered && !app->acceptFull
+                    && !scanPolicyKnown(app->acceptLoaded, &acceptCmd.address, &acceptCmd.address_type);
+  }
+  if (want.filtered != app->scan.filtered) {
+    struct gecko_msg_le_gap_enable_whitelisting_cmd_t filterCmd = { want.filtered ? 1 : 0 };
+    sendCommand(gecko_cmd_le_gap_enable_whitelisting_id, &filterCmd, sizeof(filterCmd));
+    restart = true;
+  }
+#else
+  // Without an accept list in the stack only the duty cycle is adapted
+  want.filtered = false;
+#endif
+  if (want.interval != app->scan.interval || want.window != app->scan.window) {
+    struct gecko_msg_le_gap_set_discovery_timing_cmd_t timingCmd;
+    timingCmd.phys = default_phy;
+    timingCmd.scan_interval = want.interval;
+    timingCmd.scan_window = want.window;
+    sendCommand(gecko_cmd_le_gap_set_discovery_timing_id, &timingCmd, sizeof(timingCmd));
+    restart = true;
+  }
+  app->scan = want;
+  // Otherwise they are in place for the next time scanning starts
+  if (restart && app->connState == scanning) {
+    sendCommand(gecko_cmd_le_gap_end_procedure_id, NULL, 0);
+    startDiscovery();
+  }
+}
+
+// Set the NCP up as a central with no connections, once it has booted or been taken over
+static void startCentral(void)
+{
+  struct gecko_msg_le_gap_set_discovery_type_cmd_t typeCmd;
+  struct gecko_msg_le_gap_set_discovery_timing_cmd_t timingCmd;
+  struct gecko_msg_le_gap_set_conn_timing_parameters_cmd_t connTimingCmd;
+
+  app->appBooted = true;
+  initProperties();
+  app->rssiLastMs = clockMs();
+  // The accept list is emptied by a reset, and loaded again after a warm start
+  app->scan.interval = SCAN_INTERVAL;
+  app->scan.window = SCAN_WINDOW;
+  app->scan.filtered = false;
+  app->acceptLoaded = 0;
+  app->acceptFull = false;
+  // Set passive scanning on 1Mb PHY
+  typeCmd.phys = default_phy;
+  typeCmd.scan_type = SCAN_PASSIVE;
+  sendCommand(gecko_cmd_le_gap_set_discovery_type_id, &typeCmd, sizeof(typeCmd));
+  // Set scan interval and scan window
+  timingCmd.phys = default_phy;
+  timingCmd.scan_interval = SCAN_INTERVAL;
+  timingCmd.scan_window = SCAN_WINDOW;
+  sendCommand(gecko_cmd_le_gap_set_discovery_timing_id, &timingCmd, sizeof(timingCmd));
+#if defined(gecko_cmd_le_gap_set_discovery_extended_scan_response_id)
+  // Broadcasting sensors may use extended advertising, reported as events of their own
+  if (broadcastEnabled()) {
+    struct gecko_msg_le_gap_set_discovery_extended_scan_response_cmd_t extendedCmd = { 1 };
+    sendCommand(gecko_cmd_le_gap_set_discovery_extended_scan_response_id,
+                &extendedCmd, sizeof(extendedCmd));
+  }
+#endif
+  // Set the default connection parameters for subsequent connections
+  // Rotated connections last a few connection events, the shorter the interval the sooner
+  // they are done
+  connTimingCmd.min_interval = rotationEnabled() ? ROTATION_CONN_INTERVAL : CONN_INTERVAL_MIN;
+  connTimingCmd.max_interval = rotationEnabled() ? ROTATION_CONN_INTERVAL : CONN_INTERVAL_MAX;
+  connTimingCmd.latency = CONN_SLAVE_LATENCY;
+  connTimingCmd.timeout = CONN_TIMEOUT;
+  connTimingCmd.min_ce_length = 0;
+  connTimingCmd.max_ce_length = 0xffff;
+  sendCommand(gecko_cmd_le_gap_set_conn_timing_parameters_id,
+              &connTimingCmd, sizeof(connTimingCmd));
+  app->connState = running;
+  app->openingConnection = CONNECTION_HANDLE_INVALID;
+  timerWheelCancel(&app->openingDeadline);
+}
+
+// Take over a connection the NCP has kept from the previous client. One that was running with
+// cached handles still has its indications enabled on the server and carries on as it was, the
+// others are set up again on the link they have.
+static void adoptConnection(const LinkStateEntry *link)
+{
+  struct gecko_msg_gatt_send_characteristic_confirmation_cmd_t confirmCmd = { link->connection };
+  const GattCacheEntry *cached = gattCacheLookup(&link->address);
+  uint8_t index = addConnection(link->connection, &link->address);
+
+  if (index == TABLE_INDEX_INVALID) {
+    closeConnection(link->connection);
+    return;
+  }
+  app->connAddressType[index] = link->addressType;
+  if (!link->running || cached == NULL || !cacheUsable(cached)) {
+    setupConnection(index);
+    recordLink(index);
+    return;
+  }
+  app->connProperties[index].thermometerServiceHandle = cached->serviceHandle;
+  app->connProperties[index].thermometerCharacteristicHandle = cached->characteristicHandle;
+  app->connProperties[index].delivery = cached->delivery ? cached->delivery : gatt_indication;
+  takeCachedInfo(index, cached);
+  app->connProperties[index].state = running;
+  superviseReadings(index);
+  publishSlot(index);
+  learnSensor(index);
+  recordLink(index);
+  readInfo(index);
+  // An indication the previous client never confirmed would hold back the ones after it
+  if (app->connProperties[index].delivery == gatt_indication) {
+    sendCommand(gecko_cmd_gatt_send_characteristic_confirmation_id, &confirmCmd, sizeof(confirmCmd));
+  }
+}
+
+// An adopted connection that closed while no client was listening is let go, and a connection
+// the previous client never recorded, e.g. opened as it exited, is closed
+static void onProbeResponse(const struct gecko_cmd_packet *rsp, void *context)
+{
+  uint8_t connection = (uint8_t)(uintptr_t)context;
+  bool open = (rsp->data.rsp_le_connection_get_rssi.result == 0);
+
+  if (!open && app->slotByHandle[connection] != TABLE_INDEX_INVALID) {
+    removeConnection(connection);
+    updateScanning();
+  } else if (open && app->slotByHandle[connection] == TABLE_INDEX_INVALID) {
+    closeConnection(connection);
+  }
+}
+
+// The NCP is up and answering without a reset: set it up again, keeping the connections it has
+static void onHelloResponse(const struct gecko_cmd_packet *rsp, void *context)
+{
+  struct gecko_msg_le_connection_get_rssi_cmd_t probeCmd;
+  LinkStateEntry links[MAX_CONNECTIONS];
+  uint8_t count = 0;
+  uint16_t i;
+
+  (void)context;
+  if (app->appBooted || rsp->data.rsp_system_hello.result != 0) {
+    return;
+  }
+  for (i = 0; i < MAX_CONNECTIONS; i++) {
+    if (linkStateGet((uint8_t)(app->firstSlot + i), &links[count])) {
+      count++;
+    }
+  }
+  // Whatever the scanner was doing is started again with the settings below
+  sendCommand(gecko_cmd_le_gap_end_procedure_id, NULL, 0);
+#if defined(gecko_cmd_le_gap_enable_whitelisting_id)
+  if (scanPolicyEnabled()) {
+    struct gecko_msg_le_gap_enable_whitelisting_cmd_t filterCmd = { 0 };
+    sendCommand(gecko_cmd_le_gap_enable_whitelisting_id, &filterCmd, sizeof(filterCmd));
+  }
+#endif
+  startCentral();
+  for (i = 0; i < count; i++) {
+    adoptConnection(&links[i]);
+  }
+  // Connection handles count from 1, a table's worth of them covers every link
+  for (i = 0; i <= MAX_CONNECTIONS; i++) {
+    probeCmd.connection = (uint8_t)i;
+    cmdQueueSend(gecko_cmd_le_connection_get_rssi_id, &probeCmd, sizeof(probeCmd),
+                 onProbeResponse, (void *)(uintptr_t)i);
+  }
+  warmStarted = true;
+  printf("\r\nBLE Central resumed with %u connections\r\n", (unsigned)app->activeConnectionsNum);
+  updateScanning();
+}
+
+void appSelectNcp(uint8_t ncp)
+{
+  app = &contexts[ncp];
+  app->firstSlot = (uint8_t)(ncp * MAX_CONNECTIONS);
+}
+
+bool appIsBooted(void)
+{
+  return app->appBooted;
+}
+
+void appStart(bool warm)
+{
+  if (startUs == 0) {
+    startUs = metricsNowUs();
+  }
+  timerWheelInit(&app->wheel, clockMs());
+  if (warm) {
+    cmdQueueSend(gecko_cmd_system_hello_id, NULL, 0, onHelloResponse, NULL);
+    return;
+  }
+  gecko_cmd_system_reset(0);
+}
+
+void appSetNotifications(bool enabled)
+{
+  notificationsEnabled = enabled;
+}
+
+void appSetInfoPeriod(uint32_t periodMs)
+{
+  infoPeriodMs = periodMs;
+}
+
+void appSetRssiPeriod(uint32_t periodMs)
+{
+  rssiPeriodMs = periodMs;
+}
+
+void appTick(void)
+{
+  cmdQueueExpire();
+  sampleRssi();
+  sampleInfo();
+  if (rotationEnabled() && app->appBooted) {
+    expireRotated();
+  }
+  rotate();
+  applyScanPolicy();
+  supervise();
+}
+
+// Time from now to a deadline on clockMs(), 0 if it has passed
+static uint32_t untilMs(uint64_t dueMs, uint64_t nowMs)
+{
+  return (dueMs > nowMs) ? (uint32_t)MIN(dueMs - nowMs, (uint64_t)APP_TICK_IDLE) : 0;
+}
+
+uint32_t appNextTickMs(void)
+{
+  uint64_t nowMs = clockMs();
+  // Commands are answered before boot too, e.g. system_hello on a warm start
+  uint32_t waitMs = cmdQueueNextTimeoutMs();
+  uint8_t index;
+
+  if (!app->appBooted) {
+    return (waitMs == APP_TICK_IDLE) ? APP_TICK_IDLE : MAX(waitMs, (uint32_t)APP_TICK_MIN_MS);
+  }
+  if (rssiPeriodMs != 0 && app->activeConnectionsNum != 0) {
+    waitMs = MIN(waitMs, untilMs(app->rssiLastMs + rssiPeriodMs / app->activeConnectionsNum,
+                                 nowMs));
+  }
+  if (infoPeriodMs != 0 && app->activeConnectionsNum != 0) {
+    waitMs = MIN(waitMs, untilMs(app->infoLastMs + infoPeriodMs / app->activeConnectionsNum,
+                                 nowMs));
+  }
+  if (rotationEnabled()) {
+    for (index = 0; index < MAX_CONNECTIONS; index++) {
+      if (app->connProperties[index].connectionHandle != CONNECTION_HANDLE_INVALID) {
+        waitMs = MIN(waitMs, untilMs(app->openedUs[index] / 1000 + ROTATION_READ_TIMEOUT_MS + 1,
+                                     nowMs));
+      }
+    }
+    if (app->connState == opening) {
+      if (app->openingConnection != CONNECTION_HANDLE_INVALID) {
+        waitMs = MIN(waitMs, untilMs(app->openingSinceMs + ROTATION_CONNECT_TIMEOUT_MS + 1,
+                                     nowMs));
+      }
+    } else if (app->activeConnectionsNum < MAX_CONNECTIONS) {
+      waitMs = MIN(waitMs, rotationNextDueMs());
+    }
+  }
+  if (scanPolicyEnabled()) {
+    waitMs = MIN(waitMs, scanPolicyNextChangeMs());
+#if defined(gecko_cmd_sm_add_to_whitelist_id) && defined(gecko_cmd_le_gap_enable_whitelisting_id)
+    {
+      bd_addr address;
+      uint8_t addressType;
+
+      // Known sensors still to be loaded into the accept list go a batch per tick
+      if (!app->acceptFull && scanPolicyKnown(app->acceptLoaded, &address, &addressType)) {
+        waitMs = 0;
+      }
+    }
+#endif
+  }
+  if (supervisionEnabled()) {
+    waitMs = MIN(waitMs, timerWheelNextMs(&app->wheel, nowMs));
+  }
+  return (waitMs == APP_TICK_IDLE) ? APP_TICK_IDLE : MAX(waitMs, (uint32_t)APP_TICK_MIN_MS);
 }
 
 /***********************************************************************************************//**
@@ -131,22 +1163,21 @@ void removeConnection(uint8_t connection)
  **************************************************************************************************/
 void appHandleEvents(struct gecko_cmd_packet *evt)
 {
-  static uint8_t i;
-  static bool printHeader = true;
   static uint8_t* charValue;
-  static uint16_t addrValue;
   static uint8_t tableIndex;
+  static uint8_t connection;
+  struct gecko_msg_gatt_send_characteristic_confirmation_cmd_t confirmCmd;
   if (NULL == evt) {
     return;
   }
+  metricsCountEvent(BGLIB_MSG_ID(evt->header));
 
   // Do not handle any events until system is booted up properly.
   if ((BGLIB_MSG_ID(evt->header) != gecko_evt_system_boot_id)
-      && !appBooted) {
+      && !app->appBooted) {
 #if defined(DEBUG)
     printf("Event: 0x%04x\n", BGLIB_MSG_ID(evt->header));
 #endif
-    usleep(50000);
     return;
   }
 
@@ -154,22 +1185,15 @@ void appHandleEvents(struct gecko_cmd_packet *evt)
   switch (BGLIB_MSG_ID(evt->header)) {
     case gecko_evt_system_boot_id:
 
-      appBooted = true;
+      // Commands sent before the reset will not be answered
+      cmdQueueReset();
+      if (app->appBooted) {
+        releaseConnections();
+      }
+      startCentral();
       printf("\r\nBLE Central started\r\n");
-        // Set passive scanning on 1Mb PHY
-        gecko_cmd_le_gap_set_discovery_type(default_phy, SCAN_PASSIVE);
-        // Set scan interval and scan window
-        gecko_cmd_le_gap_set_discovery_timing(default_phy, SCAN_INTERVAL, SCAN_WINDOW);
-        // Set the default connection parameters for subsequent connections
-        gecko_cmd_le_gap_set_conn_timing_parameters(CONN_INTERVAL_MIN,
-                                             CONN_INTERVAL_MAX,
-                                             CONN_SLAVE_LATENCY,
-                                             CONN_TIMEOUT,
-                                             0,
-                                             0xffff);
         // Start scanning - looking for thermometer devices
-        gecko_cmd_le_gap_start_discovery(default_phy, le_gap_discover_generic);
-        connState = scanning;
+        updateScanning();
         break;
 
       // This event is generated when an advertisement packet or a scan response
@@ -178,54 +1202,99 @@ void appHandleEvents(struct gecko_cmd_packet *evt)
       #if _DEBUG
         printf("Scan response received!\n");
       #endif
+      // Broadcast readings come in any kind of advertisement, the sensor is never connected to
+      if (broadcastEnabled()) {
+        takeBroadcast(&evt->data.evt_le_gap_scan_response.address,
+                      evt->data.evt_le_gap_scan_response.address_type,
+                      evt->data.evt_le_gap_scan_response.data.data,
+                      evt->data.evt_le_gap_scan_response.data.len,
+                      evt->data.evt_le_gap_scan_response.rssi);
+        break;
+      }
       // Parse advertisement packets - only look at connectable advertising 000b or 001b
       if ((evt->data.evt_le_gap_scan_response.packet_type & 0x3) == 0 ||
             (evt->data.evt_le_gap_scan_response.packet_type & 0x3) == 1 ) {
-          // If a thermometer advertisement is found...
-          if (findServiceInAdvertisement(&(evt->data.evt_le_gap_scan_response.data.data[0]),
-                                         evt->data.evt_le_gap_scan_response.data.len) != 0) {
+          // Rotation only learns about the thermometer, it is connected to once it is due
+          if (rotationEnabled()) {
+            if (scanFilterAccept(&evt->data.evt_le_gap_scan_response.address,
+                                 evt->data.evt_le_gap_scan_response.data.data,
+                                 evt->data.evt_le_gap_scan_response.data.len)) {
+              rotationAdd(&evt->data.evt_le_gap_scan_response.address,
+                          evt->data.evt_le_gap_scan_response.address_type);
+            }
+          // If a thermometer advertisement is found and we can connect to one more device...
+          } else if (app->connState == scanning && app->activeConnectionsNum < MAX_CONNECTIONS
+              && scanFilterAccept(&evt->data.evt_le_gap_scan_response.address,
+                                  evt->data.evt_le_gap_scan_response.data.data,
+                                  evt->data.evt_le_gap_scan_response.data.len)
+              && !supervisionHeld(&evt->data.evt_le_gap_scan_response.address)) {
 #if _DEBUG
             printf("Found device\n");
 #endif
-            // then stop scanning for a while
-            gecko_cmd_le_gap_end_procedure();
-            // and connect to that device
-            if (activeConnectionsNum < MAX_CONNECTIONS) {
 #if _DEBUG
             printf("Connecting\n");
 #endif
-              gecko_cmd_le_gap_connect(evt->data.evt_le_gap_scan_response.address,
-                                       evt->data.evt_le_gap_scan_response.address_type,
-                                       default_phy);
-              connState = opening;
-            }
+            // then stop scanning until the connection is opened
+            connectTo(&evt->data.evt_le_gap_scan_response.address,
+                      evt->data.evt_le_gap_scan_response.address_type);
+            metricsCount(metricScanAccepted);
           }
         }
         break;
 
+#if defined(gecko_evt_le_gap_extended_scan_response_id)
+      // Extended advertisements, reported once they are enabled, carry larger service data
+      case gecko_evt_le_gap_extended_scan_response_id:
+        if (broadcastEnabled()) {
+          takeBroadcast(&evt->data.evt_le_gap_extended_scan_response.address,
+                        evt->data.evt_le_gap_extended_scan_response.address_type,
+                        evt->data.evt_le_gap_extended_scan_response.data.data,
+                        evt->data.evt_le_gap_extended_scan_response.data.len,
+                        evt->data.evt_le_gap_extended_scan_response.rssi);
+        }
+        break;
+#endif
+
       // This event is generated when a new connection is established
       case gecko_evt_le_connection_opened_id:
       #if _DEBUG
           printf("Connection opened\n");
       #endif
-        // Get last two bytes of sender address
-        addrValue = (uint16_t)(evt->data.evt_le_connection_opened.address.addr[1] << 8) \
-                    + evt->data.evt_le_connection_opened.address.addr[0];
+        connection = evt->data.evt_le_connection_opened.connection;
+        metricsCount(metricConnectionsOpened);
+        if (app->connState == opening && connection == app->openingConnection) {
+          app->openingConnection = CONNECTION_HANDLE_INVALID;
+          app->connState = running;
+          timerWheelCancel(&app->openingDeadline);
+        }
         // Add connection to the connection_properties array
-        addConnection(evt->data.evt_le_connection_opened.connection, addrValue);
-        // Discover Health Thermometer service on the slave device
-        gecko_cmd_gatt_discover_primary_services_by_uuid(evt->data.evt_le_connection_opened.connection,
-                                                         2,
-                                                         (const uint8_t*)thermoService);
-        connState = discoverServices;
+        tableIndex = addConnection(connection, &evt->data.evt_le_connection_opened.address);
+        if (tableIndex == TABLE_INDEX_INVALID) {
+          // No room for it in the table
+          scanFilterSetConnected(&evt->data.evt_le_connection_opened.address, false);
+          rotationDone(&evt->data.evt_le_connection_opened.address, false);
+          closeConnection(connection);
+        } else {
+          app->connAddressType[tableIndex] = evt->data.evt_le_connection_opened.address_type;
+          // Enable indications right away if the handles are cached, or discover them
+          setupConnection(tableIndex);
+          recordLink(tableIndex);
+        }
+        // Look for the next device while this one is being set up
+        updateScanning();
         break;
 
       // This event is generated when a new service is discovered
       case gecko_evt_gatt_service_id:
         tableIndex = findIndexByConnectionHandle(evt->data.evt_gatt_service.connection);
-        if (tableIndex != TABLE_INDEX_INVALID) {
+        if (tableIndex != TABLE_INDEX_INVALID && evt->data.evt_gatt_service.uuid.len == 2) {
           // Save service handle for future reference
-          connProperties[tableIndex].thermometerServiceHandle = evt->data.evt_gatt_service.service;
+          if (memcmp(evt->data.evt_gatt_service.uuid.data, thermoService, sizeof(thermoService)) == 0) {
+            app->connProperties[tableIndex].thermometerServiceHandle = evt->data.evt_gatt_service.service;
+          } else if (memcmp(evt->data.evt_gatt_service.uuid.data, batteryService,
+                            sizeof(batteryService)) == 0) {
+            app->batteryServiceHandle[tableIndex] = evt->data.evt_gatt_service.service;
+          }
         }
         break;
 
@@ -233,52 +1302,100 @@ void appHandleEvents(struct gecko_cmd_packet *evt)
       case gecko_evt_gatt_characteristic_id:
         tableIndex = findIndexByConnectionHandle(evt->data.evt_gatt_characteristic.connection);
         if (tableIndex != TABLE_INDEX_INVALID) {
-          // Save characteristic handle for future reference
-          connProperties[tableIndex].thermometerCharacteristicHandle = evt->data.evt_gatt_characteristic.characteristic;
+          // Save characteristic handle for future reference, if the readings are to come from it
+          offerCharacteristic(tableIndex, &evt->data.evt_gatt_characteristic);
         }
         break;
 
       // This event is generated for various procedure completions, e.g. when a
       // write procedure is completed, or service discovery is completed
       case gecko_evt_gatt_procedure_completed_id:
-        tableIndex = findIndexByConnectionHandle(evt->data.evt_gatt_procedure_completed.connection);
+        connection = evt->data.evt_gatt_procedure_completed.connection;
+        tableIndex = findIndexByConnectionHandle(connection);
         if (tableIndex == TABLE_INDEX_INVALID) {
           break;
         }
-        // If service discovery finished
-        if (connState == discoverServices \
-            && connProperties[tableIndex].thermometerServiceHandle != SERVICE_HANDLE_INVALID) {
-          // Discover thermometer characteristic on the slave device
-          gecko_cmd_gatt_discover_characteristics_by_uuid(evt->data.evt_gatt_procedure_completed.connection,
-                                                          connProperties[tableIndex].thermometerServiceHandle,
-                                                          2,
-                                                          (const uint8_t*)thermoChar);
-          connState = discoverCharacteristics;
-          break;
-        }
-        // If characteristic discovery finished
-        if (connState == discoverCharacteristics \
-            && connProperties[tableIndex].thermometerCharacteristicHandle != CHARACTERISTIC_HANDLE_INVALID) {
-          // stop discovering
-          gecko_cmd_le_gap_end_procedure();
-          // enable indications
-          gecko_cmd_gatt_set_characteristic_notification(evt->data.evt_gatt_procedure_completed.connection,
-                                                         connProperties[tableIndex].thermometerCharacteristicHandle,
-                                                         gatt_indication);
-          connState = enableIndication;
-          break;
+        // The next setup step, if any, gets its time from now
+        if (app->connProperties[tableIndex].state != running) {
+          superviseSetup(tableIndex);
         }
-        // If indication enable process finished
-        if (connState == enableIndication) {
-          // and we can connect to more devices
-          if (activeConnectionsNum < MAX_CONNECTIONS) {
-            // start scanning again to find new devices
-            gecko_cmd_le_gap_start_discovery(default_phy, le_gap_discover_generic);
-            connState = scanning;
-          } else {
-            connState = running;
-          }
-          break;
+        // Advance the setup of this connection, independently of the others
+        switch (app->connProperties[tableIndex].state) {
+          // If service discovery finished
+          case discoverServices:
+            if (app->connProperties[tableIndex].thermometerServiceHandle == SERVICE_HANDLE_INVALID) {
+              // Not a thermometer after all, make room for another device
+              scanFilterReject(&app->connAddress[tableIndex]);
+              rotationForget(&app->connAddress[tableIndex]);
+              closeConnection(connection);
+              break;
+            }
+            // Discover thermometer characteristic on the slave device
+            discoverTemperature(tableIndex);
+            break;
+
+          // If characteristic discovery finished
+          case discoverCharacteristics:
+            if (app->connProperties[tableIndex].thermometerCharacteristicHandle == CHARACTERISTIC_HANDLE_INVALID) {
+              scanFilterReject(&app->connAddress[tableIndex]);
+              rotationForget(&app->connAddress[tableIndex]);
+              closeConnection(connection);
+              break;
+            }
+            // The Battery Level is in a service of its own
+            if (infoPeriodMs != 0
+                && app->batteryServiceHandle[tableIndex] != SERVICE_HANDLE_INVALID) {
+              discoverAllCharacteristics(tableIndex, app->batteryServiceHandle[tableIndex]);
+              app->connProperties[tableIndex].state = discoverBattery;
+              break;
+            }
+            // enable indications, or notifications
+            enableReadings(tableIndex);
+            break;
+
+          // If the Battery service discovery finished, with or without the Battery Level
+          case discoverBattery:
+            enableReadings(tableIndex);
+            break;
+
+          // If indication enable process finished
+          case enableIndication:
+            if (evt->data.evt_gatt_procedure_completed.result == 0) {
+              // Skip discovery next time this server connects
+              gattCacheStore(&app->connAddress[tableIndex],
+                             app->connProperties[tableIndex].thermometerServiceHandle,
+                             app->connProperties[tableIndex].thermometerCharacteristicHandle,
+                             notificationsEnabled ? app->connProperties[tableIndex].delivery : 0,
+                             (infoPeriodMs != 0) ? app->infoHandles[tableIndex] : NULL);
+            }
+            app->connProperties[tableIndex].state = running;
+            superviseReadings(tableIndex);
+            publishSlot(tableIndex);
+            learnSensor(tableIndex);
+            recordLink(tableIndex);
+            readInfo(tableIndex);
+            metricsObserve(metricConnectionSetup, metricsNowUs() - app->openedUs[tableIndex]);
+            break;
+
+          // If indication enable with cached handles finished
+          case enableCachedIndication:
+            if (evt->data.evt_gatt_procedure_completed.result != 0) {
+              // The server's database has changed, fall back to full discovery
+              gattCacheForget(&app->connAddress[tableIndex]);
+              discoverThermometer(tableIndex);
+              break;
+            }
+            app->connProperties[tableIndex].state = running;
+            superviseReadings(tableIndex);
+            publishSlot(tableIndex);
+            learnSensor(tableIndex);
+            recordLink(tableIndex);
+            readInfo(tableIndex);
+            metricsObserve(metricConnectionSetup, metricsNowUs() - app->openedUs[tableIndex]);
+            break;
+
+          default:
+            break;
         }
         break;
 
@@ -287,11 +1404,32 @@ void appHandleEvents(struct gecko_cmd_packet *evt)
       #if _DEBUG
           printf("Connection closed\n");
       #endif
+          connection = evt->data.evt_le_connection_closed.connection;
+          metricsCount(metricConnectionsClosed);
+          // A rotated sensor that closed before its reading is tried again later
+          tableIndex = findIndexByConnectionHandle(connection);
+          if (tableIndex != TABLE_INDEX_INVALID) {
+            rotationDone(&app->connAddress[tableIndex], false);
+            // Held back from reconnecting for a while, the longer the more often its links drop
+            if (supervising()) {
+              supervisionHold(&app->wheel, &app->connAddress[tableIndex],
+                              (uint32_t)((metricsNowUs() - app->openedUs[tableIndex]) / 1000u));
+            }
+          }
           // remove connection from active connections
-          removeConnection(evt->data.evt_le_connection_closed.connection);
+          removeConnection(connection);
+          // a connection attempt that failed is reported with the handle it was given
+          if (app->connState == opening && connection == app->openingConnection) {
+            scanFilterSetConnected(&app->openingAddress, false);
+            rotationDone(&app->openingAddress, false);
+            if (supervising()) {
+              supervisionHold(&app->wheel, &app->openingAddress, 0);
+            }
+            app->openingConnection = CONNECTION_HANDLE_INVALID;
+            app->connState = running;
+          }
           // start scanning again to find new devices
-          gecko_cmd_le_gap_start_discovery(default_phy, le_gap_discover_generic);
-          connState = scanning;
+          updateScanning();
         break;
 
       // This event is generated when a characteristic value was received e.g. an indication
@@ -299,15 +1437,52 @@ void appHandleEvents(struct gecko_cmd_packet *evt)
       #if _DEBUG
           printf("Char value found\n");
       #endif
+        // The server sends nothing more until an indication is confirmed, so confirm it before
+        // anything else, ahead of the commands waiting to be sent
+        if (evt->data.evt_gatt_characteristic_value.att_opcode == gatt_handle_value_indication) {
+          confirmCmd.connection = evt->data.evt_gatt_characteristic_value.connection;
+          cmdQueueSendFirst(gecko_cmd_gatt_send_characteristic_confirmation_id,
+                            &confirmCmd, sizeof(confirmCmd), NULL, NULL);
+        } else if (evt->data.evt_gatt_characteristic_value.att_opcode == gatt_handle_value_notification) {
+          metricsCount(metricNotifications);
+        }
         charValue = &(evt->data.evt_gatt_characteristic_value.value.data[0]);
         tableIndex = findIndexByConnectionHandle(evt->data.evt_gatt_characteristic_value.connection);
-        if (tableIndex != TABLE_INDEX_INVALID) {
-          connProperties[tableIndex].temperature = (charValue[1] << 0) + (charValue[2] << 8) + (charValue[3] << 16);
+        // The values read besides the readings
+        if (evt->data.evt_gatt_characteristic_value.att_opcode == gatt_read_response
+            || evt->data.evt_gatt_characteristic_value.att_opcode == gatt_read_multiple_response) {
+          if (tableIndex != TABLE_INDEX_INVALID) {
+            takeInfo(tableIndex, charValue, evt->data.evt_gatt_characteristic_value.value.len);
+          }
+          break;
+        }
+        // The FLOAT is scaled by its exponent and Fahrenheit converted, NaN and the like dropped
+        if (tableIndex != TABLE_INDEX_INVALID
+            && measurementDecode(charValue, evt->data.evt_gatt_characteristic_value.value.len,
+                                 &app->connProperties[tableIndex].temperature) > 0) {
+          sensorStatsUpdate(&app->connAddress[tableIndex], app->connProperties[tableIndex].temperature);
+          // Hand the reading over to the output thread with the last RSSI sampled
+          outputSinkPush(app->firstSlot + tableIndex,
+                         app->connProperties[tableIndex].serverAddress,
+                         app->connProperties[tableIndex].temperature,
+                         app->connProperties[tableIndex].rssi);
+          // and keep it in the history
+          readingStoreAppend(&app->connAddress[tableIndex],
+                             app->connProperties[tableIndex].temperature,
+                             app->connProperties[tableIndex].rssi);
+          publishSlot(tableIndex);
+          superviseReadings(tableIndex);
+          metricsCount(metricReadings);
+          noteFirstReading();
+          // Time spent in the host since the indication was read
+          if (metricsReadTime() != 0) {
+            metricsObserve(metricReadingDelay, metricsNowUs() - metricsReadTime());
+          }
+          // A rotated sensor has given its reading, make room for the next one
+          if (rotationDone(&app->connAddress[tableIndex], true)) {
+            closeConnection(evt->data.evt_gatt_characteristic_value.connection);
+          }
         }
-        // Send confirmation for the indication
-        gecko_cmd_gatt_send_characteristic_confirmation(evt->data.evt_gatt_characteristic_value.connection);
-        // Trigger RSSI measurement on the connection
-        gecko_cmd_le_connection_get_rssi(evt->data.evt_gatt_characteristic_value.connection);
         break;
 
       // This event is generated when RSSI value was measured
@@ -317,31 +1492,31 @@ void appHandleEvents(struct gecko_cmd_packet *evt)
       #endif
         tableIndex = findIndexByConnectionHandle(evt->data.evt_le_connection_rssi.connection);
         if (tableIndex != TABLE_INDEX_INVALID) {
-          connProperties[tableIndex].rssi = evt->data.evt_le_connection_rssi.rssi;
-        }
-        //print results
-        if (true == printHeader) {
-          printHeader = false;
-          printf("ADDR  TEMP   RSSI |ADDR  TEMP   RSSI |ADDR  TEMP   RSSI |ADDR  TEMP   RSSI |\r\n");
+          // Goes out with the next reading
+          app->connProperties[tableIndex].rssi = evt->data.evt_le_connection_rssi.rssi;
+          publishSlot(tableIndex);
+          applyLinkPolicy(tableIndex);
         }
-        for (i = 0u; i < MAX_CONNECTIONS; i++) {
-          if ((TEMP_INVALID != connProperties[i].temperature) && (RSSI_INVALID != connProperties[i].rssi) ) {
-            printf("%04x ", connProperties[i].serverAddress);
-            printf("%2lu.%02lu",
-                   (long unsigned int)(connProperties[i].temperature / 1000),
-                   (long unsigned int)((connProperties[i].temperature / 10) % 100));
-            printf("C ");
-            printf("% 3d", connProperties[i].rssi);
-            printf("dBm|");
-          } else {
-            printf("---- ------ ------|");
+        break;
+
+      // This event is generated when the PHY of a connection changes, or a change asked for is
+      // over
+      case gecko_evt_le_connection_phy_status_id:
+        tableIndex = findIndexByConnectionHandle(evt->data.evt_le_connection_phy_status.connection);
+        if (tableIndex != TABLE_INDEX_INVALID) {
+          if (evt->data.evt_le_connection_phy_status.phy != app->linkPolicy[tableIndex].phy) {
+            metricsCount(metricPhyUpdates);
           }
+          linkPolicyStatus(&app->linkPolicy[tableIndex], evt->data.evt_le_connection_phy_status.phy);
         }
-        printf("\r");
-        fflush(stdout); //flush output buffer
         break;
 
     default:
       break;
   }
+  // Sample RSSI between readings rather than after each of them
+  sampleRssi();
+  sampleInfo();
+  rotate();
+  supervise();
 }
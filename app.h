@@ -33,6 +33,8 @@ extern "C" {
  #define CONN_INTERVAL_MAX             80   //100ms
  #define CONN_SLAVE_LATENCY            0    //no latency
  #define CONN_TIMEOUT                  100  //1000ms
+ // connection interval while rotating through the sensors
+ #define ROTATION_CONN_INTERVAL        12   //15ms
 
  #define SCAN_INTERVAL                 16   //10ms
  #define SCAN_WINDOW                   16   //10ms
@@ -44,13 +46,59 @@ extern "C" {
  #define SERVICE_HANDLE_INVALID        (uint32_t)0xFFFFFFFFu
  #define CHARACTERISTIC_HANDLE_INVALID (uint16_t)0xFFFFu
  #define TABLE_INDEX_INVALID           (uint8_t)0xFFu
+ // Characteristic property bit of the characteristics that can notify
+ #define GATT_PROPERTY_NOTIFY          0x10
+ // Values of a sensor not read yet, see SensorInfo
+ #define TEMP_TYPE_INVALID             (uint8_t)0xFFu
+ #define BATTERY_LEVEL_INVALID         (uint8_t)0xFFu
+ #define MEASUREMENT_INTERVAL_INVALID  (uint16_t)0xFFFFu
+
+ // Readings are thousandths of a degree Celsius, two's complement below zero. Printed with
+ // "%s%lu.%02lu" from these three.
+ #define TEMP_SIGN(t)                  (((int32_t)(t) < 0) ? "-" : "")
+ #define TEMP_MAGNITUDE(t)             (((int32_t)(t) < 0) ? 0u - (uint32_t)(t) : (uint32_t)(t))
+ #define TEMP_DEGREES(t)               ((long unsigned int)(TEMP_MAGNITUDE(t) / 1000))
+ #define TEMP_HUNDREDTHS(t)            ((long unsigned int)((TEMP_MAGNITUDE(t) / 10) % 100))
 
  #define EXT_SIGNAL_PRINT_RESULTS      0x01
 
+ // Time between RSSI samples of one sensor, in ms, changed with appSetRssiPeriod()
+ #ifndef RSSI_DEFAULT_PERIOD_MS
+ #define RSSI_DEFAULT_PERIOD_MS        5000
+ #endif
+ // Shortest time appNextTickMs() asks to wait, work due sooner waits for it, in ms
+ #define APP_TICK_MIN_MS               10
+ // appNextTickMs() while nothing is due on the host clock
+ #define APP_TICK_IDLE                 UINT32_MAX
+
 #ifndef MAX_CONNECTIONS
 #define MAX_CONNECTIONS               4
 #endif
 
+// Slots are addressed with 8-bit indexes, TABLE_INDEX_INVALID is reserved
+#if MAX_CONNECTIONS >= 255
+#error "MAX_CONNECTIONS must be less than 255"
+#endif
+
+// Number of NCPs one client can drive, each with a table of MAX_CONNECTIONS
+#ifndef MAX_NCPS
+#if MAX_CONNECTIONS <= 63
+#define MAX_NCPS                      4
+#else
+#define MAX_NCPS                      (254 / MAX_CONNECTIONS)
+#endif
+#endif
+
+// Results table slots of all NCPs share the 8-bit index space
+#if MAX_NCPS * MAX_CONNECTIONS >= 255
+#error "MAX_NCPS * MAX_CONNECTIONS must be less than 255"
+#endif
+
+// Number of sensors printed side by side on one line of the results table
+#ifndef TABLE_COLUMNS
+#define TABLE_COLUMNS                 4
+#endif
+
 #define USE_CODED_PHY 0     //1 to use coded phy, 0 to use 1mbps PHY
 
 #if USE_CODED_PHY == 1
@@ -78,28 +126,117 @@ extern "C" {
    discoverServices,
    discoverCharacteristics,
    enableIndication,
-   running
+   enableCachedIndication,
+   running,
+   broadcasting,              // read from its advertisements, never connected
+   discoverBattery            // looking for the Battery Level once the thermometer is found
  } ConnState;
 
+ // Fields touched on every reading come first, so a slot is 16 bytes and
+ // four of them share a cache line
  typedef struct {
    uint8_t  connectionHandle;
    int8_t   rssi;
-   uint16_t serverAddress;
-   uint32_t thermometerServiceHandle;
    uint16_t thermometerCharacteristicHandle;
    uint32_t temperature;
+   uint16_t serverAddress;
+   uint8_t  state;            // ConnState of this connection's setup
+   uint8_t  delivery;         // gatt_indication or gatt_notification, how the readings come
+   uint32_t thermometerServiceHandle;
  } ConnProperties;
 
+ // Values read now and then besides the readings, with one Read Multiple request, in the order
+ // they are read
+ typedef enum {
+   infoTemperatureType,
+   infoMeasurementInterval,
+   infoBatteryLevel,
+   infoCount
+ } InfoValue;
+
+ typedef struct {
+   uint8_t  temperatureType;      // Temperature Type, where the sensor measures
+   uint8_t  batteryLevel;         // percent
+   uint16_t measurementInterval;  // s between measurements, 0 if the sensor does not measure
+                                  // periodically
+ } SensorInfo;
+
 /***************************************************************************************************
  * Function Declarations
  **************************************************************************************************/
 
+struct gecko_cmd_packet;
+
 /***********************************************************************************************//**
  *  \brief  Handle application events.
  *  \param[in]  evt  incoming event ID
  **************************************************************************************************/
 void appHandleEvents(struct gecko_cmd_packet *evt);
 
+/***********************************************************************************************//**
+ *  \brief  Pick the NCP whose events are handled next. Each NCP has a connection table of its
+ *          own and MAX_CONNECTIONS results table slots starting at ncp * MAX_CONNECTIONS.
+ *  \param[in]  ncp  NCP index, less than MAX_NCPS
+ **************************************************************************************************/
+void appSelectNcp(uint8_t ncp);
+
+/***********************************************************************************************//**
+ *  \brief  Check whether the selected NCP has reported boot since start-up.
+ *  \return  true once gecko_evt_system_boot_id has been handled
+ **************************************************************************************************/
+bool appIsBooted(void);
+
+/***********************************************************************************************//**
+ *  \brief  Bring up the selected NCP. A cold start resets it and waits for it to boot. A warm
+ *          start asks it with system_hello whether it is already up, and if so takes it over
+ *          as it is: the connections recorded in the link state are adopted, with their GATT
+ *          handles from the cache, and are checked to still be open. If it does not answer, the
+ *          caller resets it as on a cold start once appIsBooted() has stayed false for longer
+ *          than a command waits for its response. The time to the first reading is printed to
+ *          stderr.
+ *  \param[in]  warm  true for a warm start
+ **************************************************************************************************/
+void appStart(bool warm);
+
+/***********************************************************************************************//**
+ *  \brief  Take the readings as notifications from the sensors that allow them: from the
+ *          Intermediate Temperature characteristic if it notifies, else from the Temperature
+ *          Measurement if it does. The other sensors keep indications. Applies to the
+ *          connections set up from now on.
+ *  \param[in]  enabled  true to prefer notifications
+ **************************************************************************************************/
+void appSetNotifications(bool enabled);
+
+/***********************************************************************************************//**
+ *  \brief  Set how often the Temperature Type, Measurement Interval and Battery Level of each
+ *          sensor are read, all of them with one Read Multiple request. Discovery then looks at
+ *          every service and characteristic of the sensor, so the handles are found in one pass.
+ *          Applies to the connections set up from now on.
+ *  \param[in]  periodMs  time between reads of one sensor in ms, 0 to never read them
+ **************************************************************************************************/
+void appSetInfoPeriod(uint32_t periodMs);
+
+/***********************************************************************************************//**
+ *  \brief  Set how often the RSSI of each sensor is sampled. Samples are spread evenly over the
+ *          connections, one get_rssi command at a time.
+ *  \param[in]  periodMs  time between samples of one sensor in ms, 0 to never sample
+ **************************************************************************************************/
+void appSetRssiPeriod(uint32_t periodMs);
+
+/***********************************************************************************************//**
+ *  \brief  Issue the work due on the host clock, e.g. RSSI samples. appHandleEvents() does this
+ *          too, call it once appNextTickMs() has passed with no events.
+ **************************************************************************************************/
+void appTick(void);
+
+/***********************************************************************************************//**
+ *  \brief  Time until appTick() has work to do for the selected NCP: the next RSSI sample or
+ *          read, rotation step, scanner change, supervision deadline or command timeout. Handling
+ *          events may bring it forward, ask again after each batch.
+ *  \return  ms to wait, at least APP_TICK_MIN_MS, APP_TICK_IDLE if nothing is due
+ **************************************************************************************************/
+uint32_t appNextTickMs(void);
+
 /** @} (end addtogroup app) */
 /** @} (end addtogroup Application) */
 
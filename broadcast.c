@@ -0,0 +1,163 @@
+/***************************************************************************//**
+ * @file
+ * @brief Readings broadcast by thermometers in their advertising data
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2018 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+/* standard library headers */
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <time.h>
+
+/* Own header */
+#include "broadcast.h"
+#include "measurement.h"
+#include "scan_filter.h"
+
+#if (BROADCAST_MAX_SENSORS & (BROADCAST_MAX_SENSORS - 1)) != 0 || BROADCAST_MAX_SENSORS > 32768
+#error "BROADCAST_MAX_SENSORS must be a power of two, at most 32768"
+#endif
+
+// The address index is kept at most half full
+#define INDEX_SIZE                    (2 * BROADCAST_MAX_SENSORS)
+
+typedef struct {
+  uint64_t lastMs;
+  uint32_t temperature;
+  uint32_t readings;
+  uint32_t repeats;
+  int16_t  sequence;
+  bd_addr  address;
+} Sensor;
+
+static Sensor sensors[BROADCAST_MAX_SENSORS];
+static uint16_t sensorCount = 0;
+// Sensor index + 1 of each address, open addressed, 0 for a free entry
+static uint16_t byAddress[INDEX_SIZE];
+static bool connectionless = false;
+
+static uint64_t clockMs(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000u + (uint64_t)ts.tv_nsec / 1000000u;
+}
+
+// Index entry of an address, its own or the free one it would take
+static uint16_t *indexEntry(const bd_addr *address)
+{
+  uint64_t key = 0;
+  uint32_t i;
+
+  memcpy(&key, address->addr, sizeof(address->addr));
+  i = (uint32_t)((key * 0x9e3779b97f4a7c15ull) >> 48) & (INDEX_SIZE - 1);
+  while (byAddress[i] != 0
+         && memcmp(&sensors[byAddress[i] - 1].address, address, sizeof(*address)) != 0) {
+    i = (i + 1) & (INDEX_SIZE - 1);
+  }
+  return &byAddress[i];
+}
+
+/***************************************************************************************************
+ * Public Function Definitions
+ **************************************************************************************************/
+
+void broadcastSetEnabled(bool enabled)
+{
+  connectionless = enabled;
+}
+
+bool broadcastEnabled(void)
+{
+  return connectionless;
+}
+
+bool broadcastDecode(const uint8_t *data, uint8_t len, uint32_t *temperature, int16_t *sequence)
+{
+  int end = measurementDecode(data, len, temperature);
+
+  if (end < 0) {
+    return false;
+  }
+  *sequence = (len > end) ? data[end] : -1;
+  return true;
+}
+
+uint16_t broadcastAccept(const bd_addr *address, const uint8_t *data, uint8_t len,
+                         uint32_t *temperature)
+{
+  const uint8_t *serviceData;
+  uint16_t *entry;
+  Sensor *sensor;
+  uint64_t nowMs;
+  uint8_t serviceLen;
+  int16_t sequence;
+
+  serviceData = scanFilterServiceData(data, len, SCAN_FILTER_SERVICE_UUID, &serviceLen);
+  if (serviceData == NULL || !broadcastDecode(serviceData, serviceLen, temperature, &sequence)) {
+    return BROADCAST_INDEX_NONE;
+  }
+  nowMs = clockMs();
+  entry = indexEntry(address);
+  if (*entry == 0) {
+    if (sensorCount == BROADCAST_MAX_SENSORS) {
+      return BROADCAST_INDEX_NONE;
+    }
+    sensor = &sensors[sensorCount];
+    memset(sensor, 0, sizeof(*sensor));
+    sensor->address = *address;
+    *entry = (uint16_t)(++sensorCount);
+  } else {
+    sensor = &sensors[*entry - 1];
+    // An advertisement is sent on every channel and heard by every NCP, each copy but the
+    // first is a repeat. Without a sequence number only a change of value tells readings apart.
+    if (sequence >= 0 ? sequence == sensor->sequence
+        : (sensor->sequence < 0 && *temperature == sensor->temperature
+           && nowMs - sensor->lastMs < BROADCAST_REPEAT_MS)) {
+      sensor->repeats++;
+      return BROADCAST_INDEX_NONE;
+    }
+  }
+  sensor->sequence = sequence;
+  sensor->temperature = *temperature;
+  sensor->lastMs = nowMs;
+  sensor->readings++;
+  return (uint16_t)(*entry - 1);
+}
+
+void broadcastReport(FILE *out)
+{
+  const Sensor *sensor;
+  uint32_t readings = 0;
+  uint32_t repeats = 0;
+  uint16_t i;
+
+  if (!connectionless) {
+    return;
+  }
+  fprintf(out, "address readings repeats\n");
+  for (i = 0; i < sensorCount; i++) {
+    sensor = &sensors[i];
+    readings += sensor->readings;
+    repeats += sensor->repeats;
+    fprintf(out, "%02x:%02x:%02x:%02x:%02x:%02x %lu %lu\n",
+            sensor->address.addr[5], sensor->address.addr[4], sensor->address.addr[3],
+            sensor->address.addr[2], sensor->address.addr[1], sensor->address.addr[0],
+            (unsigned long)sensor->readings, (unsigned long)sensor->repeats);
+  }
+  fprintf(out, "broadcast: %u sensors, %lu readings, %lu repeated advertisements dropped\n",
+          (unsigned)sensorCount, (unsigned long)readings, (unsigned long)repeats);
+}
@@ -0,0 +1,103 @@
+/***************************************************************************//**
+ * @file
+ * @brief Readings broadcast by thermometers in their advertising data
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2018 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+#ifndef BROADCAST_H
+#define BROADCAST_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "bg_types.h"
+
+/***********************************************************************************************//**
+ * \defgroup broadcast Broadcast
+ * \brief Connectionless mode: thermometers that put a Temperature Measurement in the Health
+ *        Thermometer service data of their advertisements are read without connecting. The
+ *        same advertisement is heard many times, and by every NCP, so readings are told apart by
+ *        address and sequence number. The sensors are shared by all NCPs.
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ * @addtogroup broadcast
+ * @{
+ **************************************************************************************************/
+
+ // Sensors the broadcast table can hold, a power of two
+ #define BROADCAST_MAX_SENSORS         1024
+ // Returned for advertisements that carry no new reading
+ #define BROADCAST_INDEX_NONE          0xFFFFu
+ // A sensor without a sequence number that repeats its value is read again after this, in ms
+ #define BROADCAST_REPEAT_MS           10000
+
+/***************************************************************************************************
+ * Function Declarations
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  Turn connectionless mode on or off.
+ *  \param[in]  enabled  true to take readings from advertisements and never connect
+ **************************************************************************************************/
+void broadcastSetEnabled(bool enabled);
+
+/***********************************************************************************************//**
+ *  \brief  Check whether connectionless mode is on.
+ *  \return  true if readings are taken from advertisements
+ **************************************************************************************************/
+bool broadcastEnabled(void);
+
+/***********************************************************************************************//**
+ *  \brief  Decode the Health Thermometer service data of an advertisement: a Temperature
+ *          Measurement, flags then an IEEE-11073 FLOAT and the optional fields the flags call
+ *          for, followed by an optional sequence number byte.
+ *  \param[in]  data  service data, after the UUID
+ *  \param[in]  len  length of the service data
+ *  \param[out]  temperature  reading in thousandths of a degree Celsius
+ *  \param[out]  sequence  sequence number, -1 if there is none
+ *  \return  true if the data holds a valid reading
+ **************************************************************************************************/
+bool broadcastDecode(const uint8_t *data, uint8_t len, uint32_t *temperature, int16_t *sequence);
+
+/***********************************************************************************************//**
+ *  \brief  Take the reading an advertisement carries, unless it has been taken already.
+ *  \param[in]  address  advertiser address
+ *  \param[in]  data  advertising data
+ *  \param[in]  len  length of the data
+ *  \param[out]  temperature  reading in thousandths of a degree Celsius
+ *  \return  index of the sensor, in the order they were first heard, or BROADCAST_INDEX_NONE if
+ *           there is no new reading
+ **************************************************************************************************/
+uint16_t broadcastAccept(const bd_addr *address, const uint8_t *data, uint8_t len,
+                         uint32_t *temperature);
+
+/***********************************************************************************************//**
+ *  \brief  Print the readings and repeats heard from every sensor.
+ *  \param[in]  out  stream to print to
+ **************************************************************************************************/
+void broadcastReport(FILE *out);
+
+/** @} (end addtogroup broadcast) */
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* BROADCAST_H */
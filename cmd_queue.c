@@ -0,0 +1,386 @@
+/***************************************************************************//**
+ * @file
+ * @brief Pipelined BGAPI command queue
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2018 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+/* standard library headers */
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+
+/* BG stack headers */
+#include "bg_types.h"
+#include "gecko_bglib.h"
+
+/* Own header */
+#include "cmd_queue.h"
+#include "app.h"
+#include "flight_recorder.h"
+#include "metrics.h"
+
+#if (CMD_QUEUE_SIZE & (CMD_QUEUE_SIZE - 1)) != 0 || CMD_QUEUE_SIZE > 65536
+#error "CMD_QUEUE_SIZE must be a power of two, at most 65536"
+#endif
+
+typedef struct {
+  uint32_t header;
+  uint8_t  params[CMD_QUEUE_MAX_PARAMS];
+  CmdQueueCallback callback;
+  void     *context;
+  uint64_t sentUs;
+} Command;
+
+// A command failed by its timeout, its response is still owed by the NCP
+typedef struct {
+  uint32_t id;
+  uint64_t failedUs;
+} Stale;
+
+// Commands of one NCP in a ring: [head, sent) are in flight, [sent, tail) wait to be sent.
+// The indexes run freely and are masked on access. The timed out commands are in another ring
+// from staleHead, oldest first, as their responses come before those of the commands in flight.
+typedef struct {
+  Command  commands[CMD_QUEUE_SIZE];
+  uint16_t head;
+  uint16_t sent;
+  uint16_t tail;
+  Stale    stale[CMD_QUEUE_MAX_STALE];
+  uint8_t  staleHead;
+  uint8_t  staleCount;
+} Queue;
+
+static Queue queues[MAX_NCPS];
+// Queue of the NCP selected for BGAPI communication
+static Queue *queue = &queues[0];
+static uint8_t depth = CMD_QUEUE_DEFAULT_DEPTH;
+static CmdQueueStats stats;
+// Message read with the BGLIB input functions, an event is handed out from here
+static struct gecko_cmd_packet message;
+// Response given to the callback of a command that got none, only the header and result are set
+static struct gecko_cmd_packet lostResponse;
+static struct gecko_cmd_packet *readAvailable(void);
+static CmdQueueReader reader = readAvailable;
+
+static uint64_t clockUs(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
+
+static Command *at(uint16_t index)
+{
+  return &queue->commands[index & (CMD_QUEUE_SIZE - 1)];
+}
+
+// Write waiting commands while the pipeline has room
+static void fillPipeline(void)
+{
+  Command *cmd;
+  uint16_t inFlight;
+
+  while (queue->sent != queue->tail && (uint16_t)(queue->sent - queue->head) < depth) {
+    cmd = at(queue->sent++);
+    cmd->sentUs = clockUs();
+    // Header and parameters are contiguous, as BGLIB writes them
+    bglib_output(BGLIB_MSG_HEADER_LEN + BGLIB_MSG_LEN(cmd->header), (uint8_t *)&cmd->header);
+    stats.sent++;
+    inFlight = (uint16_t)(queue->sent - queue->head);
+    if (inFlight > stats.peakInFlight) {
+      stats.peakInFlight = inFlight;
+    }
+  }
+}
+
+// Fail the oldest command in flight, its response is not coming
+static void failHead(void)
+{
+  Command *cmd = at(queue->head++);
+  CmdQueueCallback callback = cmd->callback;
+  void *context = cmd->context;
+
+  stats.lost++;
+  lostResponse.header = BGLIB_MSG_ID(cmd->header) | (2u << 8);
+  lostResponse.data.payload[0] = (uint8_t)(CMD_QUEUE_RESULT_TIMEOUT & 0xff);
+  lostResponse.data.payload[1] = (uint8_t)(CMD_QUEUE_RESULT_TIMEOUT >> 8);
+  fillPipeline();
+  if (callback != NULL) {
+    callback(&lostResponse, context);
+  }
+}
+
+// Remember a timed out command, the oldest is forgotten when there are too many
+static void addStale(uint32_t id, uint64_t nowUs)
+{
+  Stale *stale;
+
+  if (queue->staleCount == CMD_QUEUE_MAX_STALE) {
+    queue->staleHead = (uint8_t)((queue->staleHead + 1) % CMD_QUEUE_MAX_STALE);
+    queue->staleCount--;
+  }
+  stale = &queue->stale[(queue->staleHead + queue->staleCount) % CMD_QUEUE_MAX_STALE];
+  stale->id = id;
+  stale->failedUs = nowUs;
+  queue->staleCount++;
+}
+
+// Whether a response is owed to a timed out command. Responses come in order, so the timed out
+// commands before the one it answers lost theirs, as did those that have waited too long.
+static bool takeStale(uint32_t id)
+{
+  uint64_t nowUs = clockUs();
+  Stale *stale;
+
+  while (queue->staleCount > 0) {
+    stale = &queue->stale[queue->staleHead];
+    queue->staleHead = (uint8_t)((queue->staleHead + 1) % CMD_QUEUE_MAX_STALE);
+    queue->staleCount--;
+    if (stale->id == id && stale->failedUs + (uint64_t)CMD_QUEUE_TIMEOUT_MS * 1000u > nowUs) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Complete the oldest command in flight with a response
+static void handleResponse(const struct gecko_cmd_packet *rsp)
+{
+  CmdQueueCallback callback;
+  void *context;
+  Command *cmd;
+  uint32_t rttUs;
+  uint16_t i;
+
+  // A late response to a timed out command is due before any to the commands in flight
+  if (queue->staleCount > 0 && takeStale(BGLIB_MSG_ID(rsp->header))) {
+    stats.late++;
+    return;
+  }
+  for (i = queue->head; i != queue->sent; i++) {
+    if (BGLIB_MSG_ID(at(i)->header) == BGLIB_MSG_ID(rsp->header)) {
+      break;
+    }
+  }
+  if (i == queue->sent) {
+    stats.unmatched++;
+    return;
+  }
+  // Responses come in order, the commands this one overtook lost theirs. Their callbacks may
+  // queue more, so the head is matched again after each.
+  while (queue->head != queue->sent
+         && BGLIB_MSG_ID(at(queue->head)->header) != BGLIB_MSG_ID(rsp->header)) {
+    failHead();
+  }
+  if (queue->head == queue->sent) {
+    return;
+  }
+  cmd = at(queue->head++);
+  rttUs = (uint32_t)(clockUs() - cmd->sentUs);
+  stats.completed++;
+  stats.rttTotalUs += rttUs;
+  if (rttUs > stats.rttMaxUs) {
+    stats.rttMaxUs = rttUs;
+  }
+  metricsObserve(metricCommandRtt, rttUs);
+  callback = cmd->callback;
+  context = cmd->context;
+  // Keep the NCP busy before running the callback, which may queue more
+  fillPipeline();
+  if (callback != NULL) {
+    callback(rsp, context);
+  }
+}
+
+// Read one message, header and payload, as BGLIB does
+static int readMessage(void)
+{
+  uint32_t len;
+
+  if (bglib_input(BGLIB_MSG_HEADER_LEN, (uint8_t *)&message.header) < 0) {
+    return -1;
+  }
+  len = BGLIB_MSG_LEN(message.header);
+  if ((message.header & 0x78) != gecko_dev_type_gecko || len > BGLIB_MSG_MAX_PAYLOAD) {
+    return -1;
+  }
+  if (len > 0 && bglib_input(len, message.data.payload) < 0) {
+    return -1;
+  }
+  return 0;
+}
+
+// Default reader, a message once part of it has arrived
+static struct gecko_cmd_packet *readAvailable(void)
+{
+  if (bglib_peek() > 0 && readMessage() == 0) {
+    return &message;
+  }
+  return NULL;
+}
+
+// Copy a message read into the flight recorder, stamped with the time it arrived if known
+static void recordMessage(const struct gecko_cmd_packet *msg)
+{
+  uint64_t readUs = metricsReadTime();
+
+  flightRecorderAdd(flightRecorderFromNcp, msg,
+                    (uint16_t)(BGLIB_MSG_HEADER_LEN + BGLIB_MSG_LEN(msg->header)),
+                    (readUs != 0) ? readUs : metricsNowUs());
+}
+
+static bool isEvent(const struct gecko_cmd_packet *msg)
+{
+  return (msg->header & 0xf8) == (gecko_dev_type_gecko | gecko_msg_type_evt);
+}
+
+// Queue a command at the end of the waiting ones, or ahead of them
+static int queueCommand(uint32_t id, const void *params, uint16_t len,
+                        CmdQueueCallback callback, void *context, bool first)
+{
+  Command *cmd;
+  uint16_t waiting;
+  uint16_t i;
+
+  if (len > CMD_QUEUE_MAX_PARAMS || (uint16_t)(queue->tail - queue->head) == CMD_QUEUE_SIZE) {
+    stats.overflows++;
+    return -1;
+  }
+  i = queue->tail++;
+  // Move the waiting commands back one place, there are few of them unless the NCP is stuck
+  while (first && i != queue->sent) {
+    *at(i) = *at((uint16_t)(i - 1));
+    i--;
+  }
+  cmd = at(i);
+  cmd->header = id | ((uint32_t)(len & 0xff) << 8) | ((len >> 8) & 0x7);
+  memcpy(cmd->params, params, len);
+  cmd->callback = callback;
+  cmd->context = context;
+  fillPipeline();
+  waiting = (uint16_t)(queue->tail - queue->sent);
+  if (waiting > stats.peakWaiting) {
+    stats.peakWaiting = waiting;
+  }
+  return 0;
+}
+
+/***************************************************************************************************
+ * Public Function Definitions
+ **************************************************************************************************/
+
+int cmdQueueSetDepth(uint8_t newDepth)
+{
+  if (newDepth == 0 || newDepth > CMD_QUEUE_MAX_DEPTH) {
+    return -1;
+  }
+  depth = newDepth;
+  return 0;
+}
+
+void cmdQueueSetReader(CmdQueueReader newReader)
+{
+  reader = (newReader != NULL) ? newReader : readAvailable;
+}
+
+void cmdQueueSelect(uint8_t ncp)
+{
+  queue = &queues[ncp];
+}
+
+int cmdQueueSend(uint32_t id, const void *params, uint16_t len,
+                 CmdQueueCallback callback, void *context)
+{
+  return queueCommand(id, params, len, callback, context, false);
+}
+
+int cmdQueueSendFirst(uint32_t id, const void *params, uint16_t len,
+                      CmdQueueCallback callback, void *context)
+{
+  return queueCommand(id, params, len, callback, context, true);
+}
+
+void cmdQueueReset(void)
+{
+  queue->head = queue->sent = queue->tail;
+  queue->staleCount = 0;
+}
+
+void cmdQueueExpire(void)
+{
+  uint64_t nowUs = clockUs();
+
+  // Commands are answered in order, so only the oldest one can be the first to time out. The ones
+  // sent in place of a failed one are sent after nowUs and wait their full time.
+  while (queue->head != queue->sent
+         && at(queue->head)->sentUs + (uint64_t)CMD_QUEUE_TIMEOUT_MS * 1000u <= nowUs) {
+    addStale(BGLIB_MSG_ID(at(queue->head)->header), nowUs);
+    failHead();
+  }
+}
+
+uint32_t cmdQueueNextTimeoutMs(void)
+{
+  uint64_t elapsedUs;
+
+  if (queue->head == queue->sent) {
+    return CMD_QUEUE_IDLE;
+  }
+  elapsedUs = clockUs() - at(queue->head)->sentUs;
+  if (elapsedUs >= (uint64_t)CMD_QUEUE_TIMEOUT_MS * 1000u) {
+    return 0;
+  }
+  // Rounded up, so the command has timed out once the wait is over
+  return (uint32_t)(((uint64_t)CMD_QUEUE_TIMEOUT_MS * 1000u - elapsedUs + 999u) / 1000u);
+}
+
+struct gecko_cmd_packet *cmdQueuePeekEvent(void)
+{
+  struct gecko_cmd_packet *msg;
+
+  while ((msg = reader()) != NULL) {
+    recordMessage(msg);
+    if (isEvent(msg)) {
+      return msg;
+    }
+    handleResponse(msg);
+  }
+  return NULL;
+}
+
+struct gecko_cmd_packet *cmdQueueWaitEvent(void)
+{
+  while (readMessage() == 0) {
+    recordMessage(&message);
+    if (isEvent(&message)) {
+      return &message;
+    }
+    handleResponse(&message);
+  }
+  return NULL;
+}
+
+void cmdQueueGetStats(CmdQueueStats *out)
+{
+  uint8_t i;
+
+  *out = stats;
+  out->inFlight = 0;
+  out->waiting = 0;
+  for (i = 0; i < MAX_NCPS; i++) {
+    out->inFlight += (uint16_t)(queues[i].sent - queues[i].head);
+    out->waiting += (uint16_t)(queues[i].tail - queues[i].sent);
+  }
+}
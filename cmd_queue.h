@@ -0,0 +1,203 @@
+/***************************************************************************//**
+ * @file
+ * @brief Pipelined BGAPI command queue
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2018 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+#ifndef CMD_QUEUE_H
+#define CMD_QUEUE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/***********************************************************************************************//**
+ * \defgroup cmd_queue Command Queue
+ * \brief BGAPI commands sent without waiting for their responses. Up to a configurable number
+ *        of commands are in flight on each NCP, the rest wait on the host in order. Responses
+ *        are matched to commands in the order they were sent and passed to completion
+ *        callbacks, while events keep being returned to the application. A command whose
+ *        response never comes is failed through its callback, so the pipeline moves on.
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ * @addtogroup cmd_queue
+ * @{
+ **************************************************************************************************/
+
+ // Commands in flight on one NCP unless changed with cmdQueueSetDepth(). How many commands an
+ // NCP can take before answering depends on the receive buffer of its firmware, which has not
+ // been measured on hardware, and ncp-sim takes any number. One at a time is what the
+ // blocking gecko_cmd_ functions rely on.
+ #ifndef CMD_QUEUE_DEFAULT_DEPTH
+ #define CMD_QUEUE_DEFAULT_DEPTH       1
+ #endif
+ #define CMD_QUEUE_MAX_DEPTH           16
+ // Commands held for one NCP, in flight or waiting, a power of two
+ #ifndef CMD_QUEUE_SIZE
+ #define CMD_QUEUE_SIZE                256
+ #endif
+ // Longest command parameters the queue can hold
+ #define CMD_QUEUE_MAX_PARAMS          32
+ // How long a command in flight waits for its response before it is failed, in ms
+ #ifndef CMD_QUEUE_TIMEOUT_MS
+ #define CMD_QUEUE_TIMEOUT_MS          2000
+ #endif
+ // Timed out commands of one NCP whose responses may still come, and be told from those of
+ // the commands sent after them
+ #define CMD_QUEUE_MAX_STALE           16
+ // Result a failed command's callback gets in its response, bg_err_timeout
+ #define CMD_QUEUE_RESULT_TIMEOUT      0x0185
+ // Returned by cmdQueueNextTimeoutMs() with no command in flight
+ #define CMD_QUEUE_IDLE                UINT32_MAX
+
+/***************************************************************************************************
+ * Type Definitions
+ **************************************************************************************************/
+
+struct gecko_cmd_packet;
+
+/***********************************************************************************************//**
+ *  \brief  Called with the response of a queued command, with the same NCP selected as when it
+ *          was queued. The response is only valid during the call. A command whose response was
+ *          lost gets one with only the result set, to CMD_QUEUE_RESULT_TIMEOUT.
+ *  \param[in]  rsp  response message, its data holds the rsp_ structure of the command
+ *  \param[in]  context  context given to cmdQueueSend()
+ **************************************************************************************************/
+typedef void (*CmdQueueCallback)(const struct gecko_cmd_packet *rsp, void *context);
+
+/***********************************************************************************************//**
+ *  \brief  Source of messages from the selected NCP, see cmdQueueSetReader().
+ *  \return  the next complete message, or NULL if none has arrived
+ **************************************************************************************************/
+typedef struct gecko_cmd_packet *(*CmdQueueReader)(void);
+
+// Counters of all NCPs since start-up, and the current depths
+typedef struct {
+  uint64_t sent;              // commands written to an NCP
+  uint64_t completed;         // responses matched to a command
+  uint64_t unmatched;         // responses matching no command in flight, dropped
+  uint64_t lost;              // commands failed because their response was skipped or late
+  uint64_t late;              // responses of commands that had timed out, dropped
+  uint64_t overflows;         // commands dropped because the queue was full
+  uint32_t inFlight;          // commands waiting for their response now
+  uint32_t waiting;           // commands waiting to be sent now
+  uint32_t peakInFlight;
+  uint32_t peakWaiting;
+  uint64_t rttTotalUs;        // time from sending a command to its response, summed
+  uint32_t rttMaxUs;
+} CmdQueueStats;
+
+/***************************************************************************************************
+ * Function Declarations
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  Set how many commands may be in flight on each NCP. 1 sends a command only once the
+ *          previous one has been answered, as the blocking gecko_cmd_ functions do.
+ *  \param[in]  depth  commands in flight, 1 to CMD_QUEUE_MAX_DEPTH
+ *  \return  0 on success, -1 if out of range
+ **************************************************************************************************/
+int cmdQueueSetDepth(uint8_t depth);
+
+/***********************************************************************************************//**
+ *  \brief  Take the messages for cmdQueuePeekEvent() from a transport that frames them itself,
+ *          instead of reading them with the BGLIB input functions.
+ *  \param[in]  reader  message source, NULL for the BGLIB input functions
+ **************************************************************************************************/
+void cmdQueueSetReader(CmdQueueReader reader);
+
+/***********************************************************************************************//**
+ *  \brief  Direct commands and responses to the queue of another NCP. The BGLIB I/O functions
+ *          must be directed to the same NCP.
+ *  \param[in]  ncp  NCP index, less than MAX_NCPS
+ **************************************************************************************************/
+void cmdQueueSelect(uint8_t ncp);
+
+/***********************************************************************************************//**
+ *  \brief  Queue a command to the selected NCP, sent right away if the pipeline has room.
+ *  \param[in]  id  command ID, gecko_cmd_..._id
+ *  \param[in]  params  command parameters as sent on the wire, e.g. the gecko_msg_..._cmd_t
+ *  \param[in]  len  length of the parameters, at most CMD_QUEUE_MAX_PARAMS
+ *  \param[in]  callback  called with the response, NULL if it is of no interest
+ *  \param[in]  context  passed to the callback
+ *  \return  0 on success, -1 if the parameters are too long or the queue is full
+ **************************************************************************************************/
+int cmdQueueSend(uint32_t id, const void *params, uint16_t len,
+                 CmdQueueCallback callback, void *context);
+
+/***********************************************************************************************//**
+ *  \brief  Same as cmdQueueSend(), but the command goes ahead of the ones waiting to be sent, e.g.
+ *          the confirmation of an indication, which holds up the server's next one.
+ *  \param[in]  id  command ID, gecko_cmd_..._id
+ *  \param[in]  params  command parameters as sent on the wire
+ *  \param[in]  len  length of the parameters, at most CMD_QUEUE_MAX_PARAMS
+ *  \param[in]  callback  called with the response, NULL if it is of no interest
+ *  \param[in]  context  passed to the callback
+ *  \return  0 on success, -1 if the parameters are too long or the queue is full
+ **************************************************************************************************/
+int cmdQueueSendFirst(uint32_t id, const void *params, uint16_t len,
+                      CmdQueueCallback callback, void *context);
+
+/***********************************************************************************************//**
+ *  \brief  Forget the commands of the selected NCP without calling their callbacks, e.g. once it
+ *          has booted again and will not answer the ones sent before.
+ **************************************************************************************************/
+void cmdQueueReset(void);
+
+/***********************************************************************************************//**
+ *  \brief  Fail the commands in flight on the selected NCP that have waited CMD_QUEUE_TIMEOUT_MS
+ *          for their response, and send the ones waiting in their place. A response that comes
+ *          for a failed command within another CMD_QUEUE_TIMEOUT_MS is dropped, rather than
+ *          taken for that of a later command with the same message ID.
+ **************************************************************************************************/
+void cmdQueueExpire(void);
+
+/***********************************************************************************************//**
+ *  \brief  Time until cmdQueueExpire() has a command of the selected NCP to fail.
+ *  \return  time in ms, 0 if one is due, CMD_QUEUE_IDLE if no command is in flight
+ **************************************************************************************************/
+uint32_t cmdQueueNextTimeoutMs(void);
+
+/***********************************************************************************************//**
+ *  \brief  Take the messages the selected NCP has sent so far, passing responses to their
+ *          callbacks, until an event is found. With the BGLIB input functions, reads block once
+ *          part of a message is in.
+ *  \return  the event, valid until the next call, or NULL if none has arrived
+ **************************************************************************************************/
+struct gecko_cmd_packet *cmdQueuePeekEvent(void);
+
+/***********************************************************************************************//**
+ *  \brief  Same as cmdQueuePeekEvent() with the BGLIB input functions, but wait for an event to
+ *          arrive.
+ *  \return  the event, valid until the next call, or NULL on a read failure
+ **************************************************************************************************/
+struct gecko_cmd_packet *cmdQueueWaitEvent(void);
+
+/***********************************************************************************************//**
+ *  \brief  Get the queue statistics of all NCPs.
+ *  \param[out]  stats  statistics
+ **************************************************************************************************/
+void cmdQueueGetStats(CmdQueueStats *stats);
+
+/** @} (end addtogroup cmd_queue) */
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* CMD_QUEUE_H */
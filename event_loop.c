@@ -0,0 +1,291 @@
+/***************************************************************************//**
+ * @file
+ * @brief epoll based event loop with periodic timers and signal handling
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2018 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+#if defined(__linux__)
+
+/* standard library headers */
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+
+/* Own header */
+#include "event_loop.h"
+
+typedef struct {
+  int               fd;
+  bool              timer;
+  EventLoopCallback callback;
+  void              *context;
+} EventSource;
+
+typedef struct {
+  int               sig;
+  EventLoopCallback callback;
+  void              *context;
+} SignalSource;
+
+static int epollFd = -1;
+static int signalFd = -1;
+static sigset_t signalMask;
+static EventSource sources[EVENT_LOOP_MAX_SOURCES];
+static uint8_t sourceCount;
+static SignalSource signalSources[EVENT_LOOP_MAX_SIGNALS];
+static uint8_t signalCount;
+static bool stopRequested;
+
+// Registers a descriptor in a removed one's slot or a new one, returns its index in sources
+static int addSource(int fd, bool timer, EventLoopCallback callback, void *context)
+{
+  struct epoll_event ev;
+  EventSource *source;
+  int index;
+
+  for (index = 0; index < sourceCount && sources[index].fd >= 0; index++) {
+  }
+  if (index >= EVENT_LOOP_MAX_SOURCES) {
+    return -1;
+  }
+  source = &sources[index];
+  source->fd = fd;
+  source->timer = timer;
+  source->callback = callback;
+  source->context = context;
+  ev.events = EPOLLIN;
+  ev.data.ptr = source;
+  if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+    source->fd = -1;
+    return -1;
+  }
+  if (index == sourceCount) {
+    sourceCount++;
+  }
+  return index;
+}
+
+// Source of a descriptor added with eventLoopAddFd()
+static EventSource *fdSource(int fd)
+{
+  int i;
+
+  for (i = 0; i < sourceCount; i++) {
+    if (sources[i].fd == fd && fd >= 0 && !sources[i].timer) {
+      return &sources[i];
+    }
+  }
+  return NULL;
+}
+
+static int armTimer(int fd, uint32_t periodMs)
+{
+  struct itimerspec spec;
+
+  spec.it_interval.tv_sec = periodMs / 1000;
+  spec.it_interval.tv_nsec = (long)(periodMs % 1000) * 1000000L;
+  spec.it_value = spec.it_interval;
+  return timerfd_settime(fd, 0, &spec, NULL);
+}
+
+static EventSource *timerSource(int timer)
+{
+  if (timer < 0 || timer >= sourceCount || !sources[timer].timer) {
+    return NULL;
+  }
+  return &sources[timer];
+}
+
+// Run the callback of a registered signal, false for one that ends the loop
+static bool dispatchSignal(int sig)
+{
+  uint8_t i;
+
+  for (i = 0; i < signalCount; i++) {
+    if (signalSources[i].sig == sig) {
+      signalSources[i].callback(signalSources[i].context);
+      return true;
+    }
+  }
+  return false;
+}
+
+int eventLoopInit(void)
+{
+  struct epoll_event ev;
+  sigset_t mask;
+
+  epollFd = epoll_create1(EPOLL_CLOEXEC);
+  if (epollFd < 0) {
+    return -1;
+  }
+  // Termination signals are read from a descriptor instead of interrupting handlers
+  sigemptyset(&signalMask);
+  sigaddset(&signalMask, SIGINT);
+  sigaddset(&signalMask, SIGTERM);
+  mask = signalMask;
+  if (sigprocmask(SIG_BLOCK, &mask, NULL) < 0) {
+    return -1;
+  }
+  signalFd = signalfd(-1, &mask, SFD_CLOEXEC);
+  if (signalFd < 0) {
+    return -1;
+  }
+  ev.events = EPOLLIN;
+  ev.data.ptr = NULL;
+  return epoll_ctl(epollFd, EPOLL_CTL_ADD, signalFd, &ev);
+}
+
+int eventLoopAddFd(int fd, EventLoopCallback callback, void *context)
+{
+  return (addSource(fd, false, callback, context) < 0) ? -1 : 0;
+}
+
+int eventLoopWatchFd(int fd, bool writable)
+{
+  EventSource *source = fdSource(fd);
+  struct epoll_event ev;
+
+  if (source == NULL) {
+    return -1;
+  }
+  ev.events = writable ? EPOLLOUT : EPOLLIN;
+  ev.data.ptr = source;
+  return epoll_ctl(epollFd, EPOLL_CTL_MOD, fd, &ev);
+}
+
+int eventLoopRemoveFd(int fd)
+{
+  EventSource *source = fdSource(fd);
+
+  if (source == NULL) {
+    return -1;
+  }
+  epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, NULL);
+  // Events already taken for it in this round are skipped
+  source->fd = -1;
+  return 0;
+}
+
+int eventLoopAddTimer(uint32_t periodMs, EventLoopCallback callback, void *context)
+{
+  int fd;
+  int timer;
+
+  fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+  if (fd < 0) {
+    return -1;
+  }
+  if (armTimer(fd, periodMs) < 0 || (timer = addSource(fd, true, callback, context)) < 0) {
+    close(fd);
+    return -1;
+  }
+  return timer;
+}
+
+int eventLoopSetTimer(int timer, uint32_t periodMs)
+{
+  EventSource *source = timerSource(timer);
+
+  return (source != NULL) ? armTimer(source->fd, periodMs) : -1;
+}
+
+int eventLoopSetTimeout(int timer, uint32_t delayMs)
+{
+  EventSource *source = timerSource(timer);
+  struct itimerspec spec;
+
+  if (source == NULL) {
+    return -1;
+  }
+  spec.it_interval.tv_sec = 0;
+  spec.it_interval.tv_nsec = 0;
+  spec.it_value.tv_sec = (delayMs == EVENT_LOOP_NEVER) ? 0 : delayMs / 1000;
+  spec.it_value.tv_nsec = (delayMs == EVENT_LOOP_NEVER) ? 0 : (long)(delayMs % 1000) * 1000000L;
+  // A zero value would stop it, fire right away instead
+  if (delayMs == 0) {
+    spec.it_value.tv_nsec = 1;
+  }
+  return timerfd_settime(source->fd, 0, &spec, NULL);
+}
+
+int eventLoopAddSignal(int sig, EventLoopCallback callback, void *context)
+{
+  sigset_t mask;
+
+  if (signalCount >= EVENT_LOOP_MAX_SIGNALS || sig == SIGINT || sig == SIGTERM) {
+    return -1;
+  }
+  sigaddset(&signalMask, sig);
+  mask = signalMask;
+  if (sigprocmask(SIG_BLOCK, &mask, NULL) < 0 || signalfd(signalFd, &mask, 0) < 0) {
+    return -1;
+  }
+  signalSources[signalCount].sig = sig;
+  signalSources[signalCount].callback = callback;
+  signalSources[signalCount].context = context;
+  signalCount++;
+  return 0;
+}
+
+int eventLoopRun(void)
+{
+  struct epoll_event events[EVENT_LOOP_MAX_SOURCES + 1];
+  struct signalfd_siginfo info;
+  EventSource *source;
+  uint64_t expirations;
+  int count;
+  int i;
+
+  stopRequested = false;
+  while (!stopRequested) {
+    count = epoll_wait(epollFd, events, EVENT_LOOP_MAX_SOURCES + 1, -1);
+    if (count < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    for (i = 0; i < count && !stopRequested; i++) {
+      source = events[i].data.ptr;
+      if (source == NULL) {
+        if (read(signalFd, &info, sizeof(info)) == sizeof(info)
+            && !dispatchSignal((int)info.ssi_signo)) {
+          return (int)info.ssi_signo;
+        }
+        continue;
+      }
+      if (source->fd < 0) {
+        continue; // removed by an earlier callback
+      }
+      if (source->timer && read(source->fd, &expirations, sizeof(expirations)) < 0) {
+        continue; // already consumed
+      }
+      source->callback(source->context);
+    }
+  }
+  return 0;
+}
+
+void eventLoopStop(void)
+{
+  stopRequested = true;
+}
+
+#endif /* __linux__ */
@@ -0,0 +1,141 @@
+/***************************************************************************//**
+ * @file
+ * @brief epoll based event loop with periodic timers and signal handling
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2018 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/***********************************************************************************************//**
+ * \defgroup event_loop Event Loop
+ * \brief Sleeps in epoll_wait until a watched descriptor is readable, a timerfd expires or
+ *        a signal arrives through a signalfd: SIGINT/SIGTERM end the loop, others registered
+ *        with eventLoopAddSignal() are dispatched like descriptors (Linux only)
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ * @addtogroup event_loop
+ * @{
+ **************************************************************************************************/
+
+ // Descriptors and timers that can be registered
+ #define EVENT_LOOP_MAX_SOURCES        16
+ // Signals that can be registered besides SIGINT and SIGTERM
+ #define EVENT_LOOP_MAX_SIGNALS        4
+ // eventLoopSetTimeout() delay that stops the timer
+ #define EVENT_LOOP_NEVER              UINT32_MAX
+
+/***************************************************************************************************
+ * Type Definitions
+ **************************************************************************************************/
+ typedef void (*EventLoopCallback)(void *context);
+
+/***************************************************************************************************
+ * Function Declarations
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  Create the epoll instance and route SIGINT and SIGTERM to it.
+ *  \return  0 on success, -1 on failure
+ **************************************************************************************************/
+int eventLoopInit(void);
+
+/***********************************************************************************************//**
+ *  \brief  Call a function whenever a descriptor becomes readable.
+ *  \param[in]  fd  file descriptor
+ *  \param[in]  callback  function to call, it must consume the pending input
+ *  \param[in]  context  passed to the callback
+ *  \return  0 on success, -1 on failure
+ **************************************************************************************************/
+int eventLoopAddFd(int fd, EventLoopCallback callback, void *context);
+
+/***********************************************************************************************//**
+ *  \brief  Switch a descriptor added with eventLoopAddFd() between waiting for input and waiting
+ *          for room to write. Its callback may still be called once when it has neither.
+ *  \param[in]  fd  file descriptor
+ *  \param[in]  writable  true to call the callback when the descriptor can be written
+ *  \return  0 on success, -1 on failure
+ **************************************************************************************************/
+int eventLoopWatchFd(int fd, bool writable);
+
+/***********************************************************************************************//**
+ *  \brief  Stop watching a descriptor added with eventLoopAddFd(), before it is closed. Its slot
+ *          is taken by the next descriptor added.
+ *  \param[in]  fd  file descriptor
+ *  \return  0 on success, -1 if it is not watched
+ **************************************************************************************************/
+int eventLoopRemoveFd(int fd);
+
+/***********************************************************************************************//**
+ *  \brief  Call a function periodically.
+ *  \param[in]  periodMs  period in milliseconds, 0 to add the timer stopped
+ *  \param[in]  callback  function to call
+ *  \param[in]  context  passed to the callback
+ *  \return  timer id on success, -1 on failure
+ **************************************************************************************************/
+int eventLoopAddTimer(uint32_t periodMs, EventLoopCallback callback, void *context);
+
+/***********************************************************************************************//**
+ *  \brief  Change the period of a timer, restarting it.
+ *  \param[in]  timer  timer id
+ *  \param[in]  periodMs  new period in milliseconds, 0 to stop the timer
+ *  \return  0 on success, -1 on failure
+ **************************************************************************************************/
+int eventLoopSetTimer(int timer, uint32_t periodMs);
+
+/***********************************************************************************************//**
+ *  \brief  Make a timer fire once instead of periodically, restarting it.
+ *  \param[in]  timer  timer id
+ *  \param[in]  delayMs  time from now in milliseconds, EVENT_LOOP_NEVER to stop the timer
+ *  \return  0 on success, -1 on failure
+ **************************************************************************************************/
+int eventLoopSetTimeout(int timer, uint32_t delayMs);
+
+/***********************************************************************************************//**
+ *  \brief  Call a function when a signal arrives, instead of its handler. The signal is blocked
+ *          in the calling thread and the threads it starts from now on, register it before
+ *          starting any that must not take it.
+ *  \param[in]  sig  signal number, other than SIGINT and SIGTERM
+ *  \param[in]  callback  function to call
+ *  \param[in]  context  passed to the callback
+ *  \return  0 on success, -1 on failure
+ **************************************************************************************************/
+int eventLoopAddSignal(int sig, EventLoopCallback callback, void *context);
+
+/***********************************************************************************************//**
+ *  \brief  Dispatch events until a termination signal arrives or eventLoopStop() is called.
+ *  \return  signal that ended the loop, 0 if stopped, -1 on failure
+ **************************************************************************************************/
+int eventLoopRun(void);
+
+/***********************************************************************************************//**
+ *  \brief  Make eventLoopRun() return after the current callback.
+ **************************************************************************************************/
+void eventLoopStop(void);
+
+/** @} (end addtogroup event_loop) */
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* EVENT_LOOP_H */
@@ -0,0 +1,227 @@
+/***************************************************************************//**
+ * @file
+ * @brief Flight recorder: every BGAPI frame in a memory ring, dumped on a signal or a crash
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2018 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+/* standard library headers */
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <signal.h>
+#include <time.h>
+#if !defined(_WIN32)
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/* Own header */
+#include "flight_recorder.h"
+
+#include "metrics.h"
+
+#define RING_MASK                     ((uint64_t)FLIGHT_RECORDER_SIZE - 1)
+#define PATH_SIZE                     256
+
+#if (FLIGHT_RECORDER_SIZE & (FLIGHT_RECORDER_SIZE - 1)) != 0 || FLIGHT_RECORDER_SIZE < 4096
+#error "FLIGHT_RECORDER_SIZE must be a power of two, at least 4096"
+#endif
+
+// Records [tail, head) are in the ring, the positions run freely and are masked on access. A
+// signal handler on the event thread may dump the ring between any two instructions: tail is
+// moved before old records are overwritten and head only once a record is complete.
+static uint8_t ring[FLIGHT_RECORDER_SIZE];
+static uint64_t head = 0;
+static uint64_t tail = 0;
+static uint32_t sequence = 0;
+static uint8_t selectedNcp = 0;
+
+static char path[PATH_SIZE] = DEFAULT_FLIGHT_RECORDER_FILE;
+static volatile sig_atomic_t dumpRequested = 0;
+
+static void copyIn(uint64_t position, const void *data, uint32_t length)
+{
+  uint32_t offset = (uint32_t)(position & RING_MASK);
+  uint32_t first = (length < FLIGHT_RECORDER_SIZE - offset) ? length : FLIGHT_RECORDER_SIZE - offset;
+
+  memcpy(&ring[offset], data, first);
+  memcpy(ring, (const uint8_t *)data + first, length - first);
+}
+
+static void copyOut(uint64_t position, void *data, uint32_t length)
+{
+  uint32_t offset = (uint32_t)(position & RING_MASK);
+  uint32_t first = (length < FLIGHT_RECORDER_SIZE - offset) ? length : FLIGHT_RECORDER_SIZE - offset;
+
+  memcpy(data, &ring[offset], first);
+  memcpy((uint8_t *)data + first, ring, length - first);
+}
+
+#if !defined(_WIN32)
+static int writeAll(int fd, const void *data, size_t length)
+{
+  const uint8_t *next = data;
+  ssize_t written;
+
+  while (length > 0) {
+    written = write(fd, next, length);
+    if (written < 0 && errno == EINTR) {
+      continue;
+    }
+    if (written <= 0) {
+      return -1;
+    }
+    next += written;
+    length -= (size_t)written;
+  }
+  return 0;
+}
+
+// Only system calls, so that it can run in a signal handler
+static int dumpRing(void)
+{
+  FlightRecorderHeader header;
+  struct timespec ts;
+  uint64_t from = tail;
+  uint64_t to = head;
+  uint32_t offset = (uint32_t)(from & RING_MASK);
+  uint64_t first;
+  int fd;
+  int result;
+
+  memset(&header, 0, sizeof(header));
+  header.magic = FLIGHT_RECORDER_MAGIC;
+  header.version = FLIGHT_RECORDER_VERSION;
+  header.bytes = to - from;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  header.dumpUs = (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  header.dumpWallMs = (uint64_t)ts.tv_sec * 1000u + (uint64_t)ts.tv_nsec / 1000000u;
+  first = (header.bytes < FLIGHT_RECORDER_SIZE - offset) ? header.bytes : FLIGHT_RECORDER_SIZE - offset;
+
+  fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    return -1;
+  }
+  result = writeAll(fd, &header, sizeof(header));
+  if (result == 0) {
+    result = writeAll(fd, &ring[offset], (size_t)first);
+  }
+  if (result == 0) {
+    result = writeAll(fd, ring, (size_t)(header.bytes - first));
+  }
+  close(fd);
+  return result;
+}
+
+static void onDumpSignal(int sig)
+{
+  (void)sig;
+  dumpRequested = 1;
+}
+
+// The last frames are what explains a crash. SA_RESETHAND has put the default action back, which
+// the signal raised again takes, e.g. to leave a core dump.
+static void onCrash(int sig)
+{
+  dumpRing();
+  raise(sig);
+}
+#endif
+
+/***************************************************************************************************
+ * Public Function Definitions
+ **************************************************************************************************/
+
+void flightRecorderOpen(const char *file)
+{
+#if !defined(_WIN32)
+  static const int crashSignals[] = { SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT };
+  struct sigaction action;
+  uint8_t i;
+
+  strncpy(path, file, PATH_SIZE - 1);
+  path[PATH_SIZE - 1] = '\0';
+  memset(&action, 0, sizeof(action));
+  sigemptyset(&action.sa_mask);
+  action.sa_handler = onDumpSignal;
+  action.sa_flags = SA_RESTART;
+  sigaction(SIGUSR1, &action, NULL);
+  action.sa_handler = onCrash;
+  action.sa_flags = SA_RESETHAND;
+  for (i = 0; i < sizeof(crashSignals) / sizeof(crashSignals[0]); i++) {
+    sigaction(crashSignals[i], &action, NULL);
+  }
+#else
+  (void)file;
+#endif
+}
+
+void flightRecorderSelect(uint8_t ncp)
+{
+  selectedNcp = ncp;
+}
+
+void flightRecorderAdd(uint8_t direction, const void *frame, uint16_t length, uint64_t timeUs)
+{
+  FlightRecord record;
+  uint32_t size = FLIGHT_RECORD_SIZE(length);
+  uint64_t newTail = tail;
+
+  // Make room, oldest records first
+  while (head + size - newTail > FLIGHT_RECORDER_SIZE) {
+    copyOut(newTail, &record, sizeof(record));
+    newTail += FLIGHT_RECORD_SIZE(record.length);
+  }
+  tail = newTail;
+  __atomic_signal_fence(__ATOMIC_SEQ_CST);
+  record.timeUs = timeUs;
+  record.sequence = sequence++;
+  record.length = length;
+  record.ncp = selectedNcp;
+  record.direction = direction;
+  copyIn(head, &record, sizeof(record));
+  copyIn(head + sizeof(record), frame, length);
+  __atomic_signal_fence(__ATOMIC_SEQ_CST);
+  head += size;
+}
+
+void flightRecorderPoll(void)
+{
+  if (!dumpRequested) {
+    return;
+  }
+  dumpRequested = 0;
+  if (flightRecorderDump() == 0) {
+    printf("Flight recorder written to %s\n", path);
+  } else {
+    printf("Cannot write flight recorder to %s\n", path);
+  }
+}
+
+void flightRecorderRequestDump(void)
+{
+  dumpRequested = 1;
+}
+
+int flightRecorderDump(void)
+{
+#if !defined(_WIN32)
+  return dumpRing();
+#else
+  return -1;
+#endif
+}
@@ -0,0 +1,129 @@
+/***************************************************************************//**
+ * @file
+ * @brief Flight recorder: every BGAPI frame in a memory ring, dumped on a signal or a crash
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2018 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+#ifndef FLIGHT_RECORDER_H
+#define FLIGHT_RECORDER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/***********************************************************************************************//**
+ * \defgroup flight_recorder Flight Recorder
+ * \brief Every BGAPI frame written to or read from an NCP is copied, with the NCP it belongs to
+ *        and a monotonic time stamp, into a fixed-size ring in memory. The oldest frames make
+ *        room for new ones, so the ring holds the last few megabytes of traffic at no cost but
+ *        a copy per frame. It is written to a trace file on SIGUSR1, from the event thread, and
+ *        on a crash, from the signal handler with nothing but system calls. trace-replay feeds
+ *        a trace file back into the client. Frames are recorded from the event thread only.
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ * @addtogroup flight_recorder
+ * @{
+ **************************************************************************************************/
+
+ #define DEFAULT_FLIGHT_RECORDER_FILE  "flight_recorder.bin"
+ // Bytes of frames and record headers kept, a power of two
+ #ifndef FLIGHT_RECORDER_SIZE
+ #define FLIGHT_RECORDER_SIZE          (4u * 1024u * 1024u)
+ #endif
+ #define FLIGHT_RECORDER_MAGIC         0x31524c46u  // "FLR1"
+ #define FLIGHT_RECORDER_VERSION       1u
+
+/***************************************************************************************************
+ * Type Definitions
+ **************************************************************************************************/
+
+ typedef enum {
+   flightRecorderToNcp,       // a command
+   flightRecorderFromNcp      // a response or an event
+ } FlightRecorderDirection;
+
+ // A trace file is this header followed by the records, oldest first
+ typedef struct {
+   uint32_t magic;
+   uint32_t version;
+   uint64_t bytes;            // of records following the header
+   uint64_t dumpUs;           // monotonic time of the dump, as the record time stamps
+   uint64_t dumpWallMs;       // wall clock time of the dump, ms since the epoch
+ } FlightRecorderHeader;
+
+ // One frame, padded with its record to a multiple of 8 bytes
+ typedef struct {
+   uint64_t timeUs;           // metricsNowUs() when it was written or read
+   uint32_t sequence;         // one more than the record before, across the whole run
+   uint16_t length;           // of the frame, BGAPI header included
+   uint8_t  ncp;
+   uint8_t  direction;        // FlightRecorderDirection
+ } FlightRecord;
+
+ #define FLIGHT_RECORD_SIZE(length)    ((sizeof(FlightRecord) + (length) + 7u) & ~7u)
+
+/***************************************************************************************************
+ * Function Declarations
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  Set where the trace is written, and dump it there on SIGUSR1 and on a crash. Frames
+ *          are recorded whether or not this is called.
+ *  \param[in]  path  trace file
+ **************************************************************************************************/
+void flightRecorderOpen(const char *path);
+
+/***********************************************************************************************//**
+ *  \brief  Record the frames of another NCP from now on.
+ *  \param[in]  ncp  NCP index
+ **************************************************************************************************/
+void flightRecorderSelect(uint8_t ncp);
+
+/***********************************************************************************************//**
+ *  \brief  Record a frame of the selected NCP.
+ *  \param[in]  direction  FlightRecorderDirection
+ *  \param[in]  frame  BGAPI frame, header included
+ *  \param[in]  length  frame length
+ *  \param[in]  timeUs  metricsNowUs() when it was written or read
+ **************************************************************************************************/
+void flightRecorderAdd(uint8_t direction, const void *frame, uint16_t length, uint64_t timeUs);
+
+/***********************************************************************************************//**
+ *  \brief  Write the trace if SIGUSR1 has asked for it since the last call. Called from the
+ *          event thread between events.
+ **************************************************************************************************/
+void flightRecorderPoll(void);
+
+/***********************************************************************************************//**
+ *  \brief  Ask for the trace as SIGUSR1 does, for an event loop that takes the signal itself.
+ **************************************************************************************************/
+void flightRecorderRequestDump(void);
+
+/***********************************************************************************************//**
+ *  \brief  Write the trace now.
+ *  \return  0 on success, -1 if the file could not be written
+ **************************************************************************************************/
+int flightRecorderDump(void);
+
+/** @} (end addtogroup flight_recorder) */
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* FLIGHT_RECORDER_H */
@@ -0,0 +1,198 @@
+/***************************************************************************//**
+ * @file
+ * @brief Persistent cache of discovered GATT handles
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2018 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+/* standard library headers */
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdbool.h>
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+/* Own header */
+#include "gatt_cache.h"
+
+#define GATT_CACHE_MAGIC              0x31435447u  // "GTC1"
+#define GATT_CACHE_VERSION            2u
+
+// The file is a 64-byte header followed by the buckets
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t buckets;
+  uint32_t bucketSize;
+  uint8_t  reserved[48];
+} GattCacheHeader;
+
+typedef struct {
+  GattCacheHeader header;
+  GattCacheEntry  entries[GATT_CACHE_BUCKETS][GATT_CACHE_BUCKET_SIZE];
+} GattCacheFile;
+
+// Used when the cache file cannot be mapped
+static GattCacheFile memoryCache;
+// The cache in use, either mapped from the file or memoryCache
+static GattCacheFile *cache = &memoryCache;
+
+// Bucket of a device address
+static GattCacheEntry *bucketOf(const bd_addr *address)
+{
+  uint32_t hash = 2166136261u;
+  uint8_t i;
+
+  // FNV-1a over the six address bytes
+  for (i = 0; i < sizeof(address->addr); i++) {
+    hash = (hash ^ address->addr[i]) * 16777619u;
+  }
+  return cache->entries[hash % GATT_CACHE_BUCKETS];
+}
+
+// Mark an entry as the most recently used of its bucket
+static void touch(GattCacheEntry *bucket, GattCacheEntry *entry)
+{
+  uint8_t i;
+
+  for (i = 0; i < GATT_CACHE_BUCKET_SIZE; i++) {
+    if (bucket[i].age < UINT8_MAX) {
+      bucket[i].age++;
+    }
+  }
+  entry->age = 0;
+}
+
+static void initHeader(GattCacheFile *file)
+{
+  memset(file, 0, sizeof(*file));
+  file->header.magic = GATT_CACHE_MAGIC;
+  file->header.version = GATT_CACHE_VERSION;
+  file->header.buckets = GATT_CACHE_BUCKETS;
+  file->header.bucketSize = GATT_CACHE_BUCKET_SIZE;
+}
+
+int gattCacheOpen(const char *path)
+{
+  initHeader(&memoryCache);
+#if !defined(_WIN32)
+  GattCacheFile *file;
+  struct stat st;
+  int fd;
+
+  if (path == NULL) {
+    return -1;
+  }
+  fd = open(path, O_RDWR | O_CREAT, 0644);
+  if (fd < 0) {
+    printf("Cannot open GATT cache %s, discovering every connection\n", path);
+    return -1;
+  }
+  if (fstat(fd, &st) < 0 || (st.st_size != sizeof(GattCacheFile)
+                             && ftruncate(fd, sizeof(GattCacheFile)) < 0)) {
+    close(fd);
+    return -1;
+  }
+  file = mmap(NULL, sizeof(GattCacheFile), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (file == MAP_FAILED) {
+    return -1;
+  }
+  // A new file, or one written with a different layout, starts out empty
+  if (st.st_size != sizeof(GattCacheFile)
+      || file->header.magic != GATT_CACHE_MAGIC
+      || file->header.version != GATT_CACHE_VERSION
+      || file->header.buckets != GATT_CACHE_BUCKETS
+      || file->header.bucketSize != GATT_CACHE_BUCKET_SIZE) {
+    initHeader(file);
+  }
+  cache = file;
+  return 0;
+#else
+  (void)path;
+  return -1;
+#endif
+}
+
+void gattCacheClose(void)
+{
+#if !defined(_WIN32)
+  if (cache != &memoryCache) {
+    msync(cache, sizeof(GattCacheFile), MS_SYNC);
+    munmap(cache, sizeof(GattCacheFile));
+  }
+#endif
+  cache = &memoryCache;
+}
+
+const GattCacheEntry *gattCacheLookup(const bd_addr *address)
+{
+  GattCacheEntry *bucket = bucketOf(address);
+  uint8_t i;
+
+  for (i = 0; i < GATT_CACHE_BUCKET_SIZE; i++) {
+    if (bucket[i].valid && memcmp(&bucket[i].address, address, sizeof(bd_addr)) == 0) {
+      touch(bucket, &bucket[i]);
+      return &bucket[i];
+    }
+  }
+  return NULL;
+}
+
+void gattCacheStore(const bd_addr *address, uint32_t serviceHandle, uint16_t characteristicHandle,
+                    uint8_t delivery, const uint16_t *infoHandles)
+{
+  GattCacheEntry *bucket = bucketOf(address);
+  GattCacheEntry *entry = &bucket[0];
+  uint8_t i;
+
+  // The device's own entry, else a free one, else the least recently used
+  for (i = 0; i < GATT_CACHE_BUCKET_SIZE; i++) {
+    if (bucket[i].valid && memcmp(&bucket[i].address, address, sizeof(bd_addr)) == 0) {
+      entry = &bucket[i];
+      break;
+    }
+    if (entry->valid && (!bucket[i].valid || bucket[i].age > entry->age)) {
+      entry = &bucket[i];
+    }
+  }
+  entry->address = *address;
+  entry->serviceHandle = serviceHandle;
+  entry->characteristicHandle = characteristicHandle;
+  entry->delivery = delivery;
+  entry->infoSearched = (infoHandles != NULL);
+  if (infoHandles != NULL) {
+    memcpy(entry->infoHandles, infoHandles, sizeof(entry->infoHandles));
+  } else {
+    memset(entry->infoHandles, 0, sizeof(entry->infoHandles));
+  }
+  entry->valid = 1;
+  touch(bucket, entry);
+}
+
+void gattCacheForget(const bd_addr *address)
+{
+  GattCacheEntry *bucket = bucketOf(address);
+  uint8_t i;
+
+  for (i = 0; i < GATT_CACHE_BUCKET_SIZE; i++) {
+    if (bucket[i].valid && memcmp(&bucket[i].address, address, sizeof(bd_addr)) == 0) {
+      bucket[i].valid = 0;
+    }
+  }
+}
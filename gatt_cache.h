@@ -0,0 +1,114 @@
+/***************************************************************************//**
+ * @file
+ * @brief Persistent cache of discovered GATT handles
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2018 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+#ifndef GATT_CACHE_H
+#define GATT_CACHE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#include "bg_types.h"
+
+/***********************************************************************************************//**
+ * \defgroup gatt_cache GATT Handle Cache
+ * \brief Thermometer service and characteristic handles of known servers, keyed by device address
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ * @addtogroup gatt_cache
+ * @{
+ **************************************************************************************************/
+
+ #define DEFAULT_GATT_CACHE_FILE       "gatt_cache.bin"
+
+ // Entries are kept in buckets of four, two cache lines each
+ #define GATT_CACHE_BUCKETS            256
+ #define GATT_CACHE_BUCKET_SIZE        4
+ // Handles of the values read besides the readings: Temperature Type, Measurement Interval and
+ // Battery Level
+ #define GATT_CACHE_INFO_HANDLES       3
+
+/***************************************************************************************************
+ * Type Definitions
+ **************************************************************************************************/
+ typedef struct {
+   bd_addr  address;
+   uint8_t  valid;
+   uint8_t  age;
+   uint32_t serviceHandle;
+   uint16_t characteristicHandle;
+   uint8_t  delivery;         // gatt_indication or gatt_notification, 0 if only indications were
+                              // looked for
+   uint8_t  infoSearched;     // the info handles were looked for
+   uint16_t infoHandles[GATT_CACHE_INFO_HANDLES];  // 0 for a value the sensor does not have
+   uint8_t  reserved[10];
+ } GattCacheEntry;
+
+/***************************************************************************************************
+ * Function Declarations
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  Map the cache file, creating it if needed. The cache is kept in memory only if the
+ *          file cannot be used.
+ *  \param[in]  path  cache file, NULL for a memory-only cache
+ *  \return  0 if the file is mapped, -1 if the cache is memory-only
+ **************************************************************************************************/
+int gattCacheOpen(const char *path);
+
+/***********************************************************************************************//**
+ *  \brief  Flush and unmap the cache file.
+ **************************************************************************************************/
+void gattCacheClose(void);
+
+/***********************************************************************************************//**
+ *  \brief  Look up the handles cached for a device.
+ *  \param[in]  address  device address
+ *  \return  cache entry, NULL if the device is not known
+ **************************************************************************************************/
+const GattCacheEntry *gattCacheLookup(const bd_addr *address);
+
+/***********************************************************************************************//**
+ *  \brief  Remember the handles discovered on a device, evicting the oldest entry of the bucket
+ *          if it is full.
+ *  \param[in]  address  device address
+ *  \param[in]  serviceHandle  thermometer service handle
+ *  \param[in]  characteristicHandle  handle of the characteristic the readings come from
+ *  \param[in]  delivery  gatt_indication or gatt_notification, how they come, 0 if the
+ *              characteristics were not looked for notifications
+ *  \param[in]  infoHandles  GATT_CACHE_INFO_HANDLES handles of the values read besides the
+ *              readings, 0 for the missing ones, NULL if they were not looked for
+ **************************************************************************************************/
+void gattCacheStore(const bd_addr *address, uint32_t serviceHandle, uint16_t characteristicHandle,
+                    uint8_t delivery, const uint16_t *infoHandles);
+
+/***********************************************************************************************//**
+ *  \brief  Drop the handles of a device, e.g. after its GATT database has changed.
+ *  \param[in]  address  device address
+ **************************************************************************************************/
+void gattCacheForget(const bd_addr *address);
+
+/** @} (end addtogroup gatt_cache) */
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* GATT_CACHE_H */
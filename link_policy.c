@@ -0,0 +1,136 @@
+/***************************************************************************//**
+ * @file
+ * @brief Link policy: PHY of each connection chosen from its RSSI
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2018 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+/* standard library headers */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+
+/* BG stack headers */
+#include "bg_types.h"
+#include "gecko_bglib.h"
+
+/* Own header */
+#include "link_policy.h"
+
+static bool policyEnabled = false;
+// Changes reported on every NCP, and requests turned down
+static uint32_t to2m = 0;
+static uint32_t to1m = 0;
+static uint32_t toCoded = 0;
+static uint32_t refusedCount = 0;
+
+// PHY the RSSI calls for, leaving the one in use only once past its looser threshold
+static uint8_t choosePhy(uint8_t phy, int8_t rssi)
+{
+  if (rssi >= ((phy == le_gap_phy_2m) ? LINK_POLICY_2M_EXIT_RSSI : LINK_POLICY_2M_RSSI)) {
+    return le_gap_phy_2m;
+  }
+  if (rssi < ((phy == le_gap_phy_coded) ? LINK_POLICY_CODED_EXIT_RSSI : LINK_POLICY_CODED_RSSI)) {
+    return le_gap_phy_coded;
+  }
+  return le_gap_phy_1m;
+}
+
+/***************************************************************************************************
+ * Public Function Definitions
+ **************************************************************************************************/
+
+void linkPolicySetEnabled(bool enabled)
+{
+  policyEnabled = enabled;
+}
+
+bool linkPolicyEnabled(void)
+{
+  return policyEnabled;
+}
+
+void linkPolicyOpened(LinkPolicyLink *link, uint8_t phy)
+{
+  link->phy = phy;
+  link->requested = 0;
+  link->refused = 0;
+  link->target = phy;
+  link->streak = 0;
+}
+
+uint8_t linkPolicySample(LinkPolicyLink *link, int8_t rssi)
+{
+  uint8_t target;
+
+  if (!policyEnabled || link->requested != 0) {
+    return 0;
+  }
+  target = choosePhy(link->phy, rssi);
+  // 1M is mandatory, the sensor cannot turn it down
+  if (link->refused & target) {
+    target = le_gap_phy_1m;
+  }
+  if (target == link->phy) {
+    link->streak = 0;
+    return 0;
+  }
+  link->streak = (target == link->target) ? link->streak + 1 : 1;
+  link->target = target;
+  if (link->streak < LINK_POLICY_SAMPLES) {
+    return 0;
+  }
+  link->streak = 0;
+  link->requested = target;
+  return target;
+}
+
+void linkPolicyStatus(LinkPolicyLink *link, uint8_t phy)
+{
+  if (link->requested != 0 && phy != link->requested) {
+    link->refused |= link->requested;
+    refusedCount++;
+  }
+  link->requested = 0;
+  if (phy == link->phy) {
+    return;
+  }
+  link->phy = phy;
+  if (phy == le_gap_phy_2m) {
+    to2m++;
+  } else if (phy == le_gap_phy_coded) {
+    toCoded++;
+  } else {
+    to1m++;
+  }
+}
+
+void linkPolicyRejected(LinkPolicyLink *link)
+{
+  if (link->requested == 0) {
+    return;
+  }
+  link->refused |= link->requested;
+  link->requested = 0;
+  refusedCount++;
+}
+
+void linkPolicyReport(FILE *out)
+{
+  if (!policyEnabled) {
+    return;
+  }
+  fprintf(out, "link policy: %lu links moved to 2M, %lu to Coded, %lu back to 1M, %lu requests "
+          "turned down\n", (unsigned long)to2m, (unsigned long)toCoded, (unsigned long)to1m,
+          (unsigned long)refusedCount);
+}
@@ -0,0 +1,126 @@
+/***************************************************************************//**
+ * @file
+ * @brief Link policy: PHY of each connection chosen from its RSSI
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2018 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+#ifndef LINK_POLICY_H
+#define LINK_POLICY_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+/***********************************************************************************************//**
+ * \defgroup link_policy Link Policy
+ * \brief Every connection is opened on the PHY the client scans on. Once its readings are
+ *        enabled, the RSSI samples taken of it decide its PHY from then on: 2M while the signal
+ *        is strong, which takes half the airtime of 1M for each reading and leaves the radio
+ *        room for more connections, and Coded while it is weak, which keeps a sensor at the edge
+ *        of range connected. The thresholds to leave a PHY are looser than the ones to take it,
+ *        and a change takes several samples in a row past a threshold, so a link does not flip
+ *        back and forth on a noisy signal. A PHY a sensor has turned down is not asked for again
+ *        on the same connection.
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ * @addtogroup link_policy
+ * @{
+ **************************************************************************************************/
+
+ // RSSI at or above which a link moves to 2M, and below which it leaves 2M again, in dBm
+ #define LINK_POLICY_2M_RSSI           -60
+ #define LINK_POLICY_2M_EXIT_RSSI      -70
+ // RSSI below which a link moves to Coded, and at or above which it leaves Coded again, in dBm
+ #define LINK_POLICY_CODED_RSSI        -82
+ #define LINK_POLICY_CODED_EXIT_RSSI   -75
+ // Samples in a row calling for another PHY before it is asked for
+ #define LINK_POLICY_SAMPLES           2
+
+/***************************************************************************************************
+ * Type Definitions
+ **************************************************************************************************/
+
+ // PHY of one connection, le_gap_phy_type values
+ typedef struct {
+   uint8_t  phy;              // in use, as last reported
+   uint8_t  requested;        // asked for and not reported yet, 0 if none
+   uint8_t  refused;          // a bit for each PHY the sensor has turned down
+   uint8_t  target;           // PHY the last samples called for
+   uint8_t  streak;           // samples in a row that called for target
+ } LinkPolicyLink;
+
+/***************************************************************************************************
+ * Function Declarations
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  Turn the link policy on or off.
+ *  \param[in]  enabled  true to move links to the PHY their RSSI calls for, false to leave them
+ *              on the PHY they were opened on
+ **************************************************************************************************/
+void linkPolicySetEnabled(bool enabled);
+
+/***********************************************************************************************//**
+ *  \brief  Check whether the link policy is on.
+ *  \return  true if the PHY of the links follows their RSSI
+ **************************************************************************************************/
+bool linkPolicyEnabled(void);
+
+/***********************************************************************************************//**
+ *  \brief  Start over on a new connection.
+ *  \param[out]  link  PHY state of the connection
+ *  \param[in]  phy  PHY it was opened on
+ **************************************************************************************************/
+void linkPolicyOpened(LinkPolicyLink *link, uint8_t phy);
+
+/***********************************************************************************************//**
+ *  \brief  Take an RSSI sample of a connection whose readings are enabled.
+ *  \param[in,out]  link  PHY state of the connection
+ *  \param[in]  rssi  RSSI in dBm
+ *  \return  PHY to ask the sensor for, recorded as requested, or 0 to leave the link as it is
+ **************************************************************************************************/
+uint8_t linkPolicySample(LinkPolicyLink *link, int8_t rssi);
+
+/***********************************************************************************************//**
+ *  \brief  Take the PHY reported by the NCP, after a request or a change the sensor asked for.
+ *          A request that ends on another PHY is taken as turned down.
+ *  \param[in,out]  link  PHY state of the connection
+ *  \param[in]  phy  PHY now in use
+ **************************************************************************************************/
+void linkPolicyStatus(LinkPolicyLink *link, uint8_t phy);
+
+/***********************************************************************************************//**
+ *  \brief  Record that the NCP rejected the request made, the PHY is not asked for again.
+ *  \param[in,out]  link  PHY state of the connection
+ **************************************************************************************************/
+void linkPolicyRejected(LinkPolicyLink *link);
+
+/***********************************************************************************************//**
+ *  \brief  Print the PHY changes made and turned down.
+ *  \param[in]  out  stream to print to
+ **************************************************************************************************/
+void linkPolicyReport(FILE *out);
+
+/** @} (end addtogroup link_policy) */
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* LINK_POLICY_H */
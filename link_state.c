@@ -0,0 +1,161 @@
+/***************************************************************************//**
+ * @file
+ * @brief Connections of each NCP, kept in a file for a warm start
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2018 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+/* standard library headers */
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdbool.h>
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+/* Own header */
+#include "link_state.h"
+
+#define LINK_STATE_MAGIC              0x31534b4cu  // "LKS1"
+#define LINK_STATE_VERSION            1u
+#define LINK_STATE_SLOTS              (MAX_NCPS * MAX_CONNECTIONS)
+
+// The file is a 64-byte header, the port of each NCP, then the slots
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t ncps;
+  uint32_t slots;
+  uint8_t  reserved[48];
+} LinkStateHeader;
+
+typedef struct {
+  LinkStateHeader header;
+  char            ports[MAX_NCPS][LINK_STATE_PORT_SIZE];
+  LinkStateEntry  entries[LINK_STATE_SLOTS];
+} LinkStateFile;
+
+// Used when the file cannot be mapped
+static LinkStateFile memoryState;
+// The state in use, either mapped from the file or memoryState
+static LinkStateFile *state = &memoryState;
+
+static void initState(LinkStateFile *file)
+{
+  uint32_t i;
+
+  memset(file, 0, sizeof(*file));
+  file->header.magic = LINK_STATE_MAGIC;
+  file->header.version = LINK_STATE_VERSION;
+  file->header.ncps = MAX_NCPS;
+  file->header.slots = LINK_STATE_SLOTS;
+  for (i = 0; i < LINK_STATE_SLOTS; i++) {
+    file->entries[i].connection = CONNECTION_HANDLE_INVALID;
+  }
+}
+
+int linkStateOpen(const char *path)
+{
+  initState(&memoryState);
+#if !defined(_WIN32)
+  LinkStateFile *file;
+  struct stat st;
+  int fd;
+
+  if (path == NULL) {
+    return -1;
+  }
+  fd = open(path, O_RDWR | O_CREAT, 0644);
+  if (fd < 0) {
+    printf("Cannot open link state %s, NCPs are reset on start-up\n", path);
+    return -1;
+  }
+  if (fstat(fd, &st) < 0 || (st.st_size != sizeof(LinkStateFile)
+                             && ftruncate(fd, sizeof(LinkStateFile)) < 0)) {
+    close(fd);
+    return -1;
+  }
+  file = mmap(NULL, sizeof(LinkStateFile), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (file == MAP_FAILED) {
+    return -1;
+  }
+  // A new file, or one written with a different layout, starts out empty
+  if (st.st_size != sizeof(LinkStateFile)
+      || file->header.magic != LINK_STATE_MAGIC
+      || file->header.version != LINK_STATE_VERSION
+      || file->header.ncps != MAX_NCPS
+      || file->header.slots != LINK_STATE_SLOTS) {
+    initState(file);
+  }
+  state = file;
+  return 0;
+#else
+  (void)path;
+  return -1;
+#endif
+}
+
+void linkStateClose(void)
+{
+#if !defined(_WIN32)
+  if (state != &memoryState) {
+    msync(state, sizeof(LinkStateFile), MS_SYNC);
+    munmap(state, sizeof(LinkStateFile));
+  }
+#endif
+  state = &memoryState;
+}
+
+void linkStateBindPort(uint8_t ncp, const char *port)
+{
+  uint8_t i;
+
+  if (ncp >= MAX_NCPS || strncmp(state->ports[ncp], port, LINK_STATE_PORT_SIZE - 1) == 0) {
+    return;
+  }
+  for (i = 0; i < MAX_CONNECTIONS; i++) {
+    linkStateClear((uint8_t)(ncp * MAX_CONNECTIONS + i));
+  }
+  strncpy(state->ports[ncp], port, LINK_STATE_PORT_SIZE - 1);
+  state->ports[ncp][LINK_STATE_PORT_SIZE - 1] = '\0';
+}
+
+void linkStateSet(uint8_t slot, const LinkStateEntry *entry)
+{
+  if (slot < LINK_STATE_SLOTS) {
+    state->entries[slot] = *entry;
+  }
+}
+
+void linkStateClear(uint8_t slot)
+{
+  if (slot < LINK_STATE_SLOTS) {
+    memset(&state->entries[slot], 0, sizeof(state->entries[slot]));
+    state->entries[slot].connection = CONNECTION_HANDLE_INVALID;
+  }
+}
+
+bool linkStateGet(uint8_t slot, LinkStateEntry *entry)
+{
+  if (slot >= LINK_STATE_SLOTS
+      || state->entries[slot].connection == CONNECTION_HANDLE_INVALID) {
+    return false;
+  }
+  *entry = state->entries[slot];
+  return true;
+}
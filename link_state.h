@@ -0,0 +1,112 @@
+/***************************************************************************//**
+ * @file
+ * @brief Connections of each NCP, kept in a file for a warm start
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2018 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+#ifndef LINK_STATE_H
+#define LINK_STATE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "bg_types.h"
+#include "app.h"
+
+/***********************************************************************************************//**
+ * \defgroup link_state Link State
+ * \brief The connection handle and address of the sensor on each results table slot, and
+ *        whether its indications are enabled, in a small memory-mapped file. Every change is a
+ *        store to the mapping, so the file is up to date however the client exits, and a
+ *        restarted client can adopt the connections an NCP has kept instead of resetting it.
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ * @addtogroup link_state
+ * @{
+ **************************************************************************************************/
+
+ #define DEFAULT_LINK_STATE_FILE       "link_state.bin"
+ // Longest serial port name an NCP's entries are recorded under
+ #define LINK_STATE_PORT_SIZE          64
+
+/***************************************************************************************************
+ * Type Definitions
+ **************************************************************************************************/
+
+ typedef struct {
+   bd_addr  address;
+   uint8_t  addressType;
+   uint8_t  connection;       // CONNECTION_HANDLE_INVALID for a free slot
+   uint8_t  running;          // indications were enabled
+   uint8_t  reserved;
+ } LinkStateEntry;
+
+/***************************************************************************************************
+ * Function Declarations
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  Map the link state file, creating it if needed. The state is kept in memory only if
+ *          the file cannot be used.
+ *  \param[in]  path  link state file, NULL for memory only
+ *  \return  0 if the file is mapped, -1 if the state is memory-only
+ **************************************************************************************************/
+int linkStateOpen(const char *path);
+
+/***********************************************************************************************//**
+ *  \brief  Flush and unmap the link state file.
+ **************************************************************************************************/
+void linkStateClose(void);
+
+/***********************************************************************************************//**
+ *  \brief  Record which serial port an NCP is on. Its entries are dropped if they were recorded
+ *          for another port, so a changed command line never adopts the wrong connections.
+ *  \param[in]  ncp  NCP index
+ *  \param[in]  port  serial port device
+ **************************************************************************************************/
+void linkStateBindPort(uint8_t ncp, const char *port);
+
+/***********************************************************************************************//**
+ *  \brief  Record the connection on a results table slot.
+ *  \param[in]  slot  results table slot, ncp * MAX_CONNECTIONS + table index
+ *  \param[in]  entry  connection handle, address and setup state
+ **************************************************************************************************/
+void linkStateSet(uint8_t slot, const LinkStateEntry *entry);
+
+/***********************************************************************************************//**
+ *  \brief  Record a results table slot as free.
+ *  \param[in]  slot  results table slot
+ **************************************************************************************************/
+void linkStateClear(uint8_t slot);
+
+/***********************************************************************************************//**
+ *  \brief  Get the connection recorded on a results table slot.
+ *  \param[in]  slot  results table slot
+ *  \param[out]  entry  connection handle, address and setup state
+ *  \return  true if a connection is recorded on the slot
+ **************************************************************************************************/
+bool linkStateGet(uint8_t slot, LinkStateEntry *entry);
+
+/** @} (end addtogroup link_state) */
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* LINK_STATE_H */
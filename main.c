@@ -28,9 +28,14 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <stdbool.h>
 #include <errno.h>
 #include <string.h>
 #include <unistd.h>
+#include <signal.h>
+#if defined(APP_BENCH)
+#include <time.h>
+#endif
 
 #include "infrastructure.h"
 
@@ -38,10 +43,27 @@
 #include "gecko_bglib.h"
 
 /* hardware specific headers */
-#include "uart.h"
+#include "ncp_port.h"
+#include "event_loop.h"
+#include "ncp_reader.h"
 
 /* application specific files */
 #include "app.h"
+#include "broadcast.h"
+#include "cmd_queue.h"
+#include "flight_recorder.h"
+#include "gatt_cache.h"
+#include "link_policy.h"
+#include "link_state.h"
+#include "metrics.h"
+#include "output_sink.h"
+#include "reading_store.h"
+#include "rotation.h"
+#include "scan_filter.h"
+#include "scan_policy.h"
+#include "sensor_stats.h"
+#include "sensor_table.h"
+#include "supervision.h"
 
 /***************************************************************************************************
  * Local Macros and Definitions
@@ -63,21 +85,81 @@ static char* default_uart_port = "";
 /** The default baud rate to use. */
 static uint32_t default_baud_rate = 115200;
 
-/** The serial port to use for BGAPI communication. */
+/** Serial port, baud rate and flow control of each NCP. */
+typedef struct {
+  char*    port;
+  uint32_t baud_rate;
+  uint32_t flowcontrol;
+} NcpLink;
+
+/** The NCPs to drive, more than one in event loop mode only. */
+static NcpLink ncps[MAX_NCPS];
+static uint8_t ncp_count = 0;
+
+/** The serial port of the NCP selected for BGAPI communication. */
 static char* uart_port = NULL;
 
-/** The baud rate to use. */
-static uint32_t baud_rate = 0;
+/** File the flight recorder is written to on SIGUSR1 and on a crash. */
+static char* flight_recorder_file = DEFAULT_FLIGHT_RECORDER_FILE;
+
+/** File holding the GATT handles of known servers. */
+static char* gatt_cache_file = DEFAULT_GATT_CACHE_FILE;
+
+/** Take over NCPs that are already up, with their connections, instead of resetting them. */
+static bool warm_start = false;
+
+/** File keeping the history of readings, NULL to keep none. */
+static char* reading_store_file = NULL;
+
+/** Shared-memory object the latest state of each sensor is published in, NULL for none. */
+static char* sensor_table_name = NULL;
+
+/** How readings are written to stdout. */
+static OutputFormat output_format = outputFormatTable;
+
+/** Run from the epoll event loop instead of polling the serial port. */
+static bool event_loop_mode = false;
+
+/** Where the metrics are served, a socket path or a localhost TCP port, NULL for nowhere. */
+static char* metrics_address = NULL;
+
+#if defined(APP_BENCH)
+/** SIGINT or SIGTERM once received without the event loop, 0 before. */
+static volatile sig_atomic_t bench_signal = 0;
+#endif
+
+/** How often the NCP is reset again while it has not reported boot, in ms. */
+#define BOOT_RETRY_PERIOD_MS 1000
+
+/** How long a warm start waits for the NCP to answer system_hello before resetting it, in ms.
+ *  Longer than a command waits for its response, so a late answer is not taken for none. */
+#define WARM_START_HELLO_TIMEOUT_MS 3000
 
 /** Usage string */
-#define USAGE "Usage: %s <serial port> <baud rate> [flow control: 1(on, default) or 0(off)]\n\n"
+#define USAGE "Usage: %s [-a] [-A alert rule] [-b] [-e] [-F flight recorder file] [-g gatt cache file] [-i info period s] [-m metrics socket path|port] [-n] [-o table|csv|json] [-p] [-q commands in flight] [-r rssi period ms] [-R rotation interval s] [-s reading store file] [-S] [-t shared memory table name] [-w] <serial port> <baud rate> [flow control: 1(on, default) or 0(off)] [<serial port> <baud rate> [flow control] ...]\n\n"
 
 /***************************************************************************************************
  * Static Function Declarations
  **************************************************************************************************/
 
-static int appSerialPortInit(int argc, char* argv[], int32_t timeout);
+static int appSerialPortInit(int argc, char* argv[]);
 static void on_message_send(uint32_t msg_len, uint8_t* msg_data);
+static void select_ncp(uint8_t ncp);
+static void flush_commands(void);
+static int wait_for_ncp(uint32_t timeout_ms);
+#if defined(__linux__)
+static int appEventLoop(void);
+static void schedule_app_timer(void);
+#endif
+
+#if defined(APP_BENCH)
+static void benchInit(void);
+static void benchReport(int sig);
+static void benchHandleEvents(struct gecko_cmd_packet* evt);
+#define APP_HANDLE_EVENTS(evt) benchHandleEvents(evt)
+#else
+#define APP_HANDLE_EVENTS(evt) appHandleEvents(evt)
+#endif
 
 /***************************************************************************************************
  * Public Function Definitions
@@ -92,30 +174,97 @@ static void on_message_send(uint32_t msg_len, uint8_t* msg_data);
 int main(int argc, char* argv[])
 {
   struct gecko_cmd_packet* evt;
-
-  /* Initialize BGLIB with our output function for sending messages. */
-  BGLIB_INITIALIZE_NONBLOCK(on_message_send, uartRx, uartRxPeek);
+  uint8_t i;
 
   /* Initialise serial communication as non-blocking. */
-  if (appSerialPortInit(argc, argv, 100) < 0) {
+  if (appSerialPortInit(argc, argv) < 0) {
     printf("Non-blocking serial port init failure\n");
     exit(EXIT_FAILURE);
   }
 
+  /* Initialize BGLIB with our output function for sending messages. */
+  BGLIB_INITIALIZE_NONBLOCK(on_message_send, ncpPortRx, ncpPortRxPeek);
+#if defined(__linux__)
+  if (event_loop_mode) {
+    /* Messages are read by the NCP reader thread and handed over in pooled packets. */
+    cmdQueueSetReader(ncpReaderNextMessage);
+  }
+#endif
+
+  /* Keep the last BGAPI frames, for SIGUSR1 or a crash to write out. */
+  flightRecorderOpen(flight_recorder_file);
+
+  /* Map the GATT handle cache so known servers skip discovery on reconnect. */
+  gattCacheOpen(gatt_cache_file);
+
+  /* Record the connections of every NCP, for the next start to adopt them. */
+  linkStateOpen(DEFAULT_LINK_STATE_FILE);
+  for (i = 0; i < ncp_count; i++) {
+    linkStateBindPort(i, ncps[i].port);
+  }
+
+  /* Keep the history of readings if asked to. */
+  if (reading_store_file != NULL && readingStoreOpen(reading_store_file, false) < 0) {
+    exit(EXIT_FAILURE);
+  }
+
+  /* Publish the latest state of every sensor to other processes if asked to. */
+  if (sensor_table_name != NULL) {
+    if (sensorTableOpen(sensor_table_name, (uint32_t)ncp_count * MAX_CONNECTIONS) < 0) {
+      exit(EXIT_FAILURE);
+    }
+    atexit(sensorTableClose);
+  }
+
+  /* Readings of every NCP are formatted and written by a thread of their own. */
+  if (outputSinkOpen(output_format, ncp_count) < 0) {
+    printf("Output thread init failure\n");
+    exit(EXIT_FAILURE);
+  }
+  atexit(outputSinkClose);
+
   // Flush std output
   fflush(stdout);
 
-  printf("Starting up...\nResetting NCP target...\n");
+  printf("Starting up...\n%s NCP target...\n", warm_start ? "Taking over" : "Resetting");
+
+#if defined(APP_BENCH)
+  benchInit();
+#endif
 
   /* Reset NCP to ensure it gets into a defined state.
-   * Once the chip successfully boots, gecko_evt_system_boot_id event should be received. */
-  gecko_cmd_system_reset(0);
+   * Once the chip successfully boots, gecko_evt_system_boot_id event should be received.
+   * A warm start takes over an NCP that is already up instead, keeping its connections. */
+  for (i = 0; i < ncp_count; i++) {
+    select_ncp(i);
+    appStart(warm_start);
+    flush_commands();
+  }
+
+#if defined(__linux__)
+  if (event_loop_mode) {
+    return appEventLoop();
+  }
+#endif
 
   while (1) {
-    /* Check for stack event. */
-    evt = gecko_wait_event();
-    /* Run application and event handler. */
-    appHandleEvents(evt);
+    /* Handle the events that have arrived, command responses are handled on the way. */
+    scanFilterAdvance((uint32_t)(metricsNowUs() / 1000));
+    while ((evt = cmdQueuePeekEvent()) != NULL) {
+      APP_HANDLE_EVENTS(evt);
+    }
+    flush_commands();
+    flightRecorderPoll();
+#if defined(APP_BENCH)
+    if (bench_signal != 0) {
+      benchReport(bench_signal);
+    }
+#endif
+    /* Sleep until the NCP sends more or work on the host clock is due. */
+    if (wait_for_ncp(appNextTickMs()) == 0) {
+      appTick();
+      flush_commands();
+    }
   }
 
   return -1;
@@ -134,45 +283,583 @@ static void on_message_send(uint32_t msg_len, uint8_t* msg_data)
 {
   /** Variable for storing function return values. */
   int32_t ret;
+  uint32_t header;
 
-  ret = uartTx(msg_len, msg_data);
+  memcpy(&header, msg_data, sizeof(header));
+  metricsCountCommand(BGLIB_MSG_ID(header));
+  flightRecorderAdd(flightRecorderToNcp, msg_data, (uint16_t)msg_len, metricsNowUs());
+  ret = ncpPortTx(msg_len, msg_data);
   if (ret < 0) {
     printf("Failed to write to serial port %s, ret: %d, errno: %d\n", uart_port, ret, errno);
     exit(EXIT_FAILURE);
   }
 }
 
+/***********************************************************************************************//**
+ *  \brief  Direct BGAPI traffic and event handling to one of the NCPs. BGLIB has a single set of
+ *          buffers, so the selected NCP's events must all be handled before another is selected.
+ *  \param[in] ncp Index of the NCP.
+ **************************************************************************************************/
+static void select_ncp(uint8_t ncp)
+{
+  ncpPortSelect(ncp);
+#if defined(__linux__)
+  if (event_loop_mode) {
+    ncpReaderSelect(ncp);
+  }
+#endif
+  appSelectNcp(ncp);
+  cmdQueueSelect(ncp);
+  flightRecorderSelect(ncp);
+  uart_port = ncps[ncp].port;
+}
+
+/***********************************************************************************************//**
+ *  \brief  Write the commands held for the selected NCP. They are held until the events at hand
+ *          have been handled, so they go out together.
+ **************************************************************************************************/
+static void flush_commands(void)
+{
+  if (ncpPortFlush() < 0) {
+    printf("Failed to write to serial port %s, errno: %d\n", uart_port, errno);
+    exit(EXIT_FAILURE);
+  }
+}
+
+/***********************************************************************************************//**
+ *  \brief  Wait until the selected NCP has sent more, without the event loop.
+ *  \param[in] timeout_ms Longest wait in ms, APP_TICK_IDLE to wait for the NCP only.
+ *  \return  1 if there may be input, 0 once the timeout has passed.
+ **************************************************************************************************/
+static int wait_for_ncp(uint32_t timeout_ms)
+{
+  int32_t ret;
+
+  if (ncpPortRxPeek() > 0) {
+    return 1;
+  }
+  ret = ncpPortWait((timeout_ms == APP_TICK_IDLE) ? NCP_PORT_WAIT_FOREVER : timeout_ms);
+  if (ret < 0) {
+    printf("Serial port %s closed\n", uart_port);
+    exit(EXIT_FAILURE);
+  }
+  /* A signal, e.g. SIGUSR1 for the flight recorder, is seen to on the way round. */
+  return (int)ret;
+}
+
+/***********************************************************************************************//**
+ *  \brief  Parse the <serial port> <baud rate> [flow control] groups, one for each NCP.
+ *  \param[in] argc Argument count.
+ *  \param[in] argv Arguments, the groups start at optind.
+ *  \return  0 on success, -1 on failure.
+ **************************************************************************************************/
+static int parse_ncps(int argc, char* argv[])
+{
+  NcpLink* link;
+  int i = optind;
+
+  if (argc - optind < 2) {
+    ncps[0].port = default_uart_port;
+    ncps[0].baud_rate = default_baud_rate;
+    ncps[0].flowcontrol = 1;
+    ncp_count = 1;
+    return 0;
+  }
+  while (i < argc) {
+    if (ncp_count == MAX_NCPS || i + 1 >= argc) {
+      return -1;
+    }
+    link = &ncps[ncp_count++];
+    link->port = argv[i];
+    link->baud_rate = atoi(argv[i + 1]);
+    link->flowcontrol = 1;
+    i += 2;
+    /* Flow control is optional, serial ports are never named 0 or 1. */
+    if (i < argc && (strcmp(argv[i], "0") == 0 || strcmp(argv[i], "1") == 0)) {
+      link->flowcontrol = atoi(argv[i++]);
+    }
+    if (!link->port || !link->baud_rate) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
 /***********************************************************************************************//**
  *  \brief  Serial Port initialisation routine.
  *  \param[in] argc Argument count.
  *  \param[in] argv Buffer contaning Serial Port data.
  *  \return  0 on success, -1 on failure.
  **************************************************************************************************/
-static int appSerialPortInit(int argc, char* argv[], int32_t timeout)
+static int appSerialPortInit(int argc, char* argv[])
 {
-  uint32_t flowcontrol = 1;
+  uint8_t i;
+  int opt;
+
+  /**
+   * Handle the command-line options.
+   */
+  while ((opt = getopt(argc, argv, "aA:beF:g:i:m:no:pq:r:R:s:St:w")) != -1) {
+    switch (opt) {
+      case 'a':
+        scanPolicySetEnabled(true);
+        break;
+      case 'A':
+        if (sensorStatsAddRule(optarg) < 0) {
+          printf("Bad alert rule %s, expected e.g. temp>30 or rate<-2\n", optarg);
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case 'b':
+        broadcastSetEnabled(true);
+        break;
+      case 'e':
+#if defined(__linux__)
+        event_loop_mode = true;
+        break;
+#else
+        printf("Event loop mode is only available on Linux\n");
+        exit(EXIT_FAILURE);
+#endif
+      case 'F':
+        flight_recorder_file = optarg;
+        break;
+      case 'g':
+        gatt_cache_file = optarg;
+        break;
+      case 'i':
+        appSetInfoPeriod((uint32_t)strtoul(optarg, NULL, 10) * 1000u);
+        break;
+      case 'm':
+        metrics_address = optarg;
+        break;
+      case 'n':
+        appSetNotifications(true);
+        break;
+      case 'o':
+        if (outputSinkParseFormat(optarg, &output_format) < 0) {
+          printf(USAGE, argv[0]);
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case 'p':
+        linkPolicySetEnabled(true);
+        break;
+      case 'q':
+        if (cmdQueueSetDepth((uint8_t)atoi(optarg)) < 0) {
+          printf(USAGE, argv[0]);
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case 'r':
+        appSetRssiPeriod((uint32_t)strtoul(optarg, NULL, 10));
+        break;
+      case 'R':
+        rotationSetInterval((uint32_t)strtoul(optarg, NULL, 10) * 1000u);
+        break;
+      case 's':
+        reading_store_file = optarg;
+        break;
+      case 'S':
+        supervisionSetEnabled(true);
+        break;
+      case 't':
+        sensor_table_name = optarg;
+        break;
+      case 'w':
+        warm_start = true;
+        break;
+      default:
+        printf(USAGE, argv[0]);
+        exit(EXIT_FAILURE);
+    }
+  }
 
   /**
    * Handle the command-line arguments.
    */
-  baud_rate = default_baud_rate;
-  uart_port = default_uart_port;
-  switch (argc) {
-    case 4:
-      flowcontrol = atoi(argv[3]);
-    /** Falls through on purpose. */
-    case 3:
-      baud_rate = atoi(argv[2]);
-      uart_port = argv[1];
-    /** Falls through on purpose. */
-    default:
-      break;
-  }
-  if (!uart_port || !baud_rate || (flowcontrol > 1)) {
+  if (parse_ncps(argc, argv) < 0) {
     printf(USAGE, argv[0]);
     exit(EXIT_FAILURE);
   }
+  if (ncp_count > 1 && !event_loop_mode) {
+    printf("Several NCPs can only be driven in event loop mode (-e)\n");
+    exit(EXIT_FAILURE);
+  }
+  if (rotationEnabled() && !event_loop_mode) {
+    printf("Sensors can only be rotated in event loop mode (-e)\n");
+    exit(EXIT_FAILURE);
+  }
+  if (broadcastEnabled() && rotationEnabled()) {
+    printf("Broadcast readings (-b) are taken without connecting, there is nothing to rotate (-R)\n");
+    exit(EXIT_FAILURE);
+  }
+  if (scanPolicyEnabled() && !event_loop_mode) {
+    printf("The scan policy can only be followed in event loop mode (-e)\n");
+    exit(EXIT_FAILURE);
+  }
+  if (warm_start && !event_loop_mode) {
+    printf("A warm start (-w) is only possible in event loop mode (-e)\n");
+    exit(EXIT_FAILURE);
+  }
+  if (supervisionEnabled() && !event_loop_mode) {
+    printf("Connections can only be supervised in event loop mode (-e)\n");
+    exit(EXIT_FAILURE);
+  }
+  if (metrics_address && !event_loop_mode) {
+    printf("Metrics can only be served in event loop mode (-e)\n");
+    exit(EXIT_FAILURE);
+  }
+  uart_port = ncps[0].port;
+
+  /* Initialise the serial ports with RTS/CTS enabled. Both modes wait for input with poll or
+   * epoll, the reads do not block. On Windows one port is read through the uart driver. */
+  for (i = 0; i < ncp_count; i++) {
+    if (ncpPortOpen(ncps[i].port, ncps[i].baud_rate, ncps[i].flowcontrol) < 0) {
+      printf("Failed to open serial port %s\n", ncps[i].port);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+#if defined(__linux__)
+/***********************************************************************************************//**
+ *  \brief  Handle every event that has been read. Command responses among them complete their
+ *          commands, which never keep events waiting. The commands issued meanwhile are written
+ *          at the end, in one go.
+ **************************************************************************************************/
+static void drain_events(void)
+{
+  struct gecko_cmd_packet* evt;
+
+  while ((evt = cmdQueuePeekEvent()) != NULL) {
+    APP_HANDLE_EVENTS(evt);
+  }
+  flush_commands();
+}
+
+/***********************************************************************************************//**
+ *  \brief  Called by the event loop when the NCP reader has queued packets.
+ *  \param[in] context Unused.
+ **************************************************************************************************/
+static void on_packets(void* context)
+{
+  uint8_t i;
+
+  (void)context;
+  ncpReaderAcknowledge();
+  scanFilterAdvance((uint32_t)(metricsNowUs() / 1000));
+  for (i = 0; i < ncp_count; i++) {
+    select_ncp(i);
+    drain_events();
+    if (ncpReaderFailed()) {
+      printf("Serial port %s closed\n", uart_port);
+      exit(EXIT_FAILURE);
+    }
+  }
+  schedule_app_timer();
+}
 
-  /* Initialise the serial port with RTS/CTS enabled. */
-  return uartOpen((int8_t*)uart_port, baud_rate, flowcontrol, timeout);
+/***********************************************************************************************//**
+ *  \brief  Called by the event loop when a metrics client connects.
+ *  \param[in] context The listening descriptor.
+ **************************************************************************************************/
+static void on_metrics_request(void* context)
+{
+  metricsServe(*(int*)context);
+}
+
+/** Listening descriptor of the metrics endpoint. */
+static int metrics_fd = -1;
+
+/** Timer resetting the NCP until it boots. */
+static int boot_timer = -1;
+
+/** One-shot timer giving up on system_hello after a warm start. */
+static int hello_timer = -1;
+
+/** One-shot timer for the work due on the host clock, and the time it is armed for in ms. */
+static int app_timer = -1;
+static uint64_t app_timer_due_ms = UINT64_MAX;
+
+/***********************************************************************************************//**
+ *  \brief  Arm the app timer for the earliest work due on the host clock of any NCP, or disarm it
+ *          if there is none. Called whenever events have been handled.
+ **************************************************************************************************/
+static void schedule_app_timer(void)
+{
+  uint32_t wait_ms = APP_TICK_IDLE;
+  uint64_t due_ms;
+  uint8_t i;
+
+  for (i = 0; i < ncp_count; i++) {
+    select_ncp(i);
+    wait_ms = MIN(wait_ms, appNextTickMs());
+  }
+  due_ms = (wait_ms == APP_TICK_IDLE) ? UINT64_MAX : metricsNowUs() / 1000 + wait_ms;
+  /* Only set the timer when the deadline comes forward. One that has moved back, e.g. with every
+   * command answered, costs a spare tick at most, a system call per batch of events would cost
+   * more. */
+  if (due_ms >= app_timer_due_ms) {
+    return;
+  }
+  app_timer_due_ms = due_ms;
+  eventLoopSetTimeout(app_timer, (wait_ms == APP_TICK_IDLE) ? EVENT_LOOP_NEVER : wait_ms);
+}
+
+/***********************************************************************************************//**
+ *  \brief  Reset the NCPs that have not reported boot again, stop once all of them have.
+ *  \param[in] context Unused.
+ **************************************************************************************************/
+static void on_boot_timer(void* context)
+{
+  bool booted = true;
+  uint8_t i;
+
+  (void)context;
+  for (i = 0; i < ncp_count; i++) {
+    select_ncp(i);
+    if (!appIsBooted()) {
+      printf("No boot event from %s, resetting NCP target...\n", uart_port);
+      gecko_cmd_system_reset(0);
+      drain_events();
+      booted = false;
+    }
+  }
+  if (booted) {
+    eventLoopSetTimer(boot_timer, 0);
+  }
+  schedule_app_timer();
+}
+
+/***********************************************************************************************//**
+ *  \brief  Reset the NCPs that have not answered system_hello since the warm start, and keep
+ *          resetting them until they boot as after a cold start.
+ *  \param[in] context Unused.
+ **************************************************************************************************/
+static void on_hello_timer(void* context)
+{
+  uint8_t i;
+
+  (void)context;
+  for (i = 0; i < ncp_count; i++) {
+    select_ncp(i);
+    if (!appIsBooted()) {
+      printf("No answer to system_hello from %s, resetting NCP target...\n", uart_port);
+      gecko_cmd_system_reset(0);
+      drain_events();
+      eventLoopSetTimer(boot_timer, BOOT_RETRY_PERIOD_MS);
+    }
+  }
+  schedule_app_timer();
+}
+
+/***********************************************************************************************//**
+ *  \brief  Issue the work due on the host clock while the NCPs are quiet.
+ *  \param[in] context Unused.
+ **************************************************************************************************/
+static void on_app_timer(void* context)
+{
+  uint8_t i;
+
+  (void)context;
+  app_timer_due_ms = UINT64_MAX;
+  for (i = 0; i < ncp_count; i++) {
+    select_ncp(i);
+    appTick();
+    drain_events();
+  }
+  schedule_app_timer();
+}
+
+/***********************************************************************************************//**
+ *  \brief  Called by the event loop on SIGUSR1, dumps the flight recorder.
+ *  \param[in] context Unused.
+ **************************************************************************************************/
+static void on_dump_signal(void* context)
+{
+  (void)context;
+  flightRecorderRequestDump();
+  flightRecorderPoll();
 }
+
+/***********************************************************************************************//**
+ *  \brief  Serve the NCP from an epoll loop until SIGINT or SIGTERM.
+ *  \return  exit status.
+ **************************************************************************************************/
+static int appEventLoop(void)
+{
+  int sig;
+
+  if (eventLoopInit() < 0
+      || (boot_timer = eventLoopAddTimer(warm_start ? 0 : BOOT_RETRY_PERIOD_MS, on_boot_timer,
+                                         NULL)) < 0
+      || (hello_timer = eventLoopAddTimer(0, on_hello_timer, NULL)) < 0
+      || (warm_start && eventLoopSetTimeout(hello_timer, WARM_START_HELLO_TIMEOUT_MS) < 0)
+      || (app_timer = eventLoopAddTimer(0, on_app_timer, NULL)) < 0
+      || eventLoopAddSignal(SIGUSR1, on_dump_signal, NULL) < 0) {
+    printf("Event loop init failure, errno: %d\n", errno);
+    return EXIT_FAILURE;
+  }
+  /* Started once the signals are blocked, so they are all taken by the event loop. */
+  if (ncpReaderStart(ncp_count) < 0
+      || eventLoopAddFd(ncpReaderFd(), on_packets, NULL) < 0) {
+    printf("NCP reader init failure, errno: %d\n", errno);
+    return EXIT_FAILURE;
+  }
+  if (metrics_address) {
+    if ((metrics_fd = metricsListen(metrics_address)) < 0
+        || eventLoopAddFd(metrics_fd, on_metrics_request, &metrics_fd) < 0) {
+      printf("Failed to serve metrics on %s, errno: %d\n", metrics_address, errno);
+      return EXIT_FAILURE;
+    }
+  }
+  schedule_app_timer();
+
+  sig = eventLoopRun();
+
+  /* Clean shutdown. */
+  gattCacheClose();
+  linkStateClose();
+  readingStoreClose();
+  ncpReaderStop();
+  ncpPortClose();
+  if (metrics_fd >= 0) {
+    close(metrics_fd);
+  }
+  rotationReport(stderr);
+  broadcastReport(stderr);
+  scanPolicyReport(stderr);
+  linkPolicyReport(stderr);
+  supervisionReport(stderr);
+  sensorStatsReport(stderr);
+#if defined(APP_BENCH)
+  benchReport(sig);
+#endif
+  printf("\r\nShutting down\r\n");
+  return (sig < 0) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+#endif
+
+#if defined(APP_BENCH)
+/***************************************************************************************************
+ * Benchmark Instrumentation
+ **************************************************************************************************/
+
+/** Event handler cost accumulated since start-up. */
+static struct {
+  uint64_t startNs;
+  uint64_t events;
+  uint64_t cpuNs;
+  uint64_t wallNs;
+} bench;
+
+static uint64_t benchClockNs(clockid_t clock)
+{
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/***********************************************************************************************//**
+ *  \brief  Print the event handler statistics and exit. Called from the main loop once it has
+ *          seen SIGINT or SIGTERM, never from the signal handler.
+ *  \param[in] sig Signal number.
+ **************************************************************************************************/
+static void benchReport(int sig)
+{
+  char line[512];
+  double runSec = (benchClockNs(CLOCK_MONOTONIC) - bench.startNs) / 1e9;
+  double events = bench.events ? (double)bench.events : 1.0;
+  CmdQueueStats cmds;
+  int len;
+#if defined(__linux__)
+  NcpReaderStats reader;
+  uint32_t queuePeak = 0;
+  uint8_t i;
+#endif
+
+  (void)sig;
+  cmdQueueGetStats(&cmds);
+  len = snprintf(line, sizeof(line),
+                 "client: %llu events in %.1f s (%.1f events/s), appHandleEvents %.2f us cpu/event, "
+                 "%.2f us wall/event, %lu readings dropped\n"
+                 "client: %llu commands, round trip %.0f us avg %llu us p99 %lu us max, "
+                 "peak %lu in flight %lu waiting, %llu unmatched responses, %llu lost, %llu late\n",
+                 (unsigned long long)bench.events, runSec, bench.events / runSec,
+                 bench.cpuNs / events / 1e3, bench.wallNs / events / 1e3,
+                 (unsigned long)outputSinkDropped(),
+                 (unsigned long long)cmds.completed,
+                 cmds.completed ? (double)cmds.rttTotalUs / cmds.completed : 0.0,
+                 (unsigned long long)metricsPercentile(metricCommandRtt, 99.0),
+                 (unsigned long)cmds.rttMaxUs, (unsigned long)cmds.peakInFlight,
+                 (unsigned long)cmds.peakWaiting, (unsigned long long)cmds.unmatched,
+                 (unsigned long long)cmds.lost, (unsigned long long)cmds.late);
+#if defined(__linux__)
+  ncpReaderGetStats(&reader);
+  for (i = 0; i < reader.ports; i++) {
+    queuePeak = (reader.queueHighWater[i] > queuePeak) ? reader.queueHighWater[i] : queuePeak;
+  }
+  if (len > 0 && reader.ports > 0 && (size_t)len < sizeof(line)) {
+    len += snprintf(&line[len], sizeof(line) - (size_t)len,
+                    "client: reader %llu packets, pool peak %lu of %u, queue peak %lu, %llu stalls\n",
+                    (unsigned long long)reader.packets, (unsigned long)reader.poolHighWater,
+                    (unsigned)NCP_READER_POOL_SIZE, (unsigned long)queuePeak,
+                    (unsigned long long)reader.stalls);
+  }
+#endif
+  if (len > 0 && write(STDERR_FILENO, line, (size_t)len) < 0) {
+    /* Nothing left to do about it. */
+  }
+  _exit(EXIT_SUCCESS);
+}
+
+/***********************************************************************************************//**
+ *  \brief  Note SIGINT or SIGTERM for the poll loop to report on.
+ *  \param[in] sig Signal number.
+ **************************************************************************************************/
+static void benchOnSignal(int sig)
+{
+  bench_signal = sig;
+}
+
+/***********************************************************************************************//**
+ *  \brief  Start the benchmark clock and catch the signals the report is printed on. The event
+ *          loop takes them through its signalfd instead.
+ **************************************************************************************************/
+static void benchInit(void)
+{
+  struct sigaction action;
+
+  bench.startNs = benchClockNs(CLOCK_MONOTONIC);
+  if (!event_loop_mode) {
+    /* Without SA_RESTART, so the signal cuts the wait on the port short. */
+    memset(&action, 0, sizeof(action));
+    sigemptyset(&action.sa_mask);
+    action.sa_handler = benchOnSignal;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+  }
+}
+
+/***********************************************************************************************//**
+ *  \brief  Run the application event handler and account its CPU and wall clock time.
+ *  \param[in] evt Event pointer.
+ **************************************************************************************************/
+static void benchHandleEvents(struct gecko_cmd_packet* evt)
+{
+  uint64_t cpu;
+  uint64_t wall;
+
+  if (NULL == evt) {
+    return;
+  }
+  cpu = benchClockNs(CLOCK_THREAD_CPUTIME_ID);
+  wall = benchClockNs(CLOCK_MONOTONIC);
+  appHandleEvents(evt);
+  bench.cpuNs += benchClockNs(CLOCK_THREAD_CPUTIME_ID) - cpu;
+  bench.wallNs += benchClockNs(CLOCK_MONOTONIC) - wall;
+  bench.events++;
+}
+#endif
@@ -0,0 +1,88 @@
+/***************************************************************************//**
+ * @file
+ * @brief Decoding of the Health Thermometer Temperature Measurement
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2018 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+/* standard library headers */
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Own header */
+#include "measurement.h"
+
+// Flags and FLOAT, then a 7-byte time stamp and a type byte if the flags say so
+#define MEASUREMENT_MIN_LEN           5
+#define TIME_STAMP_LEN                7
+
+// Thousandths of a unit of an IEEE-11073 32-bit FLOAT, false for NaN, infinities and the like
+static bool floatToMilli(const uint8_t *data, int32_t *milli)
+{
+  int32_t mantissa = (int32_t)(data[0] | (data[1] << 8) | ((uint32_t)data[2] << 16));
+  // Wide enough for the exponent plus 3, which an int8_t would wrap from 125 up
+  int exponent = (int8_t)data[3];
+  int64_t value;
+
+  // Special values are the mantissas from 0x7ffffe to 0x800002
+  if (mantissa >= 0x7ffffe && mantissa <= 0x800002) {
+    return false;
+  }
+  if (mantissa & 0x800000) {
+    mantissa -= 0x1000000;
+  }
+  value = mantissa;
+  for (exponent += 3; exponent > 0 && value != 0; exponent--) {
+    value *= 10;
+    if (value > INT32_MAX || value < INT32_MIN) {
+      return false;
+    }
+  }
+  for (; exponent < 0; exponent++) {
+    value /= 10;
+  }
+  *milli = (int32_t)value;
+  return true;
+}
+
+/***************************************************************************************************
+ * Public Function Definitions
+ **************************************************************************************************/
+
+int measurementDecode(const uint8_t *data, uint8_t len, uint32_t *temperature)
+{
+  int end = MEASUREMENT_MIN_LEN;
+  int32_t milli;
+
+  if (len < MEASUREMENT_MIN_LEN || !floatToMilli(&data[1], &milli)) {
+    return -1;
+  }
+  if (data[0] & MEASUREMENT_TIME_STAMP) {
+    end += TIME_STAMP_LEN;
+  }
+  if (data[0] & MEASUREMENT_TEMPERATURE_TYPE) {
+    end += 1;
+  }
+  if (len < end) {
+    return -1;
+  }
+  if (data[0] & MEASUREMENT_FAHRENHEIT) {
+    milli = (int32_t)(((int64_t)milli - 32000) * 5 / 9);
+  }
+  // -0.001 degrees would read as TEMP_INVALID, and rounds to zero as shown anyway
+  if (milli == -1) {
+    milli = 0;
+  }
+  *temperature = (uint32_t)milli;
+  return end;
+}
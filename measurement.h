@@ -0,0 +1,66 @@
+/***************************************************************************//**
+ * @file
+ * @brief Decoding of the Health Thermometer Temperature Measurement
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2018 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+#ifndef MEASUREMENT_H
+#define MEASUREMENT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+/***********************************************************************************************//**
+ * \defgroup measurement Measurement
+ * \brief Temperature Measurement values, as indicated by the thermometers or broadcast in their
+ *        advertisements: a flags byte, an IEEE-11073 32-bit FLOAT, then a time stamp and a
+ *        temperature type if the flags say so
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ * @addtogroup measurement
+ * @{
+ **************************************************************************************************/
+
+ // Flags byte of a Temperature Measurement
+ #define MEASUREMENT_FAHRENHEIT        0x01
+ #define MEASUREMENT_TIME_STAMP        0x02
+ #define MEASUREMENT_TEMPERATURE_TYPE  0x04
+
+/***************************************************************************************************
+ * Function Declarations
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  Decode a Temperature Measurement, scaling the FLOAT by its exponent and converting
+ *          Fahrenheit to Celsius. NaN, infinities and values out of range are not readings.
+ *  \param[in]  data  measurement value
+ *  \param[in]  len  length of the value
+ *  \param[out]  temperature  reading in thousandths of a degree Celsius, two's complement below
+ *               zero, never TEMP_INVALID: -0.001 degrees is given as 0
+ *  \return  length of the measurement, the bytes after it are not part of it, or -1 if the
+ *           value is short or holds no valid reading
+ **************************************************************************************************/
+int measurementDecode(const uint8_t *data, uint8_t len, uint32_t *temperature);
+
+/** @} (end addtogroup measurement) */
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* MEASUREMENT_H */
@@ -0,0 +1,97 @@
+/***************************************************************************//**
+ * @file
+ * @brief Temperature Measurement decoding test
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2018 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+/**
+ * Decodes Temperature Measurement values, in Celsius and Fahrenheit, with
+ * and without a time stamp and temperature type, and checks the reading and
+ * the length each gives. Special FLOAT values, exponents that take the value
+ * out of range, including those at the top of the exponent byte, and short
+ * values must give no reading, and -0.001 degrees must not read as
+ * TEMP_INVALID. Exits with status 1 on a failure. */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#include "measurement.h"
+
+/***************************************************************************************************
+ * Local Macros and Definitions
+ **************************************************************************************************/
+
+// The invalid reading of the client, which no decoded value may equal
+#define TEST_TEMP_INVALID            0xFFFFFFFFu
+#define TEST_NO_READING              -1
+
+typedef struct {
+  const char *name;
+  uint8_t data[13];
+  uint8_t len;
+  int end;                    // length decoded, TEST_NO_READING if none
+  int32_t milli;              // reading, when there is one
+} DecodeCase;
+
+// A FLOAT is a 24-bit mantissa then an exponent byte, both little endian two's complement
+static const DecodeCase cases[] = {
+  { "36.6 C",            { 0x00, 0x6e, 0x01, 0x00, 0xff }, 5, 5, 36600 },
+  { "-12.5 C",           { 0x00, 0x83, 0xff, 0xff, 0xff }, 5, 5, -12500 },
+  { "25 C, 10^0",        { 0x00, 0x19, 0x00, 0x00, 0x00 }, 5, 5, 25000 },
+  { "98.6 F",            { 0x01, 0xda, 0x03, 0x00, 0xff }, 5, 5, 37000 },
+  { "-0.001 C",          { 0x00, 0xff, 0xff, 0xff, 0xfd }, 5, 5, 0 },
+  { "-0.002 C",          { 0x00, 0xfe, 0xff, 0xff, 0xfd }, 5, 5, -2 },
+  { "0.0001 C, rounded", { 0x00, 0x01, 0x00, 0x00, 0xfc }, 5, 5, 0 },
+  { "time stamp, type",  { 0x06, 0x6e, 0x01, 0x00, 0xff, 0xe4, 0x07, 1, 2, 3, 4, 5, 2 }, 13, 13,
+    36600 },
+  { "trailing bytes",    { 0x00, 0x6e, 0x01, 0x00, 0xff, 0xaa }, 6, 5, 36600 },
+  { "0 * 10^127",        { 0x00, 0x00, 0x00, 0x00, 0x7f }, 5, 5, 0 },
+  { "short",             { 0x00, 0x6e, 0x01, 0x00 }, 4, TEST_NO_READING, 0 },
+  { "short time stamp",  { 0x02, 0x6e, 0x01, 0x00, 0xff, 0xe4, 0x07 }, 7, TEST_NO_READING, 0 },
+  { "NaN",               { 0x00, 0xff, 0xff, 0x7f, 0x00 }, 5, TEST_NO_READING, 0 },
+  { "+infinity",         { 0x00, 0xfe, 0xff, 0x7f, 0x00 }, 5, TEST_NO_READING, 0 },
+  { "-infinity",         { 0x00, 0x02, 0x00, 0x80, 0x00 }, 5, TEST_NO_READING, 0 },
+  { "1 * 10^7",          { 0x00, 0x01, 0x00, 0x00, 0x07 }, 5, TEST_NO_READING, 0 },
+  { "1 * 10^125",        { 0x00, 0x01, 0x00, 0x00, 0x7d }, 5, TEST_NO_READING, 0 },
+  { "1 * 10^127",        { 0x00, 0x01, 0x00, 0x00, 0x7f }, 5, TEST_NO_READING, 0 },
+  { "-1 * 10^127",       { 0x00, 0xff, 0xff, 0xff, 0x7f }, 5, TEST_NO_READING, 0 },
+};
+
+/***************************************************************************************************
+ * Public Function Definitions
+ **************************************************************************************************/
+
+int main(void)
+{
+  uint32_t temperature;
+  uint32_t failures = 0;
+  uint32_t i;
+  int end;
+
+  for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+    temperature = TEST_TEMP_INVALID;
+    end = measurementDecode(cases[i].data, cases[i].len, &temperature);
+    if (end != cases[i].end
+        || (end != TEST_NO_READING
+            && (temperature != (uint32_t)cases[i].milli || temperature == TEST_TEMP_INVALID))) {
+      fprintf(stderr, "decode-test: %s decoded to length %d, %ld m°C, %d and %ld expected\n",
+              cases[i].name, end, (long)(int32_t)temperature, cases[i].end,
+              (long)cases[i].milli);
+      failures++;
+    }
+  }
+  printf("decode-test: %u values, %s\n", (unsigned)i, (failures == 0) ? "ok" : "FAILED");
+  return (failures == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,578 @@
+/***************************************************************************//**
+ * @file
+ * @brief Counters and latency histograms, exported in Prometheus text format
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2018 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+/* standard library headers */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#if defined(__linux__)
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+/* Own header */
+#include "metrics.h"
+#if defined(__linux__)
+#include "event_loop.h"
+#endif
+#include "cmd_queue.h"
+#include "output_sink.h"
+#include "ncp_reader.h"
+
+// Top bits of a multiplicative hash index the ID tables, they depend on the class and method
+// bytes that tell BGAPI messages apart
+#define ID_HASH_SHIFT                 26
+#if METRICS_MAX_IDS != (1 << (32 - ID_HASH_SHIFT))
+#error "METRICS_MAX_IDS must match ID_HASH_SHIFT"
+#endif
+
+// Room for the whole exposition, each histogram takes about 6 KB
+#define METRICS_TEXT_SIZE             65536
+#define METRICS_HEADER_SIZE           160
+#define METRICS_PREFIX                "thermometer_client_"
+
+typedef struct {
+  uint64_t buckets[METRICS_BUCKETS];
+  uint64_t count;
+  uint64_t sumUs;
+} Histogram;
+
+// Open addressed, an ID of 0 marks a free entry as BGAPI IDs never are 0
+typedef struct {
+  uint32_t id;
+  uint64_t count;
+} IdCount;
+
+static const struct {
+  const char *name;
+  const char *help;
+} histogramInfo[metricHistogramCount] = {
+  [metricCommandRtt]      = { "command_rtt_seconds", "BGAPI command written to its response read" },
+  [metricConnectionSetup] = { "connection_setup_seconds", "Connection opened to indications enabled" },
+  [metricReadingDelay]    = { "reading_delay_seconds", "Indication read from the NCP to reading queued for output" },
+};
+
+static const struct {
+  const char *name;
+  const char *help;
+} counterInfo[metricCounterCount] = {
+  [metricConnectionsOpened] = { "connections_opened_total", "Connections opened" },
+  [metricConnectionsClosed] = { "connections_closed_total", "Connections closed" },
+  [metricGattCacheHits]     = { "gatt_cache_hits_total", "Connections set up from handles in the GATT cache" },
+  [metricScanAccepted]      = { "scan_accepted_total", "Scan responses that led to a connection attempt" },
+  [metricReadings]          = { "readings_total", "Temperature readings received" },
+  [metricAlerts]            = { "alerts_total", "Alert rules raised" },
+  [metricNotifications]     = { "notifications_total", "Readings received as notifications" },
+  [metricPhyUpdates]        = { "phy_updates_total", "PHY changes reported on the connections" },
+  [metricSupervisionCloses] = { "supervision_closes_total", "Connections closed for missing their deadlines" },
+  [metricReconnectHolds]    = { "reconnect_holds_total", "Sensors held back from reconnecting after a drop" },
+};
+
+static const struct {
+  const char *name;
+  const char *help;
+} gaugeInfo[metricGaugeCount] = {
+  [metricConnectionsActive] = { "connections_active", "Connections in the connection tables" },
+};
+
+static Histogram histograms[metricHistogramCount];
+static uint64_t counters[metricCounterCount];
+static int64_t gauges[metricGaugeCount];
+static IdCount eventCounts[METRICS_MAX_IDS];
+static IdCount commandCounts[METRICS_MAX_IDS];
+// IDs that found their table full
+static uint64_t otherIds;
+static uint64_t readTimeUs;
+
+// Bucket of a value, a clz and a shift above the linear range
+static uint32_t bucketOf(uint64_t us)
+{
+  uint32_t exponent;
+
+  if (us < METRICS_LINEAR_BUCKETS) {
+    return (uint32_t)us;
+  }
+  exponent = 63u - (uint32_t)__builtin_clzll(us);
+  if (exponent >= METRICS_MAX_EXPONENT) {
+    return METRICS_BUCKETS - 1;
+  }
+  // Two bits below the leading one pick the sub-bucket
+  return METRICS_LINEAR_BUCKETS + (exponent - 3) * METRICS_SUB_BUCKETS
+         + (uint32_t)((us >> (exponent - 2)) & (METRICS_SUB_BUCKETS - 1));
+}
+
+// Largest value counted in a bucket
+static uint64_t bucketMaxUs(uint32_t bucket)
+{
+  uint32_t exponent;
+  uint32_t sub;
+
+  if (bucket < METRICS_LINEAR_BUCKETS) {
+    return bucket;
+  }
+  exponent = 3 + (bucket - METRICS_LINEAR_BUCKETS) / METRICS_SUB_BUCKETS;
+  sub = (bucket - METRICS_LINEAR_BUCKETS) % METRICS_SUB_BUCKETS;
+  return ((uint64_t)(METRICS_SUB_BUCKETS + sub + 1) << (exponent - 2)) - 1;
+}
+
+static void countId(IdCount *table, uint32_t id)
+{
+  uint32_t i = (uint32_t)(id * 2654435761u) >> ID_HASH_SHIFT;
+  uint32_t probes;
+
+  for (probes = 0; probes < METRICS_MAX_IDS; probes++) {
+    if (table[i].id == id) {
+      table[i].count++;
+      return;
+    }
+    if (table[i].id == 0) {
+      table[i].id = id;
+      table[i].count = 1;
+      return;
+    }
+    i = (i + 1) & (METRICS_MAX_IDS - 1);
+  }
+  otherIds++;
+}
+
+// Appends to the exposition text, which stays terminated when it runs out of room
+typedef struct {
+  char     *buffer;
+  uint32_t size;
+  uint32_t len;
+} Text;
+
+static void append(Text *text, const char *format, ...)
+{
+  va_list args;
+  int n;
+
+  if (text->len + 1 >= text->size) {
+    return;
+  }
+  va_start(args, format);
+  n = vsnprintf(&text->buffer[text->len], text->size - text->len, format, args);
+  va_end(args);
+  if (n > 0) {
+    text->len = (text->len + (uint32_t)n < text->size) ? text->len + (uint32_t)n : text->size - 1;
+  }
+}
+
+static void renderHistogram(Text *text, MetricHistogram h)
+{
+  const Histogram *hist = &histograms[h];
+  uint64_t cumulative = 0;
+  uint32_t b;
+
+  append(text, "# HELP " METRICS_PREFIX "%s %s\n# TYPE " METRICS_PREFIX "%s histogram\n",
+         histogramInfo[h].name, histogramInfo[h].help, histogramInfo[h].name);
+  for (b = 0; b < METRICS_BUCKETS - 1; b++) {
+    cumulative += hist->buckets[b];
+    append(text, METRICS_PREFIX "%s_bucket{le=\"%.6f\"} %llu\n", histogramInfo[h].name,
+           bucketMaxUs(b) / 1e6, (unsigned long long)cumulative);
+  }
+  append(text, METRICS_PREFIX "%s_bucket{le=\"+Inf\"} %llu\n", histogramInfo[h].name,
+         (unsigned long long)hist->count);
+  append(text, METRICS_PREFIX "%s_sum %.6f\n" METRICS_PREFIX "%s_count %llu\n",
+         histogramInfo[h].name, hist->sumUs / 1e6,
+         histogramInfo[h].name, (unsigned long long)hist->count);
+}
+
+static void renderIds(Text *text, const char *name, const char *help, const IdCount *table)
+{
+  uint32_t i;
+
+  append(text, "# HELP " METRICS_PREFIX "%s %s\n# TYPE " METRICS_PREFIX "%s counter\n",
+         name, help, name);
+  for (i = 0; i < METRICS_MAX_IDS; i++) {
+    if (table[i].id != 0) {
+      append(text, METRICS_PREFIX "%s{id=\"0x%08x\"} %llu\n", name, (unsigned)table[i].id,
+             (unsigned long long)table[i].count);
+    }
+  }
+}
+
+#if defined(__linux__)
+static void renderReader(Text *text)
+{
+  NcpReaderStats reader;
+  uint8_t i;
+
+  ncpReaderGetStats(&reader);
+  if (reader.ports == 0) {
+    return;
+  }
+  append(text, "# HELP " METRICS_PREFIX "reader_packets_total Messages read by the NCP reader thread\n"
+         "# TYPE " METRICS_PREFIX "reader_packets_total counter\n"
+         METRICS_PREFIX "reader_packets_total %llu\n"
+         "# HELP " METRICS_PREFIX "reader_stalls_total Times the NCP reader waited for the packet pool\n"
+         "# TYPE " METRICS_PREFIX "reader_stalls_total counter\n"
+         METRICS_PREFIX "reader_stalls_total %llu\n"
+         "# HELP " METRICS_PREFIX "reader_pool_high_water Most packets out of the pool at once, of %u\n"
+         "# TYPE " METRICS_PREFIX "reader_pool_high_water gauge\n"
+         METRICS_PREFIX "reader_pool_high_water %lu\n"
+         "# HELP " METRICS_PREFIX "reader_queue_high_water Most packets waiting to be handled, by NCP\n"
+         "# TYPE " METRICS_PREFIX "reader_queue_high_water gauge\n",
+         (unsigned long long)reader.packets, (unsigned long long)reader.stalls,
+         (unsigned)NCP_READER_POOL_SIZE, (unsigned long)reader.poolHighWater);
+  for (i = 0; i < reader.ports; i++) {
+    append(text, METRICS_PREFIX "reader_queue_high_water{ncp=\"%u\"} %lu\n", (unsigned)i,
+           (unsigned long)reader.queueHighWater[i]);
+  }
+}
+#endif
+
+/***************************************************************************************************
+ * Public Function Definitions
+ **************************************************************************************************/
+
+uint64_t metricsNowUs(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
+
+void metricsObserve(MetricHistogram histogram, uint64_t us)
+{
+  Histogram *hist = &histograms[histogram];
+
+  hist->buckets[bucketOf(us)]++;
+  hist->count++;
+  hist->sumUs += us;
+}
+
+void metricsCount(MetricCounter counter)
+{
+  counters[counter]++;
+}
+
+void metricsGaugeAdd(MetricGauge gauge, int32_t delta)
+{
+  gauges[gauge] += delta;
+}
+
+void metricsCountEvent(uint32_t id)
+{
+  countId(eventCounts, id);
+}
+
+void metricsCountCommand(uint32_t id)
+{
+  countId(commandCounts, id);
+}
+
+void metricsSetReadTime(uint64_t us)
+{
+  readTimeUs = us;
+}
+
+uint64_t metricsReadTime(void)
+{
+  return readTimeUs;
+}
+
+uint64_t metricsPercentile(MetricHistogram histogram, double percent)
+{
+  const Histogram *hist = &histograms[histogram];
+  uint64_t rank = (uint64_t)(hist->count * percent / 100.0 + 0.5);
+  uint64_t cumulative = 0;
+  uint32_t b;
+
+  if (hist->count == 0) {
+    return 0;
+  }
+  if (rank == 0) {
+    rank = 1;
+  }
+  for (b = 0; b < METRICS_BUCKETS; b++) {
+    cumulative += hist->buckets[b];
+    if (cumulative >= rank) {
+      return bucketMaxUs(b);
+    }
+  }
+  return bucketMaxUs(METRICS_BUCKETS - 1);
+}
+
+uint32_t metricsRender(char *buffer, uint32_t size)
+{
+  Text text = { buffer, size, 0 };
+  CmdQueueStats cmds;
+  uint32_t i;
+
+  if (size == 0) {
+    return 0;
+  }
+  buffer[0] = '\0';
+  for (i = 0; i < metricHistogramCount; i++) {
+    renderHistogram(&text, (MetricHistogram)i);
+  }
+  for (i = 0; i < metricCounterCount; i++) {
+    append(&text, "# HELP " METRICS_PREFIX "%s %s\n# TYPE " METRICS_PREFIX "%s counter\n"
+           METRICS_PREFIX "%s %llu\n", counterInfo[i].name, counterInfo[i].help,
+           counterInfo[i].name, counterInfo[i].name, (unsigned long long)counters[i]);
+  }
+  for (i = 0; i < metricGaugeCount; i++) {
+    append(&text, "# HELP " METRICS_PREFIX "%s %s\n# TYPE " METRICS_PREFIX "%s gauge\n"
+           METRICS_PREFIX "%s %lld\n", gaugeInfo[i].name, gaugeInfo[i].help,
+           gaugeInfo[i].name, gaugeInfo[i].name, (long long)gauges[i]);
+  }
+  renderIds(&text, "events_total", "BGAPI events received, by message ID", eventCounts);
+  renderIds(&text, "commands_total", "BGAPI commands sent, by message ID", commandCounts);
+  append(&text, "# HELP " METRICS_PREFIX "messages_uncounted_total Messages whose ID found no room in the ID tables\n"
+         "# TYPE " METRICS_PREFIX "messages_uncounted_total counter\n"
+         METRICS_PREFIX "messages_uncounted_total %llu\n", (unsigned long long)otherIds);
+
+  cmdQueueGetStats(&cmds);
+  append(&text, "# HELP " METRICS_PREFIX "commands_in_flight Commands waiting for their response\n"
+         "# TYPE " METRICS_PREFIX "commands_in_flight gauge\n"
+         METRICS_PREFIX "commands_in_flight %lu\n"
+         "# HELP " METRICS_PREFIX "commands_waiting Commands waiting to be sent\n"
+         "# TYPE " METRICS_PREFIX "commands_waiting gauge\n"
+         METRICS_PREFIX "commands_waiting %lu\n"
+         "# HELP " METRICS_PREFIX "responses_unmatched_total Responses matching no command in flight\n"
+         "# TYPE " METRICS_PREFIX "responses_unmatched_total counter\n"
+         METRICS_PREFIX "responses_unmatched_total %llu\n"
+         "# HELP " METRICS_PREFIX "commands_lost_total Commands failed because their response was skipped or late\n"
+         "# TYPE " METRICS_PREFIX "commands_lost_total counter\n"
+         METRICS_PREFIX "commands_lost_total %llu\n"
+         "# HELP " METRICS_PREFIX "responses_late_total Responses of commands that had timed out, dropped\n"
+         "# TYPE " METRICS_PREFIX "responses_late_total counter\n"
+         METRICS_PREFIX "responses_late_total %llu\n"
+         "# HELP " METRICS_PREFIX "commands_dropped_total Commands that found the command queue full\n"
+         "# TYPE " METRICS_PREFIX "commands_dropped_total counter\n"
+         METRICS_PREFIX "commands_dropped_total %llu\n"
+         "# HELP " METRICS_PREFIX "readings_dropped_total Readings dropped by the output thread\n"
+         "# TYPE " METRICS_PREFIX "readings_dropped_total counter\n"
+         METRICS_PREFIX "readings_dropped_total %lu\n",
+         (unsigned long)cmds.inFlight, (unsigned long)cmds.waiting,
+         (unsigned long long)cmds.unmatched, (unsigned long long)cmds.lost,
+         (unsigned long long)cmds.late, (unsigned long long)cmds.overflows,
+         (unsigned long)outputSinkDropped());
+#if defined(__linux__)
+  renderReader(&text);
+#endif
+  return text.len;
+}
+
+#if defined(__linux__)
+
+// Clients of the metrics socket, served from the event loop without waiting on any of them
+typedef enum {
+  clientFree,
+  clientReading,
+  clientWriting
+} MetricsClientState;
+
+typedef struct {
+  int fd;
+  MetricsClientState state;
+  uint64_t acceptedUs;
+  uint32_t requestLen;
+  uint32_t responseLen;
+  uint32_t sent;
+  char request[1024];
+  char response[METRICS_HEADER_SIZE + METRICS_TEXT_SIZE];
+} MetricsClient;
+
+static MetricsClient clients[METRICS_MAX_CLIENTS];
+
+int metricsListen(const char *address)
+{
+  struct sockaddr_un local;
+  struct sockaddr_in inet;
+  int one = 1;
+  int fd;
+
+  if (strchr(address, '/') != NULL) {
+    if (strlen(address) >= sizeof(local.sun_path)) {
+      return -1;
+    }
+    memset(&local, 0, sizeof(local));
+    local.sun_family = AF_UNIX;
+    strcpy(local.sun_path, address);
+    // A socket left behind by an earlier run
+    unlink(address);
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (fd < 0 || bind(fd, (struct sockaddr *)&local, sizeof(local)) < 0) {
+      goto fail;
+    }
+  } else {
+    memset(&inet, 0, sizeof(inet));
+    inet.sin_family = AF_INET;
+    inet.sin_port = htons((uint16_t)atoi(address));
+    inet.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (fd < 0 || setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0
+        || bind(fd, (struct sockaddr *)&inet, sizeof(inet)) < 0) {
+      goto fail;
+    }
+  }
+  if (listen(fd, 4) < 0) {
+    goto fail;
+  }
+  return fd;
+
+  fail:
+  if (fd >= 0) {
+    close(fd);
+  }
+  return -1;
+}
+
+static void closeClient(MetricsClient *c)
+{
+  eventLoopRemoveFd(c->fd);
+  close(c->fd);
+  c->state = clientFree;
+}
+
+// A free slot, else that of the oldest client if it is past its time, NULL if none is
+static MetricsClient *takeClient(void)
+{
+  MetricsClient *oldest = &clients[0];
+  uint32_t i;
+
+  for (i = 0; i < METRICS_MAX_CLIENTS; i++) {
+    if (clients[i].state == clientFree) {
+      return &clients[i];
+    }
+    if (clients[i].acceptedUs < oldest->acceptedUs) {
+      oldest = &clients[i];
+    }
+  }
+  if (metricsNowUs() - oldest->acceptedUs < METRICS_REQUEST_TIMEOUT_MS * 1000ull) {
+    return NULL;
+  }
+  closeClient(oldest);
+  return oldest;
+}
+
+// Send what the socket takes, a closed connection is not worth a SIGPIPE
+static void writeResponse(MetricsClient *c)
+{
+  ssize_t n;
+
+  while (c->sent < c->responseLen) {
+    n = send(c->fd, &c->response[c->sent], c->responseLen - c->sent, MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if ((errno == EAGAIN || errno == EWOULDBLOCK) && c->state == clientWriting) {
+        return;
+      }
+      if ((errno == EAGAIN || errno == EWOULDBLOCK) && eventLoopWatchFd(c->fd, true) == 0) {
+        c->state = clientWriting;
+        return;
+      }
+      break;
+    }
+    c->sent += (uint32_t)n;
+  }
+  closeClient(c);
+}
+
+static void answer(MetricsClient *c)
+{
+  static char body[METRICS_TEXT_SIZE];
+  uint32_t bodyLen;
+  int headerLen;
+
+  bodyLen = metricsRender(body, sizeof(body));
+  headerLen = snprintf(c->response, METRICS_HEADER_SIZE,
+                       "HTTP/1.0 200 OK\r\n"
+                       "Content-Type: text/plain; version=0.0.4\r\n"
+                       "Content-Length: %lu\r\n"
+                       "Connection: close\r\n\r\n", (unsigned long)bodyLen);
+  memcpy(&c->response[headerLen], body, bodyLen);
+  c->responseLen = (uint32_t)headerLen + bodyLen;
+  c->sent = 0;
+  writeResponse(c);
+}
+
+// Take in the request headers, so closing does not reset the connection under the answer
+static void onClient(void *context)
+{
+  MetricsClient *c = context;
+  ssize_t n;
+
+  if (c->state == clientWriting) {
+    writeResponse(c);
+    return;
+  }
+  while (c->requestLen < sizeof(c->request) - 1) {
+    n = recv(c->fd, &c->request[c->requestLen], sizeof(c->request) - 1 - c->requestLen, 0);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return;
+    }
+    if (n < 0) {
+      closeClient(c);
+      return;
+    }
+    if (n == 0) {
+      break;
+    }
+    c->requestLen += (uint32_t)n;
+    c->request[c->requestLen] = '\0';
+    if (strstr(c->request, "\r\n\r\n") != NULL || strstr(c->request, "\n\n") != NULL) {
+      break;
+    }
+  }
+  answer(c);
+}
+
+void metricsServe(int listenFd)
+{
+  MetricsClient *c;
+  int flags;
+  int fd;
+
+  // The listening socket is non-blocking, take every client waiting
+  while ((fd = accept(listenFd, NULL, NULL)) >= 0) {
+    flags = fcntl(fd, F_GETFL);
+    c = takeClient();
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0 || c == NULL) {
+      close(fd);
+      continue;
+    }
+    c->fd = fd;
+    c->acceptedUs = metricsNowUs();
+    c->requestLen = 0;
+    if (eventLoopAddFd(fd, onClient, c) < 0) {
+      close(fd);
+      continue;
+    }
+    c->state = clientReading;
+    // The request has often arrived with the connection
+    onClient(c);
+  }
+}
+
+#endif /* __linux__ */
@@ -0,0 +1,176 @@
+/***************************************************************************//**
+ * @file
+ * @brief Counters and latency histograms, exported in Prometheus text format
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2018 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/***********************************************************************************************//**
+ * \defgroup metrics Metrics
+ * \brief Counters, per BGAPI message ID counters and log-linear latency histograms, updated from
+ *        the event thread with a few instructions each, and served over a local socket in
+ *        Prometheus text format.
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ * @addtogroup metrics
+ * @{
+ **************************************************************************************************/
+
+ // Histogram buckets: values below METRICS_LINEAR_BUCKETS us have a bucket each, above that
+ // each power of two is split in METRICS_SUB_BUCKETS, up to 2^METRICS_MAX_EXPONENT us (67 s)
+ #define METRICS_LINEAR_BUCKETS        8
+ #define METRICS_SUB_BUCKETS           4
+ #define METRICS_MAX_EXPONENT          26
+ #define METRICS_BUCKETS               (METRICS_LINEAR_BUCKETS \
+                                        + (METRICS_MAX_EXPONENT - 3) * METRICS_SUB_BUCKETS)
+ // BGAPI message IDs counted apart, events and commands each
+ #define METRICS_MAX_IDS               64
+ // Clients served at once, and how long one gets to send its request and take the answer
+ // before a new client may take its place, in ms; until then new clients are turned away
+ #define METRICS_MAX_CLIENTS           4
+ #define METRICS_REQUEST_TIMEOUT_MS    100
+
+/***************************************************************************************************
+ * Type Definitions
+ **************************************************************************************************/
+
+typedef enum {
+  metricCommandRtt,           // command written to its response read
+  metricConnectionSetup,      // connection opened to indications enabled
+  metricReadingDelay,         // indication read from the NCP to reading queued for output
+  metricHistogramCount
+} MetricHistogram;
+
+typedef enum {
+  metricConnectionsOpened,
+  metricConnectionsClosed,
+  metricGattCacheHits,        // connections set up from handles in the GATT cache
+  metricScanAccepted,         // scan responses that led to a connection attempt
+  metricReadings,
+  metricAlerts,               // alert rules raised, see sensor_stats.h
+  metricNotifications,        // readings that came without a confirmation
+  metricPhyUpdates,           // PHY changes reported on the links, see link_policy.h
+  metricSupervisionCloses,    // links closed past their deadlines, see supervision.h
+  metricReconnectHolds,       // sensors held back from reconnecting
+  metricCounterCount
+} MetricCounter;
+
+typedef enum {
+  metricConnectionsActive,
+  metricGaugeCount
+} MetricGauge;
+
+/***************************************************************************************************
+ * Function Declarations
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  Monotonic clock for the histograms.
+ *  \return  time in microseconds
+ **************************************************************************************************/
+uint64_t metricsNowUs(void);
+
+/***********************************************************************************************//**
+ *  \brief  Add a value to a histogram.
+ *  \param[in]  histogram  histogram
+ *  \param[in]  us  value in microseconds, larger ones count in the last bucket
+ **************************************************************************************************/
+void metricsObserve(MetricHistogram histogram, uint64_t us);
+
+/***********************************************************************************************//**
+ *  \brief  Add one to a counter.
+ *  \param[in]  counter  counter
+ **************************************************************************************************/
+void metricsCount(MetricCounter counter);
+
+/***********************************************************************************************//**
+ *  \brief  Add to a gauge.
+ *  \param[in]  gauge  gauge
+ *  \param[in]  delta  amount to add, negative to subtract
+ **************************************************************************************************/
+void metricsGaugeAdd(MetricGauge gauge, int32_t delta);
+
+/***********************************************************************************************//**
+ *  \brief  Count a BGAPI event, by message ID.
+ *  \param[in]  id  BGLIB_MSG_ID() of the event
+ **************************************************************************************************/
+void metricsCountEvent(uint32_t id);
+
+/***********************************************************************************************//**
+ *  \brief  Count a BGAPI command written to an NCP, by message ID.
+ *  \param[in]  id  BGLIB_MSG_ID() of the command
+ **************************************************************************************************/
+void metricsCountCommand(uint32_t id);
+
+/***********************************************************************************************//**
+ *  \brief  Note when the NCP's messages being handled were read, for metricReadingDelay.
+ *  \param[in]  us  metricsNowUs() at the read
+ **************************************************************************************************/
+void metricsSetReadTime(uint64_t us);
+
+/***********************************************************************************************//**
+ *  \brief  When the NCP's messages being handled were read.
+ *  \return  metricsNowUs() at the read, 0 if unknown
+ **************************************************************************************************/
+uint64_t metricsReadTime(void);
+
+/***********************************************************************************************//**
+ *  \brief  Estimate a percentile of a histogram, from the upper bound of its bucket.
+ *  \param[in]  histogram  histogram
+ *  \param[in]  percent  percentile, 0 to 100
+ *  \return  value in microseconds, 0 if the histogram is empty
+ **************************************************************************************************/
+uint64_t metricsPercentile(MetricHistogram histogram, double percent);
+
+/***********************************************************************************************//**
+ *  \brief  Write every metric in Prometheus text format.
+ *  \param[out]  buffer  output buffer
+ *  \param[in]  size  size of the buffer
+ *  \return  length of the text, truncated to size - 1
+ **************************************************************************************************/
+uint32_t metricsRender(char *buffer, uint32_t size);
+
+/***********************************************************************************************//**
+ *  \brief  Listen for metrics requests, on a unix-domain socket or a localhost TCP port. Linux
+ *          only, as the event loop serving them.
+ *  \param[in]  address  socket path if it contains a '/', else a TCP port number
+ *  \return  listening descriptor to watch for readability, -1 on failure
+ **************************************************************************************************/
+int metricsListen(const char *address);
+
+/***********************************************************************************************//**
+ *  \brief  Accept the clients waiting on the listening descriptor and add them to the event
+ *          loop, which reads each request and answers with the metrics as an HTTP response as
+ *          the socket allows, never waiting on a client. Any request gets the same answer.
+ *  \param[in]  listenFd  descriptor returned by metricsListen()
+ **************************************************************************************************/
+void metricsServe(int listenFd);
+
+/** @} (end addtogroup metrics) */
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* METRICS_H */
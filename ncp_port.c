@@ -0,0 +1,413 @@
+/***************************************************************************//**
+ * @file
+ * @brief POSIX serial port access for the NCP with a pollable file descriptor, and the uart
+ *        driver behind the same calls on Windows
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2018 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+#if !defined(_WIN32)
+
+/* standard library headers */
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+/* BG stack headers */
+#include "gecko_bglib.h"
+
+/* Own header */
+#include "ncp_port.h"
+
+#include "infrastructure.h"
+
+// An open port with the bytes read from it and the bytes waiting to be written
+typedef struct {
+  int      fd;
+  uint32_t rxStart;           // first byte not handed out yet
+  uint32_t rxEnd;             // end of the bytes read
+  uint32_t txLen;
+  uint8_t  rx[NCP_PORT_RX_BUFFER_SIZE];
+  uint8_t  tx[NCP_PORT_TX_BUFFER_SIZE];
+} Port;
+
+static Port ports[NCP_PORT_MAX];
+static uint8_t portCount;
+// Port that reads and writes go to, NULL until one is open. Each thread selects its own, so
+// the NCP reader can fill one port while the event thread writes to another.
+static __thread Port *selected;
+
+// Termios speed of a baud rate, B0 if unsupported
+static speed_t speedOf(uint32_t baudRate)
+{
+  static const struct {
+    uint32_t baud;
+    speed_t  speed;
+  } speeds[] = {
+    { 9600, B9600 }, { 19200, B19200 }, { 38400, B38400 }, { 57600, B57600 },
+    { 115200, B115200 }, { 230400, B230400 },
+#ifdef B460800
+    { 460800, B460800 },
+#endif
+#ifdef B921600
+    { 921600, B921600 },
+#endif
+  };
+  uint8_t i;
+
+  for (i = 0; i < COUNTOF(speeds); i++) {
+    if (speeds[i].baud == baudRate) {
+      return speeds[i].speed;
+    }
+  }
+  return B0;
+}
+
+// Wait until the selected port can be read or written
+static int waitFor(short events)
+{
+  struct pollfd pfd = { selected->fd, events, 0 };
+
+  while (poll(&pfd, 1, -1) < 0) {
+    if (errno != EINTR) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+// Write all of the bytes, waiting while flow control holds them back
+static int32_t writeAll(const uint8_t *data, uint32_t dataLength)
+{
+  ssize_t ret;
+
+  while (dataLength) {
+    ret = write(selected->fd, data, dataLength);
+    if (ret < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN && waitFor(POLLOUT) == 0) {
+        continue;
+      }
+      return -1;
+    }
+    dataLength -= (uint32_t)ret;
+    data += ret;
+  }
+  return 0;
+}
+
+int32_t ncpPortOpen(const char *port, uint32_t baudRate, uint32_t rtsCts)
+{
+  struct termios tio;
+  speed_t speed = speedOf(baudRate);
+  int fd;
+
+  if (speed == B0 || portCount >= NCP_PORT_MAX) {
+    return -1;
+  }
+  fd = open(port, O_RDWR | O_NOCTTY | O_CLOEXEC | O_NONBLOCK);
+  if (fd < 0) {
+    return -1;
+  }
+  if (tcgetattr(fd, &tio) < 0) {
+    close(fd);
+    return -1;
+  }
+  cfmakeraw(&tio);
+  cfsetispeed(&tio, speed);
+  cfsetospeed(&tio, speed);
+  tio.c_cflag |= CLOCAL | CREAD;
+  if (rtsCts) {
+    tio.c_cflag |= CRTSCTS;
+  } else {
+    tio.c_cflag &= ~CRTSCTS;
+  }
+  // Reads return whatever has arrived, the event loop waits for more
+  tio.c_cc[VMIN] = 0;
+  tio.c_cc[VTIME] = 0;
+  if (tcsetattr(fd, TCSANOW, &tio) < 0) {
+    close(fd);
+    return -1;
+  }
+  tcflush(fd, TCIOFLUSH);
+  selected = &ports[portCount];
+  selected->fd = fd;
+  selected->rxStart = selected->rxEnd = 0;
+  selected->txLen = 0;
+  return portCount++;
+}
+
+void ncpPortClose(void)
+{
+  while (portCount > 0) {
+    selected = &ports[--portCount];
+    ncpPortFlush();
+    close(selected->fd);
+  }
+  selected = NULL;
+}
+
+void ncpPortSelect(int32_t index)
+{
+  if (index >= 0 && index < portCount) {
+    selected = &ports[index];
+  }
+}
+
+int ncpPortFd(void)
+{
+  return (selected != NULL) ? selected->fd : -1;
+}
+
+int32_t ncpPortFill(void)
+{
+  uint32_t kept = selected->rxEnd - selected->rxStart;
+  ssize_t ret;
+
+  // Only the start of a message is left, move it to the front
+  memmove(selected->rx, &selected->rx[selected->rxStart], kept);
+  selected->rxStart = 0;
+  selected->rxEnd = kept;
+  do {
+    ret = read(selected->fd, &selected->rx[kept], sizeof(selected->rx) - kept);
+  } while (ret < 0 && errno == EINTR);
+  if (ret < 0) {
+    return (errno == EAGAIN) ? 0 : -1;
+  }
+  if (ret == 0) {
+    // Hangup, e.g. the USB device has gone
+    return -1;
+  }
+  selected->rxEnd += (uint32_t)ret;
+  return (int32_t)ret;
+}
+
+const uint8_t *ncpPortNextMessage(uint32_t *len)
+{
+  const uint8_t *msg;
+  uint32_t header;
+  uint32_t payloadLen;
+
+  while (selected->rxEnd - selected->rxStart >= BGLIB_MSG_HEADER_LEN) {
+    msg = &selected->rx[selected->rxStart];
+    // Messages lie at any offset, the header is copied out rather than read in place
+    memcpy(&header, msg, sizeof(header));
+    payloadLen = BGLIB_MSG_LEN(header);
+    if ((header & 0x78) != gecko_dev_type_gecko || payloadLen > BGLIB_MSG_MAX_PAYLOAD) {
+      // Not a message header, e.g. noise after a reset, look for one at the next byte
+      selected->rxStart++;
+      continue;
+    }
+    if (selected->rxEnd - selected->rxStart < BGLIB_MSG_HEADER_LEN + payloadLen) {
+      break;
+    }
+    *len = BGLIB_MSG_HEADER_LEN + payloadLen;
+    selected->rxStart += *len;
+    return msg;
+  }
+  return NULL;
+}
+
+int32_t ncpPortRx(uint32_t dataLength, uint8_t *data)
+{
+  uint32_t dataToRead = dataLength;
+  uint32_t count;
+
+  while (dataToRead) {
+    if (selected->rxEnd == selected->rxStart) {
+      if (waitFor(POLLIN) < 0 || ncpPortFill() < 0) {
+        return -1;
+      }
+      continue;
+    }
+    count = MIN(dataToRead, selected->rxEnd - selected->rxStart);
+    memcpy(data, &selected->rx[selected->rxStart], count);
+    selected->rxStart += count;
+    dataToRead -= count;
+    data += count;
+  }
+  return (int32_t)dataLength;
+}
+
+int32_t ncpPortRxPeek(void)
+{
+  int count;
+
+  if (ioctl(selected->fd, FIONREAD, &count) < 0) {
+    return -1;
+  }
+  return (int32_t)(selected->rxEnd - selected->rxStart) + count;
+}
+
+int32_t ncpPortWait(uint32_t timeoutMs)
+{
+  struct pollfd pfd = { selected->fd, POLLIN, 0 };
+  int ret;
+
+  if (selected->rxEnd != selected->rxStart) {
+    return 1;
+  }
+  ret = poll(&pfd, 1, (timeoutMs == NCP_PORT_WAIT_FOREVER) ? -1 : (int)MIN(timeoutMs, (uint32_t)INT32_MAX));
+  if (ret < 0) {
+    // A signal, e.g. SIGUSR1 for the flight recorder, is for the caller to see to
+    return (errno == EINTR) ? 1 : -1;
+  }
+  if (ret > 0 && (pfd.revents & (POLLERR | POLLHUP))) {
+    return -1;
+  }
+  return (ret == 0) ? 0 : 1;
+}
+
+// Commands are copied in rather than gathered with writev at the flush: BGLIB hands over the
+// bytes of its blocking commands in a buffer it reuses, and a copy of a few dozen bytes costs
+// far less than the write it saves
+int32_t ncpPortTx(uint32_t dataLength, uint8_t *data)
+{
+  if (selected->txLen + dataLength > sizeof(selected->tx) && ncpPortFlush() < 0) {
+    return -1;
+  }
+  if (dataLength > sizeof(selected->tx)) {
+    return (writeAll(data, dataLength) < 0) ? -1 : (int32_t)dataLength;
+  }
+  memcpy(&selected->tx[selected->txLen], data, dataLength);
+  selected->txLen += dataLength;
+  return (int32_t)dataLength;
+}
+
+int32_t ncpPortFlush(void)
+{
+  uint32_t len = selected->txLen;
+
+  if (len == 0) {
+    return 0;
+  }
+  selected->txLen = 0;
+  return (writeAll(selected->tx, len) < 0) ? -1 : (int32_t)len;
+}
+
+#else /* _WIN32 */
+
+/* standard library headers */
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/* BG stack headers */
+#include "uart.h"
+
+/* Own header */
+#include "ncp_port.h"
+
+// The uart driver has no descriptor to wait on, ncpPortWait() reads with its timeout instead and
+// keeps the byte it takes for the next read
+static bool portOpen;
+static bool lookaheadValid;
+static uint8_t lookahead;
+
+int32_t ncpPortOpen(const char *port, uint32_t baudRate, uint32_t rtsCts)
+{
+  if (portOpen || uartOpen((int8_t *)port, baudRate, rtsCts, NCP_PORT_WAIT_SLICE_MS) < 0) {
+    return -1;
+  }
+  portOpen = true;
+  lookaheadValid = false;
+  return 0;
+}
+
+void ncpPortClose(void)
+{
+  if (portOpen) {
+    uartClose();
+    portOpen = false;
+  }
+}
+
+void ncpPortSelect(int32_t index)
+{
+  (void)index;
+}
+
+int ncpPortFd(void)
+{
+  return -1;
+}
+
+int32_t ncpPortFill(void)
+{
+  return -1;
+}
+
+const uint8_t *ncpPortNextMessage(uint32_t *len)
+{
+  (void)len;
+  return NULL;
+}
+
+int32_t ncpPortRx(uint32_t dataLength, uint8_t *data)
+{
+  if (dataLength == 0 || !lookaheadValid) {
+    return uartRx(dataLength, data);
+  }
+  data[0] = lookahead;
+  lookaheadValid = false;
+  if (dataLength > 1 && uartRx(dataLength - 1, &data[1]) < 0) {
+    return -1;
+  }
+  return (int32_t)dataLength;
+}
+
+int32_t ncpPortRxPeek(void)
+{
+  int32_t count = uartRxPeek();
+
+  return (count < 0) ? -1 : count + (lookaheadValid ? 1 : 0);
+}
+
+int32_t ncpPortWait(uint32_t timeoutMs)
+{
+  uint32_t waitedMs = 0;
+  int32_t ret;
+
+  while (!lookaheadValid && uartRxPeek() <= 0) {
+    if (timeoutMs != NCP_PORT_WAIT_FOREVER && waitedMs >= timeoutMs) {
+      return 0;
+    }
+    ret = uartRxNonBlocking(1, &lookahead);
+    if (ret < 0) {
+      return -1;
+    }
+    lookaheadValid = (ret == 1);
+    waitedMs += NCP_PORT_WAIT_SLICE_MS;
+  }
+  return 1;
+}
+
+int32_t ncpPortTx(uint32_t dataLength, uint8_t *data)
+{
+  return uartTx(dataLength, data);
+}
+
+int32_t ncpPortFlush(void)
+{
+  return 0;
+}
+
+#endif /* _WIN32 */
@@ -0,0 +1,147 @@
+/***************************************************************************//**
+ * @file
+ * @brief POSIX serial port access for the NCP with a pollable file descriptor
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2018 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+#ifndef NCP_PORT_H
+#define NCP_PORT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/***********************************************************************************************//**
+ * \defgroup ncp_port NCP Serial Port
+ * \brief Same calling conventions as uartRx/uartRxPeek/uartTx, for use with BGLIB, plus access
+ *        to the file descriptor so the port can be watched by an event loop. Several ports can be
+ *        open, reads and writes go to the one selected by the calling thread. Each port is read in large chunks and
+ *        BGAPI messages are framed in place, and writes are held until ncpPortFlush() so the
+ *        commands issued while handling a batch of events go out in one system call. On Windows
+ *        a single port is reached through the uart driver, with no descriptor, framing in place
+ *        or held writes.
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ * @addtogroup ncp_port
+ * @{
+ **************************************************************************************************/
+
+ // Ports that can be open at once
+ #define NCP_PORT_MAX                  8
+ // Bytes read from a port in one go, and bytes of messages held for one write
+ #define NCP_PORT_RX_BUFFER_SIZE       16384
+ #define NCP_PORT_TX_BUFFER_SIZE       1024
+ // ncpPortWait() timeout that waits for input only
+ #define NCP_PORT_WAIT_FOREVER         UINT32_MAX
+ // Windows: read timeout of the uart driver, the step ncpPortWait() waits in, in ms
+ #define NCP_PORT_WAIT_SLICE_MS        10
+
+/***************************************************************************************************
+ * Function Declarations
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  Open a serial port in raw, non-blocking mode and select it.
+ *  \param[in]  port  serial port device
+ *  \param[in]  baudRate  baud rate
+ *  \param[in]  rtsCts  1 to enable RTS/CTS flow control
+ *  \return  index of the port, counting from 0 in the order they were opened, -1 on failure
+ **************************************************************************************************/
+int32_t ncpPortOpen(const char *port, uint32_t baudRate, uint32_t rtsCts);
+
+/***********************************************************************************************//**
+ *  \brief  Close every open port.
+ **************************************************************************************************/
+void ncpPortClose(void);
+
+/***********************************************************************************************//**
+ *  \brief  Direct reads and writes to another open port.
+ *  \param[in]  index  port index returned by ncpPortOpen()
+ **************************************************************************************************/
+void ncpPortSelect(int32_t index);
+
+/***********************************************************************************************//**
+ *  \brief  File descriptor of the selected port.
+ *  \return  file descriptor, -1 if the port is not open
+ **************************************************************************************************/
+int ncpPortFd(void);
+
+/***********************************************************************************************//**
+ *  \brief  Read what has arrived on the selected port into its buffer, with a single read.
+ *          Messages handed out by ncpPortNextMessage() are invalid afterwards.
+ *  \return  number of bytes read, 0 if none had arrived, -1 on hangup or failure
+ **************************************************************************************************/
+int32_t ncpPortFill(void);
+
+/***********************************************************************************************//**
+ *  \brief  Take the next complete message from the buffer of the selected port, without copying
+ *          it. Bytes that cannot start a message are skipped. The message lies wherever the
+ *          previous one ended, so it is not aligned for a struct gecko_cmd_packet, copy it into
+ *          one to read it.
+ *  \param[out]  len  length of the message, header and payload
+ *  \return  the message bytes, valid until the next ncpPortFill(), or NULL if no complete one
+ *           is in
+ **************************************************************************************************/
+const uint8_t *ncpPortNextMessage(uint32_t *len);
+
+/***********************************************************************************************//**
+ *  \brief  Read exactly dataLength bytes, from the buffer first, waiting for the rest.
+ *  \param[in]  dataLength  number of bytes to read
+ *  \param[out]  data  buffer for the data
+ *  \return  dataLength on success, -1 on failure
+ **************************************************************************************************/
+int32_t ncpPortRx(uint32_t dataLength, uint8_t *data);
+
+/***********************************************************************************************//**
+ *  \brief  Number of bytes that can be read without blocking.
+ *  \return  byte count, -1 on failure
+ **************************************************************************************************/
+int32_t ncpPortRxPeek(void);
+
+/***********************************************************************************************//**
+ *  \brief  Wait until the selected port has input, for a caller without an event loop. On
+ *          Windows the timeout is rounded up to NCP_PORT_WAIT_SLICE_MS.
+ *  \param[in]  timeoutMs  longest wait in ms, NCP_PORT_WAIT_FOREVER to wait for input only
+ *  \return  1 if there may be input, e.g. after a signal, 0 once the timeout has passed, -1 if
+ *           the port has failed or closed
+ **************************************************************************************************/
+int32_t ncpPortWait(uint32_t timeoutMs);
+
+/***********************************************************************************************//**
+ *  \brief  Queue dataLength bytes for the selected port. They are written by ncpPortFlush(), or
+ *          right away once the buffer is full.
+ *  \param[in]  dataLength  number of bytes to write
+ *  \param[in]  data  data to write
+ *  \return  dataLength on success, -1 on failure
+ **************************************************************************************************/
+int32_t ncpPortTx(uint32_t dataLength, uint8_t *data);
+
+/***********************************************************************************************//**
+ *  \brief  Write the bytes queued for the selected port with a single write, waiting while flow
+ *          control holds them back.
+ *  \return  number of bytes written, -1 on failure
+ **************************************************************************************************/
+int32_t ncpPortFlush(void);
+
+/** @} (end addtogroup ncp_port) */
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* NCP_PORT_H */
@@ -0,0 +1,334 @@
+/***************************************************************************//**
+ * @file
+ * @brief Reader thread taking BGAPI messages off the NCP serial ports into pooled packets
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2018 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+#if defined(__linux__)
+
+/* standard library headers */
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+/* BG stack headers */
+#include "gecko_bglib.h"
+
+/* Own header */
+#include "ncp_reader.h"
+
+#include "metrics.h"
+
+#define POOL_MASK                     (NCP_READER_POOL_SIZE - 1)
+#define PACKET_NONE                   0xFFFFu
+
+#if (NCP_READER_POOL_SIZE & POOL_MASK) != 0 || NCP_READER_POOL_SIZE > 32768
+#error "NCP_READER_POOL_SIZE must be a power of two, at most 32768"
+#endif
+
+typedef struct {
+  uint64_t readUs;            // metricsNowUs() when it was read
+  struct gecko_cmd_packet msg;
+} Packet;
+
+// Packets read from one port, head is only written by the reader and tail by the event thread.
+// The pool bounds what can be in it, so it never fills up.
+typedef struct {
+  uint16_t ring[NCP_READER_POOL_SIZE];
+  uint32_t head;
+  uint32_t tail;
+  uint32_t highWater;
+  bool     failed;
+  // Packet handed out by ncpReaderNextMessage(), given back at the next call
+  uint16_t current;
+} Queue;
+
+static Packet pool[NCP_READER_POOL_SIZE];
+// Free packets, head is only written by the event thread and tail by the reader
+static uint16_t freeRing[NCP_READER_POOL_SIZE];
+static uint32_t freeHead;
+static uint32_t freeTail;
+static Queue queues[NCP_PORT_MAX];
+static Queue *selectedQueue = &queues[0];
+static uint8_t portCount;
+
+// Set by the reader while it waits for packets to come back on poolFd
+static bool poolWaiting;
+// The event thread is woken up on readyFd, the reader on poolFd and stopFd
+static int readyFd = -1;
+static int poolFd = -1;
+static int stopFd = -1;
+static pthread_t reader;
+static bool readerRunning;
+
+static uint64_t packetCount;
+static uint64_t stallCount;
+static uint32_t poolHighWater;
+
+static void signalFd(int fd)
+{
+  uint64_t one = 1;
+
+  while (write(fd, &one, sizeof(one)) < 0 && errno == EINTR) {
+  }
+}
+
+static void clearFd(int fd)
+{
+  uint64_t count;
+
+  while (read(fd, &count, sizeof(count)) < 0 && errno == EINTR) {
+  }
+}
+
+// Take a packet from the pool, waiting until one comes back if it is empty. Returns PACKET_NONE
+// once the reader is asked to stop.
+static uint16_t takePacket(void)
+{
+  struct pollfd pfds[2] = { { poolFd, POLLIN, 0 }, { stopFd, POLLIN, 0 } };
+  uint32_t inUse;
+  uint16_t packet;
+
+  while (__atomic_load_n(&freeHead, __ATOMIC_ACQUIRE) == freeTail) {
+    __atomic_store_n(&poolWaiting, true, __ATOMIC_RELAXED);
+    // Pairs with the fence in givePacket(), one side sees the other's store
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&freeHead, __ATOMIC_ACQUIRE) != freeTail) {
+      __atomic_store_n(&poolWaiting, false, __ATOMIC_RELAXED);
+      break;
+    }
+    // Everything is with the event thread, make sure it knows
+    signalFd(readyFd);
+    __atomic_store_n(&stallCount, stallCount + 1, __ATOMIC_RELAXED);
+    while (poll(pfds, 2, -1) < 0 && errno == EINTR) {
+    }
+    if (pfds[1].revents) {
+      return PACKET_NONE;
+    }
+    clearFd(poolFd);
+  }
+  packet = freeRing[freeTail & POOL_MASK];
+  __atomic_store_n(&freeTail, freeTail + 1, __ATOMIC_RELEASE);
+  inUse = NCP_READER_POOL_SIZE - (__atomic_load_n(&freeHead, __ATOMIC_ACQUIRE) - freeTail);
+  if (inUse > poolHighWater) {
+    __atomic_store_n(&poolHighWater, inUse, __ATOMIC_RELAXED);
+  }
+  return packet;
+}
+
+// Give a packet back to the pool, waking the reader if it is waiting for one
+static void givePacket(uint16_t packet)
+{
+  uint32_t head = __atomic_load_n(&freeHead, __ATOMIC_RELAXED);
+
+  freeRing[head & POOL_MASK] = packet;
+  __atomic_store_n(&freeHead, head + 1, __ATOMIC_RELEASE);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&poolWaiting, __ATOMIC_RELAXED)
+      && __atomic_exchange_n(&poolWaiting, false, __ATOMIC_RELAXED)) {
+    signalFd(poolFd);
+  }
+}
+
+// Copy the messages framed in the selected port's buffer into packets and queue them
+static bool queueMessages(Queue *queue, uint64_t readUs)
+{
+  const uint8_t *msg;
+  uint32_t len;
+  uint32_t depth;
+  uint16_t packet;
+
+  while ((msg = ncpPortNextMessage(&len)) != NULL) {
+    packet = takePacket();
+    if (packet == PACKET_NONE) {
+      return false;
+    }
+    pool[packet].readUs = readUs;
+    // Into an aligned packet, the message is read through it from here on
+    memcpy(&pool[packet].msg, msg, len);
+    queue->ring[queue->head & POOL_MASK] = packet;
+    __atomic_store_n(&queue->head, queue->head + 1, __ATOMIC_RELEASE);
+    depth = queue->head - __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+    if (depth > queue->highWater) {
+      __atomic_store_n(&queue->highWater, depth, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&packetCount, packetCount + 1, __ATOMIC_RELAXED);
+  }
+  return true;
+}
+
+static void *readerThread(void *arg)
+{
+  struct pollfd pfds[NCP_PORT_MAX + 1];
+  bool queued;
+  uint8_t i;
+
+  (void)arg;
+  for (i = 0; i < portCount; i++) {
+    ncpPortSelect(i);
+    pfds[i].fd = ncpPortFd();
+    pfds[i].events = POLLIN;
+  }
+  pfds[portCount].fd = stopFd;
+  pfds[portCount].events = POLLIN;
+  while (1) {
+    if (poll(pfds, portCount + 1u, -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    if (pfds[portCount].revents) {
+      break;
+    }
+    queued = false;
+    for (i = 0; i < portCount; i++) {
+      if (pfds[i].revents == 0) {
+        continue;
+      }
+      ncpPortSelect(i);
+      // One read takes in everything that has arrived
+      if (ncpPortFill() < 0) {
+        __atomic_store_n(&queues[i].failed, true, __ATOMIC_RELEASE);
+        pfds[i].fd = -1;
+      } else if (!queueMessages(&queues[i], metricsNowUs())) {
+        return NULL;
+      }
+      queued = true;
+    }
+    if (queued) {
+      signalFd(readyFd);
+    }
+  }
+  return NULL;
+}
+
+/***************************************************************************************************
+ * Public Function Definitions
+ **************************************************************************************************/
+
+int ncpReaderStart(uint8_t ports)
+{
+  uint32_t i;
+
+  if (readerRunning || ports == 0 || ports > NCP_PORT_MAX) {
+    return -1;
+  }
+  portCount = ports;
+  for (i = 0; i < NCP_READER_POOL_SIZE; i++) {
+    freeRing[i] = (uint16_t)i;
+  }
+  freeHead = NCP_READER_POOL_SIZE;
+  freeTail = 0;
+  for (i = 0; i < NCP_PORT_MAX; i++) {
+    queues[i].head = queues[i].tail = queues[i].highWater = 0;
+    queues[i].failed = false;
+    queues[i].current = PACKET_NONE;
+  }
+  readyFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  poolFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  stopFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (readyFd < 0 || poolFd < 0 || stopFd < 0
+      || pthread_create(&reader, NULL, readerThread, NULL) != 0) {
+    readerRunning = true;
+    ncpReaderStop();
+    return -1;
+  }
+  readerRunning = true;
+  return 0;
+}
+
+void ncpReaderStop(void)
+{
+  if (!readerRunning) {
+    return;
+  }
+  if (stopFd >= 0 && readyFd >= 0 && poolFd >= 0) {
+    signalFd(stopFd);
+    pthread_join(reader, NULL);
+  }
+  if (readyFd >= 0) {
+    close(readyFd);
+  }
+  if (poolFd >= 0) {
+    close(poolFd);
+  }
+  if (stopFd >= 0) {
+    close(stopFd);
+  }
+  readyFd = poolFd = stopFd = -1;
+  readerRunning = false;
+}
+
+int ncpReaderFd(void)
+{
+  return readyFd;
+}
+
+void ncpReaderAcknowledge(void)
+{
+  clearFd(readyFd);
+}
+
+void ncpReaderSelect(uint8_t port)
+{
+  if (port < NCP_PORT_MAX) {
+    selectedQueue = &queues[port];
+  }
+}
+
+struct gecko_cmd_packet *ncpReaderNextMessage(void)
+{
+  Queue *queue = selectedQueue;
+  uint16_t packet;
+
+  if (queue->current != PACKET_NONE) {
+    givePacket(queue->current);
+    queue->current = PACKET_NONE;
+  }
+  if (queue->tail == __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE)) {
+    return NULL;
+  }
+  packet = queue->ring[queue->tail & POOL_MASK];
+  __atomic_store_n(&queue->tail, queue->tail + 1, __ATOMIC_RELEASE);
+  queue->current = packet;
+  metricsSetReadTime(pool[packet].readUs);
+  return &pool[packet].msg;
+}
+
+bool ncpReaderFailed(void)
+{
+  return __atomic_load_n(&selectedQueue->failed, __ATOMIC_ACQUIRE);
+}
+
+void ncpReaderGetStats(NcpReaderStats *stats)
+{
+  uint8_t i;
+
+  memset(stats, 0, sizeof(*stats));
+  stats->packets = __atomic_load_n(&packetCount, __ATOMIC_RELAXED);
+  stats->stalls = __atomic_load_n(&stallCount, __ATOMIC_RELAXED);
+  stats->poolHighWater = __atomic_load_n(&poolHighWater, __ATOMIC_RELAXED);
+  stats->ports = portCount;
+  for (i = 0; i < NCP_PORT_MAX; i++) {
+    stats->queueHighWater[i] = __atomic_load_n(&queues[i].highWater, __ATOMIC_RELAXED);
+  }
+}
+
+#endif /* __linux__ */
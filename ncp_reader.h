@@ -0,0 +1,125 @@
+/***************************************************************************//**
+ * @file
+ * @brief Reader thread taking BGAPI messages off the NCP serial ports into pooled packets
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2018 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+#ifndef NCP_READER_H
+#define NCP_READER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "ncp_port.h"
+
+struct gecko_cmd_packet;
+
+/***********************************************************************************************//**
+ * \defgroup ncp_reader NCP Reader
+ * \brief A thread of its own reads the NCP serial ports as soon as bytes arrive, frames the
+ *        BGAPI messages and copies each into a packet from a fixed pool. The packets are passed
+ *        to the event thread over a lock-free single-producer, single-consumer queue per NCP, and
+ *        go back to the pool once handled, over another one. Slow event handling no longer
+ *        leaves bytes in the kernel tty buffer. When the pool runs dry the reader stops reading
+ *        until packets come back, never dropping a message: the bytes wait in the kernel and
+ *        RTS/CTS holds the NCP back. Linux only, as the event loop.
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ * @addtogroup ncp_reader
+ * @{
+ **************************************************************************************************/
+
+ // Packets shared by all NCPs, a power of two. Each holds one message of up to
+ // BGLIB_MSG_MAX_PAYLOAD bytes.
+ #define NCP_READER_POOL_SIZE          1024
+
+/***************************************************************************************************
+ * Type Definitions
+ **************************************************************************************************/
+
+// Counters since the reader started, and high-water marks for sizing the pool
+typedef struct {
+  uint64_t packets;                         // messages read
+  uint64_t stalls;                          // times the reader waited for packets to come back
+  uint32_t poolHighWater;                   // most packets out of the pool at once
+  uint8_t  ports;                           // ports read, 0 if the reader has not started
+  uint32_t queueHighWater[NCP_PORT_MAX];    // most packets waiting in each NCP's queue
+} NcpReaderStats;
+
+/***************************************************************************************************
+ * Function Declarations
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  Start the reader thread on the ports opened with ncpPortOpen().
+ *  \param[in]  ports  number of ports, the first ones opened
+ *  \return  0 on success, -1 on failure
+ **************************************************************************************************/
+int ncpReaderStart(uint8_t ports);
+
+/***********************************************************************************************//**
+ *  \brief  Stop the reader thread and wait for it. Packets not taken yet are dropped.
+ **************************************************************************************************/
+void ncpReaderStop(void);
+
+/***********************************************************************************************//**
+ *  \brief  Descriptor that becomes readable when packets have been queued or a port has failed.
+ *  \return  file descriptor to watch, -1 if the reader is not running
+ **************************************************************************************************/
+int ncpReaderFd(void);
+
+/***********************************************************************************************//**
+ *  \brief  Consume the readiness of ncpReaderFd(), before taking the packets queued.
+ **************************************************************************************************/
+void ncpReaderAcknowledge(void);
+
+/***********************************************************************************************//**
+ *  \brief  Take the messages of another NCP.
+ *  \param[in]  port  port index returned by ncpPortOpen()
+ **************************************************************************************************/
+void ncpReaderSelect(uint8_t port);
+
+/***********************************************************************************************//**
+ *  \brief  Take the next message of the selected NCP, giving the one taken before back to the
+ *          pool. Also notes when it was read with metricsSetReadTime(). A CmdQueueReader, for
+ *          cmdQueueSetReader().
+ *  \return  the message, valid until the next call, or NULL if none is queued
+ **************************************************************************************************/
+struct gecko_cmd_packet *ncpReaderNextMessage(void);
+
+/***********************************************************************************************//**
+ *  \brief  Check whether the port of the selected NCP has hung up or failed. The messages read
+ *          from it before are still queued.
+ *  \return  true if nothing more will be read from it
+ **************************************************************************************************/
+bool ncpReaderFailed(void);
+
+/***********************************************************************************************//**
+ *  \brief  Get the reader counters and high-water marks.
+ *  \param[out]  stats  statistics
+ **************************************************************************************************/
+void ncpReaderGetStats(NcpReaderStats *stats);
+
+/** @} (end addtogroup ncp_reader) */
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* NCP_READER_H */
@@ -0,0 +1,1463 @@
+/***************************************************************************//**
+ * @file
+ * @brief Simulated NCP with a population of Health Thermometer servers
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2018 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+/**
+ * This is a load-test companion for the thermometer client. It opens a
+ * pseudo-terminal, speaks BGAPI on the master side and plays the part of a
+ * serial NCP with a configurable number of advertising thermometers behind it.
+ * It answers the commands the client issues (reset, discovery, connect, GATT
+ * discovery, notification enable, confirmations, reads, RSSI), and streams
+ * temperature indications from every subscribed sensor at the requested rate.
+ *
+ * If a client command line is given, the simulator starts it with every "{}"
+ * argument replaced by the pty slave path, stops it with SIGTERM after the
+ * requested duration and prints a summary of the run. Without a command line
+ * it prints the slave path and waits for a host to attach.
+ *
+ * With -p the simulator plays several NCPs, one pty each, in front of the same
+ * sensors, and the client arguments from the first "{}" to the end are
+ * repeated once per pty.
+ *
+ * With -b the sensors are broadcasters: they advertise their temperature, with
+ * a sequence number, in Health Thermometer service data at the requested rate,
+ * and cannot be connected to.
+ *
+ * With -x other devices, that are not thermometers, advertise alongside the
+ * sensors. Each NCP only reports what it hears within its scan window, and
+ * only the sensors in its accept list once the host turns whitelisting on.
+ *
+ * With -k the client is stopped and started again after a while, as for a
+ * deploy. The NCPs keep their links across the restart unless the new client
+ * resets them.
+ *
+ * With -f the sensors are fast-sampling probes that also have an Intermediate
+ * Temperature characteristic, which notifies. A sensor sends its readings as
+ * notifications, as fast as the rate asks, once the host subscribes to them
+ * instead of the Temperature Measurement indications.
+ *
+ * The sensors take the PHY the host asks for, apart from Coded, which every
+ * fourth sensor does not support. With -e the sensors at the edge of range
+ * lose their link now and then, unless it is on Coded. */
+
+#define _XOPEN_SOURCE 600
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "infrastructure.h"
+
+/* BG stack headers */
+#include "gecko_bglib.h"
+
+/***************************************************************************************************
+ * Local Macros and Definitions
+ **************************************************************************************************/
+
+#define SIM_DEFAULT_SENSORS          100
+#define SIM_DEFAULT_RATE             1.0   // indications per second per sensor
+#define SIM_DEFAULT_DURATION         10    // seconds
+#define SIM_DEFAULT_ADV_INTERVAL     100   // ms
+#define SIM_DEFAULT_CONN_INTERVAL    100   // ms, matches CONN_INTERVAL_MIN of the client
+#define SIM_DEFAULT_LINK_LIMIT       32    // simultaneous connections supported by the "NCP"
+#define SIM_MAX_SENSORS              4096
+#define SIM_MAX_NCPS                 8
+#define SIM_DEFAULT_ACCEPT_LIST      1024  // accept list entries of each NCP
+#define SIM_SCAN_INTERVAL            16    // 10 ms, until the host sets the discovery timing
+#define SIM_SCAN_WINDOW              16
+
+#define SIM_SERVICE_HANDLE           0x00010010u
+#define SIM_TEMP_CHAR_HANDLE         0x0012u
+#define SIM_INTERMEDIATE_CHAR_HANDLE 0x0015u
+#define SIM_TEMP_TYPE_CHAR_HANDLE    0x0018u
+#define SIM_INTERVAL_CHAR_HANDLE     0x001Bu
+#define SIM_BATTERY_SERVICE_HANDLE   0x00300030u
+#define SIM_BATTERY_CHAR_HANDLE      0x0032u
+
+#define SIM_ERR_INVALID_CONN_HANDLE  0x0101
+#define SIM_ERR_INVALID_PARAMETER    0x0180
+#define SIM_ERR_WRONG_STATE          0x0181
+#define SIM_ERR_OUT_OF_MEMORY        0x0182
+#define SIM_ERR_ATT_INVALID_HANDLE   0x0401
+#define SIM_REASON_LOCAL_CLOSE       0x0216
+#define SIM_REASON_SUPERVISION       0x0208
+// Below this RSSI, with -e, a link that is not on Coded drops on some of the readings
+#define SIM_EDGE_RSSI                -85
+#define SIM_EDGE_DROP_PERCENT        5
+// With -s, a stalling sensor goes quiet after this many readings on each link, leaving it open
+#define SIM_STALL_AFTER_READINGS     5
+
+#define SIM_IN_BUFFER_SIZE           4096
+#define SIM_OUT_BUFFER_SIZE          65536
+#define SIM_MAX_FRAME                (BGLIB_MSG_HEADER_LEN + BGLIB_MSG_MAX_PAYLOAD)
+#define SIM_MAX_DELAYED_COMMANDS     64
+
+#define USAGE "Usage: %s [-n sensors] [-r indications/s per sensor] [-d seconds] [-a adv interval ms]\n" \
+              "          [-i conn interval ms] [-c link limit] [-o outage after s] [-p ncps]\n" \
+              "          [-l command latency us] [-x other advertisers] [-w accept list size]\n" \
+              "          [-k restart client after s] [-s every nth sensor stalls]\n" \
+              "          [-m every nth response lost] [-b] [-e] [-f] [-v]\n" \
+              "          [client command ... {} ...]\n\n"
+
+typedef enum {
+  simIdle,
+  simConnecting,
+  simConnected
+} SimLinkState;
+
+typedef enum {
+  simEvtBoot,
+  simEvtAdvertise,
+  simEvtOpened,
+  simEvtServices,
+  simEvtCharacteristics,
+  simEvtSubscribed,
+  simEvtWriteFailed,
+  simEvtIndicate,
+  simEvtConfirmed,
+  simEvtRead,
+  simEvtPhy,
+  simEvtRssi,
+  simEvtClosed,
+  simEvtOutage
+} SimEvtKind;
+
+typedef struct {
+  uint64_t due;
+  uint16_t sensor;            // NCP index for simEvtBoot and simEvtAdvertise
+  uint8_t  kind;
+  uint8_t  arg;
+  uint32_t generation;
+} SimEvent;
+
+typedef struct {
+  bd_addr  address;
+  uint8_t  state;
+  uint8_t  ncp;               // NCP the link is on, when not simIdle
+  uint8_t  connection;
+  uint8_t  cccd;
+  uint8_t  phy;               // le_gap_phy_type of the link
+  bool     awaitingConfirmation;
+  bool     indicationDeferred;
+  uint32_t generation;
+  uint32_t indications;
+  uint32_t linkReadings;      // readings sent on the current link
+  int32_t  milliCelsius;
+  uint64_t subscribedAt;
+  uint64_t connectedAt;       // anchor of the link's connection events
+  uint64_t broadcastAt;       // when the advertised reading changes next, with -b
+  uint8_t  sequence;
+  uint8_t  acceptedBy;        // bit mask of the NCPs with the sensor in their accept list
+} SimSensor;
+
+// One simulated NCP: its pty, its links and its scanner. The sensors are shared, a sensor
+// connected through one NCP stops advertising to all of them.
+typedef struct {
+  int      masterFd;
+  uint8_t  inBuf[SIM_IN_BUFFER_SIZE];
+  uint32_t inLen;
+  uint8_t  outBuf[SIM_OUT_BUFFER_SIZE];
+  uint32_t outLen;
+  int16_t  sensorByHandle[256];
+  uint32_t openLinks;
+  bool     scanning;
+  bool     advScheduled;
+  uint32_t advCursor;
+  uint16_t scanInterval;
+  uint16_t scanWindow;
+  bool     whitelisting;
+  uint32_t acceptLen;
+  uint32_t generation;
+  char*    slave;             // path of the pty slave the host opens
+  // Commands received but not yet carried out, with -l, oldest first
+  struct gecko_cmd_packet delayed[SIM_MAX_DELAYED_COMMANDS];
+  uint64_t delayedDue[SIM_MAX_DELAYED_COMMANDS];
+  uint32_t delayedHead;
+  uint32_t delayedLen;
+} SimNcp;
+
+typedef struct {
+  uint64_t bootAt;
+  uint64_t outageAt;
+  uint64_t restartAt;
+  uint32_t linksAtRestart;
+  uint32_t droppedSinceRestart;
+  uint64_t fleetAt;
+  uint64_t lastSubscribeAt;
+  uint32_t subscribed;
+  uint32_t maxSubscribed;
+  uint64_t events;
+  uint64_t commands;
+  uint64_t scanResponses;
+  uint64_t indications;
+  uint64_t notifications;
+  uint64_t confirmations;
+  uint64_t rssiRequests;
+  uint64_t reads;
+  uint32_t edgeDrops;
+  uint32_t stalls;
+  uint64_t responses;
+  uint32_t lostResponses;
+} SimStats;
+
+/***************************************************************************************************
+ * Static Variables
+ **************************************************************************************************/
+
+static uint32_t sensorCount = SIM_DEFAULT_SENSORS;
+static double   indicationRate = SIM_DEFAULT_RATE;
+static uint32_t durationSec = SIM_DEFAULT_DURATION;
+static uint32_t advIntervalUs = SIM_DEFAULT_ADV_INTERVAL * 1000u;
+static uint32_t connIntervalUs = SIM_DEFAULT_CONN_INTERVAL * 1000u;
+static uint32_t linkLimit = SIM_DEFAULT_LINK_LIMIT;
+static uint32_t outageSec = 0;
+static uint32_t commandLatencyUs = 0;
+static bool     verbose = false;
+static bool     broadcast = false;
+static uint32_t bystanderCount = 0;
+static uint32_t acceptListSize = SIM_DEFAULT_ACCEPT_LIST;
+static uint32_t restartSec = 0;
+static bool     fastProbes = false;
+static bool     edgeDrops = false;
+static uint32_t stallEvery = 0;
+static uint32_t loseEvery = 0;
+
+static SimSensor* sensors;
+
+static SimEvent*  heap;
+static uint32_t   heapLen;
+static uint32_t   heapCap;
+
+static SimNcp     ncps[SIM_MAX_NCPS];
+static uint32_t   ncpCount = 1;
+// NCP whose commands are being handled or whose host the next messages go to
+static SimNcp*    ncp = &ncps[0];
+static bool       outageScheduled;
+
+static SimStats   stats;
+
+static volatile sig_atomic_t stopRequested;
+
+/***************************************************************************************************
+ * Static Function Definitions
+ **************************************************************************************************/
+
+static uint64_t nowUs(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
+
+static void onSignal(int sig)
+{
+  (void)sig;
+  stopRequested = 1;
+}
+
+// Boot and advertising events belong to an NCP rather than to a sensor
+static bool isNcpEvent(uint8_t kind)
+{
+  return kind == simEvtBoot || kind == simEvtAdvertise;
+}
+
+// Min-heap of scheduled NCP events ordered by due time
+static void heapPush(uint64_t due, uint16_t sensor, uint8_t kind, uint8_t arg)
+{
+  uint32_t i;
+  SimEvent e = { due, sensor, kind, arg,
+                 isNcpEvent(kind) ? ncps[sensor].generation : sensors[sensor].generation };
+
+  if (heapLen == heapCap) {
+    heapCap = heapCap ? heapCap * 2 : 1024;
+    heap = realloc(heap, heapCap * sizeof(SimEvent));
+    if (heap == NULL) {
+      fprintf(stderr, "Out of memory\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  i = heapLen++;
+  while (i > 0 && heap[(i - 1) / 2].due > e.due) {
+    heap[i] = heap[(i - 1) / 2];
+    i = (i - 1) / 2;
+  }
+  heap[i] = e;
+}
+
+static SimEvent heapPop(void)
+{
+  SimEvent top = heap[0];
+  SimEvent last = heap[--heapLen];
+  uint32_t i = 0;
+  uint32_t child;
+
+  while ((child = 2 * i + 1) < heapLen) {
+    if (child + 1 < heapLen && heap[child + 1].due < heap[child].due) {
+      child++;
+    }
+    if (heap[child].due >= last.due) {
+      break;
+    }
+    heap[i] = heap[child];
+    i = child;
+  }
+  heap[i] = last;
+  return top;
+}
+
+// Queue a BGAPI message (response or event) for the host
+static void sendMessage(uint32_t id, const void* payload, uint32_t len)
+{
+  uint32_t header = id | ((len & 0xff) << 8) | ((len & 0x700) >> 8);
+
+  // The command is carried out, only its response goes missing
+  if (!(id & gecko_msg_type_evt) && loseEvery != 0 && ++stats.responses % loseEvery == 0) {
+    stats.lostResponses++;
+    return;
+  }
+  ncp->outBuf[ncp->outLen++] = (uint8_t)header;
+  ncp->outBuf[ncp->outLen++] = (uint8_t)(header >> 8);
+  ncp->outBuf[ncp->outLen++] = (uint8_t)(header >> 16);
+  ncp->outBuf[ncp->outLen++] = (uint8_t)(header >> 24);
+  memcpy(&ncp->outBuf[ncp->outLen], payload, len);
+  ncp->outLen += len;
+  if (id & gecko_msg_type_evt) {
+    stats.events++;
+  }
+}
+
+static void sendResult(uint32_t id, uint16_t result)
+{
+  uint8_t payload[2] = { UINT16_TO_BYTES(result) };
+  sendMessage(id, payload, sizeof(payload));
+}
+
+static void sendProcedureCompleted(uint8_t connection, uint16_t result)
+{
+  struct gecko_msg_gatt_procedure_completed_evt_t evt;
+
+  evt.connection = connection;
+  evt.result = result;
+  sendMessage(gecko_evt_gatt_procedure_completed_id, &evt, sizeof(evt));
+}
+
+static SimSensor* sensorByConnection(uint8_t connection)
+{
+  int16_t index = ncp->sensorByHandle[connection];
+  return (index < 0) ? NULL : &sensors[index];
+}
+
+static void dropLink(SimSensor* s)
+{
+  SimNcp* owner = &ncps[s->ncp];
+
+  if (s->cccd != gatt_disable && stats.subscribed > 0) {
+    stats.subscribed--;
+  }
+  owner->sensorByHandle[s->connection] = -1;
+  s->state = simIdle;
+  s->connection = 0;
+  s->cccd = gatt_disable;
+  s->phy = le_gap_phy_1m;
+  s->awaitingConfirmation = false;
+  s->indicationDeferred = false;
+  s->generation++;
+  owner->openLinks--;
+  if (stats.restartAt > 0) {
+    stats.droppedSinceRestart++;
+  }
+}
+
+// Reset of the selected NCP: its links are gone, the other NCPs keep theirs
+static void resetNcp(void)
+{
+  uint32_t i;
+
+  for (i = 0; i < sensorCount; i++) {
+    if (sensors[i].state != simIdle && &ncps[sensors[i].ncp] == ncp) {
+      dropLink(&sensors[i]);
+    }
+    // The accept list does not survive the reset
+    sensors[i].acceptedBy &= (uint8_t)~(1u << (ncp - ncps));
+  }
+  for (i = 0; i < COUNTOF(ncp->sensorByHandle); i++) {
+    ncp->sensorByHandle[i] = -1;
+  }
+  ncp->openLinks = 0;
+  ncp->scanning = false;
+  ncp->advScheduled = false;
+  ncp->scanInterval = SIM_SCAN_INTERVAL;
+  ncp->scanWindow = SIM_SCAN_WINDOW;
+  ncp->whitelisting = false;
+  ncp->acceptLen = 0;
+  // Cancels the boot and advertising events still queued for it
+  ncp->generation++;
+}
+
+// Every NCP's output buffer has room for the messages an event may produce
+static bool roomForEvents(void)
+{
+  uint32_t i;
+
+  for (i = 0; i < ncpCount; i++) {
+    if (ncps[i].outLen + SIM_MAX_FRAME > sizeof(ncps[i].outBuf)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// The selected NCP reports an advertisement that falls in its scan window and, with whitelisting
+// on, comes from a sensor in its accept list. Advertisers past the sensors are bystanders.
+static bool heard(uint32_t advertiser)
+{
+  if ((uint32_t)(rand() % ncp->scanInterval) >= ncp->scanWindow) {
+    return false;
+  }
+  return !ncp->whitelisting
+         || (advertiser < sensorCount && (sensors[advertiser].acceptedBy & (1u << (ncp - ncps))));
+}
+
+// Signal strength of a sensor, from -40 down to -89 dBm
+static int8_t sensorRssi(uint32_t sensor)
+{
+  return (int8_t)(-40 - (int32_t)(sensor % 50));
+}
+
+// PHYs a sensor can take, every fourth one has no Coded PHY
+static uint8_t sensorPhys(uint32_t sensor)
+{
+  return (uint8_t)(le_gap_phy_1m | le_gap_phy_2m | ((sensor % 4 == 3) ? 0 : le_gap_phy_coded));
+}
+
+// With -s, whether a sensor has gone quiet on its link, as with hung firmware: the link stays up
+static bool stalling(uint32_t index)
+{
+  if (stallEvery == 0 || index % stallEvery != stallEvery - 1
+      || sensors[index].linkReadings < SIM_STALL_AFTER_READINGS) {
+    return false;
+  }
+  if (sensors[index].linkReadings == SIM_STALL_AFTER_READINGS) {
+    // Counted once per link
+    sensors[index].linkReadings++;
+    stats.stalls++;
+  }
+  return true;
+}
+
+// Send a reading the way the host subscribed to it, an indication waits for its confirmation
+static void sendReading(SimSensor* s)
+{
+  uint8_t buf[sizeof(struct gecko_msg_gatt_characteristic_value_evt_t) + 5];
+  struct gecko_msg_gatt_characteristic_value_evt_t* evt = (void*)buf;
+  uint32_t value;
+
+  // Random walk around room temperature, IEEE-11073 FLOAT with exponent -3
+  s->milliCelsius += (rand() % 41) - 20;
+  value = FLT_TO_UINT32(s->milliCelsius, -3);
+  evt->connection = s->connection;
+  if (s->cccd & gatt_notification) {
+    evt->characteristic = SIM_INTERMEDIATE_CHAR_HANDLE;
+    evt->att_opcode = gatt_handle_value_notification;
+  } else {
+    evt->characteristic = SIM_TEMP_CHAR_HANDLE;
+    evt->att_opcode = gatt_handle_value_indication;
+  }
+  evt->offset = 0;
+  evt->value.len = 5;
+  evt->value.data[0] = 0; // flags: Celsius, no time stamp, no type
+  evt->value.data[1] = UINT32_TO_BYTE0(value);
+  evt->value.data[2] = UINT32_TO_BYTE1(value);
+  evt->value.data[3] = UINT32_TO_BYTE2(value);
+  evt->value.data[4] = UINT32_TO_BYTE3(value);
+  sendMessage(gecko_evt_gatt_characteristic_value_id, buf, sizeof(buf));
+  s->indications++;
+  s->linkReadings++;
+  if (s->cccd & gatt_notification) {
+    stats.notifications++;
+    return;
+  }
+  s->awaitingConfirmation = true;
+  stats.indications++;
+}
+
+// Readable characteristics, a simEvtRead argument has the index + 1 of each value asked for
+static const uint16_t readableHandles[] = {
+  SIM_TEMP_TYPE_CHAR_HANDLE, SIM_INTERVAL_CHAR_HANDLE, SIM_BATTERY_CHAR_HANDLE
+};
+
+// Code of a characteristic in a simEvtRead argument, 0 if it cannot be read
+static uint8_t readCode(uint16_t characteristic)
+{
+  uint8_t i;
+
+  for (i = 0; i < sizeof(readableHandles) / sizeof(readableHandles[0]); i++) {
+    if (readableHandles[i] == characteristic) {
+      return (uint8_t)(i + 1);
+    }
+  }
+  return 0;
+}
+
+// Answer a read, arg has the code of each value asked for, two bits each in the order asked, and
+// bit 7 set for a Read Multiple
+static void sendReadResponse(SimSensor* s, uint8_t arg, uint64_t now)
+{
+  uint8_t buf[sizeof(struct gecko_msg_gatt_characteristic_value_evt_t) + 6];
+  struct gecko_msg_gatt_characteristic_value_evt_t* evt = (void*)buf;
+  uint32_t batteryLevel;
+  uint8_t len = 0;
+  uint8_t code;
+  uint8_t i;
+
+  evt->connection = s->connection;
+  // Only the response to a single read names the characteristic
+  evt->characteristic = (arg & 0x80) ? 0 : readableHandles[(arg & 3) - 1];
+  evt->att_opcode = (arg & 0x80) ? gatt_read_multiple_response : gatt_read_response;
+  evt->offset = 0;
+  for (i = 0; i < 3; i++) {
+    code = (arg >> (2 * i)) & 3;
+    if (code == 1) {
+      evt->value.data[len++] = 2; // Body (general)
+    } else if (code == 2) {
+      // Seconds between readings, 0 when faster than one a second
+      uint16_t interval = (indicationRate < 1.0) ? (uint16_t)(1.0 / indicationRate + 0.5) : 0;
+      evt->value.data[len++] = (uint8_t)interval;
+      evt->value.data[len++] = (uint8_t)(interval >> 8);
+    } else if (code == 3) {
+      // Drains a percent every ten seconds of connection
+      batteryLevel = (uint32_t)((now - s->connectedAt) / 10000000u);
+      evt->value.data[len++] = (uint8_t)((batteryLevel < 100) ? 100 - batteryLevel : 0);
+    }
+  }
+  evt->value.len = len;
+  stats.reads++;
+  sendMessage(gecko_evt_gatt_characteristic_value_id, buf,
+              (uint16_t)(sizeof(struct gecko_msg_gatt_characteristic_value_evt_t) + len));
+  sendProcedureCompleted(s->connection, 0);
+}
+
+static void fireEvent(const SimEvent* e, uint64_t now)
+{
+  SimSensor* s = &sensors[e->sensor];
+  uint32_t i;
+
+  if (isNcpEvent(e->kind)) {
+    if (e->generation != ncps[e->sensor].generation) {
+      return; // the NCP has been reset since
+    }
+    ncp = &ncps[e->sensor];
+  } else if (e->kind != simEvtOutage) {
+    if (e->generation != s->generation) {
+      return; // the link this event belonged to is gone
+    }
+    ncp = &ncps[s->ncp];
+  }
+
+  switch (e->kind) {
+    case simEvtBoot: {
+      struct gecko_msg_system_boot_evt_t evt;
+      memset(&evt, 0, sizeof(evt));
+      evt.major = 2;
+      evt.minor = 12;
+      sendMessage(gecko_evt_system_boot_id, &evt, sizeof(evt));
+      stats.bootAt = now;
+      if (outageSec && !outageScheduled) {
+        outageScheduled = true;
+        heapPush(now + (uint64_t)outageSec * 1000000u, 0, simEvtOutage, 0);
+      }
+      break;
+    }
+
+    case simEvtAdvertise: {
+      uint8_t buf[sizeof(struct gecko_msg_le_gap_scan_response_evt_t) + 21];
+      struct gecko_msg_le_gap_scan_response_evt_t* evt = (void*)buf;
+      static const uint8_t adData[] = { 0x02, 0x01, 0x06, 0x03, 0x03, 0x09, 0x18, 0x03, 0x08, 'T', 'h' };
+      // A bystander: Battery service, not a thermometer
+      static const uint8_t otherData[] = { 0x02, 0x01, 0x06, 0x03, 0x03, 0x0f, 0x18, 0x03, 0x08, 'T', 'g' };
+      // Flags, then Health Thermometer service data: a Temperature Measurement and a sequence
+      // number, non-connectable
+      uint8_t bcData[] = { 0x02, 0x01, 0x04, 0x03, 0x03, 0x09, 0x18,
+                           0x09, 0x16, 0x09, 0x18, 0x00, 0, 0, 0, 0, 0 };
+      uint32_t advertisers = sensorCount + bystanderCount;
+      uint32_t len = sizeof(adData);
+      uint32_t value;
+
+      if (!ncp->scanning) {
+        ncp->advScheduled = false;
+        break;
+      }
+      // Next advertiser that is not connected, round robin
+      for (i = 0; i < advertisers; i++) {
+        ncp->advCursor = (ncp->advCursor + 1) % advertisers;
+        if (ncp->advCursor >= sensorCount || sensors[ncp->advCursor].state == simIdle) {
+          break;
+        }
+      }
+      if (i < advertisers) {
+        SimSensor* b = (ncp->advCursor < sensorCount) ? &sensors[ncp->advCursor] : NULL;
+        // The same random walk as the indications, a new reading every 1 / rate seconds
+        if (b != NULL && broadcast && now >= b->broadcastAt) {
+          b->milliCelsius += (rand() % 41) - 20;
+          b->sequence++;
+          b->broadcastAt = now + (uint64_t)(1e6 / indicationRate);
+          b->indications++;
+          stats.indications++;
+        }
+        if (heard(ncp->advCursor)) {
+          evt->rssi = (int8_t)(-40 - (ncp->advCursor % 50));
+          evt->packet_type = 0;
+          evt->address_type = le_gap_address_type_public;
+          evt->bonding = 0xff;
+          if (b == NULL) {
+            uint8_t addr[6] = { (uint8_t)ncp->advCursor, (uint8_t)(ncp->advCursor >> 8),
+                                0x5e, 0xb4, 0x57, 0x01 };
+            memcpy(evt->address.addr, addr, sizeof(addr));
+            memcpy(evt->data.data, otherData, sizeof(otherData));
+            len = sizeof(otherData);
+          } else if (broadcast) {
+            value = FLT_TO_UINT32(b->milliCelsius, -3);
+            bcData[12] = UINT32_TO_BYTE0(value);
+            bcData[13] = UINT32_TO_BYTE1(value);
+            bcData[14] = UINT32_TO_BYTE2(value);
+            bcData[15] = UINT32_TO_BYTE3(value);
+            bcData[16] = b->sequence;
+            evt->address = b->address;
+            evt->packet_type = 3;
+            memcpy(evt->data.data, bcData, sizeof(bcData));
+            len = sizeof(bcData);
+          } else {
+            evt->address = b->address;
+            memcpy(evt->data.data, adData, sizeof(adData));
+          }
+          evt->data.len = (uint8_t)len;
+          sendMessage(gecko_evt_le_gap_scan_response_id, buf,
+                      sizeof(struct gecko_msg_le_gap_scan_response_evt_t) + len);
+          stats.scanResponses++;
+        }
+      }
+      heapPush(e->due + MAX(advIntervalUs / advertisers, 50u), e->sensor, simEvtAdvertise, 0);
+      break;
+    }
+
+    case simEvtOpened: {
+      struct gecko_msg_le_connection_opened_evt_t evt;
+      s->state = simConnected;
+      s->connectedAt = now;
+      s->linkReadings = 0;
+      s->phy = le_gap_phy_1m;
+      evt.address = s->address;
+      evt.address_type = le_gap_address_type_public;
+      evt.master = 1;
+      evt.connection = s->connection;
+      evt.bonding = 0xff;
+      evt.advertiser = 0xff;
+      sendMessage(gecko_evt_le_connection_opened_id, &evt, sizeof(evt));
+      break;
+    }
+
+    case simEvtServices: {
+      // arg has a bit for the Health Thermometer service and one for the Battery service
+      uint8_t buf[sizeof(struct gecko_msg_gatt_service_evt_t) + 2];
+      struct gecko_msg_gatt_service_evt_t* evt = (void*)buf;
+      evt->connection = s->connection;
+      evt->uuid.len = 2;
+      evt->uuid.data[1] = 0x18;
+      if (e->arg & 1) {
+        evt->service = SIM_SERVICE_HANDLE;
+        evt->uuid.data[0] = 0x09;
+        sendMessage(gecko_evt_gatt_service_id, buf, sizeof(buf));
+      }
+      if (e->arg & 2) {
+        evt->service = SIM_BATTERY_SERVICE_HANDLE;
+        evt->uuid.data[0] = 0x0f;
+        sendMessage(gecko_evt_gatt_service_id, buf, sizeof(buf));
+      }
+      sendProcedureCompleted(s->connection, 0);
+      break;
+    }
+
+    case simEvtCharacteristics: {
+      // arg has a bit for the Temperature Measurement, the Intermediate Temperature, the
+      // Temperature Type, the Measurement Interval and the Battery Level
+      uint8_t buf[sizeof(struct gecko_msg_gatt_characteristic_evt_t) + 2];
+      struct gecko_msg_gatt_characteristic_evt_t* evt = (void*)buf;
+      evt->connection = s->connection;
+      evt->uuid.len = 2;
+      if (e->arg & 1) {
+        evt->characteristic = SIM_TEMP_CHAR_HANDLE;
+        evt->properties = 0x20; // indicate
+        evt->uuid.data[0] = 0x1c;
+        evt->uuid.data[1] = 0x2a;
+        sendMessage(gecko_evt_gatt_characteristic_id, buf, sizeof(buf));
+      }
+      if (e->arg & 2) {
+        evt->characteristic = SIM_INTERMEDIATE_CHAR_HANDLE;
+        evt->properties = 0x10; // notify
+        evt->uuid.data[0] = 0x1e;
+        evt->uuid.data[1] = 0x2a;
+        sendMessage(gecko_evt_gatt_characteristic_id, buf, sizeof(buf));
+      }
+      if (e->arg & 4) {
+        evt->characteristic = SIM_TEMP_TYPE_CHAR_HANDLE;
+        evt->properties = 0x02; // read
+        evt->uuid.data[0] = 0x1d;
+        evt->uuid.data[1] = 0x2a;
+        sendMessage(gecko_evt_gatt_characteristic_id, buf, sizeof(buf));
+      }
+      if (e->arg & 8) {
+        evt->characteristic = SIM_INTERVAL_CHAR_HANDLE;
+        evt->properties = 0x02;
+        evt->uuid.data[0] = 0x21;
+        evt->uuid.data[1] = 0x2a;
+        sendMessage(gecko_evt_gatt_characteristic_id, buf, sizeof(buf));
+      }
+      if (e->arg & 16) {
+        evt->characteristic = SIM_BATTERY_CHAR_HANDLE;
+        evt->properties = 0x02;
+        evt->uuid.data[0] = 0x19;
+        evt->uuid.data[1] = 0x2a;
+        sendMessage(gecko_evt_gatt_characteristic_id, buf, sizeof(buf));
+      }
+      sendProcedureCompleted(s->connection, 0);
+      break;
+    }
+
+    case simEvtSubscribed:
+      sendProcedureCompleted(s->connection, 0);
+      if (s->cccd == gatt_disable && e->arg != gatt_disable) {
+        stats.subscribed++;
+        stats.lastSubscribeAt = now;
+        if (stats.subscribed > stats.maxSubscribed) {
+          stats.maxSubscribed = stats.subscribed;
+        }
+        if (s->subscribedAt == 0) {
+          s->subscribedAt = now;
+        }
+      }
+      s->cccd = e->arg;
+      if (s->cccd != gatt_disable) {
+        // Random phase so the sensors do not indicate in lock step
+        heapPush(now + (uint64_t)(rand() % (int)(1e6 / indicationRate)), e->sensor, simEvtIndicate, 0);
+      }
+      break;
+
+    case simEvtWriteFailed:
+      sendProcedureCompleted(s->connection, SIM_ERR_ATT_INVALID_HANDLE);
+      break;
+
+    case simEvtIndicate:
+      if (s->cccd == gatt_disable) {
+        break;
+      }
+      if (s->awaitingConfirmation) {
+        // ATT allows one outstanding indication, resume once confirmed
+        s->indicationDeferred = true;
+        break;
+      }
+      if (stalling(e->sensor)) {
+        break;
+      }
+      sendReading(s);
+      if (edgeDrops && s->phy != le_gap_phy_coded && sensorRssi(e->sensor) < SIM_EDGE_RSSI
+          && rand() % 100 < SIM_EDGE_DROP_PERCENT) {
+        // Out of range for a while, the link drops on supervision timeout
+        struct gecko_msg_le_connection_closed_evt_t evt;
+        evt.reason = SIM_REASON_SUPERVISION;
+        evt.connection = s->connection;
+        stats.edgeDrops++;
+        dropLink(s);
+        sendMessage(gecko_evt_le_connection_closed_id, &evt, sizeof(evt));
+        break;
+      }
+      heapPush(e->due + (uint64_t)(1e6 / indicationRate), e->sensor, simEvtIndicate, 0);
+      break;
+
+    case simEvtConfirmed:
+      s->awaitingConfirmation = false;
+      if (s->indicationDeferred) {
+        // The next indication goes out in the same connection event
+        s->indicationDeferred = false;
+        if (stalling(e->sensor)) {
+          break;
+        }
+        sendReading(s);
+        heapPush(now + (uint64_t)(1e6 / indicationRate), e->sensor, simEvtIndicate, 0);
+      }
+      break;
+
+    case simEvtRead:
+      if (e->arg == 0) {
+        sendProcedureCompleted(s->connection, SIM_ERR_ATT_INVALID_HANDLE);
+      } else {
+        sendReadResponse(s, e->arg, now);
+      }
+      break;
+
+    case simEvtPhy: {
+      struct gecko_msg_le_connection_phy_status_evt_t evt;
+      s->phy = e->arg;
+      evt.connection = s->connection;
+      evt.phy = s->phy;
+      sendMessage(gecko_evt_le_connection_phy_status_id, &evt, sizeof(evt));
+      break;
+    }
+
+    case simEvtRssi: {
+      struct gecko_msg_le_connection_rssi_evt_t evt;
+      evt.connection = s->connection;
+      evt.status = 0;
+      evt.rssi = sensorRssi(e->sensor);
+      sendMessage(gecko_evt_le_connection_rssi_id, &evt, sizeof(evt));
+      break;
+    }
+
+    case simEvtClosed: {
+      struct gecko_msg_le_connection_closed_evt_t evt;
+      evt.reason = SIM_REASON_LOCAL_CLOSE;
+      evt.connection = s->connection;
+      dropLink(s);
+      sendMessage(gecko_evt_le_connection_closed_id, &evt, sizeof(evt));
+      break;
+    }
+
+    case simEvtOutage: {
+      // Every sensor power cycles at once, links drop on supervision timeout
+      struct gecko_msg_le_connection_closed_evt_t evt;
+      stats.fleetAt = stats.lastSubscribeAt;
+      stats.outageAt = now;
+      for (i = 0; i < sensorCount; i++) {
+        if (sensors[i].state != simIdle) {
+          evt.reason = SIM_REASON_SUPERVISION;
+          evt.connection = sensors[i].connection;
+          ncp = &ncps[sensors[i].ncp];
+          dropLink(&sensors[i]);
+          sendMessage(gecko_evt_le_connection_closed_id, &evt, sizeof(evt));
+          if (!roomForEvents()) {
+            // Rest of the fleet goes down on the next round
+            heapPush(now, 0, simEvtOutage, 0);
+            break;
+          }
+        }
+      }
+      break;
+    }
+
+    default:
+      break;
+  }
+}
+
+// Look up the connection a command refers to; answers with an error if it is unknown
+static SimSensor* commandTarget(uint32_t id, uint8_t connection)
+{
+  SimSensor* s = sensorByConnection(connection);
+
+  if (s == NULL || s->state != simConnected) {
+    sendResult(id, SIM_ERR_INVALID_CONN_HANDLE);
+    return NULL;
+  }
+  sendResult(id, 0);
+  return s;
+}
+
+static void handleCommand(const struct gecko_cmd_packet* cmd, uint64_t now)
+{
+  uint32_t id = BGLIB_MSG_ID(cmd->header);
+  SimSensor* s;
+  uint32_t i;
+
+  stats.commands++;
+  switch (id) {
+    case gecko_cmd_system_reset_id:
+      // No response, the boot event tells the host the NCP is up again
+      resetNcp();
+      heapPush(now + 10000u, (uint16_t)(ncp - ncps), simEvtBoot, 0);
+      break;
+
+    case gecko_cmd_system_hello_id:
+      // Up since the simulator started, for a host that does not reset it
+      if (stats.bootAt == 0) {
+        stats.bootAt = now;
+      }
+      sendResult(id, 0);
+      break;
+
+    case gecko_cmd_le_gap_start_discovery_id:
+      ncp->scanning = true;
+      if (!ncp->advScheduled) {
+        ncp->advScheduled = true;
+        heapPush(now, (uint16_t)(ncp - ncps), simEvtAdvertise, 0);
+      }
+      sendResult(id, 0);
+      break;
+
+    case gecko_cmd_le_gap_end_procedure_id:
+      ncp->scanning = false;
+      sendResult(id, 0);
+      break;
+
+    case gecko_cmd_le_gap_set_discovery_timing_id: {
+      const struct gecko_msg_le_gap_set_discovery_timing_cmd_t* c =
+        &cmd->data.cmd_le_gap_set_discovery_timing;
+      // Takes effect right away rather than when scanning starts again, close enough
+      if (c->scan_window < 4 || c->scan_window > c->scan_interval) {
+        sendResult(id, SIM_ERR_INVALID_PARAMETER);
+        break;
+      }
+      ncp->scanInterval = c->scan_interval;
+      ncp->scanWindow = c->scan_window;
+      sendResult(id, 0);
+      break;
+    }
+
+    case gecko_cmd_le_gap_enable_whitelisting_id:
+      ncp->whitelisting = cmd->data.cmd_le_gap_enable_whitelisting.enable != 0;
+      sendResult(id, 0);
+      break;
+
+    case gecko_cmd_sm_add_to_whitelist_id: {
+      const bd_addr* address = &cmd->data.cmd_sm_add_to_whitelist.address;
+      uint32_t index = address->addr[0] | (address->addr[1] << 8);
+
+      if (ncp->acceptLen >= acceptListSize) {
+        sendResult(id, SIM_ERR_OUT_OF_MEMORY);
+        break;
+      }
+      ncp->acceptLen++;
+      if (index < sensorCount && memcmp(address, &sensors[index].address, sizeof(bd_addr)) == 0) {
+        sensors[index].acceptedBy |= (uint8_t)(1u << (ncp - ncps));
+      }
+      sendResult(id, 0);
+      break;
+    }
+
+    case gecko_cmd_le_gap_connect_id: {
+      struct gecko_msg_le_gap_connect_rsp_t rsp = { SIM_ERR_WRONG_STATE, 0 };
+      const bd_addr* address = &cmd->data.cmd_le_gap_connect.address;
+      uint32_t index = address->addr[0] | (address->addr[1] << 8);
+
+      // Broadcasters are not connectable
+      if (!broadcast && index < sensorCount
+          && memcmp(address, &sensors[index].address, sizeof(bd_addr)) == 0
+          && sensors[index].state == simIdle) {
+        if (ncp->openLinks >= linkLimit) {
+          rsp.result = SIM_ERR_OUT_OF_MEMORY;
+        } else {
+          // Lowest free handle, BGAPI connection handles start from 1
+          for (i = 1; i < COUNTOF(ncp->sensorByHandle) && ncp->sensorByHandle[i] >= 0; i++) {
+          }
+          s = &sensors[index];
+          s->state = simConnecting;
+          s->ncp = (uint8_t)(ncp - ncps);
+          s->connection = (uint8_t)i;
+          ncp->sensorByHandle[i] = (int16_t)index;
+          ncp->openLinks++;
+          rsp.result = 0;
+          rsp.connection = s->connection;
+          heapPush(now + connIntervalUs, (uint16_t)index, simEvtOpened, 0);
+        }
+      }
+      sendMessage(id, &rsp, sizeof(rsp));
+      break;
+    }
+
+    case gecko_cmd_gatt_discover_primary_services_by_uuid_id: {
+      const struct gecko_msg_gatt_discover_primary_services_by_uuid_cmd_t* c =
+        &cmd->data.cmd_gatt_discover_primary_services_by_uuid;
+      if ((s = commandTarget(id, c->connection)) != NULL) {
+        uint8_t match = 0;
+        if (c->uuid.len == 2 && c->uuid.data[1] == 0x18) {
+          match = (c->uuid.data[0] == 0x09) ? 1 : (c->uuid.data[0] == 0x0f) ? 2 : 0;
+        }
+        heapPush(now + connIntervalUs, (uint16_t)(s - sensors), simEvtServices, match);
+      }
+      break;
+    }
+
+    case gecko_cmd_gatt_discover_characteristics_by_uuid_id: {
+      const struct gecko_msg_gatt_discover_characteristics_by_uuid_cmd_t* c =
+        &cmd->data.cmd_gatt_discover_characteristics_by_uuid;
+      if ((s = commandTarget(id, c->connection)) != NULL) {
+        uint8_t match = 0;
+        if (c->service == SIM_SERVICE_HANDLE && c->uuid.len == 2 && c->uuid.data[1] == 0x2a) {
+          match = (c->uuid.data[0] == 0x1c) ? 1 : (fastProbes && c->uuid.data[0] == 0x1e) ? 2 : 0;
+        }
+        heapPush(now + connIntervalUs, (uint16_t)(s - sensors), simEvtCharacteristics, match);
+      }
+      break;
+    }
+
+    case gecko_cmd_gatt_discover_primary_services_id:
+      if ((s = commandTarget(id, cmd->data.cmd_gatt_discover_primary_services.connection)) != NULL) {
+        heapPush(now + connIntervalUs, (uint16_t)(s - sensors), simEvtServices, 3);
+      }
+      break;
+
+    case gecko_cmd_gatt_discover_characteristics_id: {
+      const struct gecko_msg_gatt_discover_characteristics_cmd_t* c =
+        &cmd->data.cmd_gatt_discover_characteristics;
+      if ((s = commandTarget(id, c->connection)) != NULL) {
+        uint8_t found = (c->service == SIM_BATTERY_SERVICE_HANDLE) ? 16
+                        : (c->service != SIM_SERVICE_HANDLE) ? 0 : fastProbes ? 15 : 13;
+        heapPush(now + connIntervalUs, (uint16_t)(s - sensors), simEvtCharacteristics, found);
+      }
+      break;
+    }
+
+    case gecko_cmd_gatt_set_characteristic_notification_id: {
+      const struct gecko_msg_gatt_set_characteristic_notification_cmd_t* c =
+        &cmd->data.cmd_gatt_set_characteristic_notification;
+      if ((s = commandTarget(id, c->connection)) != NULL) {
+        // Writing the client configuration of anything but the thermometer fails, and so do
+        // notifications of the Temperature Measurement and indications of the Intermediate
+        // Temperature, which the sensor does not offer
+        bool valid = (c->characteristic == SIM_TEMP_CHAR_HANDLE && !(c->flags & gatt_notification))
+                     || (fastProbes && c->characteristic == SIM_INTERMEDIATE_CHAR_HANDLE
+                         && !(c->flags & gatt_indication));
+        heapPush(now + connIntervalUs, (uint16_t)(s - sensors),
+                 valid ? simEvtSubscribed : simEvtWriteFailed, c->flags);
+      }
+      break;
+    }
+
+    case gecko_cmd_gatt_send_characteristic_confirmation_id:
+      if ((s = commandTarget(id, cmd->data.cmd_gatt_send_characteristic_confirmation.connection)) != NULL) {
+        stats.confirmations++;
+        // The confirmation reaches the sensor at the next connection event
+        heapPush(s->connectedAt + ((now - s->connectedAt) / connIntervalUs + 1) * connIntervalUs,
+                 (uint16_t)(s - sensors), simEvtConfirmed, 0);
+      }
+      break;
+
+    case gecko_cmd_gatt_read_characteristic_value_id: {
+      const struct gecko_msg_gatt_read_characteristic_value_cmd_t* c =
+        &cmd->data.cmd_gatt_read_characteristic_value;
+      if ((s = commandTarget(id, c->connection)) != NULL) {
+        heapPush(now + connIntervalUs, (uint16_t)(s - sensors), simEvtRead, readCode(c->characteristic));
+      }
+      break;
+    }
+
+    case gecko_cmd_gatt_read_multiple_characteristic_values_id: {
+      const struct gecko_msg_gatt_read_multiple_characteristic_values_cmd_t* c =
+        &cmd->data.cmd_gatt_read_multiple_characteristic_values;
+      if ((s = commandTarget(id, c->connection)) != NULL) {
+        // One request answered at a single connection event, an unknown handle fails it all
+        uint8_t arg = 0x80;
+        uint8_t count = c->characteristic_list.len / 2;
+        uint8_t code;
+        uint8_t i;
+        for (i = 0; i < count; i++) {
+          code = readCode((uint16_t)(c->characteristic_list.data[2 * i]
+                                     | (c->characteristic_list.data[2 * i + 1] << 8)));
+          if (code == 0 || count < 2 || count > 3) {
+            arg = 0;
+            break;
+          }
+          arg |= (uint8_t)(code << (2 * i));
+        }
+        heapPush(now + connIntervalUs, (uint16_t)(s - sensors), simEvtRead, arg);
+      }
+      break;
+    }
+
+    case gecko_cmd_le_connection_set_preferred_phy_id: {
+      const struct gecko_msg_le_connection_set_preferred_phy_cmd_t* c =
+        &cmd->data.cmd_le_connection_set_preferred_phy;
+      if ((s = commandTarget(id, c->connection)) != NULL) {
+        // The PHY asked for if the sensor has it, else 1M, from the next connection event on
+        uint8_t phy = (c->preferred_phy & sensorPhys((uint32_t)(s - sensors))) ? c->preferred_phy
+                      : le_gap_phy_1m;
+        heapPush(s->connectedAt + ((now - s->connectedAt) / connIntervalUs + 1) * connIntervalUs,
+                 (uint16_t)(s - sensors), simEvtPhy, phy);
+      }
+      break;
+    }
+
+    case gecko_cmd_le_connection_get_rssi_id:
+      if ((s = commandTarget(id, cmd->data.cmd_le_connection_get_rssi.connection)) != NULL) {
+        stats.rssiRequests++;
+        heapPush(now + connIntervalUs, (uint16_t)(s - sensors), simEvtRssi, 0);
+      }
+      break;
+
+    case gecko_cmd_le_connection_close_id:
+      if ((s = commandTarget(id, cmd->data.cmd_le_connection_close.connection)) != NULL) {
+        heapPush(now + connIntervalUs, (uint16_t)(s - sensors), simEvtClosed, 0);
+      }
+      break;
+
+    default:
+      // Configuration commands (hello, discovery timing, ...) just succeed
+      sendResult(id, 0);
+      break;
+  }
+}
+
+// Consume complete command frames from the input buffer
+static void parseInput(uint64_t now)
+{
+  struct gecko_cmd_packet cmd;
+  uint32_t pos = 0;
+  uint32_t len;
+  uint32_t i;
+
+  while (ncp->inLen - pos >= BGLIB_MSG_HEADER_LEN) {
+    if (ncp->inBuf[pos] != (gecko_dev_type_gecko | gecko_msg_type_cmd)) {
+      pos++; // resynchronize on the next command header
+      continue;
+    }
+    memcpy(&cmd.header, &ncp->inBuf[pos], BGLIB_MSG_HEADER_LEN);
+    len = BGLIB_MSG_LEN(cmd.header);
+    if (len > BGLIB_MSG_MAX_PAYLOAD) {
+      pos++;
+      continue;
+    }
+    if (ncp->inLen - pos < BGLIB_MSG_HEADER_LEN + len) {
+      break;
+    }
+    if (commandLatencyUs) {
+      // Carried out once the latency has passed, in the order they came in
+      if (ncp->delayedLen == SIM_MAX_DELAYED_COMMANDS) {
+        break;
+      }
+      i = (ncp->delayedHead + ncp->delayedLen++) % SIM_MAX_DELAYED_COMMANDS;
+      memcpy(&ncp->delayed[i], &ncp->inBuf[pos], BGLIB_MSG_HEADER_LEN + len);
+      ncp->delayedDue[i] = now + commandLatencyUs;
+      pos += BGLIB_MSG_HEADER_LEN + len;
+      continue;
+    }
+    memcpy(&cmd.data.payload, &ncp->inBuf[pos + BGLIB_MSG_HEADER_LEN], len);
+    pos += BGLIB_MSG_HEADER_LEN + len;
+    // Responses are written before any further events, make room for them
+    if (ncp->outLen + SIM_MAX_FRAME > sizeof(ncp->outBuf)) {
+      pos -= BGLIB_MSG_HEADER_LEN + len;
+      break;
+    }
+    handleCommand(&cmd, now);
+  }
+  memmove(ncp->inBuf, &ncp->inBuf[pos], ncp->inLen - pos);
+  ncp->inLen -= pos;
+}
+
+// Carry out the delayed commands that are due
+static void runDelayedCommands(uint64_t now)
+{
+  while (ncp->delayedLen > 0 && ncp->delayedDue[ncp->delayedHead] <= now
+         && ncp->outLen + SIM_MAX_FRAME <= sizeof(ncp->outBuf)) {
+    handleCommand(&ncp->delayed[ncp->delayedHead], now);
+    ncp->delayedHead = (ncp->delayedHead + 1) % SIM_MAX_DELAYED_COMMANDS;
+    ncp->delayedLen--;
+  }
+}
+
+static int openPty(void)
+{
+  struct termios tio;
+  char* slave;
+  int slaveFd;
+
+  ncp->masterFd = posix_openpt(O_RDWR | O_NOCTTY);
+  if (ncp->masterFd < 0 || grantpt(ncp->masterFd) < 0 || unlockpt(ncp->masterFd) < 0
+      || (slave = ptsname(ncp->masterFd)) == NULL || (ncp->slave = strdup(slave)) == NULL) {
+    return -1;
+  }
+  // Put the line in raw mode before the host opens it, and keep the slave
+  // open so the master does not see a hangup when the host closes it
+  slaveFd = open(slave, O_RDWR | O_NOCTTY);
+  if (slaveFd < 0 || tcgetattr(slaveFd, &tio) < 0) {
+    return -1;
+  }
+  cfmakeraw(&tio);
+  tcsetattr(slaveFd, TCSANOW, &tio);
+  fcntl(ncp->masterFd, F_SETFL, fcntl(ncp->masterFd, F_GETFL) | O_NONBLOCK);
+  return 0;
+}
+
+// Start the client with every "{}" replaced by a pty slave path. The arguments from the first
+// "{}" to the end are repeated once for each NCP, e.g. "{} 115200 0" names all the ports.
+static pid_t spawnClient(int argc, char** argv)
+{
+  char** args = calloc((size_t)argc * ncpCount + 1, sizeof(char*));
+  uint32_t count = 0;
+  uint32_t k;
+  pid_t pid;
+  int group;
+  int fd;
+  int i;
+
+  if (args == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+  for (group = 0; group < argc && strcmp(argv[group], "{}") != 0; group++) {
+    args[count++] = argv[group];
+  }
+  for (k = 0; group < argc && k < ncpCount; k++) {
+    for (i = group; i < argc; i++) {
+      args[count++] = (strcmp(argv[i], "{}") == 0) ? ncps[k].slave : argv[i];
+    }
+  }
+  pid = fork();
+  if (pid == 0) {
+    for (k = 0; k < ncpCount; k++) {
+      close(ncps[k].masterFd);
+    }
+    if (!verbose && (fd = open("/dev/null", O_WRONLY)) >= 0) {
+      dup2(fd, STDOUT_FILENO);
+      close(fd);
+    }
+    execvp(args[0], args);
+    fprintf(stderr, "Failed to start %s: %s\n", args[0], strerror(errno));
+    _exit(127);
+  }
+  free(args);
+  return pid;
+}
+
+static void printReport(uint64_t end)
+{
+  double runSec = (stats.bootAt && end > stats.bootAt) ? (end - stats.bootAt) / 1e6 : 0.0;
+  uint32_t i;
+  uint32_t indicating = 0;
+  uint32_t phys[3] = { 0, 0, 0 };
+
+  for (i = 0; i < sensorCount; i++) {
+    if (sensors[i].indications > 0) {
+      indicating++;
+    }
+  }
+  printf("ncp-sim: %u sensors, %u subscribed (peak %u), %u delivered readings\n",
+         sensorCount, stats.subscribed, stats.maxSubscribed, indicating);
+  if (ncpCount > 1) {
+    printf("ncp-sim: links per NCP:");
+    for (i = 0; i < ncpCount; i++) {
+      printf(" %u", ncps[i].openLinks);
+    }
+    printf("\n");
+  }
+  if (stats.outageAt == 0) {
+    stats.fleetAt = stats.lastSubscribeAt;
+  }
+  if (stats.fleetAt > 0) {
+    printf("ncp-sim: fleet connected %.1f ms after boot\n", (stats.fleetAt - stats.bootAt) / 1e3);
+  }
+  if (stats.restartAt > 0) {
+    printf("ncp-sim: client restarted with %u links open, %u links dropped since\n",
+           stats.linksAtRestart, stats.droppedSinceRestart);
+  }
+  if (stats.outageAt > 0 && stats.lastSubscribeAt > stats.outageAt) {
+    printf("ncp-sim: %u sensors reconnected %.1f ms after the outage\n",
+           stats.subscribed, (stats.lastSubscribeAt - stats.outageAt) / 1e3);
+  }
+  if (runSec > 0.0) {
+    printf("ncp-sim: %.1f s, %.1f events/s (%.1f scan responses/s, %.1f indications/s), "
+           "%.1f commands/s, %.1f confirmations/s, %.1f rssi requests/s\n",
+           runSec, stats.events / runSec, stats.scanResponses / runSec, stats.indications / runSec,
+           stats.commands / runSec, stats.confirmations / runSec, stats.rssiRequests / runSec);
+  }
+  if (runSec > 0.0 && stats.notifications > 0) {
+    printf("ncp-sim: %.1f notifications/s\n", stats.notifications / runSec);
+  }
+  if (runSec > 0.0 && stats.reads > 0) {
+    printf("ncp-sim: %.1f reads/s\n", stats.reads / runSec);
+  }
+  for (i = 0; i < sensorCount; i++) {
+    if (sensors[i].state == simConnected) {
+      phys[(sensors[i].phy == le_gap_phy_2m) ? 1 : (sensors[i].phy == le_gap_phy_coded) ? 2 : 0]++;
+    }
+  }
+  printf("ncp-sim: links on 1M %u, on 2M %u, on Coded %u", phys[0], phys[1], phys[2]);
+  printf(edgeDrops ? ", %u dropped at the edge of range" : "", stats.edgeDrops);
+  printf(stallEvery ? ", %u stalled\n" : "\n", stats.stalls);
+  if (loseEvery != 0) {
+    printf("ncp-sim: %u responses lost\n", stats.lostResponses);
+  }
+  fflush(stdout);
+}
+
+/***************************************************************************************************
+ * Public Function Definitions
+ **************************************************************************************************/
+
+int main(int argc, char* argv[])
+{
+  struct pollfd pfds[SIM_MAX_NCPS];
+  pid_t child = -1;
+  uint64_t now;
+  uint64_t deadline;
+  uint64_t restartAt;
+  int timeout;
+  int status;
+  ssize_t n;
+  uint32_t i;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "+n:r:d:a:i:c:o:p:l:x:w:k:s:m:befv")) != -1) {
+    switch (opt) {
+      case 'n': sensorCount = (uint32_t)atoi(optarg); break;
+      case 'r': indicationRate = atof(optarg); break;
+      case 'd': durationSec = (uint32_t)atoi(optarg); break;
+      case 'a': advIntervalUs = (uint32_t)atoi(optarg) * 1000u; break;
+      case 'i': connIntervalUs = (uint32_t)atoi(optarg) * 1000u; break;
+      case 'c': linkLimit = (uint32_t)atoi(optarg); break;
+      case 'o': outageSec = (uint32_t)atoi(optarg); break;
+      case 'l': commandLatencyUs = (uint32_t)atoi(optarg); break;
+      case 'p': ncpCount = (uint32_t)atoi(optarg); break;
+      case 'x': bystanderCount = (uint32_t)atoi(optarg); break;
+      case 'w': acceptListSize = (uint32_t)atoi(optarg); break;
+      case 'k': restartSec = (uint32_t)atoi(optarg); break;
+      case 's': stallEvery = (uint32_t)atoi(optarg); break;
+      case 'm': loseEvery = (uint32_t)atoi(optarg); break;
+      case 'b': broadcast = true; break;
+      case 'e': edgeDrops = true; break;
+      case 'f': fastProbes = true; break;
+      case 'v': verbose = true; break;
+      default:
+        fprintf(stderr, USAGE, argv[0]);
+        exit(EXIT_FAILURE);
+    }
+  }
+  if (sensorCount == 0 || sensorCount > SIM_MAX_SENSORS || bystanderCount > 65536 - sensorCount
+      || indicationRate <= 0.0
+      || linkLimit == 0 || linkLimit > 255 || ncpCount == 0 || ncpCount > SIM_MAX_NCPS) {
+    fprintf(stderr, USAGE, argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  sensors = calloc(sensorCount, sizeof(SimSensor));
+  if (sensors == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+  srand(1);
+  for (i = 0; i < sensorCount; i++) {
+    // Low two address bytes carry the sensor index, like "ADDR" in the client table
+    uint8_t addr[6] = { (uint8_t)i, (uint8_t)(i >> 8), 0x5e, 0xb4, 0x57, 0x00 };
+    memcpy(sensors[i].address.addr, addr, sizeof(addr));
+    sensors[i].milliCelsius = 21000 + (rand() % 8000);
+  }
+  for (i = 0; i < ncpCount; i++) {
+    ncp = &ncps[i];
+    resetNcp();
+    if (openPty() < 0) {
+      fprintf(stderr, "Failed to open pseudo-terminal: %s\n", strerror(errno));
+      exit(EXIT_FAILURE);
+    }
+    pfds[i].fd = ncp->masterFd;
+  }
+  signal(SIGINT, onSignal);
+  signal(SIGTERM, onSignal);
+  signal(SIGPIPE, SIG_IGN);
+
+  if (optind < argc) {
+    child = spawnClient(argc - optind, &argv[optind]);
+  } else {
+    for (i = 0; i < ncpCount; i++) {
+      printf("%s\n", ncps[i].slave);
+    }
+    fflush(stdout);
+  }
+
+  deadline = durationSec ? nowUs() + (uint64_t)durationSec * 1000000u : UINT64_MAX;
+  restartAt = (restartSec && child > 0) ? nowUs() + (uint64_t)restartSec * 1000000u : UINT64_MAX;
+  while (!stopRequested) {
+    now = nowUs();
+    if (now >= deadline) {
+      break;
+    }
+    while (heapLen > 0 && heap[0].due <= now && roomForEvents()) {
+      SimEvent e = heapPop();
+      fireEvent(&e, now);
+    }
+    for (i = 0; i < ncpCount; i++) {
+      ncp = &ncps[i];
+      if (ncp->outLen > 0) {
+        n = write(ncp->masterFd, ncp->outBuf, ncp->outLen);
+        if (n > 0) {
+          memmove(ncp->outBuf, &ncp->outBuf[n], ncp->outLen - (uint32_t)n);
+          ncp->outLen -= (uint32_t)n;
+        }
+      }
+      runDelayedCommands(now);
+      if (ncp->inLen > 0) {
+        parseInput(now);
+      }
+      pfds[i].events = POLLIN | (ncp->outLen ? POLLOUT : 0);
+    }
+
+    timeout = (restartAt <= now) ? 0 : (int)((MIN(deadline, restartAt) - now + 999) / 1000);
+    if (heapLen > 0 && roomForEvents()) {
+      timeout = (heap[0].due <= now) ? 0 : MIN(timeout, (int)((heap[0].due - now + 999) / 1000));
+    }
+    for (i = 0; i < ncpCount; i++) {
+      if (ncps[i].delayedLen > 0) {
+        uint64_t due = ncps[i].delayedDue[ncps[i].delayedHead];
+        timeout = (due <= now) ? 0 : MIN(timeout, (int)((due - now + 999) / 1000));
+      }
+    }
+    if (poll(pfds, ncpCount, timeout) > 0) {
+      for (i = 0; i < ncpCount; i++) {
+        if (!(pfds[i].revents & POLLIN)) {
+          continue;
+        }
+        ncp = &ncps[i];
+        n = read(ncp->masterFd, &ncp->inBuf[ncp->inLen], sizeof(ncp->inBuf) - ncp->inLen);
+        if (n > 0) {
+          ncp->inLen += (uint32_t)n;
+          parseInput(nowUs());
+        }
+      }
+    }
+    if (child > 0 && waitpid(child, &status, WNOHANG) == child) {
+      fprintf(stderr, "ncp-sim: client exited early with status %d\n", WEXITSTATUS(status));
+      child = -1;
+      break;
+    }
+    if (child > 0 && nowUs() >= restartAt) {
+      // A deploy: the links stay up while no client is listening
+      kill(child, SIGTERM);
+      waitpid(child, &status, 0);
+      stats.restartAt = nowUs();
+      for (i = 0; i < ncpCount; i++) {
+        stats.linksAtRestart += ncps[i].openLinks;
+      }
+      restartAt = UINT64_MAX;
+      child = spawnClient(argc - optind, &argv[optind]);
+    }
+  }
+
+  now = nowUs();
+  if (child > 0) {
+    kill(child, SIGTERM);
+    waitpid(child, &status, 0);
+  }
+  printReport(now);
+  return 0;
+}
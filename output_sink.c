@@ -0,0 +1,463 @@
+/***************************************************************************//**
+ * @file
+ * @brief Asynchronous output of thermometer readings
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2018 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+/* standard library headers */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+
+#include "infrastructure.h"
+
+/* Own header */
+#include "output_sink.h"
+
+#include "app.h"
+
+#define OUTPUT_RING_MASK              (OUTPUT_RING_SIZE - 1)
+// Longest formatted lines are held before they are written, so they go out in batches
+#define OUTPUT_FLUSH_MS               10
+// Returned by a sink flush with nothing left to write later
+#define OUTPUT_NO_DEADLINE            UINT32_MAX
+// Formatted output is collected here and written with one fwrite
+#define OUTPUT_BUFFER_SIZE            16384
+// Longest line any sink formats in one go
+#define OUTPUT_LINE_MAX               128
+
+#if (OUTPUT_RING_SIZE & OUTPUT_RING_MASK) != 0
+#error "OUTPUT_RING_SIZE must be a power of two"
+#endif
+
+// A sink formats records into the output buffer
+typedef struct {
+  void (*begin)(void);
+  void (*record)(const OutputRecord *record);
+  // Called after every batch, final is true once before the writer stops. Returns the time in ms
+  // until it wants to be called again, OUTPUT_NO_DEADLINE if only new records need it
+  uint32_t (*flush)(uint64_t nowMs, bool final);
+} OutputSinkOps;
+
+// The ring, head is only written by the event thread and tail only by the writer thread
+static OutputRecord ring[OUTPUT_RING_SIZE];
+static uint32_t ringHead;
+static uint32_t ringTail;
+static uint32_t droppedRecords;
+static bool stopRequested;
+static bool writerRunning;
+static pthread_t writer;
+
+// The writer waits on wake, set while it waits for records with nothing else to do
+static pthread_mutex_t wakeLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake;
+static clockid_t wakeClock;
+static bool writerIdle;
+
+static char outBuf[OUTPUT_BUFFER_SIZE];
+static size_t outLen;
+// When the first unwritten byte of the output buffer was formatted
+static uint64_t outSinceMs;
+
+// Last state of every table slot, owned by the writer thread
+static struct {
+  uint16_t serverAddress;
+  int8_t   rssi;
+  uint32_t temperature;
+} tableCells[MAX_NCPS * MAX_CONNECTIONS];
+// Slots in use, MAX_CONNECTIONS for each NCP
+static uint16_t tableSlots;
+static bool tableDirty;
+static uint64_t tableDrawnMs;
+
+static uint64_t clockMs(clockid_t clock)
+{
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+  return (uint64_t)ts.tv_sec * 1000u + (uint64_t)ts.tv_nsec / 1000000u;
+}
+
+static void outputWrite(void)
+{
+  if (outLen > 0) {
+    fwrite(outBuf, 1, outLen, stdout);
+    fflush(stdout);
+    outLen = 0;
+  }
+}
+
+// Append formatted text to the output buffer, writing it out first if it is nearly full
+static void outputf(const char *format, ...)
+{
+  va_list args;
+  int len;
+
+  if (outLen + OUTPUT_LINE_MAX > sizeof(outBuf)) {
+    outputWrite();
+  }
+  if (outLen == 0) {
+    outSinceMs = clockMs(CLOCK_MONOTONIC);
+  }
+  va_start(args, format);
+  len = vsnprintf(&outBuf[outLen], sizeof(outBuf) - outLen, format, args);
+  va_end(args);
+  if (len > 0) {
+    outLen += MIN((size_t)len, sizeof(outBuf) - outLen - 1);
+  }
+}
+
+/***************************************************************************************************
+ * Table Sink
+ **************************************************************************************************/
+
+static void tableBegin(void)
+{
+  uint16_t i;
+
+  for (i = 0; i < tableSlots; i++) {
+    tableCells[i].temperature = TEMP_INVALID;
+    tableCells[i].rssi = RSSI_INVALID;
+  }
+  for (i = 0u; i < MIN(TABLE_COLUMNS, tableSlots); i++) {
+    outputf("ADDR  TEMP   RSSI |");
+  }
+  outputf("\r\n");
+}
+
+static void tableRecord(const OutputRecord *record)
+{
+  if (record->slot >= tableSlots) {
+    return;
+  }
+  tableCells[record->slot].serverAddress = record->serverAddress;
+  tableCells[record->slot].temperature = record->temperature;
+  tableCells[record->slot].rssi = record->rssi;
+  tableDirty = true;
+}
+
+// Redraw the results table in place, TABLE_COLUMNS sensors per line, at most OUTPUT_TABLE_FPS
+// times per second
+static uint32_t tableFlush(uint64_t nowMs, bool final)
+{
+  uint8_t lines = (uint8_t)((tableSlots + TABLE_COLUMNS - 1) / TABLE_COLUMNS);
+  char degrees[16];
+  uint16_t i;
+
+  if (!final && (!tableDirty || nowMs - tableDrawnMs < 1000u / OUTPUT_TABLE_FPS)) {
+    outputWrite();
+    // A change held back by the frame rate is drawn when the next frame is due
+    return tableDirty ? (uint32_t)(tableDrawnMs + 1000u / OUTPUT_TABLE_FPS - nowMs)
+           : OUTPUT_NO_DEADLINE;
+  }
+  for (i = 0u; i < tableSlots; i++) {
+    if (TEMP_INVALID != tableCells[i].temperature) {
+      snprintf(degrees, sizeof(degrees), "%s%lu.%02lu", TEMP_SIGN(tableCells[i].temperature),
+               TEMP_DEGREES(tableCells[i].temperature), TEMP_HUNDREDTHS(tableCells[i].temperature));
+      outputf("%04x %5sC ", tableCells[i].serverAddress, degrees);
+      // RSSI is sampled less often than readings arrive, the first ones go without
+      if (RSSI_INVALID != tableCells[i].rssi) {
+        outputf("% 3ddBm|", tableCells[i].rssi);
+      } else {
+        outputf("------|");
+      }
+    } else {
+      outputf("---- ------ ------|");
+    }
+    if ((i + 1) % TABLE_COLUMNS == 0 || i + 1 == tableSlots) {
+      // Continue on the next line, or go back to the first one after the last
+      outputf((i + 1 < tableSlots) ? "\r\n" : "\r");
+    }
+  }
+  if (lines > 1) {
+    outputf("\033[%uA", (unsigned)(lines - 1));
+  }
+  // Leave the cursor below the table when done
+  if (final) {
+    if (lines > 1) {
+      outputf("\033[%uB", (unsigned)(lines - 1));
+    }
+    outputf("\r\n");
+  }
+  outputWrite();
+  tableDirty = false;
+  tableDrawnMs = nowMs;
+  return OUTPUT_NO_DEADLINE;
+}
+
+/***************************************************************************************************
+ * CSV Sink
+ **************************************************************************************************/
+
+static void csvBegin(void)
+{
+  outputf("time_ms,address,slot,temperature,rssi\n");
+}
+
+static void csvRecord(const OutputRecord *record)
+{
+  // Emptied slots are of no interest in a log of readings
+  if (record->temperature == TEMP_INVALID) {
+    return;
+  }
+  outputf("%llu,%04x,", (unsigned long long)record->timeMs, record->serverAddress);
+  // Empty for broadcast sensors past the end of the table
+  if (record->slot < tableSlots) {
+    outputf("%u", record->slot);
+  }
+  outputf(",%s%lu.%02lu,",
+          TEMP_SIGN(record->temperature),
+          TEMP_DEGREES(record->temperature),
+          TEMP_HUNDREDTHS(record->temperature));
+  // Empty until the first RSSI sample
+  if (record->rssi != RSSI_INVALID) {
+    outputf("%d", record->rssi);
+  }
+  outputf("\n");
+}
+
+/***************************************************************************************************
+ * JSON Lines Sink
+ **************************************************************************************************/
+
+static void jsonBegin(void)
+{
+}
+
+static void jsonRecord(const OutputRecord *record)
+{
+  if (record->temperature == TEMP_INVALID) {
+    return;
+  }
+  outputf("{\"time_ms\":%llu,\"address\":\"%04x\",",
+          (unsigned long long)record->timeMs,
+          record->serverAddress);
+  // null for broadcast sensors past the end of the table
+  if (record->slot < tableSlots) {
+    outputf("\"slot\":%u,", record->slot);
+  } else {
+    outputf("\"slot\":null,");
+  }
+  outputf("\"temperature\":%s%lu.%02lu,",
+          TEMP_SIGN(record->temperature),
+          TEMP_DEGREES(record->temperature),
+          TEMP_HUNDREDTHS(record->temperature));
+  // null until the first RSSI sample
+  if (record->rssi != RSSI_INVALID) {
+    outputf("\"rssi\":%d}\n", record->rssi);
+  } else {
+    outputf("\"rssi\":null}\n");
+  }
+}
+
+// Line formats are written out once the oldest unwritten line has waited OUTPUT_FLUSH_MS
+static uint32_t linesFlush(uint64_t nowMs, bool final)
+{
+  if (outLen > 0 && !final && nowMs - outSinceMs < OUTPUT_FLUSH_MS) {
+    return (uint32_t)(outSinceMs + OUTPUT_FLUSH_MS - nowMs);
+  }
+  outputWrite();
+  return OUTPUT_NO_DEADLINE;
+}
+
+static const OutputSinkOps sinks[] = {
+  [outputFormatTable] = { tableBegin, tableRecord, tableFlush },
+  [outputFormatCsv]   = { csvBegin, csvRecord, linesFlush },
+  [outputFormatJson]  = { jsonBegin, jsonRecord, linesFlush },
+};
+
+/***************************************************************************************************
+ * Writer Thread
+ **************************************************************************************************/
+
+// Wake the writer, or let it see the stop request if it has not gone to sleep yet
+static void wakeWriter(void)
+{
+  pthread_mutex_lock(&wakeLock);
+  pthread_cond_signal(&wake);
+  pthread_mutex_unlock(&wakeLock);
+}
+
+// Sleep until a sink deadline, or with none until a record is pushed or the writer is stopped
+static void writerWait(uint32_t waitMs, uint32_t tail)
+{
+  struct timespec deadline;
+  uint64_t ns;
+
+  pthread_mutex_lock(&wakeLock);
+  if (waitMs == OUTPUT_NO_DEADLINE) {
+    // Seen by the producer once it has pushed, or the record is seen here
+    __atomic_store_n(&writerIdle, true, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&ringHead, __ATOMIC_SEQ_CST) == tail
+        && !__atomic_load_n(&stopRequested, __ATOMIC_ACQUIRE)) {
+      pthread_cond_wait(&wake, &wakeLock);
+    }
+    __atomic_store_n(&writerIdle, false, __ATOMIC_RELAXED);
+  } else {
+    // Records pushed meanwhile are taken at the deadline, unless they fill a batch first
+    clock_gettime(wakeClock, &deadline);
+    ns = (uint64_t)deadline.tv_nsec + (uint64_t)waitMs * 1000000u;
+    deadline.tv_sec += (time_t)(ns / 1000000000u);
+    deadline.tv_nsec = (long)(ns % 1000000000u);
+    pthread_cond_timedwait(&wake, &wakeLock, &deadline);
+  }
+  pthread_mutex_unlock(&wakeLock);
+}
+
+static void *writerThread(void *arg)
+{
+  const OutputSinkOps *sink = arg;
+  uint32_t tail = __atomic_load_n(&ringTail, __ATOMIC_RELAXED);
+  uint32_t head;
+  uint32_t count;
+  uint32_t waitMs;
+  uint32_t i;
+  bool stop;
+
+  sink->begin();
+  while (1) {
+    // Everything pushed before the stop request is written out
+    stop = __atomic_load_n(&stopRequested, __ATOMIC_ACQUIRE);
+    head = __atomic_load_n(&ringHead, __ATOMIC_ACQUIRE);
+    count = MIN(head - tail, (uint32_t)OUTPUT_BATCH_SIZE);
+    for (i = 0; i < count; i++) {
+      sink->record(&ring[(tail + i) & OUTPUT_RING_MASK]);
+    }
+    tail += count;
+    __atomic_store_n(&ringTail, tail, __ATOMIC_RELEASE);
+    if (stop && head == tail) {
+      sink->flush(clockMs(CLOCK_MONOTONIC), true);
+      break;
+    }
+    waitMs = sink->flush(clockMs(CLOCK_MONOTONIC), false);
+    // Go on with the next batch at once if this one was full
+    if (count < OUTPUT_BATCH_SIZE) {
+      writerWait(waitMs, tail);
+    }
+  }
+  return NULL;
+}
+
+/***************************************************************************************************
+ * Public Function Definitions
+ **************************************************************************************************/
+
+int outputSinkParseFormat(const char *name, OutputFormat *format)
+{
+  if (strcmp(name, "table") == 0) {
+    *format = outputFormatTable;
+  } else if (strcmp(name, "csv") == 0) {
+    *format = outputFormatCsv;
+  } else if (strcmp(name, "json") == 0) {
+    *format = outputFormatJson;
+  } else {
+    return -1;
+  }
+  return 0;
+}
+
+int outputSinkOpen(OutputFormat format, uint8_t ncps)
+{
+  pthread_condattr_t attr;
+  sigset_t blocked;
+  sigset_t old;
+  int ret;
+
+  if (writerRunning || (unsigned)format >= COUNTOF(sinks) || ncps == 0 || ncps > MAX_NCPS) {
+    return -1;
+  }
+  tableSlots = (uint16_t)(ncps * MAX_CONNECTIONS);
+  __atomic_store_n(&stopRequested, false, __ATOMIC_RELAXED);
+  // Flush deadlines are kept on the monotonic clock where the condition variable allows it
+  wakeClock = CLOCK_REALTIME;
+  pthread_condattr_init(&attr);
+#if defined(__linux__)
+  if (pthread_condattr_setclock(&attr, CLOCK_MONOTONIC) == 0) {
+    wakeClock = CLOCK_MONOTONIC;
+  }
+#endif
+  ret = pthread_cond_init(&wake, &attr);
+  pthread_condattr_destroy(&attr);
+  if (ret != 0) {
+    return -1;
+  }
+  // The writer leaves the signals the client acts on to the event thread
+  sigemptyset(&blocked);
+  sigaddset(&blocked, SIGINT);
+  sigaddset(&blocked, SIGTERM);
+  sigaddset(&blocked, SIGUSR1);
+  pthread_sigmask(SIG_BLOCK, &blocked, &old);
+  ret = pthread_create(&writer, NULL, writerThread, (void *)&sinks[format]);
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  if (ret != 0) {
+    pthread_cond_destroy(&wake);
+    return -1;
+  }
+  writerRunning = true;
+  return 0;
+}
+
+void outputSinkClose(void)
+{
+  uint32_t dropped;
+
+  if (!writerRunning) {
+    return;
+  }
+  __atomic_store_n(&stopRequested, true, __ATOMIC_RELEASE);
+  wakeWriter();
+  pthread_join(writer, NULL);
+  pthread_cond_destroy(&wake);
+  writerRunning = false;
+  dropped = outputSinkDropped();
+  if (dropped > 0) {
+    fprintf(stderr, "Output fell behind, %lu readings dropped\n", (unsigned long)dropped);
+  }
+}
+
+bool outputSinkPush(uint8_t slot, uint16_t serverAddress, uint32_t temperature, int8_t rssi)
+{
+  uint32_t head = __atomic_load_n(&ringHead, __ATOMIC_RELAXED);
+  uint32_t tail = __atomic_load_n(&ringTail, __ATOMIC_ACQUIRE);
+  OutputRecord *record;
+
+  if (head - tail >= OUTPUT_RING_SIZE) {
+    // Never wait for the writer, BGAPI processing comes first
+    __atomic_store_n(&droppedRecords, __atomic_load_n(&droppedRecords, __ATOMIC_RELAXED) + 1,
+                     __ATOMIC_RELAXED);
+    return false;
+  }
+  record = &ring[head & OUTPUT_RING_MASK];
+  record->timeMs = clockMs(CLOCK_REALTIME);
+  record->temperature = temperature;
+  record->serverAddress = serverAddress;
+  record->slot = slot;
+  record->rssi = rssi;
+  __atomic_store_n(&ringHead, head + 1, __ATOMIC_SEQ_CST);
+  // The writer is only woken when it waits on an empty ring, or once a batch has built up while
+  // it waits to flush
+  if (__atomic_load_n(&writerIdle, __ATOMIC_SEQ_CST) || head + 1 - tail == OUTPUT_BATCH_SIZE) {
+    wakeWriter();
+  }
+  return true;
+}
+
+uint32_t outputSinkDropped(void)
+{
+  return __atomic_load_n(&droppedRecords, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,114 @@
+/***************************************************************************//**
+ * @file
+ * @brief Asynchronous output of thermometer readings
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2018 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+#ifndef OUTPUT_SINK_H
+#define OUTPUT_SINK_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/***********************************************************************************************//**
+ * \defgroup output_sink Output Sink
+ * \brief The event thread queues readings in a lock-free single-producer/single-consumer ring,
+ *        a writer thread formats them in batches so slow terminals or pipes never hold up BGAPI
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ * @addtogroup output_sink
+ * @{
+ **************************************************************************************************/
+
+ // Records the ring can hold, a power of two
+ #define OUTPUT_RING_SIZE              1024
+ // Most records formatted before the output is flushed
+ #define OUTPUT_BATCH_SIZE             256
+ // Most redraws of the results table per second
+ #ifndef OUTPUT_TABLE_FPS
+ #define OUTPUT_TABLE_FPS              10
+ #endif
+
+/***************************************************************************************************
+ * Type Definitions
+ **************************************************************************************************/
+ typedef enum {
+   outputFormatTable,
+   outputFormatCsv,
+   outputFormatJson
+ } OutputFormat;
+
+ // One reading, or an emptied table slot when temperature is TEMP_INVALID
+ typedef struct {
+   uint64_t timeMs;           // wall clock time in ms since the epoch
+   uint32_t temperature;
+   uint16_t serverAddress;
+   uint8_t  slot;
+   int8_t   rssi;
+ } OutputRecord;
+
+/***************************************************************************************************
+ * Function Declarations
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  Parse an output format name.
+ *  \param[in]  name  "table", "csv" or "json"
+ *  \param[out]  format  parsed format
+ *  \return  0 on success, -1 if the name is unknown
+ **************************************************************************************************/
+int outputSinkParseFormat(const char *name, OutputFormat *format);
+
+/***********************************************************************************************//**
+ *  \brief  Start the writer thread.
+ *  \param[in]  format  how readings are written to stdout
+ *  \param[in]  ncps  number of NCPs, the results table has MAX_CONNECTIONS slots for each
+ *  \return  0 on success, -1 on failure
+ **************************************************************************************************/
+int outputSinkOpen(OutputFormat format, uint8_t ncps);
+
+/***********************************************************************************************//**
+ *  \brief  Write out the queued records, stop the writer thread and report dropped records.
+ **************************************************************************************************/
+void outputSinkClose(void);
+
+/***********************************************************************************************//**
+ *  \brief  Queue a reading for output, called from the event thread only. Never blocks.
+ *  \param[in]  slot  results table slot of the sensor, broadcast sensors past the end of the table
+ *                    have none and are written without one
+ *  \param[in]  serverAddress  last two bytes of the sensor address
+ *  \param[in]  temperature  temperature, TEMP_INVALID to empty the slot
+ *  \param[in]  rssi  RSSI in dBm
+ *  \return  true if queued, false if dropped because the ring is full
+ **************************************************************************************************/
+bool outputSinkPush(uint8_t slot, uint16_t serverAddress, uint32_t temperature, int8_t rssi);
+
+/***********************************************************************************************//**
+ *  \brief  Number of records dropped because the writer fell behind.
+ *  \return  dropped record count
+ **************************************************************************************************/
+uint32_t outputSinkDropped(void);
+
+/** @} (end addtogroup output_sink) */
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* OUTPUT_SINK_H */
@@ -0,0 +1,659 @@
+/***************************************************************************//**
+ * @file
+ * @brief Append-only store of thermometer readings
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2018 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+/* standard library headers */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <time.h>
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "infrastructure.h"
+
+/* Own header */
+#include "reading_store.h"
+
+#define READING_STORE_MAGIC           0x31535452u  // "RTS1"
+#define READING_STORE_VERSION         1u
+
+#define CHUNK_SIZE                    ((size_t)READING_STORE_BLOCK_SIZE * READING_STORE_CHUNK_BLOCKS)
+#define SENSOR_MASK                   (READING_STORE_MAX_SENSORS - 1)
+// A block is never index 0, that is where the header lives
+#define BLOCK_NONE                    0u
+// Most bits one sample takes: timestamp 4 + 32, temperature 2 + 5 + 5 + 32, RSSI 2 + 8
+#define SAMPLE_BITS_MAX               90u
+// No previous XOR window to reuse
+#define WINDOW_NONE                   0xffu
+
+#if (READING_STORE_MAX_SENSORS & SENSOR_MASK) != 0
+#error "READING_STORE_MAX_SENSORS must be a power of two"
+#endif
+
+// Directory entry of one sensor
+typedef struct {
+  bd_addr  address;
+  uint8_t  valid;
+  uint8_t  reserved;
+  uint32_t lastBlock;         // newest block of the sensor
+  uint32_t samples;
+} StoreSensor;
+
+// The file starts with a 64-byte header and the sensor directory, blocks follow
+typedef struct {
+  uint32_t    magic;
+  uint32_t    version;
+  uint32_t    blockSize;
+  uint32_t    chunkBlocks;
+  uint32_t    maxSensors;
+  uint32_t    blockCount;     // blocks in use, the header's included
+  uint8_t     reserved[40];
+  StoreSensor sensors[READING_STORE_MAX_SENSORS];
+} StoreHeader;
+
+#define HEADER_BLOCKS ((sizeof(StoreHeader) + READING_STORE_BLOCK_SIZE - 1) / READING_STORE_BLOCK_SIZE)
+
+// Samples of one sensor. The first one is stored whole, the others against the one before.
+typedef struct {
+  uint64_t firstTimeMs;       // multiples of READING_STORE_TICK_MS
+  uint64_t lastTimeMs;
+  bd_addr  address;
+  uint16_t count;             // written last, readers decode this many samples
+  uint32_t prevBlock;         // previous block of the same sensor
+  uint32_t bits;              // payload bits in use
+  uint8_t  payload[READING_STORE_BLOCK_SIZE - 32];
+} StoreBlock;
+
+// Encoder state of a sensor, the block being filled is abandoned on close
+typedef struct {
+  uint32_t block;
+  uint64_t ticks;
+  int64_t  delta;
+  uint32_t temperature;
+  int8_t   rssi;
+  uint8_t  leading;
+  uint8_t  trailing;
+} StoreWriter;
+
+// Decoder state while walking a block
+typedef struct {
+  const StoreBlock *block;
+  uint32_t pos;
+  uint64_t ticks;
+  int64_t  delta;
+  uint32_t temperature;
+  int8_t   rssi;
+  uint8_t  leading;
+  uint8_t  trailing;
+} StoreReader;
+
+static int storeFd = -1;
+static bool storeReadOnly;
+static StoreHeader *header;
+// Mapping of every chunk of the file, mapped on first use
+static uint8_t **chunks;
+static uint32_t chunkCount;
+static StoreWriter writers[READING_STORE_MAX_SENSORS];
+// Added to the monotonic clock to get wall clock time
+static int64_t epochOffsetMs;
+
+/***************************************************************************************************
+ * Bit Stream
+ **************************************************************************************************/
+
+// Append the low n bits of a value, most significant first
+static void putBits(uint8_t *buf, uint32_t *pos, uint32_t value, uint8_t n)
+{
+  uint8_t space;
+  uint8_t take;
+
+  while (n > 0) {
+    space = 8 - (*pos & 7);
+    take = MIN(n, space);
+    buf[*pos >> 3] |= (uint8_t)(((value >> (n - take)) & ((1u << take) - 1)) << (space - take));
+    *pos += take;
+    n -= take;
+  }
+}
+
+static uint32_t getBits(const uint8_t *buf, uint32_t *pos, uint8_t n)
+{
+  uint32_t value = 0;
+  uint8_t space;
+  uint8_t take;
+
+  while (n > 0) {
+    space = 8 - (*pos & 7);
+    take = MIN(n, space);
+    value = (value << take) | ((buf[*pos >> 3] >> (space - take)) & ((1u << take) - 1));
+    *pos += take;
+    n -= take;
+  }
+  return value;
+}
+
+static int32_t signExtend(uint32_t value, uint8_t n)
+{
+  return (n < 32 && (value & (1u << (n - 1)))) ? (int32_t)(value | ~((1u << n) - 1)) : (int32_t)value;
+}
+
+static uint8_t leadingZeros(uint32_t x)
+{
+  return (uint8_t)__builtin_clz(x);
+}
+
+static uint8_t trailingZeros(uint32_t x)
+{
+  return (uint8_t)__builtin_ctz(x);
+}
+
+/***************************************************************************************************
+ * Encoding
+ **************************************************************************************************/
+
+// Delta-of-delta buckets of the timestamps: 0, then 7, 9, 12 or 32 bit signed values
+static bool dodFits(int64_t dod)
+{
+  return dod >= INT32_MIN && dod <= INT32_MAX;
+}
+
+static void encodeTime(uint8_t *buf, uint32_t *pos, int64_t dod)
+{
+  if (dod == 0) {
+    putBits(buf, pos, 0x0, 1);
+  } else if (dod >= -64 && dod <= 63) {
+    putBits(buf, pos, 0x2, 2);
+    putBits(buf, pos, (uint32_t)dod, 7);
+  } else if (dod >= -256 && dod <= 255) {
+    putBits(buf, pos, 0x6, 3);
+    putBits(buf, pos, (uint32_t)dod, 9);
+  } else if (dod >= -2048 && dod <= 2047) {
+    putBits(buf, pos, 0xe, 4);
+    putBits(buf, pos, (uint32_t)dod, 12);
+  } else {
+    putBits(buf, pos, 0xf, 4);
+    putBits(buf, pos, (uint32_t)dod, 32);
+  }
+}
+
+static int64_t decodeTime(const uint8_t *buf, uint32_t *pos)
+{
+  static const uint8_t widths[] = { 7, 9, 12, 32 };
+  uint8_t bucket = 0;
+
+  while (bucket < COUNTOF(widths) && getBits(buf, pos, 1) == 1) {
+    bucket++;
+  }
+  if (bucket == 0) {
+    return 0;
+  }
+  bucket--;
+  return signExtend(getBits(buf, pos, widths[bucket]), widths[bucket]);
+}
+
+// XOR with the previous temperature: 0 if equal, 10 and the bits inside the previous window of
+// meaningful bits, or 11, 5 bits of leading zeros, 5 bits of length - 1 and the meaningful bits
+static void encodeTemperature(uint8_t *buf, uint32_t *pos, StoreWriter *w, uint32_t temperature)
+{
+  uint32_t x = temperature ^ w->temperature;
+  uint8_t lead;
+  uint8_t trail;
+
+  if (x == 0) {
+    putBits(buf, pos, 0x0, 1);
+    return;
+  }
+  lead = leadingZeros(x);
+  trail = trailingZeros(x);
+  if (w->leading != WINDOW_NONE && lead >= w->leading && trail >= w->trailing) {
+    putBits(buf, pos, 0x2, 2);
+    putBits(buf, pos, x >> w->trailing, 32 - w->leading - w->trailing);
+    return;
+  }
+  putBits(buf, pos, 0x3, 2);
+  putBits(buf, pos, lead, 5);
+  putBits(buf, pos, 31u - lead - trail, 5);
+  putBits(buf, pos, x >> trail, 32 - lead - trail);
+  w->leading = lead;
+  w->trailing = trail;
+}
+
+static uint32_t decodeTemperature(StoreReader *r)
+{
+  uint8_t len;
+
+  if (getBits(r->block->payload, &r->pos, 1) == 0) {
+    return r->temperature;
+  }
+  if (getBits(r->block->payload, &r->pos, 1) == 1) {
+    r->leading = (uint8_t)getBits(r->block->payload, &r->pos, 5);
+    len = (uint8_t)getBits(r->block->payload, &r->pos, 5) + 1;
+    r->trailing = 32 - r->leading - len;
+  } else {
+    len = 32 - r->leading - r->trailing;
+  }
+  return r->temperature ^ (getBits(r->block->payload, &r->pos, len) << r->trailing);
+}
+
+// RSSI: 0 if equal, 10 and a 3-bit signed difference, or 11 and the value
+static void encodeRssi(uint8_t *buf, uint32_t *pos, int8_t previous, int8_t rssi)
+{
+  int16_t diff = (int16_t)rssi - previous;
+
+  if (diff == 0) {
+    putBits(buf, pos, 0x0, 1);
+  } else if (diff >= -4 && diff <= 3) {
+    putBits(buf, pos, 0x2, 2);
+    putBits(buf, pos, (uint32_t)diff, 3);
+  } else {
+    putBits(buf, pos, 0x3, 2);
+    putBits(buf, pos, (uint8_t)rssi, 8);
+  }
+}
+
+static int8_t decodeRssi(const uint8_t *buf, uint32_t *pos, int8_t previous)
+{
+  if (getBits(buf, pos, 1) == 0) {
+    return previous;
+  }
+  if (getBits(buf, pos, 1) == 0) {
+    return (int8_t)(previous + signExtend(getBits(buf, pos, 3), 3));
+  }
+  return (int8_t)getBits(buf, pos, 8);
+}
+
+static bool nextReading(StoreReader *r, uint16_t index, StoredReading *reading)
+{
+  const uint8_t *buf = r->block->payload;
+
+  if (index == 0) {
+    r->pos = 0;
+    r->ticks = r->block->firstTimeMs / READING_STORE_TICK_MS;
+    r->delta = 0;
+    r->temperature = getBits(buf, &r->pos, 32);
+    r->rssi = (int8_t)getBits(buf, &r->pos, 8);
+    r->leading = 0;
+    r->trailing = 0;
+  } else {
+    r->delta += decodeTime(buf, &r->pos);
+    r->ticks += (uint64_t)r->delta;
+    r->temperature = decodeTemperature(r);
+    r->rssi = decodeRssi(buf, &r->pos, r->rssi);
+  }
+  if (r->pos > r->block->bits) {
+    return false;
+  }
+  reading->timeMs = r->ticks * READING_STORE_TICK_MS;
+  reading->address = r->block->address;
+  reading->temperature = r->temperature;
+  reading->rssi = r->rssi;
+  return true;
+}
+
+/***************************************************************************************************
+ * File Mapping
+ **************************************************************************************************/
+
+// Wall clock time in READING_STORE_TICK_MS units, advancing with the monotonic clock
+static uint64_t nowTicks(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)((int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000 + epochOffsetMs)
+         / READING_STORE_TICK_MS;
+}
+
+// Map a chunk of the file if it exists, NULL otherwise
+static uint8_t *chunkAt(uint32_t chunk)
+{
+#if !defined(_WIN32)
+  struct stat st;
+  uint8_t **grown;
+  void *map;
+
+  if (chunk >= chunkCount) {
+    // Another process may have grown the file
+    if (fstat(storeFd, &st) < 0 || (uint64_t)st.st_size < (uint64_t)(chunk + 1) * CHUNK_SIZE) {
+      return NULL;
+    }
+    grown = realloc(chunks, (chunk + 1) * sizeof(*chunks));
+    if (grown == NULL) {
+      return NULL;
+    }
+    memset(&grown[chunkCount], 0, (chunk + 1 - chunkCount) * sizeof(*chunks));
+    chunks = grown;
+    chunkCount = chunk + 1;
+  }
+  if (chunks[chunk] == NULL) {
+    map = mmap(NULL, CHUNK_SIZE, storeReadOnly ? PROT_READ : PROT_READ | PROT_WRITE, MAP_SHARED,
+               storeFd, (off_t)chunk * CHUNK_SIZE);
+    if (map == MAP_FAILED) {
+      return NULL;
+    }
+    chunks[chunk] = map;
+  }
+  return chunks[chunk];
+#else
+  (void)chunk;
+  return NULL;
+#endif
+}
+
+static StoreBlock *blockAt(uint32_t index)
+{
+  uint8_t *chunk = chunkAt(index / READING_STORE_CHUNK_BLOCKS);
+
+  if (chunk == NULL) {
+    return NULL;
+  }
+  return (StoreBlock *)&chunk[(size_t)(index % READING_STORE_CHUNK_BLOCKS) * READING_STORE_BLOCK_SIZE];
+}
+
+// Take the next unused block, growing the file by a chunk when it is full
+static uint32_t allocBlock(void)
+{
+  uint32_t index = header->blockCount;
+
+#if !defined(_WIN32)
+  if (index % READING_STORE_CHUNK_BLOCKS == 0
+      && ftruncate(storeFd, (off_t)(index / READING_STORE_CHUNK_BLOCKS + 1) * CHUNK_SIZE) < 0) {
+    return BLOCK_NONE;
+  }
+#endif
+  if (blockAt(index) == NULL) {
+    return BLOCK_NONE;
+  }
+  header->blockCount++;
+  return index;
+}
+
+static uint32_t hashOf(const bd_addr *address)
+{
+  uint32_t hash = 2166136261u;
+  uint8_t i;
+
+  // FNV-1a over the six address bytes
+  for (i = 0; i < sizeof(address->addr); i++) {
+    hash = (hash ^ address->addr[i]) * 16777619u;
+  }
+  return hash;
+}
+
+// Directory slot of a sensor, open addressing with linear probing. -1 if not found and not added.
+static int findSensor(const bd_addr *address, bool add)
+{
+  uint32_t slot = hashOf(address) & SENSOR_MASK;
+  uint32_t i;
+
+  for (i = 0; i < READING_STORE_MAX_SENSORS; i++, slot = (slot + 1) & SENSOR_MASK) {
+    if (!header->sensors[slot].valid) {
+      if (!add) {
+        return -1;
+      }
+      header->sensors[slot].address = *address;
+      header->sensors[slot].lastBlock = BLOCK_NONE;
+      header->sensors[slot].samples = 0;
+      header->sensors[slot].valid = 1;
+      return (int)slot;
+    }
+    if (memcmp(&header->sensors[slot].address, address, sizeof(bd_addr)) == 0) {
+      return (int)slot;
+    }
+  }
+  return -1;
+}
+
+// Start a block with a whole sample
+static bool startBlock(StoreSensor *sensor, StoreWriter *w, uint64_t ticks, uint32_t temperature,
+                       int8_t rssi)
+{
+  uint32_t index = allocBlock();
+  StoreBlock *block;
+  uint32_t pos = 0;
+
+  if (index == BLOCK_NONE) {
+    return false;
+  }
+  block = blockAt(index);
+  block->address = sensor->address;
+  block->prevBlock = sensor->lastBlock;
+  block->firstTimeMs = ticks * READING_STORE_TICK_MS;
+  block->lastTimeMs = block->firstTimeMs;
+  putBits(block->payload, &pos, temperature, 32);
+  putBits(block->payload, &pos, (uint8_t)rssi, 8);
+  block->bits = pos;
+  block->count = 1;
+  sensor->lastBlock = index;
+  w->block = index;
+  w->ticks = ticks;
+  w->delta = 0;
+  w->temperature = temperature;
+  w->rssi = rssi;
+  w->leading = WINDOW_NONE;
+  w->trailing = 0;
+  return true;
+}
+
+/***************************************************************************************************
+ * Public Function Definitions
+ **************************************************************************************************/
+
+int readingStoreOpen(const char *path, bool readOnly)
+{
+#if !defined(_WIN32)
+  struct timespec mono;
+  struct timespec real;
+  struct stat st;
+  bool created = false;
+
+  if (storeFd >= 0 || path == NULL) {
+    return -1;
+  }
+  storeFd = open(path, readOnly ? O_RDONLY : O_RDWR | O_CREAT, 0644);
+  if (storeFd < 0) {
+    printf("Cannot open reading store %s\n", path);
+    return -1;
+  }
+  storeReadOnly = readOnly;
+  if (fstat(storeFd, &st) < 0) {
+    readingStoreClose();
+    return -1;
+  }
+  if (st.st_size == 0 && !readOnly) {
+    if (ftruncate(storeFd, CHUNK_SIZE) < 0) {
+      readingStoreClose();
+      return -1;
+    }
+    created = true;
+  } else if (st.st_size == 0 || st.st_size % CHUNK_SIZE != 0) {
+    printf("%s is not a reading store\n", path);
+    readingStoreClose();
+    return -1;
+  }
+  header = (StoreHeader *)chunkAt(0);
+  if (header == NULL) {
+    readingStoreClose();
+    return -1;
+  }
+  if (created) {
+    header->magic = READING_STORE_MAGIC;
+    header->version = READING_STORE_VERSION;
+    header->blockSize = READING_STORE_BLOCK_SIZE;
+    header->chunkBlocks = READING_STORE_CHUNK_BLOCKS;
+    header->maxSensors = READING_STORE_MAX_SENSORS;
+    header->blockCount = HEADER_BLOCKS;
+  } else if (header->magic != READING_STORE_MAGIC
+             || header->version != READING_STORE_VERSION
+             || header->blockSize != READING_STORE_BLOCK_SIZE
+             || header->chunkBlocks != READING_STORE_CHUNK_BLOCKS
+             || header->maxSensors != READING_STORE_MAX_SENSORS) {
+    // History is never thrown away, unlike the GATT cache
+    printf("%s is not a reading store\n", path);
+    readingStoreClose();
+    return -1;
+  }
+  // Timestamps follow the monotonic clock from the wall clock time at start-up
+  clock_gettime(CLOCK_MONOTONIC, &mono);
+  clock_gettime(CLOCK_REALTIME, &real);
+  epochOffsetMs = ((int64_t)real.tv_sec - mono.tv_sec) * 1000 + (real.tv_nsec - mono.tv_nsec) / 1000000;
+  memset(writers, 0, sizeof(writers));
+  return 0;
+#else
+  (void)path;
+  (void)readOnly;
+  return -1;
+#endif
+}
+
+void readingStoreClose(void)
+{
+#if !defined(_WIN32)
+  uint32_t i;
+
+  for (i = 0; i < chunkCount; i++) {
+    if (chunks[i] != NULL) {
+      if (!storeReadOnly) {
+        msync(chunks[i], CHUNK_SIZE, MS_SYNC);
+      }
+      munmap(chunks[i], CHUNK_SIZE);
+    }
+  }
+  if (storeFd >= 0) {
+    close(storeFd);
+  }
+#endif
+  free(chunks);
+  chunks = NULL;
+  chunkCount = 0;
+  header = NULL;
+  storeFd = -1;
+}
+
+bool readingStoreAppend(const bd_addr *address, uint32_t temperature, int8_t rssi)
+{
+  StoreSensor *sensor;
+  StoreWriter *w;
+  StoreBlock *block;
+  uint64_t ticks;
+  int64_t delta;
+  uint32_t pos;
+  int slot;
+
+  if (header == NULL || storeReadOnly || (slot = findSensor(address, true)) < 0) {
+    return false;
+  }
+  sensor = &header->sensors[slot];
+  w = &writers[slot];
+  ticks = nowTicks();
+  delta = (int64_t)(ticks - w->ticks);
+  block = (w->block != BLOCK_NONE) ? blockAt(w->block) : NULL;
+  if (block == NULL || block->count == UINT16_MAX || !dodFits(delta - w->delta)
+      || block->bits + SAMPLE_BITS_MAX > sizeof(block->payload) * 8) {
+    if (!startBlock(sensor, w, ticks, temperature, rssi)) {
+      return false;
+    }
+  } else {
+    pos = block->bits;
+    encodeTime(block->payload, &pos, delta - w->delta);
+    encodeTemperature(block->payload, &pos, w, temperature);
+    encodeRssi(block->payload, &pos, w->rssi, rssi);
+    w->ticks = ticks;
+    w->delta = delta;
+    w->temperature = temperature;
+    w->rssi = rssi;
+    block->bits = pos;
+    block->lastTimeMs = ticks * READING_STORE_TICK_MS;
+    block->count++;
+  }
+  sensor->samples++;
+  return true;
+}
+
+uint32_t readingStoreQuery(const bd_addr *address, uint64_t fromMs, uint64_t toMs,
+                           ReadingStoreCallback callback, void *context)
+{
+  StoredReading reading;
+  StoreReader reader;
+  const StoreBlock *block;
+  uint32_t *matches = NULL;
+  uint32_t *grown;
+  uint32_t matchCount = 0;
+  uint32_t capacity = 0;
+  uint32_t found = 0;
+  uint32_t index;
+  uint16_t i;
+  int slot;
+
+  if (header == NULL || (slot = findSensor(address, false)) < 0) {
+    return 0;
+  }
+  // Walk the chain back to the window, blocks are in time order
+  for (index = header->sensors[slot].lastBlock; index != BLOCK_NONE; index = block->prevBlock) {
+    block = blockAt(index);
+    if (block == NULL || block->lastTimeMs < fromMs) {
+      break;
+    }
+    if (block->firstTimeMs > toMs) {
+      continue;
+    }
+    if (matchCount == capacity) {
+      capacity = capacity ? capacity * 2 : 16;
+      grown = realloc(matches, capacity * sizeof(*matches));
+      if (grown == NULL) {
+        break;
+      }
+      matches = grown;
+    }
+    matches[matchCount++] = index;
+  }
+  // Then decode them oldest first
+  while (matchCount > 0) {
+    reader.block = blockAt(matches[--matchCount]);
+    for (i = 0; i < reader.block->count && nextReading(&reader, i, &reading); i++) {
+      if (reading.timeMs < fromMs || reading.timeMs > toMs) {
+        continue;
+      }
+      found++;
+      if (!callback(&reading, context)) {
+        matchCount = 0;
+        break;
+      }
+    }
+  }
+  free(matches);
+  return found;
+}
+
+void readingStoreSensors(ReadingStoreSensorCallback callback, void *context)
+{
+  uint32_t i;
+
+  if (header == NULL) {
+    return;
+  }
+  for (i = 0; i < READING_STORE_MAX_SENSORS; i++) {
+    if (header->sensors[i].valid) {
+      callback(&header->sensors[i].address, header->sensors[i].samples, context);
+    }
+  }
+}
@@ -0,0 +1,121 @@
+/***************************************************************************//**
+ * @file
+ * @brief Append-only store of thermometer readings
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2018 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+#ifndef READING_STORE_H
+#define READING_STORE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "bg_types.h"
+
+/***********************************************************************************************//**
+ * \defgroup reading_store Reading Store
+ * \brief Memory-mapped history of readings in per-sensor blocks, timestamps delta-of-delta,
+ *        temperatures XOR and RSSI delta encoded against the previous sample of the same sensor
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ * @addtogroup reading_store
+ * @{
+ **************************************************************************************************/
+
+ #define READING_STORE_BLOCK_SIZE      4096
+ // The file grows, and is mapped, this many blocks at a time
+ #define READING_STORE_CHUNK_BLOCKS    256
+ // Sensors the directory can hold, a power of two
+ #define READING_STORE_MAX_SENSORS     1024
+ // Timestamp resolution. Readings arrive on connection events, they cannot be timed any closer
+ // than the 100 ms connection interval.
+ #ifndef READING_STORE_TICK_MS
+ #define READING_STORE_TICK_MS         100
+ #endif
+
+/***************************************************************************************************
+ * Type Definitions
+ **************************************************************************************************/
+ typedef struct {
+   uint64_t timeMs;           // wall clock time in ms since the epoch, in READING_STORE_TICK_MS steps
+   bd_addr  address;
+   int8_t   rssi;
+   uint32_t temperature;
+ } StoredReading;
+
+ // Called for every reading found by a query, return false to stop the query
+ typedef bool (*ReadingStoreCallback)(const StoredReading *reading, void *context);
+
+ // Called for every sensor in the store
+ typedef void (*ReadingStoreSensorCallback)(const bd_addr *address, uint32_t samples,
+                                            void *context);
+
+/***************************************************************************************************
+ * Function Declarations
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  Map the store file, creating it if needed and allowed.
+ *  \param[in]  path  store file
+ *  \param[in]  readOnly  true to query the store only
+ *  \return  0 on success, -1 if the store cannot be used
+ **************************************************************************************************/
+int readingStoreOpen(const char *path, bool readOnly);
+
+/***********************************************************************************************//**
+ *  \brief  Flush and unmap the store file.
+ **************************************************************************************************/
+void readingStoreClose(void);
+
+/***********************************************************************************************//**
+ *  \brief  Append a reading, timestamped now. No system call is made unless the file has to grow.
+ *  \param[in]  address  device address
+ *  \param[in]  temperature  temperature in thousandths of a degree Celsius
+ *  \param[in]  rssi  RSSI in dBm
+ *  \return  true if stored, false if the store is closed, read-only or full
+ **************************************************************************************************/
+bool readingStoreAppend(const bd_addr *address, uint32_t temperature, int8_t rssi);
+
+/***********************************************************************************************//**
+ *  \brief  Walk the readings of one sensor in a time window, oldest first. Only the blocks of that
+ *          sensor overlapping the window are decoded.
+ *  \param[in]  address  device address
+ *  \param[in]  fromMs  start of the window, ms since the epoch
+ *  \param[in]  toMs  end of the window (inclusive), ms since the epoch
+ *  \param[in]  callback  function called for every reading in the window
+ *  \param[in]  context  passed to the callback
+ *  \return  number of readings passed to the callback
+ **************************************************************************************************/
+uint32_t readingStoreQuery(const bd_addr *address, uint64_t fromMs, uint64_t toMs,
+                           ReadingStoreCallback callback, void *context);
+
+/***********************************************************************************************//**
+ *  \brief  List the sensors in the store.
+ *  \param[in]  callback  function called for every sensor
+ *  \param[in]  context  passed to the callback
+ **************************************************************************************************/
+void readingStoreSensors(ReadingStoreSensorCallback callback, void *context);
+
+/** @} (end addtogroup reading_store) */
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* READING_STORE_H */
@@ -0,0 +1,264 @@
+/***************************************************************************//**
+ * @file
+ * @brief Rotation of connections through more sensors than the NCPs have links for
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2018 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+/* standard library headers */
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <time.h>
+
+/* Own header */
+#include "rotation.h"
+
+#if (ROTATION_MAX_SENSORS & (ROTATION_MAX_SENSORS - 1)) != 0 || ROTATION_MAX_SENSORS > 32768
+#error "ROTATION_MAX_SENSORS must be a power of two, at most 32768"
+#endif
+
+// The address index is kept at most half full
+#define INDEX_SIZE                    (2 * ROTATION_MAX_SENSORS)
+
+typedef enum {
+  sensorWaiting,              // in the heap
+  sensorTaken,                // handed out by rotationNextDue()
+  sensorForgotten
+} SensorState;
+
+typedef struct {
+  uint64_t dueMs;
+  uint64_t firstReadMs;
+  uint64_t lastReadMs;
+  uint32_t readings;
+  uint32_t failures;
+  bd_addr  address;
+  uint8_t  addressType;
+  uint8_t  state;
+} Sensor;
+
+static Sensor sensors[ROTATION_MAX_SENSORS];
+static uint16_t sensorCount = 0;
+// Sensor index + 1 of each address, open addressed, 0 for a free entry. Sensors are never
+// removed, so neither are the entries.
+static uint16_t byAddress[INDEX_SIZE];
+// Min-heap of the waiting sensors on dueMs
+static uint16_t heap[ROTATION_MAX_SENSORS];
+static uint16_t heapSize = 0;
+static uint32_t sampleIntervalMs = 0;
+
+static uint64_t clockMs(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000u + (uint64_t)ts.tv_nsec / 1000000u;
+}
+
+// Index entry of an address, its own or the free one it would take
+static uint16_t *indexEntry(const bd_addr *address)
+{
+  uint64_t key = 0;
+  uint32_t i;
+
+  memcpy(&key, address->addr, sizeof(address->addr));
+  i = (uint32_t)((key * 0x9e3779b97f4a7c15ull) >> 48) & (INDEX_SIZE - 1);
+  while (byAddress[i] != 0
+         && memcmp(&sensors[byAddress[i] - 1].address, address, sizeof(*address)) != 0) {
+    i = (i + 1) & (INDEX_SIZE - 1);
+  }
+  return &byAddress[i];
+}
+
+static Sensor *find(const bd_addr *address)
+{
+  uint16_t entry = *indexEntry(address);
+
+  return (entry != 0) ? &sensors[entry - 1] : NULL;
+}
+
+static bool earlier(uint16_t a, uint16_t b)
+{
+  return sensors[a].dueMs < sensors[b].dueMs;
+}
+
+static void heapPush(uint16_t sensor)
+{
+  uint16_t pos = heapSize++;
+  uint16_t parent;
+
+  while (pos > 0) {
+    parent = (uint16_t)((pos - 1) / 2);
+    if (!earlier(sensor, heap[parent])) {
+      break;
+    }
+    heap[pos] = heap[parent];
+    pos = parent;
+  }
+  heap[pos] = sensor;
+  sensors[sensor].state = sensorWaiting;
+}
+
+static uint16_t heapPop(void)
+{
+  uint16_t top = heap[0];
+  uint16_t last = heap[--heapSize];
+  uint16_t pos = 0;
+  uint16_t child;
+
+  while ((child = (uint16_t)(2 * pos + 1)) < heapSize) {
+    if (child + 1 < heapSize && earlier(heap[child + 1], heap[child])) {
+      child++;
+    }
+    if (!earlier(heap[child], last)) {
+      break;
+    }
+    heap[pos] = heap[child];
+    pos = child;
+  }
+  heap[pos] = last;
+  return top;
+}
+
+/***************************************************************************************************
+ * Public Function Definitions
+ **************************************************************************************************/
+
+void rotationSetInterval(uint32_t intervalMs)
+{
+  sampleIntervalMs = intervalMs;
+}
+
+bool rotationEnabled(void)
+{
+  return sampleIntervalMs != 0;
+}
+
+void rotationAdd(const bd_addr *address, uint8_t addressType)
+{
+  uint16_t *entry = indexEntry(address);
+  Sensor *sensor;
+
+  if (*entry != 0) {
+    sensor = &sensors[*entry - 1];
+    sensor->addressType = addressType;
+    if (sensor->state == sensorForgotten) {
+      sensor->dueMs = clockMs();
+      heapPush((uint16_t)(*entry - 1));
+    }
+    return;
+  }
+  if (sensorCount == ROTATION_MAX_SENSORS) {
+    return;
+  }
+  sensor = &sensors[sensorCount];
+  memset(sensor, 0, sizeof(*sensor));
+  sensor->address = *address;
+  sensor->addressType = addressType;
+  sensor->dueMs = clockMs();
+  *entry = (uint16_t)(sensorCount + 1);
+  heapPush(sensorCount++);
+}
+
+bool rotationNextDue(bd_addr *address, uint8_t *addressType)
+{
+  Sensor *sensor;
+
+  if (heapSize == 0 || sensors[heap[0]].dueMs > clockMs()) {
+    return false;
+  }
+  sensor = &sensors[heapPop()];
+  sensor->state = sensorTaken;
+  *address = sensor->address;
+  *addressType = sensor->addressType;
+  return true;
+}
+
+uint32_t rotationNextDueMs(void)
+{
+  uint64_t nowMs = clockMs();
+
+  if (heapSize == 0) {
+    return ROTATION_IDLE;
+  }
+  if (sensors[heap[0]].dueMs <= nowMs) {
+    return 0;
+  }
+  // Never more than an interval away
+  return (uint32_t)(sensors[heap[0]].dueMs - nowMs);
+}
+
+bool rotationDone(const bd_addr *address, bool read)
+{
+  Sensor *sensor = find(address);
+  uint64_t nowMs = clockMs();
+
+  if (sensor == NULL || sensor->state != sensorTaken) {
+    return false;
+  }
+  if (read) {
+    if (sensor->readings++ == 0) {
+      sensor->firstReadMs = nowMs;
+    }
+    sensor->lastReadMs = nowMs;
+    sensor->dueMs = nowMs + sampleIntervalMs;
+  } else {
+    sensor->failures++;
+    sensor->dueMs = nowMs + ((sampleIntervalMs < ROTATION_RETRY_MS) ? sampleIntervalMs
+                             : ROTATION_RETRY_MS);
+  }
+  heapPush((uint16_t)(sensor - sensors));
+  return true;
+}
+
+void rotationForget(const bd_addr *address)
+{
+  Sensor *sensor = find(address);
+
+  if (sensor != NULL && sensor->state == sensorTaken) {
+    sensor->state = sensorForgotten;
+  }
+}
+
+void rotationReport(FILE *out)
+{
+  const Sensor *sensor;
+  uint64_t nowMs = clockMs();
+  double requested = 60000.0 / sampleIntervalMs;
+  double achieved;
+  double total = 0.0;
+  uint16_t i;
+
+  if (!rotationEnabled()) {
+    return;
+  }
+  fprintf(out, "address readings/min requested achieved readings failures\n");
+  for (i = 0; i < sensorCount; i++) {
+    sensor = &sensors[i];
+    // Over the time between the first and the last reading, once there are two
+    achieved = (sensor->readings > 1)
+               ? (sensor->readings - 1) * 60000.0 / (double)(sensor->lastReadMs - sensor->firstReadMs)
+               : 0.0;
+    total += achieved;
+    fprintf(out, "%02x:%02x:%02x:%02x:%02x:%02x %.2f %.2f %lu %lu%s\n",
+            sensor->address.addr[5], sensor->address.addr[4], sensor->address.addr[3],
+            sensor->address.addr[2], sensor->address.addr[1], sensor->address.addr[0],
+            requested, achieved, (unsigned long)sensor->readings, (unsigned long)sensor->failures,
+            (sensor->state == sensorForgotten) ? " not a thermometer"
+            : (sensor->state == sensorWaiting && sensor->dueMs + sampleIntervalMs < nowMs)
+            ? " overdue" : "");
+  }
+  fprintf(out, "rotation: %u sensors, %.1f readings/min requested, %.1f achieved\n",
+          (unsigned)sensorCount, requested * sensorCount, total);
+}
@@ -0,0 +1,122 @@
+/***************************************************************************//**
+ * @file
+ * @brief Rotation of connections through more sensors than the NCPs have links for
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2018 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+#ifndef ROTATION_H
+#define ROTATION_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "bg_types.h"
+
+/***********************************************************************************************//**
+ * \defgroup rotation Rotation
+ * \brief Known sensors in a min-heap keyed on when their next reading is due, the last reading
+ *        plus the sample interval. Each sensor is connected when it comes up, read once and
+ *        disconnected again, so a few links serve many slowly changing sensors. The list is
+ *        shared by all NCPs.
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ * @addtogroup rotation
+ * @{
+ **************************************************************************************************/
+
+ // Sensors the rotation can hold, a power of two
+ #define ROTATION_MAX_SENSORS          1024
+ // A connection that has not opened, or has not delivered a reading, is given up after this, in ms
+ #define ROTATION_CONNECT_TIMEOUT_MS   3000
+ #define ROTATION_READ_TIMEOUT_MS      5000
+ // A sensor that could not be read is tried again after this, or after its interval if shorter
+ #define ROTATION_RETRY_MS             10000
+ // rotationNextDueMs() while no sensor is waiting
+ #define ROTATION_IDLE                 UINT32_MAX
+
+/***************************************************************************************************
+ * Function Declarations
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  Turn rotation on or off.
+ *  \param[in]  intervalMs  time between readings of one sensor in ms, 0 to keep the sensors
+ *              connected instead
+ **************************************************************************************************/
+void rotationSetInterval(uint32_t intervalMs);
+
+/***********************************************************************************************//**
+ *  \brief  Check whether rotation is on.
+ *  \return  true if a sample interval is set
+ **************************************************************************************************/
+bool rotationEnabled(void);
+
+/***********************************************************************************************//**
+ *  \brief  Add a thermometer found by the scanner, due right away. Known sensors are left as
+ *          they are.
+ *  \param[in]  address  sensor address
+ *  \param[in]  addressType  address type to connect with
+ **************************************************************************************************/
+void rotationAdd(const bd_addr *address, uint8_t addressType);
+
+/***********************************************************************************************//**
+ *  \brief  Take the sensor whose reading is most overdue, if any is due. It stays out of the
+ *          queue until rotationDone() is called for it.
+ *  \param[out]  address  sensor address
+ *  \param[out]  addressType  address type to connect with
+ *  \return  true if a sensor is due
+ **************************************************************************************************/
+bool rotationNextDue(bd_addr *address, uint8_t *addressType);
+
+/***********************************************************************************************//**
+ *  \brief  Time until rotationNextDue() has a sensor to hand out.
+ *  \return  ms to wait, 0 if one is due, ROTATION_IDLE if no sensor is waiting
+ **************************************************************************************************/
+uint32_t rotationNextDueMs(void);
+
+/***********************************************************************************************//**
+ *  \brief  Put a sensor taken with rotationNextDue() back in the queue.
+ *  \param[in]  address  sensor address
+ *  \param[in]  read  true if a reading was taken, due again an interval after it, false if the
+ *              connection failed, tried again after ROTATION_RETRY_MS
+ *  \return  true if the sensor was taken, false if it was not or has been put back already
+ **************************************************************************************************/
+bool rotationDone(const bd_addr *address, bool read);
+
+/***********************************************************************************************//**
+ *  \brief  Drop a sensor taken with rotationNextDue() that is not a thermometer after all. It
+ *          comes back if rotationAdd() is called for it again.
+ *  \param[in]  address  sensor address
+ **************************************************************************************************/
+void rotationForget(const bd_addr *address);
+
+/***********************************************************************************************//**
+ *  \brief  Print the achieved and requested sample rate of every sensor.
+ *  \param[in]  out  stream to print to
+ **************************************************************************************************/
+void rotationReport(FILE *out);
+
+/** @} (end addtogroup rotation) */
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* ROTATION_H */
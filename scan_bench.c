@@ -0,0 +1,210 @@
+/***************************************************************************//**
+ * @file
+ * @brief Scan response filter microbenchmark
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2018 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+/**
+ * Feeds a busy RF environment worth of scan responses, a few thermometers
+ * among many other advertisers repeating themselves, through the original
+ * advertisement parser, the new parser alone and the scan filter, the
+ * parser with its cache of connected and rejected thermometers behind it,
+ * and prints the cost per scan response of
+ * each. Thermometers the filter accepts are marked
+ * connected, as the client does once it has connected to them, and the
+ * filter is given the time once per batch of scan responses as the event
+ * loop does. */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "infrastructure.h"
+#include "scan_filter.h"
+
+/***************************************************************************************************
+ * Local Macros and Definitions
+ **************************************************************************************************/
+
+#define BENCH_DEFAULT_ADVERTISERS    2000
+#define BENCH_DEFAULT_THERMOMETERS   20
+#define BENCH_DEFAULT_EVENTS         2000000
+#define BENCH_MAX_ADV_DATA           31
+// Scan responses handled per wakeup, the filter is given the time once for each batch
+#define BENCH_BATCH                  32
+
+#define USAGE "Usage: %s [-n advertisers] [-t thermometers] [-e scan responses]\n\n"
+
+typedef struct {
+  bd_addr address;
+  uint8_t len;
+  uint8_t data[BENCH_MAX_ADV_DATA];
+} BenchAdvertiser;
+
+static BenchAdvertiser *advertisers;
+static uint32_t *schedule;
+
+// Health Thermometer service UUID, as the original parser compared it
+static const uint8_t thermoService[2] = { 0x09, 0x18 };
+
+/***************************************************************************************************
+ * Static Function Definitions
+ **************************************************************************************************/
+
+// The advertisement parser the client used before the scan filter, kept as the baseline
+static uint8_t findServiceInAdvertisement(uint8_t *data, uint8_t len)
+{
+  uint8_t adFieldLength;
+  uint8_t adFieldType;
+  uint8_t i = 0;
+  // Parse advertisement packet
+  while (i < len) {
+    adFieldLength = data[i];
+    adFieldType = data[i + 1];
+    // Partial ($02) or complete ($03) list of 16-bit UUIDs
+    if (adFieldType == 0x02 || adFieldType == 0x03) {
+      // compare UUID to Health Thermometer service UUID
+      if (memcmp(&data[i + 2], thermoService, 2) == 0) {
+        return 1;
+      }
+    }
+    // advance to the next AD struct
+    i = i + adFieldLength + 1;
+  }
+  return 0;
+}
+
+static uint64_t clockNs(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+// Typical advertising data: flags, manufacturer data, a UUID list and a short name
+static void makeAdvertiser(BenchAdvertiser *a, uint32_t index, bool thermometer)
+{
+  uint8_t *p = a->data;
+  uint8_t i;
+
+  memset(a, 0, sizeof(*a));
+  a->address.addr[0] = (uint8_t)index;
+  a->address.addr[1] = (uint8_t)(index >> 8);
+  a->address.addr[2] = (uint8_t)(index >> 16);
+  a->address.addr[5] = 0xc0;
+  *p++ = 0x02; *p++ = 0x01; *p++ = 0x06;
+  *p++ = 0x09; *p++ = 0xff;
+  for (i = 0; i < 8; i++) {
+    *p++ = (uint8_t)rand();
+  }
+  // Thermometers list theirs after another service
+  *p++ = 0x05; *p++ = 0x03;
+  *p++ = 0x0f; *p++ = 0x18;
+  *p++ = thermometer ? 0x09 : 0x0a;
+  *p++ = 0x18;
+  *p++ = 0x05; *p++ = 0x08;
+  *p++ = 'S'; *p++ = 'n'; *p++ = 's'; *p++ = 'r';
+  a->len = (uint8_t)(p - a->data);
+}
+
+/***************************************************************************************************
+ * Public Function Definitions
+ **************************************************************************************************/
+
+int main(int argc, char* argv[])
+{
+  uint32_t advertiserCount = BENCH_DEFAULT_ADVERTISERS;
+  uint32_t thermometerCount = BENCH_DEFAULT_THERMOMETERS;
+  uint32_t events = BENCH_DEFAULT_EVENTS;
+  uint32_t foundBefore = 0;
+  uint32_t foundParser = 0;
+  uint32_t foundAfter = 0;
+  uint64_t start;
+  double beforeNs;
+  double parserNs;
+  double afterNs;
+  BenchAdvertiser *a;
+  uint32_t i;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:t:e:")) != -1) {
+    switch (opt) {
+      case 'n': advertiserCount = (uint32_t)atoi(optarg); break;
+      case 't': thermometerCount = (uint32_t)atoi(optarg); break;
+      case 'e': events = (uint32_t)atoi(optarg); break;
+      default:
+        fprintf(stderr, USAGE, argv[0]);
+        exit(EXIT_FAILURE);
+    }
+  }
+  if (advertiserCount == 0 || thermometerCount > advertiserCount || events == 0) {
+    fprintf(stderr, USAGE, argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  advertisers = calloc(advertiserCount, sizeof(BenchAdvertiser));
+  schedule = calloc(events, sizeof(uint32_t));
+  if (advertisers == NULL || schedule == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+  srand(1);
+  for (i = 0; i < advertiserCount; i++) {
+    makeAdvertiser(&advertisers[i], i, i < thermometerCount);
+  }
+  for (i = 0; i < events; i++) {
+    schedule[i] = (uint32_t)rand() % advertiserCount;
+  }
+
+  start = clockNs();
+  for (i = 0; i < events; i++) {
+    a = &advertisers[schedule[i]];
+    foundBefore += findServiceInAdvertisement(a->data, a->len);
+  }
+  beforeNs = (double)(clockNs() - start) / events;
+
+  start = clockNs();
+  for (i = 0; i < events; i++) {
+    a = &advertisers[schedule[i]];
+    foundParser += scanFilterHasService(a->data, a->len, SCAN_FILTER_SERVICE_UUID);
+  }
+  parserNs = (double)(clockNs() - start) / events;
+
+  start = clockNs();
+  for (i = 0; i < events; i++) {
+    a = &advertisers[schedule[i]];
+    if (i % BENCH_BATCH == 0) {
+      scanFilterAdvance((uint32_t)(clockNs() / 1000000u));
+    }
+    if (scanFilterAccept(&a->address, a->data, a->len)) {
+      scanFilterSetConnected(&a->address, true);
+      foundAfter++;
+    }
+  }
+  afterNs = (double)(clockNs() - start) / events;
+
+  printf("scan-bench: %u scan responses from %u advertisers, %u of them thermometers\n",
+         events, advertiserCount, thermometerCount);
+  printf("scan-bench: before %.1f ns/event (%u thermometer advertisements)\n",
+         beforeNs, foundBefore);
+  printf("scan-bench: parser %.1f ns/event (%u thermometer advertisements)\n",
+         parserNs, foundParser);
+  printf("scan-bench: after  %.1f ns/event (%u thermometers to connect)\n",
+         afterNs, foundAfter);
+  return 0;
+}
@@ -0,0 +1,258 @@
+/***************************************************************************//**
+ * @file
+ * @brief Scan response filter
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2018 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+/* standard library headers */
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+
+/* Own header */
+#include "scan_filter.h"
+
+// AD types holding service UUIDs
+#define AD_UUID16_PARTIAL             0x02
+#define AD_UUID16_COMPLETE            0x03
+#define AD_UUID128_PARTIAL            0x06
+#define AD_UUID128_COMPLETE           0x07
+// AD type of service data, a 16-bit service UUID followed by the data
+#define AD_SERVICE_DATA16             0x16
+
+typedef enum {
+  advertiserUnused,
+  advertiserRejected,
+  advertiserConnected
+} AdvertiserState;
+
+// How the payload of an AD field is searched for a service UUID
+typedef enum {
+  adFieldSkip,
+  adFieldUuid16List,
+  adFieldUuid128List,
+  adFieldServiceData16
+} AdFieldKind;
+
+// 16 bytes, so a bucket of four is one cache line
+typedef struct {
+  uint64_t key;               // address in the low 48 bits
+  uint32_t expiresMs;         // end of the rejection, advertiserRejected only
+  uint8_t  state;
+  uint8_t  reserved[3];
+} Advertiser;
+
+static Advertiser advertisers[SCAN_FILTER_BUCKETS][SCAN_FILTER_BUCKET_SIZE]
+__attribute__((aligned(64)));
+
+// Bluetooth Base UUID with the 16-bit UUID in bytes 12 and 13, little endian
+static const uint8_t baseUuid[16] = {
+  0xfb, 0x34, 0x9b, 0x5f, 0x80, 0x00, 0x00, 0x80, 0x00, 0x10, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+static bool uuid16ListHas(const uint8_t *field, uint8_t len, uint16_t uuid)
+{
+  uint8_t i;
+
+  for (i = 0; i + 2 <= len; i += 2) {
+    if ((uint16_t)(field[i] | (field[i + 1] << 8)) == uuid) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool uuid128ListHas(const uint8_t *field, uint8_t len, uint16_t uuid)
+{
+  uint8_t i;
+
+  for (i = 0; i + 16 <= len; i += 16) {
+    if ((uint16_t)(field[i + 12] | (field[i + 13] << 8)) == uuid
+        && memcmp(&field[i], baseUuid, 12) == 0 && field[i + 14] == 0 && field[i + 15] == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Kind of each AD type, the ones not listed are skipped
+static const uint8_t adFieldKinds[256] = {
+  [AD_UUID16_PARTIAL]   = adFieldUuid16List,
+  [AD_UUID16_COMPLETE]  = adFieldUuid16List,
+  [AD_UUID128_PARTIAL]  = adFieldUuid128List,
+  [AD_UUID128_COMPLETE] = adFieldUuid128List,
+  [AD_SERVICE_DATA16]   = adFieldServiceData16,
+};
+
+// Time given to scanFilterAdvance(), rejections last seconds so the time of the last batch of
+// events is precise enough, and no clock is read per scan response
+static uint32_t nowMs;
+
+static uint64_t addressKey(const bd_addr *address)
+{
+  uint64_t key = 0;
+
+  memcpy(&key, address->addr, sizeof(address->addr));
+  return key;
+}
+
+// Bucket of an address key, one multiplication as this runs for every scan response
+static Advertiser *bucketOf(uint64_t key)
+{
+  return advertisers[((key * 0x9e3779b97f4a7c15ull) >> 48) % SCAN_FILTER_BUCKETS];
+}
+
+static bool isLive(const Advertiser *entry)
+{
+  return entry->state == advertiserConnected
+         || (entry->state == advertiserRejected && (int32_t)(entry->expiresMs - nowMs) > 0);
+}
+
+static Advertiser *find(Advertiser *bucket, uint64_t key)
+{
+  uint8_t i;
+
+  for (i = 0; i < SCAN_FILTER_BUCKET_SIZE; i++) {
+    if (bucket[i].key == key && bucket[i].state != advertiserUnused) {
+      return &bucket[i];
+    }
+  }
+  return NULL;
+}
+
+// The advertiser's own entry, else a free or expired one, else the rejection closest to expiry.
+// Connected advertisers are only replaced when the whole bucket is connected.
+static void insert(uint64_t key, uint8_t state)
+{
+  Advertiser *bucket = bucketOf(key);
+  Advertiser *entry = find(bucket, key);
+  uint8_t i;
+
+  if (entry == NULL) {
+    entry = &bucket[0];
+    for (i = 0; i < SCAN_FILTER_BUCKET_SIZE; i++) {
+      if (!isLive(&bucket[i])) {
+        entry = &bucket[i];
+        break;
+      }
+      if (bucket[i].state == advertiserRejected
+          && (entry->state == advertiserConnected
+              || (int32_t)(bucket[i].expiresMs - entry->expiresMs) < 0)) {
+        entry = &bucket[i];
+      }
+    }
+    entry->key = key;
+  }
+  entry->state = state;
+  entry->expiresMs = nowMs + SCAN_FILTER_REJECT_MS;
+}
+
+/***************************************************************************************************
+ * Public Function Definitions
+ **************************************************************************************************/
+
+bool scanFilterHasService(const uint8_t *data, uint8_t len, uint16_t uuid)
+{
+  uint8_t fieldLen;
+  uint16_t i = 0;
+
+  // Each field is a length byte, then the AD type and length - 1 bytes of payload
+  while (i + 1 < len) {
+    fieldLen = data[i];
+    if (fieldLen == 0 || i + 1 + fieldLen > len) {
+      // Early end of the data, or a field running past it
+      break;
+    }
+    switch (adFieldKinds[data[i + 1]]) {
+      case adFieldUuid16List:
+        if (uuid16ListHas(&data[i + 2], fieldLen - 1, uuid)) {
+          return true;
+        }
+        break;
+      case adFieldUuid128List:
+        if (uuid128ListHas(&data[i + 2], fieldLen - 1, uuid)) {
+          return true;
+        }
+        break;
+      default:
+        break;
+    }
+    i += 1 + fieldLen;
+  }
+  return false;
+}
+
+const uint8_t *scanFilterServiceData(const uint8_t *data, uint8_t len, uint16_t uuid,
+                                     uint8_t *dataLen)
+{
+  uint8_t fieldLen;
+  uint16_t i = 0;
+
+  while (i + 1 < len) {
+    fieldLen = data[i];
+    if (fieldLen == 0 || i + 1 + fieldLen > len) {
+      break;
+    }
+    // The AD type and the UUID take three bytes of the field
+    if (adFieldKinds[data[i + 1]] == adFieldServiceData16 && fieldLen >= 3
+        && (uint16_t)(data[i + 2] | (data[i + 3] << 8)) == uuid) {
+      *dataLen = (uint8_t)(fieldLen - 3);
+      return &data[i + 4];
+    }
+    i += 1 + fieldLen;
+  }
+  return NULL;
+}
+
+bool scanFilterAccept(const bd_addr *address, const uint8_t *data, uint8_t len)
+{
+  uint64_t key;
+  Advertiser *entry;
+
+  // Parsing the data costs less than looking the address up, which is left to the few that pass
+  if (!scanFilterHasService(data, len, SCAN_FILTER_SERVICE_UUID)) {
+    return false;
+  }
+  key = addressKey(address);
+  entry = find(bucketOf(key), key);
+  return entry == NULL || !isLive(entry);
+}
+
+void scanFilterReject(const bd_addr *address)
+{
+  insert(addressKey(address), advertiserRejected);
+}
+
+void scanFilterSetConnected(const bd_addr *address, bool connected)
+{
+  uint64_t key = addressKey(address);
+  Advertiser *entry;
+
+  if (connected) {
+    insert(key, advertiserConnected);
+  } else if ((entry = find(bucketOf(key), key)) != NULL
+             && entry->state == advertiserConnected) {
+    entry->state = advertiserUnused;
+  }
+}
+
+void scanFilterAdvance(uint32_t timeMs)
+{
+  nowMs = timeMs;
+}
+
+void scanFilterReset(void)
+{
+  memset(advertisers, 0, sizeof(advertisers));
+}
@@ -0,0 +1,119 @@
+/***************************************************************************//**
+ * @file
+ * @brief Scan response filter
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2018 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+#ifndef SCAN_FILTER_H
+#define SCAN_FILTER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "bg_types.h"
+
+/***********************************************************************************************//**
+ * \defgroup scan_filter Scan Filter
+ * \brief Table-driven advertising data parser, and a cache of the thermometers that are already
+ *        connected or were rejected, looked up only for the advertisers that have the service
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ * @addtogroup scan_filter
+ * @{
+ **************************************************************************************************/
+
+ // Service advertised by the sensors, Health Thermometer
+ #define SCAN_FILTER_SERVICE_UUID      0x1809
+ // Advertisers are kept in buckets of four
+ #define SCAN_FILTER_BUCKETS           512
+ #define SCAN_FILTER_BUCKET_SIZE       4
+ // How long a rejected thermometer is ignored, in ms
+ #ifndef SCAN_FILTER_REJECT_MS
+ #define SCAN_FILTER_REJECT_MS         60000
+ #endif
+
+/***************************************************************************************************
+ * Function Declarations
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  Check whether advertising data lists a 16-bit service UUID, in a complete or partial
+ *          list of 16-bit or 128-bit UUIDs. Malformed fields end the parse.
+ *  \param[in]  data  advertising data
+ *  \param[in]  len  length of the data
+ *  \param[in]  uuid  16-bit service UUID
+ *  \return  true if the service is listed
+ **************************************************************************************************/
+bool scanFilterHasService(const uint8_t *data, uint8_t len, uint16_t uuid);
+
+/***********************************************************************************************//**
+ *  \brief  Find the service data a 16-bit service UUID has in advertising data. Malformed fields
+ *          end the parse.
+ *  \param[in]  data  advertising data
+ *  \param[in]  len  length of the data
+ *  \param[in]  uuid  16-bit service UUID
+ *  \param[out]  dataLen  length of the service data, without the UUID
+ *  \return  the service data following the UUID, NULL if there is none
+ **************************************************************************************************/
+const uint8_t *scanFilterServiceData(const uint8_t *data, uint8_t len, uint16_t uuid,
+                                     uint8_t *dataLen);
+
+/***********************************************************************************************//**
+ *  \brief  Check whether a scan response comes from a thermometer worth connecting to: the data
+ *          lists the thermometer service and the advertiser is neither connected nor rejected.
+ *  \param[in]  address  advertiser address
+ *  \param[in]  data  advertising data
+ *  \param[in]  len  length of the data
+ *  \return  true if the advertiser is an unconnected thermometer
+ **************************************************************************************************/
+bool scanFilterAccept(const bd_addr *address, const uint8_t *data, uint8_t len);
+
+/***********************************************************************************************//**
+ *  \brief  Ignore an advertiser for SCAN_FILTER_REJECT_MS, e.g. when it turned out not to have
+ *          the thermometer characteristic.
+ *  \param[in]  address  advertiser address
+ **************************************************************************************************/
+void scanFilterReject(const bd_addr *address);
+
+/***********************************************************************************************//**
+ *  \brief  Ignore an advertiser for as long as it is connected.
+ *  \param[in]  address  advertiser address
+ *  \param[in]  connected  true when the connection opens, false when it closes
+ **************************************************************************************************/
+void scanFilterSetConnected(const bd_addr *address, bool connected);
+
+/***********************************************************************************************//**
+ *  \brief  Set the time the rejections are aged by, once per batch of events rather than per
+ *          scan response. Until it is first called the time is 0.
+ *  \param[in]  timeMs  monotonic time in ms, wrapping at 32 bits
+ **************************************************************************************************/
+void scanFilterAdvance(uint32_t timeMs);
+
+/***********************************************************************************************//**
+ *  \brief  Forget every advertiser, e.g. after the NCP has been reset.
+ **************************************************************************************************/
+void scanFilterReset(void);
+
+/** @} (end addtogroup scan_filter) */
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* SCAN_FILTER_H */
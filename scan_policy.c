@@ -0,0 +1,223 @@
+/***************************************************************************//**
+ * @file
+ * @brief Scan policy: controller accept list and adaptive scan duty cycle
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2018 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+/* standard library headers */
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "app.h"
+
+/* Own header */
+#include "scan_policy.h"
+
+#if (SCAN_POLICY_MAX_SENSORS & (SCAN_POLICY_MAX_SENSORS - 1)) != 0 || SCAN_POLICY_MAX_SENSORS > 32768
+#error "SCAN_POLICY_MAX_SENSORS must be a power of two, at most 32768"
+#endif
+
+// The address index is kept at most half full
+#define INDEX_SIZE                    (2 * SCAN_POLICY_MAX_SENSORS)
+
+typedef struct {
+  bd_addr address;
+  uint8_t addressType;
+  bool    connected;
+} Sensor;
+
+// Steps of the duty cycle, from continuous scanning down to 10 ms a second
+static const struct {
+  uint16_t interval;
+  uint16_t window;
+} schedule[] = {
+  { SCAN_INTERVAL, SCAN_WINDOW },
+  { 64, 16 },                 // 25 %
+  { 320, 16 },                // 5 %
+  { 1600, 16 }                // 1 %
+};
+
+#define SCHEDULE_STEPS                (sizeof(schedule) / sizeof(schedule[0]))
+
+static Sensor sensors[SCAN_POLICY_MAX_SENSORS];
+static uint16_t sensorCount = 0;
+// Sensor index + 1 of each address, open addressed, 0 for a free entry. Sensors are never
+// removed, so neither are the entries.
+static uint16_t byAddress[INDEX_SIZE];
+static uint16_t connectedCount = 0;
+static bool policyEnabled = false;
+// Set once no new sensor has turned up for SCAN_POLICY_SETTLE_MS
+static bool fleetKnown = false;
+static uint64_t learnedMs = 0;
+// Step of the schedule and when it was taken
+static uint8_t step = 0;
+static uint64_t stepMs = 0;
+// When the next open sweep starts
+static uint64_t sweepMs = 0;
+
+static uint64_t clockMs(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000u + (uint64_t)ts.tv_nsec / 1000000u;
+}
+
+// Index entry of an address, its own or the free one it would take
+static uint16_t *indexEntry(const bd_addr *address)
+{
+  uint64_t key = 0;
+  uint32_t i;
+
+  memcpy(&key, address->addr, sizeof(address->addr));
+  i = (uint32_t)((key * 0x9e3779b97f4a7c15ull) >> 48) & (INDEX_SIZE - 1);
+  while (byAddress[i] != 0
+         && memcmp(&sensors[byAddress[i] - 1].address, address, sizeof(*address)) != 0) {
+    i = (i + 1) & (INDEX_SIZE - 1);
+  }
+  return &byAddress[i];
+}
+
+/***************************************************************************************************
+ * Public Function Definitions
+ **************************************************************************************************/
+
+void scanPolicySetEnabled(bool enabled)
+{
+  policyEnabled = enabled;
+}
+
+bool scanPolicyEnabled(void)
+{
+  return policyEnabled;
+}
+
+void scanPolicyLearn(const bd_addr *address, uint8_t addressType)
+{
+  uint16_t *entry = indexEntry(address);
+
+  if (*entry != 0 || sensorCount == SCAN_POLICY_MAX_SENSORS) {
+    return;
+  }
+  sensors[sensorCount].address = *address;
+  sensors[sensorCount].addressType = addressType;
+  sensors[sensorCount].connected = false;
+  *entry = (uint16_t)(sensorCount + 1);
+  sensorCount++;
+  learnedMs = clockMs();
+}
+
+void scanPolicySetConnected(const bd_addr *address, bool connected)
+{
+  uint16_t entry = *indexEntry(address);
+  Sensor *sensor;
+
+  if (entry == 0) {
+    return;
+  }
+  sensor = &sensors[entry - 1];
+  if (sensor->connected == connected) {
+    return;
+  }
+  sensor->connected = connected;
+  if (connected) {
+    connectedCount++;
+    return;
+  }
+  connectedCount--;
+  // Find it again as soon as it comes back
+  step = 0;
+  stepMs = clockMs();
+}
+
+bool scanPolicyKnown(uint16_t index, bd_addr *address, uint8_t *addressType)
+{
+  if (index >= sensorCount) {
+    return false;
+  }
+  *address = sensors[index].address;
+  *addressType = sensors[index].addressType;
+  return true;
+}
+
+void scanPolicyCurrent(ScanPolicySettings *settings)
+{
+  uint64_t nowMs = clockMs();
+  bool sweeping = false;
+
+  if (!policyEnabled) {
+    settings->interval = SCAN_INTERVAL;
+    settings->window = SCAN_WINDOW;
+    settings->filtered = false;
+    return;
+  }
+  if (!fleetKnown && sensorCount > 0 && nowMs - learnedMs >= SCAN_POLICY_SETTLE_MS) {
+    fleetKnown = true;
+    sweepMs = nowMs + SCAN_POLICY_SWEEP_MS;
+  }
+  if (fleetKnown && nowMs >= sweepMs) {
+    if (nowMs - sweepMs < SCAN_POLICY_SWEEP_LENGTH_MS) {
+      sweeping = true;
+    } else {
+      sweepMs = nowMs + SCAN_POLICY_SWEEP_MS;
+    }
+  }
+  // Back off only while there is nothing left to look for
+  if (!fleetKnown || sweeping || connectedCount < sensorCount) {
+    step = 0;
+    stepMs = nowMs;
+  } else if (step + 1u < SCHEDULE_STEPS && nowMs - stepMs >= SCAN_POLICY_BACKOFF_MS) {
+    step++;
+    stepMs = nowMs;
+  }
+  settings->interval = schedule[step].interval;
+  settings->window = schedule[step].window;
+  settings->filtered = fleetKnown && !sweeping;
+}
+
+uint32_t scanPolicyNextChangeMs(void)
+{
+  uint64_t nowMs = clockMs();
+  uint64_t dueMs;
+
+  if (!policyEnabled || sensorCount == 0) {
+    return SCAN_POLICY_IDLE;
+  }
+  if (!fleetKnown) {
+    dueMs = learnedMs + SCAN_POLICY_SETTLE_MS;
+  } else if (nowMs < sweepMs) {
+    dueMs = sweepMs;
+    if (connectedCount == sensorCount && step + 1u < SCHEDULE_STEPS
+        && stepMs + SCAN_POLICY_BACKOFF_MS < dueMs) {
+      dueMs = stepMs + SCAN_POLICY_BACKOFF_MS;
+    }
+  } else {
+    // Sweeping, until it ends
+    dueMs = sweepMs + SCAN_POLICY_SWEEP_LENGTH_MS;
+  }
+  return (dueMs > nowMs) ? (uint32_t)(dueMs - nowMs) : 0;
+}
+
+void scanPolicyReport(FILE *out)
+{
+  if (!policyEnabled) {
+    return;
+  }
+  fprintf(out, "scan policy: %u known sensors, %u connected, %s, scanning %u/%u\n",
+          (unsigned)sensorCount, (unsigned)connectedCount,
+          fleetKnown ? "fleet known" : "still learning",
+          (unsigned)schedule[step].window, (unsigned)schedule[step].interval);
+}
@@ -0,0 +1,140 @@
+/***************************************************************************//**
+ * @file
+ * @brief Scan policy: controller accept list and adaptive scan duty cycle
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2018 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+#ifndef SCAN_POLICY_H
+#define SCAN_POLICY_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "bg_types.h"
+
+/***********************************************************************************************//**
+ * \defgroup scan_policy Scan Policy
+ * \brief Thermometers that have been set up, or heard broadcasting, are known. Once no new
+ *        one has turned up for a while the fleet is taken to be known, and the NCPs only report
+ *        the known sensors from their accept list, apart from a short open sweep now and then
+ *        for newcomers. While every known sensor is connected the scan duty cycle backs off step
+ *        by step, and goes back to continuous scanning as soon as one drops. The sensors are
+ *        shared by all NCPs, each NCP loads them into its own accept list.
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ * @addtogroup scan_policy
+ * @{
+ **************************************************************************************************/
+
+ // Sensors the policy can know, a power of two
+ #define SCAN_POLICY_MAX_SENSORS       1024
+ // The fleet is taken to be known once no new sensor has turned up for this long, in ms
+ #define SCAN_POLICY_SETTLE_MS         15000
+ // Time spent at each step of the duty cycle schedule before backing off further, in ms
+ #define SCAN_POLICY_BACKOFF_MS        10000
+ // How often, and for how long, the accept list is lifted to look for new sensors, in ms
+ #define SCAN_POLICY_SWEEP_MS          300000
+ #define SCAN_POLICY_SWEEP_LENGTH_MS   2000
+ // Accept list entries loaded into an NCP per tick, leaving room in the command queue
+ #define SCAN_POLICY_LOAD_BATCH        8
+ // scanPolicyNextChangeMs() while the settings stay as they are
+ #define SCAN_POLICY_IDLE              UINT32_MAX
+
+/***************************************************************************************************
+ * Type Definitions
+ **************************************************************************************************/
+
+ // Scanner settings the policy asks for, interval and window in units of 0.625 ms
+ typedef struct {
+   uint16_t interval;
+   uint16_t window;
+   bool     filtered;         // report the sensors in the accept list only
+ } ScanPolicySettings;
+
+/***************************************************************************************************
+ * Function Declarations
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  Turn the scan policy on or off.
+ *  \param[in]  enabled  true to filter and back off the scanner, false to scan continuously for
+ *              every advertiser
+ **************************************************************************************************/
+void scanPolicySetEnabled(bool enabled);
+
+/***********************************************************************************************//**
+ *  \brief  Check whether the scan policy is on.
+ *  \return  true if the scanner follows the policy
+ **************************************************************************************************/
+bool scanPolicyEnabled(void);
+
+/***********************************************************************************************//**
+ *  \brief  Record a thermometer that has been set up, or heard broadcasting. A new one delays
+ *          the fleet being taken as known by SCAN_POLICY_SETTLE_MS.
+ *  \param[in]  address  sensor address
+ *  \param[in]  addressType  address type to put in the accept list
+ **************************************************************************************************/
+void scanPolicyLearn(const bd_addr *address, uint8_t addressType);
+
+/***********************************************************************************************//**
+ *  \brief  Record a known sensor being connected or losing its connection. Losing one puts the
+ *          scanner back to continuous scanning. Unknown sensors are ignored.
+ *  \param[in]  address  sensor address
+ *  \param[in]  connected  true once its connection is set up, false when it is lost
+ **************************************************************************************************/
+void scanPolicySetConnected(const bd_addr *address, bool connected);
+
+/***********************************************************************************************//**
+ *  \brief  Get a known sensor, for loading into an accept list.
+ *  \param[in]  index  sensor index, in the order they were learned
+ *  \param[out]  address  sensor address
+ *  \param[out]  addressType  address type
+ *  \return  true if there is a sensor with this index
+ **************************************************************************************************/
+bool scanPolicyKnown(uint16_t index, bd_addr *address, uint8_t *addressType);
+
+/***********************************************************************************************//**
+ *  \brief  Get the scanner settings called for now, advancing the schedule on the way. Cheap
+ *          enough to be called on every tick of every NCP.
+ *  \param[out]  settings  scan interval, window and whether to filter on the accept list
+ **************************************************************************************************/
+void scanPolicyCurrent(ScanPolicySettings *settings);
+
+/***********************************************************************************************//**
+ *  \brief  Time until scanPolicyCurrent() may call for other settings with no sensor learned,
+ *          connected or lost meanwhile: the fleet taken as known, a sweep starting or ending, or
+ *          the next step of the schedule.
+ *  \return  ms to wait, 0 if a change is due, SCAN_POLICY_IDLE if none is coming
+ **************************************************************************************************/
+uint32_t scanPolicyNextChangeMs(void);
+
+/***********************************************************************************************//**
+ *  \brief  Print the known and connected sensors and the scanner settings in force.
+ *  \param[in]  out  stream to print to
+ **************************************************************************************************/
+void scanPolicyReport(FILE *out);
+
+/** @} (end addtogroup scan_policy) */
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* SCAN_POLICY_H */
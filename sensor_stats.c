@@ -0,0 +1,435 @@
+/***************************************************************************//**
+ * @file
+ * @brief Incremental statistics of every sensor's readings and threshold alerts on them
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2018 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+/* standard library headers */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <math.h>
+#include <time.h>
+
+/* Own header */
+#include "sensor_stats.h"
+#include "metrics.h"
+
+#if (STATS_MAX_SENSORS & (STATS_MAX_SENSORS - 1)) != 0 || STATS_MAX_SENSORS > 32768
+#error "STATS_MAX_SENSORS must be a power of two, at most 32768"
+#endif
+#if (STATS_WINDOW & (STATS_WINDOW - 1)) != 0 || STATS_WINDOW > 128
+#error "STATS_WINDOW must be a power of two, at most 128"
+#endif
+
+// The address index is kept at most half full
+#define INDEX_SIZE                    (2 * STATS_MAX_SENSORS)
+#define WINDOW_MASK                   (STATS_WINDOW - 1)
+#define RULE_TEXT_MAX                 24
+
+// Window positions, oldest first, whose readings are each smaller (or larger) than all the
+// readings after them. The front is the minimum (or maximum) of the window.
+typedef struct {
+  uint16_t position[STATS_WINDOW];
+  uint8_t  head;
+  uint8_t  len;
+} Deque;
+
+// Bucket a percentile falls in, and the readings in the buckets below it
+typedef struct {
+  uint16_t bucket;
+  uint32_t below;
+} Marker;
+
+typedef struct {
+  uint32_t count;
+  int32_t  last;
+  double   ewma;
+  double   mean;
+  double   m2;                // sum of squared differences from the mean
+  uint8_t  alerts;
+  bd_addr  address;
+  uint32_t maxGapMs;
+  uint32_t gaps;
+  // The last STATS_WINDOW readings and when they came, reading n at n % STATS_WINDOW
+  int32_t  window[STATS_WINDOW];
+  uint32_t windowMs[STATS_WINDOW];
+  Deque    minimum;
+  Deque    maximum;
+  Marker   markers[STATS_PERCENTILES];
+  uint32_t sketch[STATS_SKETCH_BUCKETS];
+} Sensor;
+
+typedef struct {
+  uint8_t  quantity;
+  bool     above;
+  int32_t  threshold;
+  char     text[RULE_TEXT_MAX];
+} Rule;
+
+static Sensor sensors[STATS_MAX_SENSORS];
+static uint16_t sensorCount = 0;
+// Sensor index + 1 of each address, open addressed, 0 for a free entry
+static uint16_t byAddress[INDEX_SIZE];
+static Rule rules[STATS_MAX_RULES];
+static uint8_t ruleCount = 0;
+
+// Percentiles followed in the histogram, in thousandths
+static const uint16_t percentiles[STATS_PERCENTILES] = { 500, 900, 990 };
+
+static const char *quantityNames[] = {
+  [statsQuantityTemperature] = "temp",
+  [statsQuantityEwma]        = "ewma",
+  [statsQuantityMean]        = "mean",
+  [statsQuantityRate]        = "rate",
+};
+
+// The rate of change is taken over many readings, the coarse clock is precise enough and cheaper
+#if defined(CLOCK_MONOTONIC_COARSE)
+#define STATS_CLOCK CLOCK_MONOTONIC_COARSE
+#else
+#define STATS_CLOCK CLOCK_MONOTONIC
+#endif
+
+static uint32_t clockMs(void)
+{
+  struct timespec ts;
+  clock_gettime(STATS_CLOCK, &ts);
+  return (uint32_t)((uint64_t)ts.tv_sec * 1000u + (uint64_t)ts.tv_nsec / 1000000u);
+}
+
+// Index entry of an address, its own or the free one it would take
+static uint16_t *indexEntry(const bd_addr *address)
+{
+  uint64_t key = 0;
+  uint32_t i;
+
+  memcpy(&key, address->addr, sizeof(address->addr));
+  i = (uint32_t)((key * 0x9e3779b97f4a7c15ull) >> 48) & (INDEX_SIZE - 1);
+  while (byAddress[i] != 0
+         && memcmp(&sensors[byAddress[i] - 1].address, address, sizeof(*address)) != 0) {
+    i = (i + 1) & (INDEX_SIZE - 1);
+  }
+  return &byAddress[i];
+}
+
+static Sensor *find(const bd_addr *address)
+{
+  uint16_t entry = *indexEntry(address);
+
+  return (entry != 0) ? &sensors[entry - 1] : NULL;
+}
+
+static uint16_t dequeBack(const Deque *deque)
+{
+  return deque->position[(deque->head + deque->len - 1) & WINDOW_MASK];
+}
+
+// Take reading n into a deque, after the ones it makes irrelevant. Each position goes in and out
+// once, so this is constant time on average.
+static void dequePush(Deque *deque, const int32_t *window, uint32_t n, bool minimum)
+{
+  int32_t value = window[n & WINDOW_MASK];
+  int32_t back;
+
+  // The front has left the window
+  if (deque->len > 0 && (uint16_t)((uint16_t)n - deque->position[deque->head]) >= STATS_WINDOW) {
+    deque->head = (uint8_t)((deque->head + 1) & WINDOW_MASK);
+    deque->len--;
+  }
+  while (deque->len > 0) {
+    back = window[dequeBack(deque) & WINDOW_MASK];
+    if (minimum ? back < value : back > value) {
+      break;
+    }
+    deque->len--;
+  }
+  deque->position[(deque->head + deque->len) & WINDOW_MASK] = (uint16_t)n;
+  deque->len++;
+}
+
+static int32_t dequeFront(const Deque *deque, const int32_t *window)
+{
+  return window[deque->position[deque->head] & WINDOW_MASK];
+}
+
+// Rate of change from the oldest reading of the window to the newest, per minute
+static int32_t ratePerMin(const Sensor *sensor)
+{
+  uint32_t newest = (sensor->count - 1) & WINDOW_MASK;
+  uint32_t oldest = (sensor->count > STATS_WINDOW) ? sensor->count & WINDOW_MASK : 0;
+  uint32_t spanMs = sensor->windowMs[newest] - sensor->windowMs[oldest];
+
+  if (spanMs == 0) {
+    return 0;
+  }
+  return (int32_t)((int64_t)(sensor->window[newest] - sensor->window[oldest]) * 60000 / spanMs);
+}
+
+// Readings per minute over the window
+static uint32_t readingsPerMin(const Sensor *sensor)
+{
+  uint32_t newest = (sensor->count - 1) & WINDOW_MASK;
+  uint32_t oldest = (sensor->count > STATS_WINDOW) ? sensor->count & WINDOW_MASK : 0;
+  uint32_t intervals = ((sensor->count > STATS_WINDOW) ? STATS_WINDOW : sensor->count) - 1;
+  uint32_t spanMs = sensor->windowMs[newest] - sensor->windowMs[oldest];
+
+  if (spanMs == 0) {
+    return 0;
+  }
+  return (uint32_t)((uint64_t)intervals * 60000 / spanMs);
+}
+
+// Follow the time since the last reading, n readings in. Past STATS_GAP_FACTOR times the average
+// over the window, readings went missing.
+static void checkGap(Sensor *sensor, uint32_t n, uint32_t nowMs)
+{
+  uint32_t last = (n - 1) & WINDOW_MASK;
+  uint32_t oldest = (n > STATS_WINDOW) ? n & WINDOW_MASK : 0;
+  uint32_t intervals = ((n > STATS_WINDOW) ? STATS_WINDOW : n) - 1;
+  uint32_t spanMs = sensor->windowMs[last] - sensor->windowMs[oldest];
+  uint32_t gapMs = nowMs - sensor->windowMs[last];
+
+  if (gapMs > sensor->maxGapMs) {
+    sensor->maxGapMs = gapMs;
+  }
+  if (intervals > 0 && spanMs > 0
+      && (uint64_t)gapMs * intervals > (uint64_t)STATS_GAP_FACTOR * spanMs) {
+    sensor->gaps++;
+  }
+}
+
+// Rank of a percentile among the readings, from 1
+static uint32_t rankOf(uint32_t count, uint16_t perMille)
+{
+  uint32_t rank = (uint32_t)(((uint64_t)count * perMille + 999) / 1000);
+
+  return (rank > 0) ? rank : 1;
+}
+
+// Move a percentile marker after a reading went into a bucket. The rank moves by at most one
+// reading, so the marker only steps over empty buckets on its way to the next reading.
+static void updateMarker(Sensor *sensor, Marker *marker, uint16_t bucket, uint16_t perMille,
+                         bool first)
+{
+  uint32_t rank = rankOf(sensor->count, perMille);
+
+  if (first) {
+    marker->bucket = bucket;
+    marker->below = 0;
+    return;
+  }
+  if (bucket < marker->bucket) {
+    marker->below++;
+  }
+  while (rank > marker->below + sensor->sketch[marker->bucket]) {
+    marker->below += sensor->sketch[marker->bucket];
+    marker->bucket++;
+  }
+  while (rank <= marker->below) {
+    marker->bucket--;
+    marker->below -= sensor->sketch[marker->bucket];
+  }
+}
+
+// Readings are taken as spread evenly over the bucket of the marker
+static int32_t markerValue(const Sensor *sensor, const Marker *marker, uint16_t perMille)
+{
+  uint32_t rank = rankOf(sensor->count, perMille);
+
+  return STATS_SKETCH_MIN + (int32_t)marker->bucket * STATS_SKETCH_STEP
+         + (int32_t)((rank - marker->below) * STATS_SKETCH_STEP
+                     / sensor->sketch[marker->bucket]);
+}
+
+static int32_t quantityOf(const Sensor *sensor, uint8_t quantity)
+{
+  switch (quantity) {
+    case statsQuantityEwma:
+      return (int32_t)lround(sensor->ewma);
+    case statsQuantityMean:
+      return (int32_t)lround(sensor->mean);
+    case statsQuantityRate:
+      return ratePerMin(sensor);
+    default:
+      return sensor->last;
+  }
+}
+
+static void printAlert(const Sensor *sensor, const Rule *rule, int32_t value, bool raised)
+{
+  int32_t magnitude = (value < 0) ? -value : value;
+
+  fprintf(stderr, "alert: %02x:%02x:%02x:%02x:%02x:%02x %s %s at %s%ld.%02ld\n",
+          sensor->address.addr[5], sensor->address.addr[4], sensor->address.addr[3],
+          sensor->address.addr[2], sensor->address.addr[1], sensor->address.addr[0],
+          rule->text, raised ? "raised" : "cleared", (value < 0) ? "-" : "",
+          (long)(magnitude / 1000), (long)((magnitude / 10) % 100));
+}
+
+// Raise the rules that hold and clear the raised ones that are back past their threshold
+static void checkRules(Sensor *sensor)
+{
+  const Rule *rule;
+  int32_t value;
+  bool raised;
+  uint8_t bit;
+  uint8_t i;
+
+  for (i = 0; i < ruleCount; i++) {
+    rule = &rules[i];
+    bit = (uint8_t)(1u << i);
+    value = quantityOf(sensor, rule->quantity);
+    if (sensor->alerts & bit) {
+      raised = rule->above ? value >= rule->threshold - STATS_ALERT_HYSTERESIS
+               : value <= rule->threshold + STATS_ALERT_HYSTERESIS;
+    } else {
+      raised = rule->above ? value > rule->threshold : value < rule->threshold;
+    }
+    if (raised != ((sensor->alerts & bit) != 0)) {
+      sensor->alerts ^= bit;
+      printAlert(sensor, rule, value, raised);
+      if (raised) {
+        metricsCount(metricAlerts);
+      }
+    }
+  }
+}
+
+/***************************************************************************************************
+ * Public Function Definitions
+ **************************************************************************************************/
+
+int sensorStatsAddRule(const char *text)
+{
+  Rule *rule = &rules[ruleCount];
+  size_t nameLen = strcspn(text, "<>");
+  char *end;
+  double threshold;
+  uint8_t i;
+
+  if (ruleCount == STATS_MAX_RULES || text[nameLen] == '\0'
+      || strlen(text) >= sizeof(rule->text)) {
+    return -1;
+  }
+  for (i = 0; i < sizeof(quantityNames) / sizeof(quantityNames[0]); i++) {
+    if (strlen(quantityNames[i]) == nameLen && strncmp(text, quantityNames[i], nameLen) == 0) {
+      break;
+    }
+  }
+  threshold = strtod(&text[nameLen + 1], &end);
+  if (i == sizeof(quantityNames) / sizeof(quantityNames[0]) || end == &text[nameLen + 1]
+      || *end != '\0') {
+    return -1;
+  }
+  rule->quantity = i;
+  rule->above = text[nameLen] == '>';
+  // Thresholds are compared in thousandths, like the readings
+  rule->threshold = (int32_t)lround(threshold * 1000.0);
+  strcpy(rule->text, text);
+  ruleCount++;
+  return 0;
+}
+
+void sensorStatsUpdate(const bd_addr *address, uint32_t temperature)
+{
+  uint16_t *entry = indexEntry(address);
+  int32_t value = (int32_t)temperature;
+  int32_t bucket;
+  Sensor *sensor;
+  uint32_t nowMs = clockMs();
+  uint32_t n;
+  double delta;
+  uint8_t i;
+
+  if (*entry == 0) {
+    if (sensorCount == STATS_MAX_SENSORS) {
+      return;
+    }
+    sensor = &sensors[sensorCount];
+    memset(sensor, 0, sizeof(*sensor));
+    sensor->address = *address;
+    sensor->ewma = value;
+    *entry = (uint16_t)(++sensorCount);
+  } else {
+    sensor = &sensors[*entry - 1];
+  }
+  n = sensor->count++;
+  if (n > 0) {
+    checkGap(sensor, n, nowMs);
+  }
+  sensor->last = value;
+  sensor->ewma += STATS_EWMA_ALPHA * (value - sensor->ewma);
+  // Welford's update of the mean and the sum of squared differences
+  delta = value - sensor->mean;
+  sensor->mean += delta / sensor->count;
+  sensor->m2 += delta * (value - sensor->mean);
+
+  sensor->window[n & WINDOW_MASK] = value;
+  sensor->windowMs[n & WINDOW_MASK] = nowMs;
+  dequePush(&sensor->minimum, sensor->window, n, true);
+  dequePush(&sensor->maximum, sensor->window, n, false);
+
+  bucket = (value - STATS_SKETCH_MIN) / STATS_SKETCH_STEP;
+  bucket = (bucket < 0) ? 0 : (bucket >= STATS_SKETCH_BUCKETS) ? STATS_SKETCH_BUCKETS - 1 : bucket;
+  sensor->sketch[bucket]++;
+  for (i = 0; i < STATS_PERCENTILES; i++) {
+    updateMarker(sensor, &sensor->markers[i], (uint16_t)bucket, percentiles[i], n == 0);
+  }
+
+  checkRules(sensor);
+}
+
+bool sensorStatsGet(const bd_addr *address, SensorStats *stats)
+{
+  const Sensor *sensor = find(address);
+
+  if (sensor == NULL) {
+    return false;
+  }
+  stats->count = sensor->count;
+  stats->last = sensor->last;
+  stats->ewma = (int32_t)lround(sensor->ewma);
+  stats->windowMin = dequeFront(&sensor->minimum, sensor->window);
+  stats->windowMax = dequeFront(&sensor->maximum, sensor->window);
+  stats->mean = (int32_t)lround(sensor->mean);
+  stats->stddev = (int32_t)lround(sqrt(sensor->m2 / sensor->count));
+  stats->ratePerMin = ratePerMin(sensor);
+  stats->p50 = markerValue(sensor, &sensor->markers[0], percentiles[0]);
+  stats->p90 = markerValue(sensor, &sensor->markers[1], percentiles[1]);
+  stats->p99 = markerValue(sensor, &sensor->markers[2], percentiles[2]);
+  stats->alerts = sensor->alerts;
+  stats->readingsPerMin = readingsPerMin(sensor);
+  stats->maxGapMs = sensor->maxGapMs;
+  stats->gaps = sensor->gaps;
+  return true;
+}
+
+void sensorStatsReport(FILE *out)
+{
+  const Sensor *sensor;
+  uint16_t i;
+
+  for (i = 0; i < sensorCount; i++) {
+    sensor = &sensors[i];
+    fprintf(out, "stats: %02x:%02x:%02x:%02x:%02x:%02x %u readings, %u/min, "
+            "longest gap %u ms, %u gaps\n",
+            sensor->address.addr[5], sensor->address.addr[4], sensor->address.addr[3],
+            sensor->address.addr[2], sensor->address.addr[1], sensor->address.addr[0],
+            (unsigned)sensor->count, (unsigned)readingsPerMin(sensor),
+            (unsigned)sensor->maxGapMs, (unsigned)sensor->gaps);
+  }
+}
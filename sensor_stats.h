@@ -0,0 +1,137 @@
+/***************************************************************************//**
+ * @file
+ * @brief Incremental statistics of every sensor's readings and threshold alerts on them
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2018 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+#ifndef SENSOR_STATS_H
+#define SENSOR_STATS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "bg_types.h"
+
+/***********************************************************************************************//**
+ * \defgroup sensor_stats Sensor Statistics
+ * \brief Aggregates of every sensor's readings, updated as each reading is decoded: an EWMA,
+ *        the minimum and maximum of the last readings kept in monotonic deques, the mean and
+ *        variance of all of them (Welford) and percentiles followed by markers in a fixed-size
+ *        histogram. Updates take constant time and never allocate, and so do queries, whatever
+ *        the number of readings. Alert rules are checked on every update, and the times between
+ *        readings for the rate achieved and the gaps. The sensors are shared by all NCPs.
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ * @addtogroup sensor_stats
+ * @{
+ **************************************************************************************************/
+
+ // Sensors the statistics are kept for, a power of two
+ #define STATS_MAX_SENSORS             1024
+ // Readings the windowed minimum, maximum and rate of change are taken over, a power of two
+ #define STATS_WINDOW                  64
+ // Weight of a new reading in the EWMA
+ #define STATS_EWMA_ALPHA              0.125
+ // Percentile histogram: 0.25 degree buckets from -40 degrees up, the ends take the rest
+ #define STATS_SKETCH_BUCKETS          512
+ #define STATS_SKETCH_MIN              (-40000)
+ #define STATS_SKETCH_STEP             250
+ // Percentiles followed, the median, 90th and 99th
+ #define STATS_PERCENTILES             3
+ // Alert rules, one bit each in the alert mask
+ #define STATS_MAX_RULES               8
+ // A raised alert is cleared once its value is this far back past the threshold, in thousandths
+ #define STATS_ALERT_HYSTERESIS        200
+ // A time between readings this many times the average over the window is counted as a gap
+ #define STATS_GAP_FACTOR              2
+
+/***************************************************************************************************
+ * Type Definitions
+ **************************************************************************************************/
+
+ // What an alert rule compares with its threshold
+ typedef enum {
+   statsQuantityTemperature,  // the last reading
+   statsQuantityEwma,
+   statsQuantityMean,
+   statsQuantityRate          // rate of change over the window, per minute
+ } StatsQuantity;
+
+ // Aggregates of one sensor, in thousandths of a degree Celsius
+ typedef struct {
+   uint32_t count;            // readings since the sensor was first heard
+   int32_t  last;
+   int32_t  ewma;
+   int32_t  windowMin;        // of the last STATS_WINDOW readings
+   int32_t  windowMax;
+   int32_t  mean;
+   int32_t  stddev;
+   int32_t  ratePerMin;       // from the oldest to the newest reading of the window
+   int32_t  p50;              // of every reading, to within STATS_SKETCH_STEP
+   int32_t  p90;
+   int32_t  p99;
+   uint8_t  alerts;           // a bit for each rule that is raised
+   uint32_t readingsPerMin;   // over the window
+   uint32_t maxGapMs;         // longest time between two readings
+   uint32_t gaps;             // times between readings of STATS_GAP_FACTOR times the average
+ } SensorStats;
+
+/***************************************************************************************************
+ * Function Declarations
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  Add an alert rule, a quantity, < or > and a threshold, e.g. "temp>30" or "rate<-2".
+ *          The quantity is one of temp, ewma, mean, in degrees Celsius, or rate, in degrees per
+ *          minute.
+ *  \param[in]  text  rule text
+ *  \return  0 on success, -1 if the rule is malformed or there are STATS_MAX_RULES already
+ **************************************************************************************************/
+int sensorStatsAddRule(const char *text);
+
+/***********************************************************************************************//**
+ *  \brief  Add a reading to the aggregates of its sensor and check the alert rules against them.
+ *          Raised and cleared alerts are printed to stderr.
+ *  \param[in]  address  sensor address
+ *  \param[in]  temperature  reading in thousandths of a degree Celsius
+ **************************************************************************************************/
+void sensorStatsUpdate(const bd_addr *address, uint32_t temperature);
+
+/***********************************************************************************************//**
+ *  \brief  Get the aggregates of a sensor.
+ *  \param[in]  address  sensor address
+ *  \param[out]  stats  aggregates
+ *  \return  true if the sensor has readings
+ **************************************************************************************************/
+bool sensorStatsGet(const bd_addr *address, SensorStats *stats);
+
+/***********************************************************************************************//**
+ *  \brief  Print the readings, achieved rate and gaps of every sensor.
+ *  \param[in]  out  stream to print to
+ **************************************************************************************************/
+void sensorStatsReport(FILE *out);
+
+/** @} (end addtogroup sensor_stats) */
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* SENSOR_STATS_H */
@@ -0,0 +1,254 @@
+/***************************************************************************//**
+ * @file
+ * @brief Latest state of every sensor, published in POSIX shared memory
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2018 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+/* standard library headers */
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <time.h>
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+/* Own header */
+#include "sensor_table.h"
+
+// Mapped segment, NULL while nothing is published
+static SensorTableHeader *table = NULL;
+static SensorSlot *slotTable = NULL;
+static uint32_t slotCount = 0;
+static size_t tableSize = 0;
+
+static uint64_t wallClockMs(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (uint64_t)ts.tv_sec * 1000u + (uint64_t)ts.tv_nsec / 1000000u;
+}
+
+// Readers retry while the sequence is odd, or has moved on since they started their copy
+static void beginWrite(SensorSlot *slot)
+{
+  __atomic_store_n(&slot->sequence, slot->sequence + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void endWrite(SensorSlot *slot)
+{
+  __atomic_store_n(&slot->sequence, slot->sequence + 1, __ATOMIC_RELEASE);
+}
+
+// Hundredths of a degree from thousandths, saturated
+static int16_t centi(int32_t milli)
+{
+  int32_t value = milli / 10;
+
+  return (int16_t)((value > INT16_MAX) ? INT16_MAX
+                   : (value <= SENSOR_TABLE_STATS_INVALID) ? SENSOR_TABLE_STATS_INVALID + 1 : value);
+}
+
+static void setStats(SensorSlot *slot, const SensorStats *stats)
+{
+  if (stats == NULL) {
+    slot->alerts = 0;
+    slot->ewma = slot->windowMin = slot->windowMax = SENSOR_TABLE_STATS_INVALID;
+    slot->mean = slot->stddev = slot->ratePerMin = SENSOR_TABLE_STATS_INVALID;
+    slot->p50 = slot->p90 = slot->p99 = SENSOR_TABLE_STATS_INVALID;
+    return;
+  }
+  slot->alerts = stats->alerts;
+  slot->ewma = centi(stats->ewma);
+  slot->windowMin = centi(stats->windowMin);
+  slot->windowMax = centi(stats->windowMax);
+  slot->mean = centi(stats->mean);
+  slot->stddev = centi(stats->stddev);
+  slot->ratePerMin = centi(stats->ratePerMin);
+  slot->p50 = centi(stats->p50);
+  slot->p90 = centi(stats->p90);
+  slot->p99 = centi(stats->p99);
+}
+
+static void setInfo(SensorSlot *slot, const SensorInfo *info)
+{
+  if (info == NULL) {
+    slot->temperatureType = TEMP_TYPE_INVALID;
+    slot->batteryLevel = BATTERY_LEVEL_INVALID;
+    slot->measurementInterval = MEASUREMENT_INTERVAL_INVALID;
+    return;
+  }
+  slot->temperatureType = info->temperatureType;
+  slot->batteryLevel = info->batteryLevel;
+  slot->measurementInterval = info->measurementInterval;
+}
+
+// An empty slot, with the generation and sequence it had
+static void emptySlot(SensorSlot *slot, uint64_t nowMs)
+{
+  slot->timeMs = nowMs;
+  slot->temperature = TEMP_INVALID;
+  slot->thermometerServiceHandle = SERVICE_HANDLE_INVALID;
+  slot->thermometerCharacteristicHandle = CHARACTERISTIC_HANDLE_INVALID;
+  slot->serverAddress = 0;
+  memset(&slot->address, 0, sizeof(slot->address));
+  slot->connectionHandle = CONNECTION_HANDLE_INVALID;
+  slot->rssi = RSSI_INVALID;
+  slot->state = running;
+  setStats(slot, NULL);
+  setInfo(slot, NULL);
+}
+
+/***************************************************************************************************
+ * Public Function Definitions
+ **************************************************************************************************/
+
+int sensorTableOpen(const char *name, uint32_t slots)
+{
+#if !defined(_WIN32)
+  SensorTableHeader *file;
+  SensorSlot *slot;
+  struct stat st;
+  size_t size = sizeof(SensorTableHeader) + (size_t)slots * sizeof(SensorSlot);
+  bool keep;
+  uint64_t nowMs = wallClockMs();
+  uint32_t i;
+  int fd;
+
+  fd = shm_open(name, O_RDWR | O_CREAT, 0644);
+  if (fd < 0) {
+    printf("Cannot create shared memory %s\n", name);
+    return -1;
+  }
+  if (fstat(fd, &st) < 0 || ((size_t)st.st_size < size && ftruncate(fd, (off_t)size) < 0)) {
+    close(fd);
+    return -1;
+  }
+  // Never shrunk under readers that have mapped it all
+  if ((size_t)st.st_size > size) {
+    size = (size_t)st.st_size;
+  }
+  file = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (file == MAP_FAILED) {
+    return -1;
+  }
+  slot = (SensorSlot *)(file + 1);
+  // Readers attached to a segment of the same layout keep polling it across the restart
+  keep = file->magic == SENSOR_TABLE_MAGIC
+         && file->version == SENSOR_TABLE_VERSION
+         && file->slots == slots
+         && file->slotSize == sizeof(SensorSlot);
+  if (!keep) {
+    __atomic_store_n(&file->magic, 0, __ATOMIC_RELEASE);
+    memset(slot, 0, (size_t)slots * sizeof(SensorSlot));
+  }
+  for (i = 0; i < slots; i++) {
+    beginWrite(&slot[i]);
+    emptySlot(&slot[i], nowMs);
+    if (keep) {
+      slot[i].generation++;
+    }
+    endWrite(&slot[i]);
+  }
+  file->version = SENSOR_TABLE_VERSION;
+  file->slots = slots;
+  file->slotSize = sizeof(SensorSlot);
+  file->startMs = nowMs;
+  __atomic_store_n(&file->magic, SENSOR_TABLE_MAGIC, __ATOMIC_RELEASE);
+
+  table = file;
+  slotTable = slot;
+  slotCount = slots;
+  tableSize = size;
+  return 0;
+#else
+  (void)name;
+  (void)slots;
+  return -1;
+#endif
+}
+
+void sensorTableClose(void)
+{
+  uint32_t i;
+
+  if (table == NULL) {
+    return;
+  }
+  for (i = 0; i < slotCount; i++) {
+    sensorTableClear((uint8_t)i);
+  }
+#if !defined(_WIN32)
+  munmap(table, tableSize);
+#endif
+  table = NULL;
+  slotTable = NULL;
+  slotCount = 0;
+}
+
+void sensorTableUpdate(uint8_t slot, const bd_addr *address, const ConnProperties *props,
+                       const SensorStats *stats, const SensorInfo *info)
+{
+  SensorSlot *s;
+
+  if (slot >= slotCount) {
+    return;
+  }
+  s = &slotTable[slot];
+  beginWrite(s);
+  // A broadcasting sensor keeps its slot without ever holding a connection
+  if ((s->connectionHandle == CONNECTION_HANDLE_INVALID && s->state != broadcasting)
+      || memcmp(&s->address, address, sizeof(*address)) != 0) {
+    s->generation++;
+    s->address = *address;
+  }
+  s->timeMs = wallClockMs();
+  s->temperature = props->temperature;
+  s->thermometerServiceHandle = props->thermometerServiceHandle;
+  s->thermometerCharacteristicHandle = props->thermometerCharacteristicHandle;
+  s->serverAddress = props->serverAddress;
+  s->connectionHandle = props->connectionHandle;
+  s->rssi = props->rssi;
+  s->state = props->state;
+  setStats(s, stats);
+  setInfo(s, info);
+  endWrite(s);
+}
+
+void sensorTableClear(uint8_t slot)
+{
+  SensorSlot *s;
+
+  if (slot >= slotCount) {
+    return;
+  }
+  s = &slotTable[slot];
+  if (s->connectionHandle == CONNECTION_HANDLE_INVALID && s->state != broadcasting) {
+    return;
+  }
+  beginWrite(s);
+  s->timeMs = wallClockMs();
+  s->connectionHandle = CONNECTION_HANDLE_INVALID;
+  // A broadcasting sensor is no longer listened to
+  if (s->state == broadcasting) {
+    s->state = running;
+  }
+  endWrite(s);
+}
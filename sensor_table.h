@@ -0,0 +1,143 @@
+/***************************************************************************//**
+ * @file
+ * @brief Latest state of every sensor, published in POSIX shared memory
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2018 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+#ifndef SENSOR_TABLE_H
+#define SENSOR_TABLE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "bg_types.h"
+#include "app.h"
+#include "sensor_stats.h"
+
+/***********************************************************************************************//**
+ * \defgroup sensor_table Sensor Table
+ * \brief The event thread publishes the state of each results table slot in a shared-memory
+ *        segment, one cache line per slot guarded by a seqlock. Other processes map it read-only
+ *        with the sensor table reader and poll it without locks or system calls, and the event
+ *        thread never waits for them.
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ * @addtogroup sensor_table
+ * @{
+ **************************************************************************************************/
+
+ #define SENSOR_TABLE_MAGIC            0x31544e53u  // "SNT1"
+ #define SENSOR_TABLE_VERSION          2u
+ // Aggregates of a slot whose sensor has no readings
+ #define SENSOR_TABLE_STATS_INVALID    INT16_MIN
+ // Shared-memory object used by the client and the readers unless named otherwise
+ #define SENSOR_TABLE_DEFAULT_NAME     "/thermometer-client"
+
+/***************************************************************************************************
+ * Type Definitions
+ **************************************************************************************************/
+
+ // The segment is a 64-byte header followed by the slots
+ typedef struct {
+   uint32_t magic;            // written last, once the slots are valid
+   uint32_t version;
+   uint32_t slots;            // results table slots, MAX_CONNECTIONS for each NCP
+   uint32_t slotSize;
+   uint64_t startMs;          // wall clock time the client started, changes on every restart
+   uint8_t  reserved[40];
+ } SensorTableHeader;
+
+ // One results table slot, a cache line. A reader takes a copy whenever sequence is even and
+ // unchanged across the copy, see sensorTableRead().
+ typedef struct {
+   uint32_t sequence;         // odd while the event thread is changing the slot
+   uint32_t generation;       // incremented each time another sensor takes the slot
+   uint64_t timeMs;           // wall clock time of the last change, ms since the epoch
+   uint32_t temperature;      // TEMP_INVALID until the first reading
+   uint32_t thermometerServiceHandle;
+   uint16_t thermometerCharacteristicHandle;
+   uint16_t serverAddress;    // last two bytes of the address, as in the results table
+   bd_addr  address;          // the sensor's address, kept once it has disconnected
+   uint8_t  connectionHandle; // CONNECTION_HANDLE_INVALID once the sensor has disconnected
+   int8_t   rssi;             // RSSI_INVALID until the first sample
+   uint8_t  state;            // ConnState of the connection's setup
+   uint8_t  alerts;           // a bit for each alert rule raised on the sensor
+   // Aggregates of the sensor's readings, see sensor_stats.h, in hundredths of a degree,
+   // SENSOR_TABLE_STATS_INVALID until the first reading
+   int16_t  ewma;
+   int16_t  windowMin;
+   int16_t  windowMax;
+   int16_t  mean;
+   int16_t  stddev;
+   int16_t  ratePerMin;
+   int16_t  p50;
+   int16_t  p90;
+   int16_t  p99;
+   // Read every info period, see appSetInfoPeriod(), TEMP_TYPE_INVALID, BATTERY_LEVEL_INVALID
+   // and MEASUREMENT_INTERVAL_INVALID until read or if the sensor does not have them
+   uint8_t  temperatureType;
+   uint8_t  batteryLevel;     // percent
+   uint16_t measurementInterval; // seconds
+   uint8_t  reserved[4];
+ } SensorSlot;
+
+/***************************************************************************************************
+ * Function Declarations
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  Create or reuse the shared-memory segment and empty its slots. Slots kept from an
+ *          earlier run get a new generation, so readers that stayed attached see the change.
+ *  \param[in]  name  shared-memory object name, e.g. SENSOR_TABLE_DEFAULT_NAME
+ *  \param[in]  slots  results table slots to publish
+ *  \return  0 on success, -1 on failure
+ **************************************************************************************************/
+int sensorTableOpen(const char *name, uint32_t slots);
+
+/***********************************************************************************************//**
+ *  \brief  Mark every slot disconnected and unmap the segment. The segment stays, with the last
+ *          values, until the next run or until it is removed from /dev/shm.
+ **************************************************************************************************/
+void sensorTableClose(void);
+
+/***********************************************************************************************//**
+ *  \brief  Publish the state of a connected or broadcasting sensor, called from the event thread
+ *          only. Never blocks. The slot's generation changes if it held another sensor or none.
+ *  \param[in]  slot  results table slot
+ *  \param[in]  address  address of the sensor
+ *  \param[in]  props  connection properties
+ *  \param[in]  stats  aggregates of the sensor's readings, NULL if it has none
+ *  \param[in]  info  values read besides the readings, NULL if none are
+ **************************************************************************************************/
+void sensorTableUpdate(uint8_t slot, const bd_addr *address, const ConnProperties *props,
+                       const SensorStats *stats, const SensorInfo *info);
+
+/***********************************************************************************************//**
+ *  \brief  Publish that the sensor of a slot has disconnected, its last values are kept.
+ *  \param[in]  slot  results table slot
+ **************************************************************************************************/
+void sensorTableClear(uint8_t slot);
+
+/** @} (end addtogroup sensor_table) */
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* SENSOR_TABLE_H */
@@ -0,0 +1,120 @@
+/***************************************************************************//**
+ * @file
+ * @brief Lock-free reader of the shared-memory sensor table
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2018 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+/* standard library headers */
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* Own header */
+#include "sensor_table_reader.h"
+
+static const SensorTableHeader *table = NULL;
+static const SensorSlot *slotTable = NULL;
+static uint32_t slotCount = 0;
+static size_t tableSize = 0;
+
+/***************************************************************************************************
+ * Public Function Definitions
+ **************************************************************************************************/
+
+int sensorTableReaderOpen(const char *name)
+{
+  const SensorTableHeader *file;
+  struct stat st;
+  int fd;
+
+  fd = shm_open(name, O_RDONLY, 0);
+  if (fd < 0) {
+    return -1;
+  }
+  if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(SensorTableHeader)) {
+    close(fd);
+    return -1;
+  }
+  file = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (file == MAP_FAILED) {
+    return -1;
+  }
+  // The magic is written last, the rest of the header is valid once it is there
+  if (__atomic_load_n(&file->magic, __ATOMIC_ACQUIRE) != SENSOR_TABLE_MAGIC
+      || file->version != SENSOR_TABLE_VERSION
+      || file->slotSize != sizeof(SensorSlot)
+      || sizeof(SensorTableHeader) + (size_t)file->slots * sizeof(SensorSlot) > (size_t)st.st_size) {
+    munmap((void *)file, (size_t)st.st_size);
+    return -1;
+  }
+  table = file;
+  slotTable = (const SensorSlot *)(file + 1);
+  slotCount = file->slots;
+  tableSize = (size_t)st.st_size;
+  return 0;
+}
+
+void sensorTableReaderClose(void)
+{
+  if (table != NULL) {
+    munmap((void *)table, tableSize);
+  }
+  table = NULL;
+  slotTable = NULL;
+  slotCount = 0;
+}
+
+uint32_t sensorTableReaderSlots(void)
+{
+  return slotCount;
+}
+
+uint64_t sensorTableReaderStartMs(void)
+{
+  return (table != NULL) ? __atomic_load_n(&table->startMs, __ATOMIC_RELAXED) : 0;
+}
+
+uint32_t sensorTableSequence(uint32_t slot)
+{
+  return (slot < slotCount) ? __atomic_load_n(&slotTable[slot].sequence, __ATOMIC_ACQUIRE) : 0;
+}
+
+int sensorTableRead(uint32_t slot, SensorSlot *out)
+{
+  uint32_t before;
+  uint32_t attempt;
+
+  if (slot >= slotCount) {
+    return -1;
+  }
+  for (attempt = 0; attempt < SENSOR_TABLE_READ_RETRIES; attempt++) {
+    before = __atomic_load_n(&slotTable[slot].sequence, __ATOMIC_ACQUIRE);
+    if (before & 1) {
+      continue;
+    }
+    memcpy(out, &slotTable[slot], sizeof(*out));
+    // The copy must be complete before the sequence is checked again
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&slotTable[slot].sequence, __ATOMIC_RELAXED) == before) {
+      out->sequence = before;
+      return 0;
+    }
+  }
+  return -1;
+}
@@ -0,0 +1,96 @@
+/***************************************************************************//**
+ * @file
+ * @brief Lock-free reader of the shared-memory sensor table
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2018 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+#ifndef SENSOR_TABLE_READER_H
+#define SENSOR_TABLE_READER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "sensor_table.h"
+
+/***********************************************************************************************//**
+ * \defgroup sensor_table_reader Sensor Table Reader
+ * \brief For processes other than the client: maps the sensor table read-only and copies slots
+ *        out of it consistently. Reading makes no system call and never holds up the client.
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ * @addtogroup sensor_table_reader
+ * @{
+ **************************************************************************************************/
+
+ // Attempts at a consistent copy of a slot before sensorTableRead() gives up, the client only
+ // stops halfway through a write if it dies there
+ #define SENSOR_TABLE_READ_RETRIES     1000
+
+/***************************************************************************************************
+ * Function Declarations
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  Map the sensor table read-only.
+ *  \param[in]  name  shared-memory object name, e.g. SENSOR_TABLE_DEFAULT_NAME
+ *  \return  0 on success, -1 if there is no table of a known layout
+ **************************************************************************************************/
+int sensorTableReaderOpen(const char *name);
+
+/***********************************************************************************************//**
+ *  \brief  Unmap the sensor table.
+ **************************************************************************************************/
+void sensorTableReaderClose(void);
+
+/***********************************************************************************************//**
+ *  \brief  Number of slots in the table.
+ *  \return  slot count, 0 if no table is mapped
+ **************************************************************************************************/
+uint32_t sensorTableReaderSlots(void);
+
+/***********************************************************************************************//**
+ *  \brief  When the client that wrote the table started, to tell a restart.
+ *  \return  wall clock time in ms since the epoch, 0 if no table is mapped
+ **************************************************************************************************/
+uint64_t sensorTableReaderStartMs(void);
+
+/***********************************************************************************************//**
+ *  \brief  Sequence number of a slot, a single load. It changes with every update, so pollers
+ *          can skip the slots whose sequence is the same as in their last copy.
+ *  \param[in]  slot  slot index
+ *  \return  current sequence, odd while an update is under way
+ **************************************************************************************************/
+uint32_t sensorTableSequence(uint32_t slot);
+
+/***********************************************************************************************//**
+ *  \brief  Copy a slot as the client last left it, never half updated.
+ *  \param[in]  slot  slot index
+ *  \param[out]  out  copy of the slot, its sequence is even
+ *  \return  0 on success, -1 if the slot is out of range or stayed busy for
+ *           SENSOR_TABLE_READ_RETRIES attempts
+ **************************************************************************************************/
+int sensorTableRead(uint32_t slot, SensorSlot *out);
+
+/** @} (end addtogroup sensor_table_reader) */
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* SENSOR_TABLE_READER_H */
@@ -0,0 +1,241 @@
+/***************************************************************************//**
+ * @file
+ * @brief Example consumer of the shared-memory sensor table
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2018 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+/**
+ * This is a companion of the thermometer client. It maps the sensor table the
+ * client publishes with its -t option and polls it, printing a CSV line for
+ * every slot that has changed since the last poll. Only the sequence number of
+ * an unchanged slot is read, so polling often stays cheap, and the client is
+ * never held up by it. With -a only readings at or above a temperature are
+ * printed, as an alarm daemon would raise them, and with -1 the table is
+ * printed once. With -s the aggregates the client keeps of each sensor's
+ * readings, and the alert rules raised on it, are printed as well. */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "infrastructure.h"
+#include "app.h"
+#include "sensor_table_reader.h"
+
+/***************************************************************************************************
+ * Local Macros and Definitions
+ **************************************************************************************************/
+
+#define USAGE "Usage: %s [-1] [-s] [-d] [-a alarm temperature] [-i poll interval ms] [shared memory name]\n\n" \
+              "  -1  print every slot once and exit\n" \
+              "  -s  print the aggregates of the readings and the alerts raised\n" \
+              "  -d  print the temperature type, measurement interval and battery level\n" \
+              "  -a  print only readings at or above this temperature, in degrees Celsius\n" \
+              "  -i  time between polls, 100 ms by default\n\n"
+
+#define DEFAULT_POLL_INTERVAL_MS      100
+
+/***************************************************************************************************
+ * Static Function Definitions
+ **************************************************************************************************/
+
+static const char *stateName(uint8_t state)
+{
+  static const char *names[] = {
+    "scanning", "opening", "discover-services", "discover-characteristics",
+    "enable-indication", "enable-cached-indication", "running", "broadcasting",
+    "discover-battery"
+  };
+
+  return (state < sizeof(names) / sizeof(names[0])) ? names[state] : "unknown";
+}
+
+// Hundredths of a degree, empty without readings
+static void printCenti(int16_t value)
+{
+  int32_t magnitude = (value < 0) ? -(int32_t)value : value;
+
+  printf(",");
+  if (value != SENSOR_TABLE_STATS_INVALID) {
+    printf("%s%ld.%02ld", (value < 0) ? "-" : "", (long)(magnitude / 100), (long)(magnitude % 100));
+  }
+}
+
+static void printStats(const SensorSlot *slot)
+{
+  printCenti(slot->ewma);
+  printCenti(slot->windowMin);
+  printCenti(slot->windowMax);
+  printCenti(slot->mean);
+  printCenti(slot->stddev);
+  printCenti(slot->ratePerMin);
+  printCenti(slot->p50);
+  printCenti(slot->p90);
+  printCenti(slot->p99);
+  printf(",0x%02x", slot->alerts);
+}
+
+// Empty until read, or if the sensor does not have it
+static void printInfo(const SensorSlot *slot)
+{
+  printf(",");
+  if (slot->temperatureType != TEMP_TYPE_INVALID) {
+    printf("%u", slot->temperatureType);
+  }
+  printf(",");
+  if (slot->measurementInterval != MEASUREMENT_INTERVAL_INVALID) {
+    printf("%u", slot->measurementInterval);
+  }
+  printf(",");
+  if (slot->batteryLevel != BATTERY_LEVEL_INVALID) {
+    printf("%u", slot->batteryLevel);
+  }
+}
+
+static void printSlot(uint32_t index, const SensorSlot *slot, bool stats, bool info)
+{
+  printf("%llu,%lu,%lu,%02x:%02x:%02x:%02x:%02x:%02x,%s,",
+         (unsigned long long)slot->timeMs, (unsigned long)index, (unsigned long)slot->generation,
+         slot->address.addr[5], slot->address.addr[4], slot->address.addr[3],
+         slot->address.addr[2], slot->address.addr[1], slot->address.addr[0],
+         (slot->connectionHandle == CONNECTION_HANDLE_INVALID && slot->state != broadcasting)
+         ? "disconnected"
+         : stateName(slot->state));
+  if (slot->temperature != TEMP_INVALID) {
+    printf("%s%lu.%02lu", TEMP_SIGN(slot->temperature), TEMP_DEGREES(slot->temperature),
+           TEMP_HUNDREDTHS(slot->temperature));
+  }
+  printf(",");
+  if (slot->rssi != RSSI_INVALID) {
+    printf("%d", slot->rssi);
+  }
+  if (stats) {
+    printStats(slot);
+  }
+  if (info) {
+    printInfo(slot);
+  }
+  printf("\n");
+}
+
+static void sleepMs(uint32_t ms)
+{
+  struct timespec ts = { ms / 1000, (long)(ms % 1000) * 1000000L };
+  nanosleep(&ts, NULL);
+}
+
+/***************************************************************************************************
+ * Public Function Definitions
+ **************************************************************************************************/
+
+int main(int argc, char* argv[])
+{
+  const char *name = SENSOR_TABLE_DEFAULT_NAME;
+  uint32_t intervalMs = DEFAULT_POLL_INTERVAL_MS;
+  int32_t alarm = 0;
+  bool alarmSet = false;
+  bool once = false;
+  bool stats = false;
+  bool info = false;
+  uint32_t *seen;
+  uint64_t startMs;
+  SensorSlot slot;
+  uint32_t sequence;
+  uint32_t i;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "1a:di:s")) != -1) {
+    switch (opt) {
+      case '1':
+        once = true;
+        break;
+      case 'a':
+        // Readings are in thousandths of a degree
+        alarm = (int32_t)(atof(optarg) * 1000.0);
+        alarmSet = true;
+        break;
+      case 'd':
+        info = true;
+        break;
+      case 'i':
+        intervalMs = (uint32_t)strtoul(optarg, NULL, 10);
+        break;
+      case 's':
+        stats = true;
+        break;
+      default:
+        fprintf(stderr, USAGE, argv[0]);
+        exit(EXIT_FAILURE);
+    }
+  }
+  if (optind < argc - 1) {
+    fprintf(stderr, USAGE, argv[0]);
+    exit(EXIT_FAILURE);
+  }
+  if (optind == argc - 1) {
+    name = argv[optind];
+  }
+  if (sensorTableReaderOpen(name) < 0) {
+    fprintf(stderr, "No sensor table %s, is the client running with -t?\n", name);
+    exit(EXIT_FAILURE);
+  }
+
+  printf("time_ms,slot,generation,address,state,temperature,rssi%s%s\n",
+         stats ? ",ewma,window_min,window_max,mean,stddev,rate_per_min,p50,p90,p99,alerts" : "",
+         info ? ",temperature_type,measurement_interval,battery" : "");
+  if (once) {
+    for (i = 0; i < sensorTableReaderSlots(); i++) {
+      if (sensorTableRead(i, &slot) == 0) {
+        printSlot(i, &slot, stats, info);
+      }
+    }
+    sensorTableReaderClose();
+    return 0;
+  }
+
+  // Sequence of each slot when it was last printed
+  seen = calloc(sensorTableReaderSlots(), sizeof(*seen));
+  startMs = sensorTableReaderStartMs();
+  while (seen != NULL) {
+    for (i = 0; i < sensorTableReaderSlots(); i++) {
+      sequence = sensorTableSequence(i);
+      if (sequence == seen[i] || sensorTableRead(i, &slot) < 0) {
+        continue;
+      }
+      seen[i] = slot.sequence;
+      if (!alarmSet
+          || (slot.temperature != TEMP_INVALID && (int32_t)slot.temperature >= alarm)) {
+        printSlot(i, &slot, stats, info);
+      }
+    }
+    fflush(stdout);
+    sleepMs(intervalMs);
+    // A restarted client may publish another number of slots, wait until it has set them up
+    if (sensorTableReaderStartMs() != startMs) {
+      sensorTableReaderClose();
+      while (sensorTableReaderOpen(name) < 0) {
+        sleepMs(intervalMs);
+      }
+      free(seen);
+      seen = calloc(sensorTableReaderSlots(), sizeof(*seen));
+      startMs = sensorTableReaderStartMs();
+    }
+  }
+  sensorTableReaderClose();
+  return EXIT_FAILURE;
+}
@@ -0,0 +1,198 @@
+/***************************************************************************//**
+ * @file
+ * @brief Range queries over the reading store
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2018 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+/**
+ * This is a companion of the thermometer client. It maps a reading store
+ * written with the client's -s option read-only and prints the readings of
+ * one sensor, or of all of them, in a time window as CSV lines. Only the
+ * blocks of the selected sensors that overlap the window are read, so a
+ * query over a short window of a large store stays cheap. With -l it lists
+ * the sensors in the store instead. */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "infrastructure.h"
+#include "app.h"
+#include "reading_store.h"
+
+/***************************************************************************************************
+ * Local Macros and Definitions
+ **************************************************************************************************/
+
+#define USAGE "Usage: %s [-l] [-a address] [-f from] [-t to] <store file>\n\n" \
+              "  -l  list the sensors in the store\n" \
+              "  -a  sensor address, xx:xx:xx:xx:xx:xx or the 4-digit ADDR of the results table\n" \
+              "  -f  start of the window, Unix time in seconds, or seconds ago if negative\n" \
+              "  -t  end of the window, same format\n\n"
+
+typedef struct {
+  bool     full;              // whole address given, else only the two bytes in address[0..1]
+  bd_addr  address;
+  uint64_t fromMs;
+  uint64_t toMs;
+} Query;
+
+/***************************************************************************************************
+ * Static Function Definitions
+ **************************************************************************************************/
+
+static void printAddress(const bd_addr *address)
+{
+  printf("%02x:%02x:%02x:%02x:%02x:%02x",
+         address->addr[5], address->addr[4], address->addr[3],
+         address->addr[2], address->addr[1], address->addr[0]);
+}
+
+// Parse a full address or the last two bytes as shown in the results table
+static int parseAddress(const char *text, Query *query)
+{
+  unsigned int b[6];
+  uint8_t i;
+
+  if (sscanf(text, "%2x:%2x:%2x:%2x:%2x:%2x", &b[5], &b[4], &b[3], &b[2], &b[1], &b[0]) == 6) {
+    for (i = 0; i < 6; i++) {
+      query->address.addr[i] = (uint8_t)b[i];
+    }
+    query->full = true;
+    return 0;
+  }
+  if (strlen(text) == 4 && sscanf(text, "%4x", &b[0]) == 1) {
+    query->address.addr[0] = (uint8_t)b[0];
+    query->address.addr[1] = (uint8_t)(b[0] >> 8);
+    query->full = false;
+    return 0;
+  }
+  return -1;
+}
+
+// Unix time in seconds, or seconds before now if negative
+static int parseTime(const char *text, uint64_t *ms)
+{
+  char *end;
+  long long seconds = strtoll(text, &end, 10);
+
+  if (*text == '\0' || *end != '\0') {
+    return -1;
+  }
+  if (seconds < 0) {
+    seconds += (long long)time(NULL);
+  }
+  *ms = (seconds < 0) ? 0 : (uint64_t)seconds * 1000u;
+  return 0;
+}
+
+static bool printReading(const StoredReading *reading, void *context)
+{
+  (void)context;
+  printf("%llu,", (unsigned long long)reading->timeMs);
+  printAddress(&reading->address);
+  printf(",%s%lu.%02lu,", TEMP_SIGN(reading->temperature),
+         TEMP_DEGREES(reading->temperature), TEMP_HUNDREDTHS(reading->temperature));
+  // Readings taken before the first RSSI sample have none
+  if (reading->rssi != RSSI_INVALID) {
+    printf("%d", reading->rssi);
+  }
+  printf("\n");
+  return true;
+}
+
+static void printSensor(const bd_addr *address, uint32_t samples, void *context)
+{
+  (void)context;
+  printAddress(address);
+  printf(" %04x %lu\n", (uint16_t)(address->addr[1] << 8) + address->addr[0], (unsigned long)samples);
+}
+
+static void querySensor(const bd_addr *address, uint32_t samples, void *context)
+{
+  const Query *query = context;
+
+  (void)samples;
+  if (query->full ? memcmp(address, &query->address, sizeof(bd_addr)) == 0
+      : (address->addr[0] == query->address.addr[0] && address->addr[1] == query->address.addr[1])) {
+    readingStoreQuery(address, query->fromMs, query->toMs, printReading, NULL);
+  }
+}
+
+static void queryAll(const bd_addr *address, uint32_t samples, void *context)
+{
+  const Query *query = context;
+
+  (void)samples;
+  readingStoreQuery(address, query->fromMs, query->toMs, printReading, NULL);
+}
+
+/***************************************************************************************************
+ * Public Function Definitions
+ **************************************************************************************************/
+
+int main(int argc, char* argv[])
+{
+  Query query = { false, { { 0 } }, 0, UINT64_MAX };
+  bool list = false;
+  bool bySensor = false;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "la:f:t:")) != -1) {
+    switch (opt) {
+      case 'l':
+        list = true;
+        break;
+      case 'a':
+        if (parseAddress(optarg, &query) < 0) {
+          fprintf(stderr, USAGE, argv[0]);
+          exit(EXIT_FAILURE);
+        }
+        bySensor = true;
+        break;
+      case 'f':
+      case 't':
+        if (parseTime(optarg, (opt == 'f') ? &query.fromMs : &query.toMs) < 0) {
+          fprintf(stderr, USAGE, argv[0]);
+          exit(EXIT_FAILURE);
+        }
+        break;
+      default:
+        fprintf(stderr, USAGE, argv[0]);
+        exit(EXIT_FAILURE);
+    }
+  }
+  if (optind != argc - 1) {
+    fprintf(stderr, USAGE, argv[0]);
+    exit(EXIT_FAILURE);
+  }
+  if (readingStoreOpen(argv[optind], true) < 0) {
+    exit(EXIT_FAILURE);
+  }
+
+  if (list) {
+    printf("address ADDR samples\n");
+    readingStoreSensors(printSensor, NULL);
+  } else {
+    printf("time_ms,address,temperature,rssi\n");
+    readingStoreSensors(bySensor ? querySensor : queryAll, &query);
+  }
+
+  readingStoreClose();
+  return 0;
+}
@@ -0,0 +1,172 @@
+/***************************************************************************//**
+ * @file
+ * @brief Supervision: deadlines of the connections and paced reconnects
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2018 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+/* standard library headers */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdbool.h>
+
+/* Own header */
+#include "supervision.h"
+
+#include "app.h"
+#include "metrics.h"
+
+#if (SUPERVISION_MAX_SENSORS & (SUPERVISION_MAX_SENSORS - 1)) != 0 || SUPERVISION_MAX_SENSORS > 32768
+#error "SUPERVISION_MAX_SENSORS must be a power of two, at most 32768"
+#endif
+
+#define INDEX_SIZE                    (2 * SUPERVISION_MAX_SENSORS)
+
+typedef struct {
+  bd_addr address;
+  uint8_t drops;              // links in a row that did not last SUPERVISION_STABLE_MS
+  TimerWheelTimer hold;       // armed while it is held back
+} Sensor;
+
+static bool supervisionOn = false;
+static Sensor sensors[SUPERVISION_MAX_SENSORS];
+static uint16_t sensorCount = 0;
+// Open addressing on the address, entries are sensor index + 1, 0 if free
+static uint16_t byAddress[INDEX_SIZE];
+static uint32_t closedCount[supervisionConnectHung + 1];
+static uint32_t holdCount = 0;
+static uint32_t longestHoldMs = 0;
+
+// Index entry of an address, its own or the free one it would take
+static uint16_t *indexEntry(const bd_addr *address)
+{
+  uint64_t key = 0;
+  uint32_t i;
+
+  memcpy(&key, address->addr, sizeof(address->addr));
+  i = (uint32_t)((key * 0x9e3779b97f4a7c15ull) >> 48) & (INDEX_SIZE - 1);
+  while (byAddress[i] != 0
+         && memcmp(&sensors[byAddress[i] - 1].address, address, sizeof(*address)) != 0) {
+    i = (i + 1) & (INDEX_SIZE - 1);
+  }
+  return &byAddress[i];
+}
+
+// Hold after a number of drops in a row, +-25 % so the sensors that dropped together spread out
+static uint32_t backoffMs(uint8_t drops)
+{
+  uint32_t ms = SUPERVISION_BACKOFF_MS;
+
+  while (drops-- > 0 && ms < SUPERVISION_BACKOFF_MAX_MS) {
+    ms *= 2;
+  }
+  if (ms > SUPERVISION_BACKOFF_MAX_MS) {
+    ms = SUPERVISION_BACKOFF_MAX_MS;
+  }
+  return ms - ms / 4 + (uint32_t)rand() % (ms / 2 + 1);
+}
+
+/***************************************************************************************************
+ * Public Function Definitions
+ **************************************************************************************************/
+
+void supervisionSetEnabled(bool enabled)
+{
+  supervisionOn = enabled;
+}
+
+bool supervisionEnabled(void)
+{
+  return supervisionOn;
+}
+
+uint32_t supervisionStallMs(uint16_t measurementIntervalS, uint32_t readingsPerMin)
+{
+  uint32_t intervalMs = 0;
+  uint32_t stallMs;
+
+  if (measurementIntervalS != 0 && measurementIntervalS != MEASUREMENT_INTERVAL_INVALID) {
+    intervalMs = measurementIntervalS * 1000u;
+  }
+  // A sensor may be slower than it says, e.g. while it is far away
+  if (readingsPerMin != 0 && 60000u / readingsPerMin > intervalMs) {
+    intervalMs = 60000u / readingsPerMin;
+  }
+  if (intervalMs == 0) {
+    intervalMs = SUPERVISION_DEFAULT_INTERVAL_MS;
+  }
+  stallMs = intervalMs * SUPERVISION_STALL_INTERVALS;
+  return (stallMs > SUPERVISION_MIN_STALL_MS) ? stallMs : SUPERVISION_MIN_STALL_MS;
+}
+
+void supervisionHold(TimerWheel *wheel, const bd_addr *address, uint32_t linkMs)
+{
+  uint16_t *entry = indexEntry(address);
+  Sensor *sensor;
+  uint32_t ms;
+
+  if (*entry == 0) {
+    // Past the table the sensors reconnect as soon as they advertise
+    if (sensorCount == SUPERVISION_MAX_SENSORS) {
+      return;
+    }
+    sensor = &sensors[sensorCount];
+    memset(sensor, 0, sizeof(*sensor));
+    sensor->address = *address;
+    *entry = (uint16_t)(++sensorCount);
+  } else {
+    sensor = &sensors[*entry - 1];
+  }
+  if (linkMs >= SUPERVISION_STABLE_MS) {
+    sensor->drops = 0;
+  }
+  ms = backoffMs(sensor->drops);
+  if (sensor->drops < UINT8_MAX) {
+    sensor->drops++;
+  }
+  // Nothing to do when it is over, the sensor is connected at its next advertisement
+  timerWheelArm(wheel, &sensor->hold, ms, NULL, NULL);
+  holdCount++;
+  if (ms > longestHoldMs) {
+    longestHoldMs = ms;
+  }
+  metricsCount(metricReconnectHolds);
+}
+
+bool supervisionHeld(const bd_addr *address)
+{
+  uint16_t entry = *indexEntry(address);
+
+  return entry != 0 && timerWheelArmed(&sensors[entry - 1].hold);
+}
+
+void supervisionClosed(SupervisionReason reason)
+{
+  closedCount[reason]++;
+  metricsCount(metricSupervisionCloses);
+}
+
+void supervisionReport(FILE *out)
+{
+  if (!supervisionOn) {
+    return;
+  }
+  fprintf(out, "supervision: %lu stalled links closed, %lu hung setups, %lu hung connects, "
+          "%lu reconnects held back, longest %.1f s\n",
+          (unsigned long)closedCount[supervisionStalled],
+          (unsigned long)closedCount[supervisionSetupHung],
+          (unsigned long)closedCount[supervisionConnectHung],
+          (unsigned long)holdCount, longestHoldMs / 1e3);
+}
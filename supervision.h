@@ -0,0 +1,136 @@
+/***************************************************************************//**
+ * @file
+ * @brief Supervision: deadlines of the connections and paced reconnects
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2018 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+#ifndef SUPERVISION_H
+#define SUPERVISION_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "bg_types.h"
+#include "timer_wheel.h"
+
+/***********************************************************************************************//**
+ * \defgroup supervision Supervision
+ * \brief A link whose sensor has stopped sending readings stays open until the controller's
+ *        supervision timeout, and one whose setup hangs stays open for good. Each connection
+ *        gets a deadline in its NCP's timer wheel: while it is set up, the time a step may take,
+ *        and once it is running, a few of the sensor's intervals between readings, moved on with
+ *        every reading. A connection past its deadline is closed, and its sensor connected again
+ *        once it advertises. A sensor whose link drops, or cannot be opened, is held back from
+ *        reconnecting for a while, doubled each time the link did not last, with jitter so the
+ *        sensors that dropped together do not come back together. The hold of each sensor is a
+ *        deadline in the timer wheel too. The sensors are shared by all NCPs.
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ * @addtogroup supervision
+ * @{
+ **************************************************************************************************/
+
+ // Intervals between readings a running link may miss before it is closed
+ #define SUPERVISION_STALL_INTERVALS   4
+ // Interval taken until the sensor's is known, and the shortest time to a stall, in ms
+ #define SUPERVISION_DEFAULT_INTERVAL_MS 10000
+ #define SUPERVISION_MIN_STALL_MS      3000
+ // Time a setup step, e.g. a discovery, and the opening of a connection may take, in ms
+ #define SUPERVISION_STEP_TIMEOUT_MS   10000
+ #define SUPERVISION_CONNECT_TIMEOUT_MS 5000
+ // Hold on reconnecting after the first drop, and the longest, in ms
+ #define SUPERVISION_BACKOFF_MS        1000
+ #define SUPERVISION_BACKOFF_MAX_MS    120000
+ // A link that lasted this long starts the backoff over, in ms
+ #define SUPERVISION_STABLE_MS         60000
+ // Sensors the backoff is kept for, a power of two
+ #define SUPERVISION_MAX_SENSORS       1024
+
+/***************************************************************************************************
+ * Type Definitions
+ **************************************************************************************************/
+
+ // Why supervision closed a connection
+ typedef enum {
+   supervisionStalled,        // running, but no reading in time
+   supervisionSetupHung,      // a setup step did not complete in time
+   supervisionConnectHung     // the connection did not open in time
+ } SupervisionReason;
+
+/***************************************************************************************************
+ * Function Declarations
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  Turn supervision on or off.
+ *  \param[in]  enabled  true to close the links past their deadlines and pace reconnects
+ **************************************************************************************************/
+void supervisionSetEnabled(bool enabled);
+
+/***********************************************************************************************//**
+ *  \brief  Check whether supervision is on.
+ *  \return  true if the links have deadlines
+ **************************************************************************************************/
+bool supervisionEnabled(void);
+
+/***********************************************************************************************//**
+ *  \brief  Time a running link may go without a reading, SUPERVISION_STALL_INTERVALS of the
+ *          longer of the interval the sensor reports and the one its readings come at.
+ *  \param[in]  measurementIntervalS  Measurement Interval of the sensor in s, 0 or
+ *              MEASUREMENT_INTERVAL_INVALID if unknown
+ *  \param[in]  readingsPerMin  rate of its recent readings, 0 if unknown
+ *  \return  deadline after a reading in ms
+ **************************************************************************************************/
+uint32_t supervisionStallMs(uint16_t measurementIntervalS, uint32_t readingsPerMin);
+
+/***********************************************************************************************//**
+ *  \brief  Hold a sensor back from reconnecting, after its link dropped or could not be opened.
+ *  \param[in,out]  wheel  timer wheel of the NCP the link was on
+ *  \param[in]  address  sensor address
+ *  \param[in]  linkMs  time the link was up, 0 if it never opened
+ **************************************************************************************************/
+void supervisionHold(TimerWheel *wheel, const bd_addr *address, uint32_t linkMs);
+
+/***********************************************************************************************//**
+ *  \brief  Check whether a sensor is held back from reconnecting.
+ *  \param[in]  address  sensor address
+ *  \return  true if it is not to be connected yet
+ **************************************************************************************************/
+bool supervisionHeld(const bd_addr *address);
+
+/***********************************************************************************************//**
+ *  \brief  Count a connection closed for being past its deadline.
+ *  \param[in]  reason  SupervisionReason
+ **************************************************************************************************/
+void supervisionClosed(SupervisionReason reason);
+
+/***********************************************************************************************//**
+ *  \brief  Print the links closed and the reconnects held back.
+ *  \param[in]  out  stream to print to
+ **************************************************************************************************/
+void supervisionReport(FILE *out);
+
+/** @} (end addtogroup supervision) */
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* SUPERVISION_H */
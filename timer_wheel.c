@@ -0,0 +1,209 @@
+/***************************************************************************//**
+ * @file
+ * @brief Hierarchical timer wheel
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2018 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+/* standard library headers */
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/* Own header */
+#include "timer_wheel.h"
+
+#define SLOT_MASK                     (TIMER_WHEEL_SLOTS - 1)
+#define MAX_TICKS                     ((1u << (TIMER_WHEEL_SLOT_BITS * TIMER_WHEEL_LEVELS)) - 1)
+
+static void unlink(TimerWheelTimer *timer)
+{
+  timer->prev->next = timer->next;
+  timer->next->prev = timer->prev;
+  timer->next = NULL;
+  timer->prev = NULL;
+}
+
+// Put a timer in the finest wheel its deadline fits in, as seen from the next tick to expire
+static void insert(TimerWheel *wheel, TimerWheelTimer *timer)
+{
+  uint32_t delta = timer->expires - wheel->tick;
+  TimerWheelTimer *head;
+  uint8_t level = 0;
+
+  // Overdue, e.g. moved down late, expires with the next tick
+  if ((int32_t)delta < 0) {
+    timer->expires = wheel->tick;
+    delta = 0;
+  }
+  while (level < TIMER_WHEEL_LEVELS - 1 && delta >= (1u << (TIMER_WHEEL_SLOT_BITS * (level + 1)))) {
+    level++;
+  }
+  head = &wheel->slots[level][(timer->expires >> (TIMER_WHEEL_SLOT_BITS * level)) & SLOT_MASK];
+  timer->next = head;
+  timer->prev = head->prev;
+  head->prev->next = timer;
+  head->prev = timer;
+}
+
+// Move the ring of one slot to another head, leaving the slot empty
+static void detach(TimerWheelTimer *head, TimerWheelTimer *to)
+{
+  if (head->next == head) {
+    to->next = to;
+    to->prev = to;
+    return;
+  }
+  to->next = head->next;
+  to->prev = head->prev;
+  to->next->prev = to;
+  to->prev->next = to;
+  head->next = head;
+  head->prev = head;
+}
+
+// Move the timers of the slot of a coarser wheel that has come round into the finer ones.
+// Returns the index of that slot, the next wheel up comes round too when it is 0.
+static uint32_t cascade(TimerWheel *wheel, uint8_t level)
+{
+  uint32_t index = (wheel->tick >> (TIMER_WHEEL_SLOT_BITS * level)) & SLOT_MASK;
+  TimerWheelTimer ring;
+  TimerWheelTimer *timer;
+
+  detach(&wheel->slots[level][index], &ring);
+  while (ring.next != &ring) {
+    timer = ring.next;
+    unlink(timer);
+    insert(wheel, timer);
+  }
+  return index;
+}
+
+/***************************************************************************************************
+ * Public Function Definitions
+ **************************************************************************************************/
+
+void timerWheelInit(TimerWheel *wheel, uint64_t nowMs)
+{
+  uint8_t level;
+  uint32_t i;
+
+  // As after timerWheelAdvance(wheel, nowMs)
+  wheel->now = (uint32_t)(nowMs / TIMER_WHEEL_TICK_MS);
+  wheel->tick = wheel->now + 1;
+  for (level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+    for (i = 0; i < TIMER_WHEEL_SLOTS; i++) {
+      wheel->slots[level][i].next = &wheel->slots[level][i];
+      wheel->slots[level][i].prev = &wheel->slots[level][i];
+    }
+  }
+}
+
+void timerWheelArm(TimerWheel *wheel, TimerWheelTimer *timer, uint32_t delayMs,
+                   TimerWheelCallback callback, void *context)
+{
+  // Never early: the current tick may have gone some way by now
+  uint32_t ticks = (delayMs + TIMER_WHEEL_TICK_MS - 1) / TIMER_WHEEL_TICK_MS + 1;
+
+  timerWheelCancel(timer);
+  timer->expires = wheel->now + ((ticks < MAX_TICKS) ? ticks : MAX_TICKS);
+  timer->callback = callback;
+  timer->context = context;
+  insert(wheel, timer);
+}
+
+void timerWheelCancel(TimerWheelTimer *timer)
+{
+  if (timer->next != NULL) {
+    unlink(timer);
+  }
+}
+
+bool timerWheelArmed(const TimerWheelTimer *timer)
+{
+  return timer->next != NULL;
+}
+
+void timerWheelAdvance(TimerWheel *wheel, uint64_t nowMs)
+{
+  TimerWheelTimer due;
+  TimerWheelTimer *timer;
+  uint8_t level;
+
+  // Callbacks of ticks caught up with arm their timers from now too. The clock does not wrap
+  // for 584 million years, its ticks go on through the wrap of their 32 bits.
+  wheel->now = (uint32_t)(nowMs / TIMER_WHEEL_TICK_MS);
+  while ((int32_t)(wheel->now - wheel->tick) >= 0) {
+    for (level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+      if (((wheel->tick >> (TIMER_WHEEL_SLOT_BITS * (level - 1))) & SLOT_MASK) != 0
+          || cascade(wheel, level) != 0) {
+        break;
+      }
+    }
+    detach(&wheel->slots[0][wheel->tick & SLOT_MASK], &due);
+    wheel->tick++;
+    while (due.next != &due) {
+      timer = due.next;
+      unlink(timer);
+      if (timer->callback != NULL) {
+        timer->callback(timer->context);
+      }
+    }
+  }
+}
+
+uint32_t timerWheelNextMs(const TimerWheel *wheel, uint64_t nowMs)
+{
+  uint32_t nowTick = (uint32_t)(nowMs / TIMER_WHEEL_TICK_MS);
+  const TimerWheelTimer *head;
+  uint32_t best = UINT32_MAX;
+  uint32_t base;
+  uint32_t index;
+  uint32_t distance;
+  uint32_t ticks;
+  uint8_t level;
+  uint32_t k;
+
+  for (level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+    base = wheel->tick >> (TIMER_WHEEL_SLOT_BITS * level);
+    index = base & SLOT_MASK;
+    for (k = 0; k < TIMER_WHEEL_SLOTS; k++) {
+      head = &wheel->slots[level][(index + k) & SLOT_MASK];
+      if (head->next == head) {
+        continue;
+      }
+      // The first wheel's slots expire at their tick, the others' are moved down when the wheel
+      // below comes round to them. The current slot of a coarser wheel has been moved down
+      // already, unless that happens with the next tick.
+      distance = k;
+      if (level > 0 && k == 0
+          && (wheel->tick & ((1u << (TIMER_WHEEL_SLOT_BITS * level)) - 1)) != 0) {
+        distance = TIMER_WHEEL_SLOTS;
+      }
+      ticks = (level == 0) ? distance
+              : ((base + distance) << (TIMER_WHEEL_SLOT_BITS * level)) - wheel->tick;
+      if (ticks < best) {
+        best = ticks;
+      }
+    }
+  }
+  if (best == UINT32_MAX) {
+    return TIMER_WHEEL_IDLE;
+  }
+  // Ticks from the next one to expire, which is due once the clock reaches its start
+  ticks = wheel->tick + best - nowTick;
+  if ((int32_t)ticks <= 0) {
+    return 0;
+  }
+  return ticks * TIMER_WHEEL_TICK_MS - (uint32_t)(nowMs % TIMER_WHEEL_TICK_MS);
+}
@@ -0,0 +1,138 @@
+/***************************************************************************//**
+ * @file
+ * @brief Hierarchical timer wheel
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2018 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/***********************************************************************************************//**
+ * \defgroup timer_wheel Timer Wheel
+ * \brief Timers in TIMER_WHEEL_LEVELS wheels of TIMER_WHEEL_SLOTS slots, each slot a ring of the
+ *        timers due in it. The first wheel turns one slot per tick, each of the others one slot
+ *        per turn of the wheel below, and a timer goes into the finest wheel its deadline fits
+ *        in. When a wheel comes round, the timers of its next coarser slot are moved down.
+ *        Arming and cancelling a timer is a few pointer updates, and a tick costs the same however
+ *        many timers are armed. The timers are embedded in their owner, nothing is allocated.
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ * @addtogroup timer_wheel
+ * @{
+ **************************************************************************************************/
+
+ // Resolution of the timers, in ms
+ #define TIMER_WHEEL_TICK_MS           10
+ // Slots of each wheel, a power of two, and wheels: 64^4 ticks of 10 ms cover 46 hours
+ #define TIMER_WHEEL_SLOT_BITS         6
+ #define TIMER_WHEEL_SLOTS             (1u << TIMER_WHEEL_SLOT_BITS)
+ #define TIMER_WHEEL_LEVELS            4
+ // Longest delay a timer can be armed with, longer ones are cut to it
+ #define TIMER_WHEEL_MAX_MS            ((uint32_t)((1ull << (TIMER_WHEEL_SLOT_BITS * TIMER_WHEEL_LEVELS)) - 1) * TIMER_WHEEL_TICK_MS)
+ // timerWheelNextMs() of a wheel with no timers armed
+ #define TIMER_WHEEL_IDLE              UINT32_MAX
+
+/***************************************************************************************************
+ * Type Definitions
+ **************************************************************************************************/
+
+ // Called when a timer expires, it is no longer armed and may be armed again
+ typedef void (*TimerWheelCallback)(void *context);
+
+ typedef struct TimerWheelTimer {
+   struct TimerWheelTimer *next;  // in the ring of its slot, NULL while not armed
+   struct TimerWheelTimer *prev;
+   uint32_t expires;              // tick it is due at
+   TimerWheelCallback callback;
+   void *context;
+ } TimerWheelTimer;
+
+ typedef struct {
+   // Ticks count on modulo 2^32, the wheels turn on across the wrap
+   uint32_t tick;                 // next tick to expire
+   uint32_t now;                  // tick of the time last given, timers are armed from it
+   // Ring heads, a slot is empty while its head points to itself
+   TimerWheelTimer slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+ } TimerWheel;
+
+/***************************************************************************************************
+ * Function Declarations
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  Start a wheel with no timers.
+ *  \param[out]  wheel  wheel
+ *  \param[in]  nowMs  current time in ms, on the monotonic clock later given to
+ *              timerWheelAdvance()
+ **************************************************************************************************/
+void timerWheelInit(TimerWheel *wheel, uint64_t nowMs);
+
+/***********************************************************************************************//**
+ *  \brief  Arm a timer, or move it if it is armed already.
+ *  \param[in,out]  wheel  wheel
+ *  \param[in,out]  timer  timer, zeroed or used before
+ *  \param[in]  delayMs  time from now, the timer expires within two ticks of it
+ *  \param[in]  callback  called when it expires, NULL for a deadline only looked at with
+ *              timerWheelArmed()
+ *  \param[in]  context  passed to the callback
+ **************************************************************************************************/
+void timerWheelArm(TimerWheel *wheel, TimerWheelTimer *timer, uint32_t delayMs,
+                   TimerWheelCallback callback, void *context);
+
+/***********************************************************************************************//**
+ *  \brief  Disarm a timer, nothing happens if it is not armed.
+ *  \param[in,out]  timer  timer
+ **************************************************************************************************/
+void timerWheelCancel(TimerWheelTimer *timer);
+
+/***********************************************************************************************//**
+ *  \brief  Check whether a timer is armed.
+ *  \param[in]  timer  timer
+ *  \return  true if it is waiting to expire
+ **************************************************************************************************/
+bool timerWheelArmed(const TimerWheelTimer *timer);
+
+/***********************************************************************************************//**
+ *  \brief  Expire the timers due by now, calling their callbacks in the order they are due.
+ *          The callbacks may arm and cancel timers of the same wheel.
+ *  \param[in,out]  wheel  wheel
+ *  \param[in]  nowMs  current time in ms, never going back
+ **************************************************************************************************/
+void timerWheelAdvance(TimerWheel *wheel, uint64_t nowMs);
+
+/***********************************************************************************************//**
+ *  \brief  Time until the wheel is next to be advanced, for a caller that sleeps in between. A
+ *          timer in a coarser wheel is waited for until it is moved down, which may take another
+ *          wait or two. Looks at every slot, call it once per wakeup rather than per event.
+ *  \param[in]  wheel  wheel
+ *  \param[in]  nowMs  current time in ms
+ *  \return  ms to wait, 0 if a timer is due, TIMER_WHEEL_IDLE if none is armed
+ **************************************************************************************************/
+uint32_t timerWheelNextMs(const TimerWheel *wheel, uint64_t nowMs);
+
+/** @} (end addtogroup timer_wheel) */
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* TIMER_WHEEL_H */
@@ -0,0 +1,164 @@
+/***************************************************************************//**
+ * @file
+ * @brief Timer wheel test
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2018 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+/**
+ * Arms timers with deadlines from milliseconds to an hour in a timer wheel,
+ * cancels some, re-arms others from their callbacks, and advances the wheel
+ * in uneven steps until all of them are due, then again sleeping for the
+ * time timerWheelNextMs() gives, as the event loop does. Every timer must
+ * expire once, never before its deadline, within two ticks of the step that
+ * passed it, and never before the time the wheel said it could sleep for.
+ * The runs are repeated from start times just before the millisecond count
+ * wraps its 32 bits and before the tick count does, so the wheel is shown to
+ * turn on across both. Exits with status 1 on a failure. */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "timer_wheel.h"
+
+/***************************************************************************************************
+ * Local Macros and Definitions
+ **************************************************************************************************/
+
+#define TEST_TIMERS                  5000
+// Longest delay armed, and the longest step the wheel is advanced by, in ms
+#define TEST_MAX_DELAY_MS            3600000u
+#define TEST_MAX_STEP_MS             250u
+
+typedef struct {
+  TimerWheelTimer timer;
+  uint64_t dueMs;
+  uint32_t expiries;
+  bool cancelled;
+} TestTimer;
+
+static TimerWheel wheel;
+static TestTimer timers[TEST_TIMERS];
+// Time given to the last and the current advance, and the time nothing was to expire before
+static uint64_t lastMs;
+static uint64_t nowMs;
+static uint64_t quietUntilMs;
+static uint32_t failures;
+
+/***************************************************************************************************
+ * Static Function Definitions
+ **************************************************************************************************/
+
+static uint32_t randomDelayMs(uint32_t i)
+{
+  switch (i % 3) {
+    case 0: return (uint32_t)rand() % 1000u;
+    case 1: return (uint32_t)rand() % 200000u;
+    default: return (uint32_t)rand() % TEST_MAX_DELAY_MS;
+  }
+}
+
+static void onExpired(void *context)
+{
+  TestTimer *t = context;
+  uint32_t i = (uint32_t)(t - timers);
+
+  t->expiries++;
+  if (t->cancelled || nowMs < t->dueMs || lastMs >= t->dueMs + 2 * TIMER_WHEEL_TICK_MS
+      || nowMs < quietUntilMs) {
+    if (failures++ < 5) {
+      fprintf(stderr, "wheel-test: timer %u due at %llu expired at %llu (last advance %llu)\n", i,
+              (unsigned long long)t->dueMs, (unsigned long long)nowMs, (unsigned long long)lastMs);
+    }
+  }
+  // Every seventh timer is armed again from its callback, once
+  if (i % 7 == 0 && t->expiries == 1) {
+    uint32_t delayMs = (uint32_t)rand() % 100000u;
+    t->dueMs = nowMs + delayMs;
+    timerWheelArm(&wheel, &t->timer, delayMs, onExpired, t);
+  }
+}
+
+static uint32_t run(uint64_t startMs, bool sleeping)
+{
+  uint32_t failuresBefore = failures;
+  uint32_t waitMs;
+  uint32_t i;
+
+  memset(timers, 0, sizeof(timers));
+  nowMs = startMs;
+  lastMs = startMs;
+  timerWheelInit(&wheel, nowMs);
+  for (i = 0; i < TEST_TIMERS; i++) {
+    uint32_t delayMs = randomDelayMs(i);
+    timers[i].dueMs = nowMs + delayMs;
+    timerWheelArm(&wheel, &timers[i].timer, delayMs, onExpired, &timers[i]);
+  }
+  for (i = 0; i < TEST_TIMERS; i += 11) {
+    timerWheelCancel(&timers[i].timer);
+    timers[i].cancelled = true;
+  }
+  while (nowMs < startMs + TEST_MAX_DELAY_MS + 200000u) {
+    waitMs = timerWheelNextMs(&wheel, nowMs);
+    quietUntilMs = (waitMs == TIMER_WHEEL_IDLE) ? UINT64_MAX : nowMs + waitMs;
+    if (sleeping) {
+      if (waitMs == TIMER_WHEEL_IDLE) {
+        break;
+      }
+      nowMs += waitMs;
+    } else {
+      nowMs += 1 + (uint32_t)rand() % TEST_MAX_STEP_MS;
+    }
+    timerWheelAdvance(&wheel, nowMs);
+    lastMs = nowMs;
+  }
+  quietUntilMs = 0;
+  for (i = 0; i < TEST_TIMERS; i++) {
+    uint32_t expected = timers[i].cancelled ? 0 : (i % 7 == 0) ? 2 : 1;
+    if (timers[i].expiries != expected || timerWheelArmed(&timers[i].timer)) {
+      if (failures++ < 5) {
+        fprintf(stderr, "wheel-test: timer %u expired %u times, %u expected\n", i,
+                timers[i].expiries, expected);
+      }
+    }
+  }
+  printf("wheel-test: from %llu ms, %s, %s\n", (unsigned long long)startMs,
+         sleeping ? "sleeping" : "stepping", (failures == failuresBefore) ? "ok" : "FAILED");
+  return failures - failuresBefore;
+}
+
+/***************************************************************************************************
+ * Public Function Definitions
+ **************************************************************************************************/
+
+int main(void)
+{
+  static const uint64_t startMs[] = {
+    123457u,
+    // The millisecond count passes 2^32 half an hour in
+    (1ull << 32) - 1800000u,
+    // The tick count passes 2^32 half an hour in
+    ((1ull << 32) - 180000u) * TIMER_WHEEL_TICK_MS
+  };
+  uint32_t i;
+
+  srand(1);
+  for (i = 0; i < sizeof(startMs) / sizeof(startMs[0]); i++) {
+    run(startMs[i], false);
+    run(startMs[i], true);
+  }
+  return (failures == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,276 @@
+/***************************************************************************//**
+ * @file
+ * @brief Offline replay of a flight recorder trace through the client
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2018 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+/**
+ * This is a companion of the thermometer client. It reads a trace the client's
+ * flight recorder has written and feeds the responses and events in it, NCP by
+ * NCP and in the order they were read, through the same read path and event
+ * handlers as the client, with no NCP attached. The commands the client issues
+ * on the way are not sent anywhere but counted and hashed, and compared with
+ * the commands recorded. A trace taken from start-up, of a client whose work
+ * is all driven by events, e.g. run with -r 0, is replayed to the same
+ * commands every time, so a bug seen in the field can be stepped through in a
+ * debugger, and a change to the event handlers can be checked against it.
+ * The time taken per event is printed as well. */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "infrastructure.h"
+
+/* BG stack headers */
+#include "bg_types.h"
+#include "gecko_bglib.h"
+
+#include "app.h"
+#include "broadcast.h"
+#include "cmd_queue.h"
+#include "flight_recorder.h"
+#include "gatt_cache.h"
+#include "link_policy.h"
+#include "link_state.h"
+#include "output_sink.h"
+
+/***************************************************************************************************
+ * Local Macros and Definitions
+ **************************************************************************************************/
+
+#define USAGE "Usage: %s [-b] [-n] [-p] [-o table|csv|json] <trace file>\n\n" \
+              "  -b  the client took readings from advertisements (its -b)\n" \
+              "  -n  the client preferred notifications (its -n)\n" \
+              "  -p  the client followed the link policy (its -p)\n" \
+              "  -o  how the readings are written to stdout\n\n"
+
+#define FNV_OFFSET                    1469598103934665603ull
+#define FNV_PRIME                     1099511628211ull
+
+BGLIB_DEFINE();
+
+// Frame of the record being replayed, handed to the client's reads
+static const uint8_t *frame = NULL;
+static uint32_t frameLeft = 0;
+
+static uint64_t commandsIssued = 0;
+static uint64_t issuedHash = FNV_OFFSET;
+
+/***************************************************************************************************
+ * Static Function Definitions
+ **************************************************************************************************/
+
+static uint64_t hashBytes(uint64_t hash, const uint8_t *data, uint32_t len)
+{
+  uint32_t i;
+
+  for (i = 0; i < len; i++) {
+    hash = (hash ^ data[i]) * FNV_PRIME;
+  }
+  return hash;
+}
+
+static uint64_t clockUs(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
+
+// The client's commands go nowhere, they are only counted and hashed
+static void onMessageSend(uint32_t len, uint8_t *data)
+{
+  commandsIssued++;
+  issuedHash = hashBytes(issuedHash, data, len);
+}
+
+static int32_t replayRx(uint32_t len, uint8_t *data)
+{
+  if (len > frameLeft) {
+    return -1;
+  }
+  memcpy(data, frame, len);
+  frame += len;
+  frameLeft -= len;
+  return (int32_t)len;
+}
+
+static int32_t replayRxPeek(void)
+{
+  return (int32_t)frameLeft;
+}
+
+static uint8_t *readTrace(const char *path, FlightRecorderHeader *header)
+{
+  FILE *file;
+  uint8_t *records;
+
+  file = fopen(path, "rb");
+  if (file == NULL) {
+    fprintf(stderr, "Cannot open %s\n", path);
+    return NULL;
+  }
+  if (fread(header, sizeof(*header), 1, file) != 1
+      || header->magic != FLIGHT_RECORDER_MAGIC || header->version != FLIGHT_RECORDER_VERSION) {
+    fprintf(stderr, "%s is not a flight recorder trace\n", path);
+    fclose(file);
+    return NULL;
+  }
+  records = malloc(header->bytes ? header->bytes : 1);
+  if (records == NULL) {
+    fclose(file);
+    return NULL;
+  }
+  // A trace cut short, e.g. by a crash while it was written, is replayed as far as it goes
+  header->bytes = fread(records, 1, header->bytes, file);
+  fclose(file);
+  return records;
+}
+
+// Records up to the first one that does not fit, and the NCPs they belong to
+static uint64_t checkRecords(const uint8_t *records, uint64_t bytes, uint8_t *ncps)
+{
+  FlightRecord record;
+  uint64_t offset = 0;
+
+  *ncps = 0;
+  while (offset + sizeof(record) <= bytes) {
+    memcpy(&record, &records[offset], sizeof(record));
+    if (offset + FLIGHT_RECORD_SIZE(record.length) > bytes || record.ncp >= MAX_NCPS
+        || record.length < BGLIB_MSG_HEADER_LEN) {
+      break;
+    }
+    if (record.ncp >= *ncps) {
+      *ncps = record.ncp + 1;
+    }
+    offset += FLIGHT_RECORD_SIZE(record.length);
+  }
+  return offset;
+}
+
+/***************************************************************************************************
+ * Public Function Definitions
+ **************************************************************************************************/
+
+int main(int argc, char* argv[])
+{
+  OutputFormat format = outputFormatTable;
+  FlightRecorderHeader header;
+  FlightRecord record;
+  struct gecko_cmd_packet *evt;
+  uint8_t *records;
+  uint64_t bytes;
+  uint64_t offset;
+  uint64_t commandsRecorded = 0;
+  uint64_t recordedHash = FNV_OFFSET;
+  uint64_t messages = 0;
+  uint64_t events = 0;
+  uint64_t startUs;
+  uint64_t elapsedUs;
+  uint8_t ncps;
+  uint8_t i;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "bno:p")) != -1) {
+    switch (opt) {
+      case 'b':
+        broadcastSetEnabled(true);
+        break;
+      case 'n':
+        appSetNotifications(true);
+        break;
+      case 'o':
+        if (outputSinkParseFormat(optarg, &format) < 0) {
+          fprintf(stderr, USAGE, argv[0]);
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case 'p':
+        linkPolicySetEnabled(true);
+        break;
+      default:
+        fprintf(stderr, USAGE, argv[0]);
+        exit(EXIT_FAILURE);
+    }
+  }
+  if (optind != argc - 1) {
+    fprintf(stderr, USAGE, argv[0]);
+    exit(EXIT_FAILURE);
+  }
+  records = readTrace(argv[optind], &header);
+  if (records == NULL) {
+    exit(EXIT_FAILURE);
+  }
+  bytes = checkRecords(records, header.bytes, &ncps);
+  if (bytes < header.bytes) {
+    fprintf(stderr, "Trace ends in a torn record, %llu bytes of %llu replayed\n",
+            (unsigned long long)bytes, (unsigned long long)header.bytes);
+  }
+
+  // Nothing is sampled on the host clock, so the commands depend on the trace alone
+  appSetRssiPeriod(0);
+  BGLIB_INITIALIZE_NONBLOCK(onMessageSend, replayRx, replayRxPeek);
+  gattCacheOpen(NULL);
+  linkStateOpen(NULL);
+  if (outputSinkOpen(format, ncps ? ncps : 1) < 0) {
+    fprintf(stderr, "Output thread init failure\n");
+    exit(EXIT_FAILURE);
+  }
+  for (i = 0; i < ncps; i++) {
+    appSelectNcp(i);
+    cmdQueueSelect(i);
+    appStart(false);
+  }
+
+  startUs = clockUs();
+  for (offset = 0; offset < bytes; offset += FLIGHT_RECORD_SIZE(record.length)) {
+    memcpy(&record, &records[offset], sizeof(record));
+    if (record.direction == flightRecorderToNcp) {
+      commandsRecorded++;
+      recordedHash = hashBytes(recordedHash, &records[offset + sizeof(record)], record.length);
+      continue;
+    }
+    messages++;
+    frame = &records[offset + sizeof(record)];
+    frameLeft = record.length;
+    appSelectNcp(record.ncp);
+    cmdQueueSelect(record.ncp);
+    while ((evt = cmdQueuePeekEvent()) != NULL) {
+      appHandleEvents(evt);
+      events++;
+    }
+  }
+  elapsedUs = clockUs() - startUs;
+
+  outputSinkClose();
+  gattCacheClose();
+  linkStateClose();
+  free(records);
+
+  fprintf(stderr, "replay: %llu messages from %u NCPs, %llu events in %.1f ms (%.0f events/s, "
+          "%.2f us/event)\n", (unsigned long long)messages, ncps, (unsigned long long)events,
+          elapsedUs / 1e3, elapsedUs ? events * 1e6 / elapsedUs : 0.0,
+          events ? (double)elapsedUs / events : 0.0);
+  fprintf(stderr, "replay: %llu commands issued, hash %016llx\n",
+          (unsigned long long)commandsIssued, (unsigned long long)issuedHash);
+  fprintf(stderr, "replay: %llu commands recorded, hash %016llx, %s\n",
+          (unsigned long long)commandsRecorded, (unsigned long long)recordedHash,
+          (issuedHash == recordedHash) ? "same" : "different");
+  return (issuedHash == recordedHash) ? EXIT_SUCCESS : EXIT_FAILURE;
+}